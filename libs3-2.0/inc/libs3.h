@@ -170,6 +170,13 @@ extern "C" {
 #define S3_MAX_ACL_GRANT_COUNT             100
 
 
+/**
+ * S3_MAX_DELETE_OBJECTS_COUNT is the maximum number of keys that may be
+ * deleted by one multi-object delete request.
+ **/
+#define S3_MAX_DELETE_OBJECTS_COUNT        1000
+
+
 /**
  * This is the maximum number of characters (including terminating \0) that
  * libs3 supports in an ACL grantee email address.
@@ -281,6 +288,7 @@ typedef enum
     S3StatusServerFailedVerification                        ,
     S3StatusConnectionFailed                                ,
     S3StatusAbortedByCallback                               ,
+    S3StatusBadKeysCount                                    ,
     
     /**
      * Errors from the S3 service
@@ -359,6 +367,7 @@ typedef enum
     S3StatusHttpErrorForbidden                              ,
     S3StatusHttpErrorNotFound                               ,
     S3StatusHttpErrorConflict                               ,
+    S3StatusHttpErrorNotModified                            ,
     S3StatusHttpErrorUnknown
 } S3Status;
 
@@ -630,6 +639,75 @@ typedef struct S3AclGrant
 } S3AclGrant;
 
 
+/**
+ * Limits on how long a request may take.  A request that runs out of time
+ * fails with S3StatusConnectionFailed.  Any of these left as 0 takes the
+ * default.
+ **/
+typedef struct S3RequestTimeouts
+{
+    /**
+     * Milliseconds to allow for connecting to S3 (including the TLS
+     * handshake).  The default is libcurl's (300 seconds).
+     **/
+    int connectTimeoutMs;
+
+    /**
+     * Milliseconds to allow, from the start of the request or, if it has
+     * a body, from when the last of that was sent, for the first byte of
+     * the response to arrive.  This is checked whenever libcurl reports
+     * progress, which may be only once a second.  The default is no limit.
+     **/
+    int firstByteTimeoutMs;
+
+    /**
+     * Milliseconds to allow for the whole request.  The default is no limit.
+     **/
+    int totalTimeoutMs;
+
+    /**
+     * Abort a transfer that stays slower than lowSpeedLimit bytes per
+     * second for lowSpeedTime seconds.  The defaults are 1024 bytes per
+     * second for 15 seconds.
+     **/
+    int lowSpeedLimit;
+    int lowSpeedTime;
+} S3RequestTimeouts;
+
+
+/**
+ * Counts of how finished requests (with their curl handles, and often an
+ * open connection) are re-used; see S3_get_request_cache_stats().
+ **/
+typedef struct S3RequestCacheStats
+{
+    /**
+     * Requests re-used from the calling thread's own cache
+     **/
+    uint64_t threadHits;
+
+    /**
+     * Requests re-used from the overflow pool shared by all threads
+     **/
+    uint64_t poolHits;
+
+    /**
+     * Requests created because there was none to re-use
+     **/
+    uint64_t created;
+
+    /**
+     * Requests destroyed because the caches were full
+     **/
+    uint64_t destroyed;
+
+    /**
+     * Times a thread lost a race for a slot of the overflow pool
+     **/
+    uint64_t contended;
+} S3RequestCacheStats;
+
+
 /**
  * A context for working with objects within a bucket.  A bucket context holds
  * all information necessary for working with a bucket, and may be used
@@ -669,6 +747,12 @@ typedef struct S3BucketContext
      *  The Amazon Secret Access Key to use for access to the bucket
      **/
     const char *secretAccessKey;
+
+    /**
+     * Timeouts for requests made with this bucket context, or NULL for the
+     * defaults
+     **/
+    const S3RequestTimeouts *timeouts;
 } S3BucketContext;
 
 
@@ -967,6 +1051,28 @@ typedef S3Status (S3ListBucketCallback)(int isTruncated,
                                         int commonPrefixesCount,
                                         const char **commonPrefixes,
                                         void *callbackData);
+
+
+/**
+ * This callback is made once for each key that a multi-object delete
+ * operation failed to delete.  Keys that are not reported via this
+ * callback were deleted (or did not exist), provided that the request as
+ * a whole completed with S3StatusOK.
+ *
+ * @param key is the key that could not be deleted
+ * @param code is the S3 error code for the failure, such as "AccessDenied"
+ * @param message is the S3 error message for the failure, if any
+ * @param callbackData is the callback data as specified when the request
+ *        was issued.
+ * @return S3StatusOK to continue processing the request, anything else to
+ *         immediately abort the request with a status which will be
+ *         passed to the S3ResponseCompleteCallback for this request.
+ *         Typically, this will return either S3StatusOK or
+ *         S3StatusAbortedByCallback.
+ **/
+typedef S3Status (S3DeleteObjectsCallback)(const char *key, const char *code,
+                                           const char *message,
+                                           void *callbackData);
                                        
 
 /**
@@ -1081,6 +1187,25 @@ typedef struct S3ListBucketHandler
 } S3ListBucketHandler;
 
 
+/**
+ * An S3DeleteObjectsHandler defines the callbacks which are made for
+ * delete_objects requests.
+ **/
+typedef struct S3DeleteObjectsHandler
+{
+    /**
+     * responseHandler provides the properties and complete callback
+     **/
+    S3ResponseHandler responseHandler;
+
+    /**
+     * The deleteObjectsCallback is called for each key that S3 reports it
+     * could not delete.  It may be NULL.
+     **/
+    S3DeleteObjectsCallback *deleteObjectsCallback;
+} S3DeleteObjectsHandler;
+
+
 /**
  * An S3PutObjectHandler defines the callbacks which are made for
  * put_object requests.
@@ -1178,6 +1303,46 @@ S3Status S3_initialize(const char *userAgentInfo, int flags,
 void S3_deinitialize();
 
 
+/**
+ * Sets how many finished requests libs3 keeps for re-use: up to
+ * threadCacheSize in a cache of each thread's own, and up to poolSize more
+ * in an overflow pool shared by all threads.  Re-using a request re-uses its
+ * curl handle, which saves setting one up and keeps the connection it may
+ * hold open.  The defaults are 4 and 32.  This must be called before
+ * S3_initialize() to take effect.
+ *
+ * @param threadCacheSize is the size of each thread's cache; 0 gives
+ *        threads no cache of their own
+ * @param poolSize is the size of the overflow pool
+ **/
+void S3_set_request_cache_size(int threadCacheSize, int poolSize);
+
+
+/**
+ * Returns counts of how requests have been re-used since the program
+ * started.
+ *
+ * @param statsReturn returns the counts
+ **/
+void S3_get_request_cache_stats(S3RequestCacheStats *statsReturn);
+
+
+/**
+ * Sets whether requests negotiate HTTP/2 with S3.  Over HTTP/2, the
+ * requests of an S3RequestContext are multiplexed over as few connections
+ * as possible, instead of each taking a connection of its own.  Requests
+ * made without a request context aren't: each still goes over the
+ * connection of its own curl handle, so only requests sent together in a
+ * context benefit.  S3 may decline HTTP/2, in which case requests fall
+ * back to HTTP/1.1, which is also the default.  This must be called before
+ * S3_initialize() to take effect, and has no effect if libcurl was built
+ * without HTTP/2 support.
+ *
+ * @param enable is nonzero to negotiate HTTP/2, 0 for HTTP/1.1 only
+ **/
+void S3_set_http2(int enable);
+
+
 /**
  * Returns a string with the textual name of an S3Status code
  *
@@ -1589,6 +1754,32 @@ void S3_list_bucket(const S3BucketContext *bucketContext,
                     const S3ListBucketHandler *handler, void *callbackData);
 
 
+/**
+ * Deletes up to S3_MAX_DELETE_OBJECTS_COUNT objects from a bucket with a
+ * single multi-object delete request.  The request is made in quiet mode:
+ * only the keys that could not be deleted are reported back, via the
+ * handler's deleteObjectsCallback.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param keysCount is the number of keys in the keys parameter; the
+ *        request completes with S3StatusBadKeysCount, without being made,
+ *        unless it is between 1 and S3_MAX_DELETE_OBJECTS_COUNT
+ * @param keys gives the keys of the objects to delete
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_delete_objects(const S3BucketContext *bucketContext, int keysCount,
+                       const char **keys, S3RequestContext *requestContext,
+                       const S3DeleteObjectsHandler *handler,
+                       void *callbackData);
+
+
 /** **************************************************************************
  * Object Functions
  ************************************************************************** **/
@@ -39,7 +39,8 @@ typedef enum
     HttpRequestTypeHEAD,
     HttpRequestTypePUT,
     HttpRequestTypeCOPY,
-    HttpRequestTypeDELETE
+    HttpRequestTypeDELETE,
+    HttpRequestTypePOST
 } HttpRequestType;
 
 
@@ -156,6 +157,15 @@ typedef struct Request
     // This is set to nonzero after the properties callback has been made
     int propertiesCallbackMade;
 
+    // If nonzero, when (ms on the monotonic clock) the request fails if no
+    // response has started to arrive by then, and how long (ms) after the
+    // request was sent that is
+    int64_t firstByteDeadline;
+    int firstByteTimeoutMs;
+
+    // This is set to nonzero once the first response header arrives
+    int responseStarted;
+
     // Parser of errors
     ErrorParser errorParser;
 } Request;
@@ -179,6 +189,9 @@ void request_perform(const RequestParams *params, S3RequestContext *context);
 // curl has finished the request
 void request_finish(Request *request);
 
+// Whether requests negotiate HTTP/2 (see S3_set_http2())
+int request_http2();
+
 // Convert a CURLE code to an S3Status
 S3Status request_curl_code_to_status(CURLcode code);
 
@@ -73,6 +73,11 @@
 // urlEncode, else nonzero is returned.
 int urlEncode(char *dest, const char *src, int maxSrcSize);
 
+// Copies [src] to [dest] with the characters that XML reserves (&<>"')
+// replaced by their entities, and returns the number of characters written,
+// without a terminating nul.  With [dest] NULL, just returns the count.
+int xmlEscape(char *dest, const char *src);
+
 // Returns < 0 on failure >= 0 on success
 int64_t parseIso8601Time(const char *str);
 
@@ -88,6 +93,10 @@ int base64Encode(const unsigned char *in, int inLen, char *out);
 void HMAC_SHA1(unsigned char hmac[20], const unsigned char *key, int key_len,
                const unsigned char *message, int message_len);
 
+// Compute the MD5 digest of [message], storing it in [digest]
+void md5Digest(unsigned char digest[16], const unsigned char *message,
+               int message_len);
+
 // Compute a 64-bit hash values given a set of bytes
 uint64_t hash(const unsigned char *k, int length);
 
@@ -140,7 +140,8 @@ void S3_test_bucket(S3Protocol protocol, S3UriStyle uriStyle,
           protocol,                                   // protocol
           uriStyle,                                   // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          0 },                                        // timeouts
         0,                                            // key
         0,                                            // queryParams
         "location",                                   // subResource
@@ -278,7 +279,8 @@ void S3_create_bucket(S3Protocol protocol, const char *accessKeyId,
           protocol,                                   // protocol
           S3UriStylePath,                             // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          0 },                                        // timeouts
         0,                                            // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -361,7 +363,8 @@ void S3_delete_bucket(S3Protocol protocol, S3UriStyle uriStyle,
           protocol,                                   // protocol
           uriStyle,                                   // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          0 },                                        // timeouts
         0,                                            // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -720,7 +723,8 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->timeouts },                  // timeouts
         0,                                            // key
         queryParams[0] ? queryParams : 0,             // queryParams
         0,                                            // subResource
@@ -741,3 +745,243 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     // Perform the request
     request_perform(&params, requestContext);
 }
+
+
+// delete objects -------------------------------------------------------------
+
+typedef struct DeleteObjectsData
+{
+    SimpleXml simpleXml;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3DeleteObjectsCallback *deleteObjectsCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    // The current DeleteResult/Error being parsed
+    string_buffer(errorKey, 1024);
+    string_buffer(errorCode, 256);
+    string_buffer(errorMessage, 1024);
+
+    char *xmlDocument;
+    int xmlDocumentLen;
+    int xmlDocumentBytesWritten;
+
+    char md5[32];
+    S3PutProperties putProperties;
+} DeleteObjectsData;
+
+
+static S3Status deleteObjectsXmlCallback(const char *elementPath,
+                                         const char *data, int dataLen,
+                                         void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    int fit;
+
+    if (data) {
+        if (!strcmp(elementPath, "DeleteResult/Error/Key")) {
+            string_buffer_append(doData->errorKey, data, dataLen, fit);
+        }
+        else if (!strcmp(elementPath, "DeleteResult/Error/Code")) {
+            string_buffer_append(doData->errorCode, data, dataLen, fit);
+        }
+        else if (!strcmp(elementPath, "DeleteResult/Error/Message")) {
+            string_buffer_append(doData->errorMessage, data, dataLen, fit);
+        }
+    }
+    else if (!strcmp(elementPath, "DeleteResult/Error")) {
+        // Finished an Error
+        S3Status status = S3StatusOK;
+        if (doData->deleteObjectsCallback) {
+            status = (*(doData->deleteObjectsCallback))
+                (doData->errorKey, doData->errorCode, doData->errorMessage,
+                 doData->callbackData);
+        }
+        string_buffer_initialize(doData->errorKey);
+        string_buffer_initialize(doData->errorCode);
+        string_buffer_initialize(doData->errorMessage);
+        if (status != S3StatusOK) {
+            return status;
+        }
+    }
+
+    /* Avoid compiler error about variable set but not used */
+    (void) fit;
+
+    return S3StatusOK;
+}
+
+
+static S3Status deleteObjectsPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    if (!doData->responsePropertiesCallback) {
+        return S3StatusOK;
+    }
+
+    return (*(doData->responsePropertiesCallback))
+        (responseProperties, doData->callbackData);
+}
+
+
+static int deleteObjectsToS3Callback(int bufferSize, char *buffer,
+                                     void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    int remaining = (doData->xmlDocumentLen - 
+                     doData->xmlDocumentBytesWritten);
+
+    int toCopy = bufferSize > remaining ? remaining : bufferSize;
+    
+    if (!toCopy) {
+        return 0;
+    }
+
+    memcpy(buffer, &(doData->xmlDocument[doData->xmlDocumentBytesWritten]),
+           toCopy);
+
+    doData->xmlDocumentBytesWritten += toCopy;
+
+    return toCopy;
+}
+
+
+static S3Status deleteObjectsFromS3Callback(int bufferSize,
+                                            const char *buffer,
+                                            void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+    
+    return simplexml_add(&(doData->simpleXml), buffer, bufferSize);
+}
+
+
+static void deleteObjectsCompleteCallback(S3Status requestStatus, 
+                                          const S3ErrorDetails *s3ErrorDetails,
+                                          void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    (*(doData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, doData->callbackData);
+
+    simplexml_deinitialize(&(doData->simpleXml));
+
+    free(doData->xmlDocument);
+    free(doData);
+}
+
+
+#define DELETE_OBJECTS_HEADER \
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?><Delete><Quiet>true</Quiet>"
+#define DELETE_OBJECTS_FOOTER "</Delete>"
+#define DELETE_OBJECTS_KEY_OPEN "<Object><Key>"
+#define DELETE_OBJECTS_KEY_CLOSE "</Key></Object>"
+
+void S3_delete_objects(const S3BucketContext *bucketContext, int keysCount,
+                       const char **keys, S3RequestContext *requestContext,
+                       const S3DeleteObjectsHandler *handler,
+                       void *callbackData)
+{
+    if ((keysCount < 1) || (keysCount > S3_MAX_DELETE_OBJECTS_COUNT)) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusBadKeysCount, 0, callbackData);
+        return;
+    }
+
+    DeleteObjectsData *doData =
+        (DeleteObjectsData *) malloc(sizeof(DeleteObjectsData));
+
+    if (!doData) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    // Size the XML document, then compose it
+    int i, len = (sizeof(DELETE_OBJECTS_HEADER) - 1) +
+        (sizeof(DELETE_OBJECTS_FOOTER) - 1);
+    for (i = 0; i < keysCount; i++) {
+        len += (sizeof(DELETE_OBJECTS_KEY_OPEN) - 1) +
+            xmlEscape(0, keys[i]) + (sizeof(DELETE_OBJECTS_KEY_CLOSE) - 1);
+    }
+
+    if (!(doData->xmlDocument = (char *) malloc(len + 1))) {
+        free(doData);
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    char *doc = doData->xmlDocument;
+    doc += sprintf(doc, "%s", DELETE_OBJECTS_HEADER);
+    for (i = 0; i < keysCount; i++) {
+        doc += sprintf(doc, "%s", DELETE_OBJECTS_KEY_OPEN);
+        doc += xmlEscape(doc, keys[i]);
+        doc += sprintf(doc, "%s", DELETE_OBJECTS_KEY_CLOSE);
+    }
+    sprintf(doc, "%s", DELETE_OBJECTS_FOOTER);
+    doData->xmlDocumentLen = len;
+    doData->xmlDocumentBytesWritten = 0;
+
+    // S3 insists on a Content-MD5 for this request
+    unsigned char digest[16];
+    md5Digest(digest, (const unsigned char *) doData->xmlDocument, len);
+    doData->md5[base64Encode(digest, sizeof(digest), doData->md5)] = 0;
+
+    S3PutProperties *properties = &(doData->putProperties);
+    memset(properties, 0, sizeof(S3PutProperties));
+    properties->md5 = doData->md5;
+    properties->expires = -1;
+    properties->cannedAcl = S3CannedAclPrivate;
+
+    simplexml_initialize(&(doData->simpleXml), &deleteObjectsXmlCallback,
+                         doData);
+
+    doData->responsePropertiesCallback = 
+        handler->responseHandler.propertiesCallback;
+    doData->deleteObjectsCallback = handler->deleteObjectsCallback;
+    doData->responseCompleteCallback = 
+        handler->responseHandler.completeCallback;
+    doData->callbackData = callbackData;
+
+    string_buffer_initialize(doData->errorKey);
+    string_buffer_initialize(doData->errorCode);
+    string_buffer_initialize(doData->errorMessage);
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePOST,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->timeouts },                  // timeouts
+        0,                                            // key
+        0,                                            // queryParams
+        "delete",                                     // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        properties,                                   // putProperties
+        &deleteObjectsPropertiesCallback,             // propertiesCallback
+        &deleteObjectsToS3Callback,                   // toS3Callback
+        doData->xmlDocumentLen,                       // toS3CallbackTotalSize
+        &deleteObjectsFromS3Callback,                 // fromS3Callback
+        &deleteObjectsCompleteCallback,               // completeCallback
+        doData                                        // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
@@ -107,6 +107,7 @@ const char *S3_get_status_name(S3Status status)
         handlecase(ServerFailedVerification);
         handlecase(ConnectionFailed);
         handlecase(AbortedByCallback);
+        handlecase(BadKeysCount);
         handlecase(ErrorAccessDenied);
         handlecase(ErrorAccountProblem);
         handlecase(ErrorAmbiguousGrantByEmailAddress);
@@ -176,6 +177,7 @@ const char *S3_get_status_name(S3Status status)
         handlecase(HttpErrorForbidden);
         handlecase(HttpErrorNotFound);
         handlecase(HttpErrorConflict);
+        handlecase(HttpErrorNotModified);
         handlecase(HttpErrorUnknown);
     }
 
@@ -466,6 +468,7 @@ int S3_status_is_retryable(S3Status status)
     case S3StatusErrorInternalError:
     case S3StatusErrorOperationAborted:
     case S3StatusErrorRequestTimeout:
+    case S3StatusErrorSlowDown:
         return 1;
     default:
         return 0;
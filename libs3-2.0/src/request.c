@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include "request.h"
 #include "request_context.h"
 #include "response_headers_handler.h"
@@ -36,15 +37,67 @@
 
 
 #define USER_AGENT_SIZE 256
-#define REQUEST_STACK_SIZE 32
+#define DEFAULT_THREAD_CACHE_SIZE 4
+#define DEFAULT_POOL_SIZE 32
 
 static char userAgentG[USER_AGENT_SIZE];
 
-static pthread_mutex_t requestStackMutexG;
+// Finished requests (and their curl handles, which may hold a connection
+// open) are kept for re-use.  Each thread keeps a few in a cache of its own,
+// which needs no locking; those that don't fit there go to an overflow pool
+// shared by all threads, an array of slots that requests are put into and
+// taken out of with atomic operations, and only once that is full are they
+// destroyed.
+typedef struct ThreadCache
+{
+    // These put the cache on the list of all of them, threadCachesG
+    struct ThreadCache *prev, *next;
+
+    int count;
+
+    Request *requests[];
+} ThreadCache;
+
+// The sizes asked for by S3_set_request_cache_size(), which take effect at
+// the next initialization, and the sizes in effect
+static int threadCacheSizeSettingG = DEFAULT_THREAD_CACHE_SIZE;
+
+static int poolSizeSettingG = DEFAULT_POOL_SIZE;
+
+static int threadCacheSizeG;
+
+static int poolSizeG;
+
+// Whether requests negotiate HTTP/2, as asked for by S3_set_http2(), and in
+// effect
+static int http2SettingG = 0;
+
+static int http2G;
+
+static Request **poolG;
+
+static pthread_key_t threadCacheKeyG;
 
-static Request *requestStackG[REQUEST_STACK_SIZE];
+// Guards threadCachesG, which is only touched when a thread's cache is
+// created or destroyed
+static pthread_mutex_t threadCachesMutexG;
 
-static int requestStackCountG;
+static ThreadCache *threadCachesG;
+
+static S3RequestCacheStats requestCacheStatsG;
+
+#define count_stat(field)                                               \
+    __atomic_fetch_add(&(requestCacheStatsG. field), 1, __ATOMIC_RELAXED)
+
+// DNS results and TLS sessions are shared between the curl handles of all
+// requests, so that a handle that has never been used can still reuse an
+// address or resume a session.  Each kind of shared data has its own lock.
+// Connections aren't shared: curl doesn't support sharing them between
+// threads, so each handle keeps its own, and they are re-used by re-using
+// the handle.
+static CURLSH *shareG;
+
+static pthread_mutex_t shareMutexesG[CURL_LOCK_DATA_LAST];
 
 char defaultHostNameG[S3_MAX_HOSTNAME_SIZE];
 
@@ -155,6 +208,8 @@ static size_t curl_header_func(void *ptr, size_t size, size_t nmemb,
 
     int len = size * nmemb;
 
+    request->responseStarted = 1;
+
     response_headers_handler_add
         (&(request->responseHeadersHandler), (char *) ptr, len);
 
@@ -333,8 +388,10 @@ static S3Status compose_amz_headers(const RequestParams *params,
 
     // Add the x-amz-date header
     time_t now = time(NULL);
+    struct tm gmt;
     char date[64];
-    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT",
+             gmtime_r(&now, &gmt));
     headers_append(1, "x-amz-date: %s", date);
 
     if (params->httpRequestType == HttpRequestTypeCOPY) {
@@ -446,8 +503,9 @@ static S3Status compose_standard_headers(const RequestParams *params,
     // Expires
     if (params->putProperties && (params->putProperties->expires >= 0)) {
         time_t t = (time_t) params->putProperties->expires;
+        struct tm gmt;
         strftime(values->expiresHeader, sizeof(values->expiresHeader),
-                 "Expires: %a, %d %b %Y %H:%M:%S UTC", gmtime(&t));
+                 "Expires: %a, %d %b %Y %H:%M:%S UTC", gmtime_r(&t, &gmt));
     }
     else {
         values->expiresHeader[0] = 0;
@@ -457,9 +515,11 @@ static S3Status compose_standard_headers(const RequestParams *params,
     if (params->getConditions &&
         (params->getConditions->ifModifiedSince >= 0)) {
         time_t t = (time_t) params->getConditions->ifModifiedSince;
+        struct tm gmt;
         strftime(values->ifModifiedSinceHeader,
                  sizeof(values->ifModifiedSinceHeader),
-                 "If-Modified-Since: %a, %d %b %Y %H:%M:%S UTC", gmtime(&t));
+                 "If-Modified-Since: %a, %d %b %Y %H:%M:%S UTC",
+                 gmtime_r(&t, &gmt));
     }
     else {
         values->ifModifiedSinceHeader[0] = 0;
@@ -469,9 +529,11 @@ static S3Status compose_standard_headers(const RequestParams *params,
     if (params->getConditions &&
         (params->getConditions->ifNotModifiedSince >= 0)) {
         time_t t = (time_t) params->getConditions->ifNotModifiedSince;
+        struct tm gmt;
         strftime(values->ifUnmodifiedSinceHeader,
                  sizeof(values->ifUnmodifiedSinceHeader),
-                 "If-Unmodified-Since: %a, %d %b %Y %H:%M:%S UTC", gmtime(&t));
+                 "If-Unmodified-Since: %a, %d %b %Y %H:%M:%S UTC",
+                 gmtime_r(&t, &gmt));
     }
     else {
         values->ifUnmodifiedSinceHeader[0] = 0;
@@ -676,6 +738,8 @@ static const char *http_request_type_to_verb(HttpRequestType requestType)
     case HttpRequestTypePUT:
     case HttpRequestTypeCOPY:
         return "PUT";
+    case HttpRequestTypePOST:
+        return "POST";
     default: // HttpRequestTypeDELETE
         return "DELETE";
     }
@@ -790,6 +854,44 @@ static S3Status compose_uri(char *buffer, int bufferSize,
 }
 
 
+static int64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// Fails a request whose response hasn't started by its first byte deadline;
+// curl calls this regularly while the request is in progress.  The response
+// can't start before the request body has been sent, so while it is still
+// being sent the deadline keeps moving.
+static int curl_xferinfo_func(void *data, curl_off_t dltotal, curl_off_t dlnow,
+                              curl_off_t ultotal, curl_off_t ulnow)
+{
+    (void) dltotal;
+    (void) dlnow;
+    (void) ultotal;
+    (void) ulnow;
+
+    Request *request = (Request *) data;
+
+    if (request->toS3CallbackBytesRemaining > 0) {
+        request->firstByteDeadline =
+            monotonic_ms() + request->firstByteTimeoutMs;
+        return 0;
+    }
+
+    if (!request->responseStarted &&
+        (monotonic_ms() >= request->firstByteDeadline)) {
+        request->status = S3StatusConnectionFailed;
+        return 1;
+    }
+
+    return 0;
+}
+
+
 // Sets up the curl handle given the completely computed RequestParams
 static S3Status setup_curl(Request *request,
                            const RequestParams *params,
@@ -808,6 +910,11 @@ static S3Status setup_curl(Request *request,
     
     // Set private data to request for the benefit of S3RequestContext
     curl_easy_setopt_safe(CURLOPT_PRIVATE, request);
+
+    // Share DNS results and TLS sessions with other requests
+    if (shareG) {
+        curl_easy_setopt_safe(CURLOPT_SHARE, shareG);
+    }
     
     // Set header callback and data
     curl_easy_setopt_safe(CURLOPT_HEADERDATA, request);
@@ -857,15 +964,64 @@ static S3Status setup_curl(Request *request,
     // A safety valve in case S3 goes bananas with redirects
     curl_easy_setopt_safe(CURLOPT_MAXREDIRS, 10);
 
+    // Speak HTTP/1.1 unless asked for HTTP/2, which is negotiated during the
+    // TLS handshake (falling back to HTTP/1.1 if S3 won't).  Over HTTP/2,
+    // wait for a connection that is being set up to see whether it can
+    // multiplex this request too, rather than open another.
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    if (http2G) {
+        // Fails if curl has no HTTP/2, which leaves it at HTTP/1.1
+        curl_easy_setopt(request->curl, CURLOPT_HTTP_VERSION,
+                         CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt_safe(CURLOPT_PIPEWAIT, 1);
+    }
+    else {
+        curl_easy_setopt_safe(CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    }
+#else
+    curl_easy_setopt_safe(CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+#endif
+
     // Set the User-Agent; maybe Amazon will track these?
     curl_easy_setopt_safe(CURLOPT_USERAGENT, userAgentG);
 
-    // Set the low speed limit and time; we abort transfers that stay at
-    // less than 1K per second for more than 15 seconds.
-    // xxx todo - make these configurable
+    // Set the timeouts.  By default, we abort transfers that stay at less
+    // than 1K per second for more than 15 seconds, and that's all.
     // xxx todo - allow configurable max send and receive speed
-    curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, 1024);
-    curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, 15);
+    const S3RequestTimeouts *timeouts = params->bucketContext.timeouts;
+    long lowSpeedLimit = 1024, lowSpeedTime = 15;
+    request->firstByteDeadline = 0;
+    request->firstByteTimeoutMs = 0;
+    request->responseStarted = 0;
+    if (timeouts) {
+        if (timeouts->connectTimeoutMs > 0) {
+            curl_easy_setopt_safe(CURLOPT_CONNECTTIMEOUT_MS,
+                                  (long) timeouts->connectTimeoutMs);
+        }
+        if (timeouts->totalTimeoutMs > 0) {
+            curl_easy_setopt_safe(CURLOPT_TIMEOUT_MS,
+                                  (long) timeouts->totalTimeoutMs);
+        }
+        if (timeouts->lowSpeedLimit > 0) {
+            lowSpeedLimit = timeouts->lowSpeedLimit;
+        }
+        if (timeouts->lowSpeedTime > 0) {
+            lowSpeedTime = timeouts->lowSpeedTime;
+        }
+        if (timeouts->firstByteTimeoutMs > 0) {
+            // curl has no such timeout of its own; watch for it from the
+            // progress callback
+            request->firstByteTimeoutMs = timeouts->firstByteTimeoutMs;
+            request->firstByteDeadline =
+                monotonic_ms() + timeouts->firstByteTimeoutMs;
+            curl_easy_setopt_safe(CURLOPT_XFERINFOFUNCTION,
+                                  &curl_xferinfo_func);
+            curl_easy_setopt_safe(CURLOPT_XFERINFODATA, request);
+            curl_easy_setopt_safe(CURLOPT_NOPROGRESS, 0);
+        }
+    }
+    curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, lowSpeedLimit);
+    curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, lowSpeedTime);
 
     // Append standard headers
 #define append_standard_header(fieldName)                               \
@@ -875,7 +1031,8 @@ static S3Status setup_curl(Request *request,
     }
 
     // Would use CURLOPT_INFILESIZE_LARGE, but it is buggy in libcurl
-    if (params->httpRequestType == HttpRequestTypePUT) {
+    if ((params->httpRequestType == HttpRequestTypePUT) ||
+        (params->httpRequestType == HttpRequestTypePOST)) {
         char header[256];
         snprintf(header, sizeof(header), "Content-Length: %llu",
                  (unsigned long long) params->toS3CallbackTotalSize);
@@ -926,6 +1083,13 @@ static S3Status setup_curl(Request *request,
     case HttpRequestTypeDELETE:
     curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, "DELETE");
         break;
+    case HttpRequestTypePOST:
+        // An upload with the verb swapped, so that the body comes from the
+        // read callback like a PUT's, and curl adds no form Content-Type
+        // that the signature doesn't cover
+        curl_easy_setopt_safe(CURLOPT_UPLOAD, 1);
+        curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, "POST");
+        break;
     default: // HttpRequestTypeGET
         break;
     }
@@ -942,36 +1106,30 @@ static void request_deinitialize(Request *request)
     
     error_parser_deinitialize(&(request->errorParser));
 
-    // curl_easy_reset prevents connections from being re-used for some
-    // reason.  This makes HTTP Keep-Alive meaningless and is very bad for
-    // performance.  But it is necessary to allow curl to work properly.
-    // xxx todo figure out why
+    // curl_easy_reset only puts the handle's options back to their defaults;
+    // it keeps the handle's open connections (and its DNS and TLS session
+    // caches), so HTTP Keep-Alive carries over to the handle's next request
     curl_easy_reset(request->curl);
 }
 
 
+static Request *request_cache_get();
+
+
 static S3Status request_get(const RequestParams *params, 
                             const RequestComputedValues *values,
                             Request **reqReturn)
 {
-    Request *request = 0;
-    
-    // Try to get one from the request stack.  We hold the lock for the
-    // shortest time possible here.
-    pthread_mutex_lock(&requestStackMutexG);
-
-    if (requestStackCountG) {
-        request = requestStackG[--requestStackCountG];
-    }
-    
-    pthread_mutex_unlock(&requestStackMutexG);
+    // Try to get one from the caches
+    Request *request = request_cache_get();
 
     // If we got one, deinitialize it for re-use
     if (request) {
         request_deinitialize(request);
     }
-    // Else there wasn't one available in the request stack, so create one
+    // Else there wasn't one available in the caches, so create one
     else {
+        count_stat(created);
         if (!(request = (Request *) malloc(sizeof(Request)))) {
             return S3StatusOutOfMemory;
         }
@@ -1043,22 +1201,244 @@ static void request_destroy(Request *request)
 }
 
 
+// Puts request into a free slot of the overflow pool; returns 0 if there is
+// none
+static int pool_put(Request *request)
+{
+    int i;
+    for (i = 0; i < poolSizeG; i++) {
+        Request *empty = 0;
+        if (__atomic_load_n(&(poolG[i]), __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&(poolG[i]), &empty, request, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+        // Another thread took the slot first
+        count_stat(contended);
+    }
+    return 0;
+}
+
+
+// Takes a request out of the overflow pool, or returns 0 if it is empty
+static Request *pool_get()
+{
+    int i;
+    for (i = 0; i < poolSizeG; i++) {
+        if (!__atomic_load_n(&(poolG[i]), __ATOMIC_RELAXED)) {
+            continue;
+        }
+        Request *request = __atomic_exchange_n(&(poolG[i]), 0,
+                                               __ATOMIC_ACQUIRE);
+        if (request) {
+            return request;
+        }
+        // Another thread emptied the slot first
+        count_stat(contended);
+    }
+    return 0;
+}
+
+
+// Called when a thread that has a cache exits: its requests go to the pool
+// (or are destroyed if that is full)
+static void thread_cache_destroy(void *data)
+{
+    ThreadCache *cache = (ThreadCache *) data;
+
+    while (cache->count--) {
+        Request *request = cache->requests[cache->count];
+        if (!pool_put(request)) {
+            count_stat(destroyed);
+            request_destroy(request);
+        }
+    }
+
+    pthread_mutex_lock(&threadCachesMutexG);
+    if (cache->next == cache) {
+        threadCachesG = 0;
+    }
+    else {
+        cache->prev->next = cache->next;
+        cache->next->prev = cache->prev;
+        if (threadCachesG == cache) {
+            threadCachesG = cache->next;
+        }
+    }
+    pthread_mutex_unlock(&threadCachesMutexG);
+
+    free(cache);
+}
+
+
+// Returns the calling thread's cache, creating it if need be; or 0 if it
+// can't be created (or threads aren't to have caches)
+static ThreadCache *thread_cache()
+{
+    ThreadCache *cache = (ThreadCache *) pthread_getspecific(threadCacheKeyG);
+    if (cache || !threadCacheSizeG) {
+        return cache;
+    }
+
+    if (!(cache = (ThreadCache *) malloc(sizeof(ThreadCache) + 
+                                         (threadCacheSizeG * 
+                                          sizeof(Request *))))) {
+        return 0;
+    }
+    cache->count = 0;
+    if (pthread_setspecific(threadCacheKeyG, cache)) {
+        free(cache);
+        return 0;
+    }
+
+    pthread_mutex_lock(&threadCachesMutexG);
+    if (threadCachesG) {
+        cache->prev = threadCachesG->prev;
+        cache->next = threadCachesG;
+        threadCachesG->prev->next = cache;
+        threadCachesG->prev = cache;
+    }
+    else {
+        threadCachesG = cache->next = cache->prev = cache;
+    }
+    pthread_mutex_unlock(&threadCachesMutexG);
+
+    return cache;
+}
+
+
+static Request *request_cache_get()
+{
+    ThreadCache *cache = (ThreadCache *) pthread_getspecific(threadCacheKeyG);
+
+    // The most recently used request first, to maximize our chances of
+    // re-using a TCP connection before it times out
+    if (cache && cache->count) {
+        count_stat(threadHits);
+        return cache->requests[--cache->count];
+    }
+
+    Request *request = pool_get();
+    if (request) {
+        count_stat(poolHits);
+    }
+    return request;
+}
+
+
 static void request_release(Request *request)
 {
-    pthread_mutex_lock(&requestStackMutexG);
+    ThreadCache *cache = thread_cache();
 
-    // If the request stack is full, destroy this one
-    if (requestStackCountG == REQUEST_STACK_SIZE) {
-        pthread_mutex_unlock(&requestStackMutexG);
+    if (cache && (cache->count < threadCacheSizeG)) {
+        cache->requests[cache->count++] = request;
+    }
+    else if (!pool_put(request)) {
+        // Both are full, destroy this one
+        count_stat(destroyed);
         request_destroy(request);
     }
-    // Else put this one at the front of the request stack; we do this because
-    // we want the most-recently-used curl handle to be re-used on the next
-    // request, to maximize our chances of re-using a TCP connection before it
-    // times out
-    else {
-        requestStackG[requestStackCountG++] = request;
-        pthread_mutex_unlock(&requestStackMutexG);
+}
+
+
+void S3_set_request_cache_size(int threadCacheSize, int poolSize)
+{
+    threadCacheSizeSettingG = (threadCacheSize < 0) ? 0 : threadCacheSize;
+    poolSizeSettingG = (poolSize < 0) ? 0 : poolSize;
+}
+
+
+void S3_set_http2(int enable)
+{
+    http2SettingG = enable;
+}
+
+
+int request_http2()
+{
+    return http2G;
+}
+
+
+void S3_get_request_cache_stats(S3RequestCacheStats *statsReturn)
+{
+    statsReturn->threadHits =
+        __atomic_load_n(&(requestCacheStatsG.threadHits), __ATOMIC_RELAXED);
+    statsReturn->poolHits =
+        __atomic_load_n(&(requestCacheStatsG.poolHits), __ATOMIC_RELAXED);
+    statsReturn->created =
+        __atomic_load_n(&(requestCacheStatsG.created), __ATOMIC_RELAXED);
+    statsReturn->destroyed =
+        __atomic_load_n(&(requestCacheStatsG.destroyed), __ATOMIC_RELAXED);
+    statsReturn->contended =
+        __atomic_load_n(&(requestCacheStatsG.contended), __ATOMIC_RELAXED);
+}
+
+
+static void share_lock(CURL *curl, curl_lock_data data,
+                       curl_lock_access access, void *userptr)
+{
+    (void) curl;
+    (void) access;
+    (void) userptr;
+
+    pthread_mutex_lock(&(shareMutexesG[data]));
+}
+
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+    (void) curl;
+    (void) userptr;
+
+    pthread_mutex_unlock(&(shareMutexesG[data]));
+}
+
+
+// Sets up shareG, or leaves it 0 if curl can't share (requests then work
+// as before, each on its own)
+static void share_initialize()
+{
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&(shareMutexesG[i]), 0);
+    }
+
+    if (!(shareG = curl_share_init())) {
+        return;
+    }
+
+    if ((curl_share_setopt(shareG, CURLSHOPT_LOCKFUNC, 
+                           &share_lock) != CURLSHE_OK) ||
+        (curl_share_setopt(shareG, CURLSHOPT_UNLOCKFUNC,
+                           &share_unlock) != CURLSHE_OK) ||
+        (curl_share_setopt(shareG, CURLSHOPT_SHARE, 
+                           CURL_LOCK_DATA_DNS) != CURLSHE_OK)) {
+        curl_share_cleanup(shareG);
+        shareG = 0;
+        return;
+    }
+
+    // This is optional; older versions of curl can't share it
+    curl_share_setopt(shareG, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+
+static void share_deinitialize()
+{
+    // Requests still running in a request context hold on to the share;
+    // it is then left to the process exit
+    if (shareG && (curl_share_cleanup(shareG) != CURLSHE_OK)) {
+        return;
+    }
+
+    shareG = 0;
+
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&(shareMutexesG[i]));
     }
 }
 
@@ -1081,9 +1461,26 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
         return S3StatusUriTooLong;
     }
 
-    pthread_mutex_init(&requestStackMutexG, 0);
+    threadCacheSizeG = threadCacheSizeSettingG;
+    poolSizeG = poolSizeSettingG;
+    http2G = http2SettingG;
 
-    requestStackCountG = 0;
+    if (poolSizeG && !(poolG = (Request **) calloc(poolSizeG, 
+                                                  sizeof(Request *)))) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (pthread_key_create(&threadCacheKeyG, &thread_cache_destroy)) {
+        free(poolG);
+        poolG = 0;
+        return S3StatusInternalError;
+    }
+
+    pthread_mutex_init(&threadCachesMutexG, 0);
+
+    threadCachesG = 0;
+
+    share_initialize();
 
     if (!userAgentInfo || !*userAgentInfo) {
         userAgentInfo = "Unknown";
@@ -1111,11 +1508,33 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 
 void request_api_deinitialize()
 {
-    pthread_mutex_destroy(&requestStackMutexG);
+    // No other thread may be using libs3 now, so the caches of all threads
+    // can be emptied from here
+    pthread_key_delete(threadCacheKeyG);
+
+    while (threadCachesG) {
+        ThreadCache *cache = threadCachesG;
+        threadCachesG = (cache->next == cache) ? 0 : cache->next;
+        cache->prev->next = cache->next;
+        cache->next->prev = cache->prev;
+        while (cache->count--) {
+            request_destroy(cache->requests[cache->count]);
+        }
+        free(cache);
+    }
 
-    while (requestStackCountG--) {
-        request_destroy(requestStackG[requestStackCountG]);
+    pthread_mutex_destroy(&threadCachesMutexG);
+
+    int i;
+    for (i = 0; i < poolSizeG; i++) {
+        if (poolG[i]) {
+            request_destroy(poolG[i]);
+        }
     }
+    free(poolG);
+    poolG = 0;
+
+    share_deinitialize();
 }
 
 
@@ -1237,6 +1656,11 @@ void request_finish(Request *request)
             case 301:
                 request->status = S3StatusErrorPermanentRedirect;
                 break;
+            case 304:
+                // The object matched an If-None-Match/If-Modified-Since
+                // condition; there is no body
+                request->status = S3StatusHttpErrorNotModified;
+                break;
             case 307:
                 request->status = S3StatusHttpErrorMovedTemporarily;
                 break;
@@ -45,6 +45,14 @@ S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
         return S3StatusOutOfMemory;
     }
 
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    // Let the context's requests share HTTP/2 connections
+    if (request_http2()) {
+        curl_multi_setopt((*requestContextReturn)->curlm,
+                          CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    }
+#endif
+
     (*requestContextReturn)->requests = 0;
 
     return S3StatusOK;
@@ -0,0 +1,122 @@
+/** **************************************************************************
+ * testutil.c
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+static int failuresG = 0;
+
+
+static void checkMd5(const char *message, int messageLen,
+                     const char *expected)
+{
+    unsigned char digest[16];
+    char hex[33];
+    int i;
+
+    md5Digest(digest, (const unsigned char *) message, messageLen);
+    for (i = 0; i < 16; i++) {
+        sprintf(&(hex[i * 2]), "%02x", digest[i]);
+    }
+
+    if (strcmp(hex, expected)) {
+        printf("md5 of %d bytes: got %s, expected %s\n", messageLen, hex,
+               expected);
+        failuresG++;
+    }
+}
+
+
+static void checkXmlEscape(const char *src, const char *expected)
+{
+    char dest[256];
+    int len = xmlEscape(dest, src);
+    dest[len] = 0;
+
+    if ((xmlEscape(0, src) != len) || strcmp(dest, expected)) {
+        printf("xmlEscape of [%s]: got [%s], expected [%s]\n", src, dest,
+               expected);
+        failuresG++;
+    }
+}
+
+
+int main()
+{
+    // The test suite of RFC 1321, appendix A.5
+    static const struct {
+        const char *message, *digest;
+    } suite[] = {
+        { "", "d41d8cd98f00b204e9800998ecf8427e" },
+        { "a", "0cc175b9c0f1b6a831c399e269772661" },
+        { "abc", "900150983cd24fb0d6963f7d28e17f72" },
+        { "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+        { "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b" },
+        { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+          "d174ab98d277d9f5a5611c2c9f419d9f" },
+        { "1234567890123456789012345678901234567890"
+          "1234567890123456789012345678901234567890",
+          "57edf4a22be3c955ac49da2e2107b67a" }
+    };
+    // Lengths around the block size: up to 55 bytes the padding and length
+    // fit in the last block, from 56 on they take another one
+    static const struct {
+        int length;
+        const char *digest;
+    } lengths[] = {
+        { 55, "ef1772b6dff9a122358552954ad0df65" },
+        { 56, "3b0c8ac703f828b04c6c197006d17218" },
+        { 63, "b06521f39153d618550606be297466d5" },
+        { 64, "014842d480b571495a4a0363793f7367" },
+        { 65, "c743a45e0d2e6a95cb859adae0248435" },
+        { 128, "e510683b3f5ffe4093d021808bc6ff70" }
+    };
+    char as[128];
+    unsigned int i;
+
+    for (i = 0; i < sizeof(suite) / sizeof(suite[0]); i++) {
+        checkMd5(suite[i].message, strlen(suite[i].message), suite[i].digest);
+    }
+
+    memset(as, 'a', sizeof(as));
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        checkMd5(as, lengths[i].length, lengths[i].digest);
+    }
+
+    checkXmlEscape("", "");
+    checkXmlEscape("dir/file.txt", "dir/file.txt");
+    checkXmlEscape("a&b<c>d\"e'f", "a&amp;b&lt;c&gt;d&quot;e&apos;f");
+    checkXmlEscape("&&", "&amp;&amp;");
+    checkXmlEscape("&amp;", "&amp;amp;");
+
+    if (failuresG) {
+        printf("%d checks failed\n", failuresG);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+
+    return 0;
+}
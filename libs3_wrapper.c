@@ -56,17 +56,17 @@
 #include "libs3_wrapper.h"
 
 
-// Some Unix stuff (to work around Windows issues)
-#ifndef SLEEP_UNITS_PER_SECOND
-#define SLEEP_UNITS_PER_SECOND 1
-#endif
-
 // prototype declarations
 int __s3fs_test_bucket(const char *bucketName);
 int __s3fs_clear_bucket(const char *bucketName);
 int __s3fs_remove_object(const char *bucketName, const char *key);
-ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, ssize_t start_byte, ssize_t byte_count);
-ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength); 
+int __s3fs_remove_objects(const char *bucketName, const char **keys, int count, int *results);
+ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, ssize_t start_byte, ssize_t byte_count, const s3fs_conditions_t *conditions, s3fs_object_info_t *info);
+ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength, const s3fs_meta_t *meta, s3fs_object_info_t *info); 
+int __s3fs_head_object(const char *bucketName, const char *key, s3fs_meta_t *meta, int64_t *size);
+int __s3fs_set_meta(const char *bucketName, const char *key, const s3fs_meta_t *meta);
+int __s3fs_warm_connections(const char *bucketName, int count);
+static void retire_flights(const char *bucketName, const char *key);
 
 
 // Command-line options, saved as globals ------------------------------------
@@ -75,7 +75,6 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
 static int showResponsePropertiesG = 0;
 static S3Protocol protocolG = S3ProtocolHTTPS;
 static S3UriStyle uriStyleG = S3UriStylePath;
-static int retriesG = 5;
 
 
 // Environment variables, saved as globals ----------------------------------
@@ -84,28 +83,22 @@ static const char *accessKeyIdG = 0;
 static const char *secretAccessKeyG = 0;
 
 
-// Request results, saved as globals -----------------------------------------
-
-static int statusG = 0;
-static char errorDetailsG[4096] = { 0 };
-
-
+// Request results, saved per thread -----------------------------------------
 
-// Option prefixes -----------------------------------------------------------
-
-// s3fs Global lock
+// A request's callbacks run in the thread that made it (a request context is
+// run by the thread that created it), so each thread has results of its own
+// and requests from different threads run side by side without a lock.
 
-static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int statusG = 0;
+static __thread char errorDetailsG[4096] = { 0 };
+static __thread s3fs_object_info_t responseInfoG;
+static __thread s3fs_meta_t responseMetaG;
+static __thread int responseMetaFieldsG = 0;
+static __thread int64_t responseContentLengthG = 0;
 
-void s3fs_lock() {
-    pthread_mutex_lock(&global_lock);
-}
 
-void s3fs_unlock() {
-    pthread_mutex_unlock(&global_lock);
-}
 
-// --------------------------------------------------------
+// Option prefixes -----------------------------------------------------------
 
 
 #define LOCATION_PREFIX "location="
@@ -181,15 +174,25 @@ int s3fs_init_credentials() {
     return 0;
 }
 
+// The first request initializes libs3, which then stays initialized, so
+// that it keeps its pooled curl handles and the DNS and TLS session caches
+// they share from one request to the next.  (libs3 counts calls to
+// S3_initialize and S3_deinitialize, but not safely from several threads at
+// once, so requests don't bracket themselves with them.)
+static pthread_once_t initOnceG = PTHREAD_ONCE_INIT;
+static S3Status initStatusG;
+
+static void S3_init_once()
+{
+    initStatusG = S3_initialize("s3", S3_INIT_ALL, getenv("S3_HOSTNAME"));
+}
+
 static void S3_init()
 {
-    S3Status status;
-    const char *hostname = getenv("S3_HOSTNAME");
-    
-    if ((status = S3_initialize("s3", S3_INIT_ALL, hostname))
-        != S3StatusOK) {
+    pthread_once(&initOnceG, &S3_init_once);
+    if (initStatusG != S3StatusOK) {
         fprintf(stderr, "Failed to initialize libs3: %s\n", 
-                S3_get_status_name(status));
+                S3_get_status_name(initStatusG));
         exit(-1);
     }
 }
@@ -205,18 +208,293 @@ static void printError()
     }
 }
 
-static int should_retry()
+// retries -------------------------------------------------------------------
+
+// A request that fails with an error that may go away (S3_status_is_retryable)
+// is tried again, up to RETRY_MAX_TRIES times in all.  Before try n+1 we back
+// off for a random time of up to RETRY_BASE_MS * 2^(n-1) ms, capped at
+// RETRY_MAX_MS ("full jitter"), so that requests that failed together don't
+// all come back together.
+#define RETRY_MAX_TRIES 6
+#define RETRY_BASE_MS 50
+#define RETRY_MAX_MS 10000
+
+// per thread: whether to give up at the first transient error, the status
+// of the last request, the state of the backoff's random numbers, and when
+// the request under way was sent
+static __thread int retryNowaitG = 0;
+static __thread S3Status lastStatusG = S3StatusOK;
+static __thread unsigned int retrySeedG = 0;
+static __thread int64_t requestStartG = 0;
+
+static int64_t now_ms()
 {
-    if (retriesG--) {
-        // Sleep before next retry; start out with a 1 second sleep
-        static int retrySleepInterval = 1 * SLEEP_UNITS_PER_SECOND;
-        sleep(retrySleepInterval);
-        // Next sleep 1 second longer
-        retrySleepInterval++;
-        return 1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int s3fs_backoff_ms(int tries)
+{
+    if (!retrySeedG) {
+        retrySeedG = (unsigned int) time(0) ^
+                     (unsigned int) (uintptr_t) &retrySeedG;
+    }
+    int n = (tries > 0) ? tries - 1 : 0;
+    int64_t cap = RETRY_MAX_MS;
+    if (n < 20 && ((int64_t) RETRY_BASE_MS << n) < cap) {
+        cap = (int64_t) RETRY_BASE_MS << n;
     }
+    return (int) (rand_r(&retrySeedG) % (cap + 1));
+}
 
-    return 0;
+int s3fs_set_retry_nowait(int nowait)
+{
+    int old = retryNowaitG;
+    retryNowaitG = nowait;
+    return old;
+}
+
+int s3fs_last_retryable()
+{
+    return S3_status_is_retryable(lastStatusG);
+}
+
+int s3fs_last_missing()
+{
+    return lastStatusG == S3StatusErrorNoSuchKey ||
+           lastStatusG == S3StatusHttpErrorNotFound;
+}
+
+// Called after a try of a request failed with a transient error, with *tries
+// the number of tries it has had so far.  Waits out the backoff and returns
+// whether to try again.  The wait blocks the calling thread, which for a
+// FUSE handler means the request it is serving: with RETRY_MAX_TRIES tries
+// the backoffs add up to at most 50 + 100 + 200 + 400 + 800 ms, about 1.5 s,
+// before the error is returned.  Background work (write-back, batched
+// deletes) sets retryNowaitG instead and waits out its backoffs as delayed
+// jobs, which hold no thread.
+static int should_retry(int *tries)
+{
+    if (retryNowaitG || ++(*tries) >= RETRY_MAX_TRIES) {
+        return 0;
+    }
+    int ms = s3fs_backoff_ms(*tries);
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&delay, 0);
+    return 1;
+}
+
+// adaptive concurrency ------------------------------------------------------
+
+// An AIMD window on how many requests bulk work (batch deletes, background
+// uploads) keeps in flight.  Every healthy response grows it by 1/window,
+// so by one per window's worth of responses; a SlowDown, a timeout or a
+// failed connection halves it, but no more than once per window's worth
+// of responses, since everything that was in flight together tends to
+// fail together.  A response is healthy if it succeeded no slower than
+// WINDOW_SLOW_FACTOR times the usual fastest one; a slow one leaves the
+// window as it is, so latency alone never shrinks it.  Every response
+// feeds the window, but requests made from FUSE handlers aren't held to
+// it: each handler thread makes its own, as many at once as there are
+// handler threads.
+#define WINDOW_MIN 1
+#define WINDOW_MAX 64
+#define WINDOW_INITIAL 4
+#define WINDOW_SLOW_FACTOR 4
+
+static pthread_mutex_t window_lock = PTHREAD_MUTEX_INITIALIZER;
+static double windowG = WINDOW_INITIAL;
+static int64_t fastestG = -1;           // ms, drifting up slowly
+static int sinceCutG = 0;               // responses since the last cut
+static int64_t lastResponseG = 0;       // when the last response came in
+static s3fs_window_stats_t windowStatsG;
+
+static int is_congestion(S3Status status)
+{
+    return status == S3StatusErrorSlowDown ||
+           status == S3StatusErrorRequestTimeout ||
+           status == S3StatusConnectionFailed;
+}
+
+// Feed the response to a request sent at start (ms) into the window
+static void window_update(S3Status status, int64_t start)
+{
+    int64_t now = now_ms();
+    int64_t latency = now - start;
+    pthread_mutex_lock(&window_lock);
+    lastResponseG = now;
+    sinceCutG++;
+    if (status == S3StatusErrorSlowDown) {
+        windowStatsG.slowdowns++;
+    }
+    else if (status != S3StatusOK && is_congestion(status)) {
+        windowStatsG.timeouts++;
+    }
+    if (is_congestion(status)) {
+        if (sinceCutG >= (int) windowG) {
+            windowG = (windowG / 2 < WINDOW_MIN) ? WINDOW_MIN : windowG / 2;
+            sinceCutG = 0;
+            windowStatsG.decreases++;
+        }
+    }
+    else if (status == S3StatusOK && start > 0) {
+        if (fastestG < 0 || latency < fastestG) {
+            fastestG = latency;
+        }
+        else {
+            fastestG += (latency - fastestG) / 64;
+        }
+        if (latency <= WINDOW_SLOW_FACTOR * (fastestG + 1) &&
+            windowG < WINDOW_MAX) {
+            int before = (int) windowG;
+            windowG += 1.0 / windowG;
+            if (windowG > WINDOW_MAX) {
+                windowG = WINDOW_MAX;
+            }
+            if ((int) windowG > before) {
+                windowStatsG.increases++;
+            }
+        }
+    }
+    if ((int) windowG > windowStatsG.max_window) {
+        windowStatsG.max_window = (int) windowG;
+    }
+    pthread_mutex_unlock(&window_lock);
+}
+
+int s3fs_window()
+{
+    pthread_mutex_lock(&window_lock);
+    int window = (int) windowG;
+    pthread_mutex_unlock(&window_lock);
+    return window;
+}
+
+int64_t s3fs_idle_ms()
+{
+    pthread_mutex_lock(&window_lock);
+    int64_t idle = now_ms() - lastResponseG;
+    pthread_mutex_unlock(&window_lock);
+    return idle;
+}
+
+void s3fs_window_stats(s3fs_window_stats_t *stats)
+{
+    pthread_mutex_lock(&window_lock);
+    *stats = windowStatsG;
+    stats->window = (int) windowG;
+    if (stats->max_window < stats->window) {
+        stats->max_window = stats->window;
+    }
+    pthread_mutex_unlock(&window_lock);
+}
+
+// request timeouts ----------------------------------------------------------
+
+// Requests come in two classes with timeouts of their own: metadata
+// requests (HEADs, deletes, lists, and GETs and PUTs of small objects such
+// as directories), which a lookup is usually waiting on, and bulk data
+// (everything else), which may well take a while.  Until s3fs_set_timeouts
+// says otherwise, both get libs3's defaults.
+#define SMALL_OBJECT_BYTES (64 * 1024)
+
+static S3RequestTimeouts timeoutsG[S3FS_REQUEST_CLASSES];
+static __thread int smallGetsG = 0;
+
+void s3fs_set_timeouts(int requestClass, const S3RequestTimeouts *timeouts)
+{
+    timeoutsG[requestClass] = *timeouts;
+}
+
+void s3fs_set_handle_caches(int per_thread, int pool)
+{
+    S3_set_request_cache_size(per_thread, pool);
+}
+
+void s3fs_set_http2(int enable)
+{
+    S3_set_http2(enable);
+}
+
+void s3fs_handle_stats(S3RequestCacheStats *stats)
+{
+    S3_get_request_cache_stats(stats);
+}
+
+int s3fs_set_small_gets(int small)
+{
+    int old = smallGetsG;
+    smallGetsG = small;
+    return old;
+}
+
+// Whether a GET of byteCount bytes (0: all of the object) is of a small
+// object
+static int is_small_get(uint64_t byteCount)
+{
+    return smallGetsG || (byteCount > 0 && byteCount <= SMALL_OBJECT_BYTES);
+}
+
+// s3fs metadata headers -----------------------------------------------------
+
+// x-amz-meta-* names we store s3fs_meta_t fields under
+#define META_INO "ino"
+#define META_MODE "mode"
+#define META_UID "uid"
+#define META_GID "gid"
+#define META_MTIME "mtime"
+#define META_FIELDS 5
+
+// Fill props (META_FIELDS long) with meta; values holds the strings
+static int encode_meta(const s3fs_meta_t *meta, S3NameValue *props,
+                       char values[META_FIELDS][32])
+{
+    snprintf(values[0], 32, "%llu", (unsigned long long) meta->ino);
+    snprintf(values[1], 32, "%o", (unsigned int) meta->mode);
+    snprintf(values[2], 32, "%u", (unsigned int) meta->uid);
+    snprintf(values[3], 32, "%u", (unsigned int) meta->gid);
+    snprintf(values[4], 32, "%lld", (long long) meta->mtime);
+    const char *names[META_FIELDS] =
+        { META_INO, META_MODE, META_UID, META_GID, META_MTIME };
+    int i;
+    for (i = 0; i < META_FIELDS; i++) {
+        props[i].name = names[i];
+        props[i].value = values[i];
+    }
+    return META_FIELDS;
+}
+
+// Pick our fields out of a response's x-amz-meta-* headers, counting
+// how many were present
+static void decode_meta(const S3ResponseProperties *properties,
+                        s3fs_meta_t *meta, int *fields)
+{
+    *fields = 0;
+    int i;
+    for (i = 0; i < properties->metaDataCount; i++) {
+        const char *name = properties->metaData[i].name;
+        const char *value = properties->metaData[i].value;
+        if (!strcasecmp(name, META_INO)) {
+            meta->ino = strtoull(value, 0, 10);
+        }
+        else if (!strcasecmp(name, META_MODE)) {
+            meta->mode = strtoul(value, 0, 8);
+        }
+        else if (!strcasecmp(name, META_UID)) {
+            meta->uid = strtoul(value, 0, 10);
+        }
+        else if (!strcasecmp(name, META_GID)) {
+            meta->gid = strtoul(value, 0, 10);
+        }
+        else if (!strcasecmp(name, META_MTIME)) {
+            meta->mtime = strtoll(value, 0, 10);
+        }
+        else {
+            continue;
+        }
+        (*fields)++;
+    }
 }
 
 // response properties callback ----------------------------------------------
@@ -228,6 +506,14 @@ static S3Status responsePropertiesCallback
 {
     (void) callbackData;
 
+    if (properties->eTag) {
+        snprintf(responseInfoG.eTag, sizeof(responseInfoG.eTag), "%s",
+                 properties->eTag);
+    }
+    responseInfoG.lastModified = properties->lastModified;
+    responseContentLengthG = properties->contentLength;
+    decode_meta(properties, &responseMetaG, &responseMetaFieldsG);
+
     if (!showResponsePropertiesG) {
         return S3StatusOK;
     }
@@ -275,6 +561,8 @@ static void responseCompleteCallback(S3Status status,
     (void) callbackData;
 
     statusG = status;
+    lastStatusG = status;
+    window_update(status, requestStartG);
     // Compose the error details message now, although we might not use it.
     // Can't just save a pointer to [error] since it's not guaranteed to last
     // beyond this callback
@@ -306,10 +594,7 @@ static void responseCompleteCallback(S3Status status,
 
 
 int s3fs_test_bucket(const char *bucketName) {
-    s3fs_lock();
-    int rv = __s3fs_test_bucket(bucketName);
-    s3fs_unlock();
-    return rv;
+    return __s3fs_test_bucket(bucketName);
 }
 
 int __s3fs_test_bucket(const char *bucketName)
@@ -322,11 +607,13 @@ int __s3fs_test_bucket(const char *bucketName)
     };
 
     char locationConstraint[64];
+    int tries = 0;
     do {
+        requestStartG = now_ms();
         S3_test_bucket(protocolG, uriStyleG, accessKeyIdG, secretAccessKeyG,
                        0, bucketName, sizeof(locationConstraint),
                        locationConstraint, 0, &responseHandler, 0);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    } while (S3_status_is_retryable(statusG) && should_retry(&tries));
 
     const char *reason = "Unknown";
     int result = statusG == S3StatusOK ? 1 : 0;
@@ -348,39 +635,57 @@ int __s3fs_test_bucket(const char *bucketName)
 
     fprintf(stderr, "S3 test_bucket: %s\n", reason);
 
-    S3_deinitialize();
-
     return result;
 }
 
 
-// list bucket ---------------------------------------------------------------
+// clear bucket --------------------------------------------------------------
 // JS: well, it's really remove bucket.  doesn't that make sense?
+//
+// Listing pages go straight into multi-object deletes of up to 1000 keys
+// each.  The list requests and the deletes share one request context, so
+// the next page is listed while the deletes of earlier pages are still in
+// flight, with as many deletes outstanding at once as the concurrency
+// window allows (up to CLEAR_MAX_BATCHES).
 
-struct node {
-    char *key;
-    struct node *next;
-};
+#define CLEAR_MAX_BATCHES 16
+#define CLEAR_MAX_TRIES 3
+
+// how long to wait when nothing is in flight but a batch's backoff (ms)
+#define CLEAR_IDLE_MS 10
 
-typedef struct traverse_bucket_callback_data
+typedef struct clear_batch
+{
+    const char *keys[S3_MAX_DELETE_OBJECTS_COUNT];
+    int count;
+    int tries;
+    int64_t retryAt;        // when to try a failed batch again (ms), or 0
+    int64_t started;        // when the try under way was sent
+    int done;
+    S3Status status;
+    int failed;             // keys s3 reported it couldn't delete
+} clear_batch;
+
+typedef struct clear_bucket_callback_data
 {
     int isTruncated;
     char nextMarker[1024];
-    int keyCount;
-    int allDetails;
-    struct node *keylist;
-} traverse_bucket_callback_data;
-
-
-static S3Status traverseBucketCallback(int isTruncated, const char *nextMarker,
-                                   int contentsCount, 
-                                   const S3ListBucketContent *contents,
-                                   int commonPrefixesCount,
-                                   const char **commonPrefixes,
-                                   void *callbackData)
+    int listDone;
+    S3Status listStatus;
+    int64_t listStart;      // when the list request was sent
+    clear_batch *filling;   // the page being listed
+} clear_bucket_callback_data;
+
+
+static S3Status clearListCallback(int isTruncated, const char *nextMarker,
+                                  int contentsCount, 
+                                  const S3ListBucketContent *contents,
+                                  int commonPrefixesCount,
+                                  const char **commonPrefixes,
+                                  void *callbackData)
 {
-    traverse_bucket_callback_data *data = 
-        (traverse_bucket_callback_data *) callbackData;
+    clear_bucket_callback_data *data = 
+        (clear_bucket_callback_data *) callbackData;
 
     data->isTruncated = isTruncated;
     // This is tricky.  S3 doesn't return the NextMarker if there is no
@@ -398,39 +703,155 @@ static S3Status traverseBucketCallback(int isTruncated, const char *nextMarker,
         data->nextMarker[0] = 0;
     }
     
+    clear_batch *batch = data->filling;
     int i;
     for (i = 0; i < contentsCount; i++) {
-        const S3ListBucketContent *content = &(contents[i]);
-
-        // add key onto linked list; push at head
-        struct node *el = malloc(sizeof(struct node));
-        el->key = strdup(content->key);
-        el->next = data->keylist;
-        data->keylist = el;
+        if (batch->count == S3_MAX_DELETE_OBJECTS_COUNT) {
+            return S3StatusAbortedByCallback;
+        }
+        if (!(batch->keys[batch->count] = strdup(contents[i].key))) {
+            return S3StatusOutOfMemory;
+        }
+        batch->count++;
     }
 
-    data->keyCount += contentsCount;
+    return S3StatusOK;
+}
 
+static void clearListCompleteCallback(S3Status status,
+                                      const S3ErrorDetails *error,
+                                      void *callbackData)
+{
+    clear_bucket_callback_data *data = 
+        (clear_bucket_callback_data *) callbackData;
+    data->listStatus = status;
+    data->listDone = 1;
+    requestStartG = data->listStart;
+    responseCompleteCallback(status, error, 0);
+}
+
+static S3Status clearBatchErrorCallback(const char *key, const char *code,
+                                        const char *message,
+                                        void *callbackData)
+{
+    clear_batch *batch = (clear_batch *) callbackData;
+    fprintf(stderr, "S3 clear_bucket: can't delete %s: %s\n", key, code);
+    batch->failed++;
     return S3StatusOK;
 }
 
+static void clearBatchCompleteCallback(S3Status status,
+                                       const S3ErrorDetails *error,
+                                       void *callbackData)
+{
+    clear_batch *batch = (clear_batch *) callbackData;
+    batch->status = status;
+    batch->done = 1;
+    requestStartG = batch->started;
+    responseCompleteCallback(status, error, 0);
+}
 
-// JS: for s3fs project; adapted from original list_bucket.
-// (Makes sense, right?  Instead of listing, we just remove everything :-)
+static void free_clear_batch(clear_batch *batch)
+{
+    int i;
+    for (i = 0; i < batch->count; i++) {
+        free((char *) batch->keys[i]);
+    }
+    batch->count = 0;
+}
 
-int s3fs_clear_bucket(const char *bucketName) {
-    s3fs_lock();
-    int rv = __s3fs_clear_bucket(bucketName);
-    s3fs_unlock();
+static void submit_clear_batch(const S3BucketContext *bucketContext,
+                               S3RequestContext *context, clear_batch *batch)
+{
+    S3DeleteObjectsHandler handler =
+    {
+        { 0, &clearBatchCompleteCallback },
+        &clearBatchErrorCallback
+    };
+
+    batch->done = 0;
+    batch->failed = 0;
+    batch->tries++;
+    batch->started = now_ms();
+    S3_delete_objects(bucketContext, batch->count, batch->keys, context,
+                      &handler, batch);
+}
+
+// Wait (no longer than max_wait ms, unless that is -1) for the requests in
+// context to make progress, and run them.
+static S3Status run_context_once(S3RequestContext *context, int64_t max_wait)
+{
+    fd_set readfds, writefds, exceptfds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+    int maxfd, remaining;
+    S3Status status = S3_get_request_context_fdsets
+        (context, &readfds, &writefds, &exceptfds, &maxfd);
+    if (status != S3StatusOK) {
+        return status;
+    }
+    if (maxfd != -1) {
+        int64_t timeout = S3_get_request_context_timeout(context);
+        if (max_wait >= 0 && (timeout == -1 || timeout > max_wait)) {
+            timeout = max_wait;
+        }
+        struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+        select(maxfd + 1, &readfds, &writefds, &exceptfds,
+               (timeout == -1) ? 0 : &tv);
+    }
+    status = S3_runonce_request_context(context, &remaining);
+    if (maxfd == -1 && !remaining) {
+        // only batches backing off; don't spin
+        struct timespec idle = { 0, CLEAR_IDLE_MS * 1000000L };
+        nanosleep(&idle, 0);
+    }
+    return status;
+}
+
+// Retire finished deletes, resubmitting those that failed for a reason
+// that may go away; returns -1 if any keys couldn't be deleted, else 0
+static int reap_clear_batches(const S3BucketContext *bucketContext,
+                              S3RequestContext *context,
+                              clear_batch **inflight, int *inflightCount)
+{
+    int rv = 0, i = 0;
+    while (i < *inflightCount) {
+        clear_batch *batch = inflight[i];
+        if (!batch->done) {
+            i++;
+            continue;
+        }
+        if (S3_status_is_retryable(batch->status) &&
+            (batch->tries < CLEAR_MAX_TRIES)) {
+            // resubmit it once its backoff is over
+            if (!batch->retryAt) {
+                batch->retryAt = now_ms() + s3fs_backoff_ms(batch->tries);
+            }
+            if (now_ms() >= batch->retryAt) {
+                batch->retryAt = 0;
+                submit_clear_batch(bucketContext, context, batch);
+            }
+            i++;
+            continue;
+        }
+        if ((batch->status != S3StatusOK) || batch->failed) {
+            rv = -1;
+        }
+        free_clear_batch(batch);
+        free(batch);
+        inflight[i] = inflight[--(*inflightCount)];
+    }
     return rv;
 }
 
+int s3fs_clear_bucket(const char *bucketName) {
+    return __s3fs_clear_bucket(bucketName);
+}
+
 int __s3fs_clear_bucket(const char *bucketName) {
     S3_init();
 
-    const char *prefix = 0, *marker = 0, *delimiter = 0;
-    int maxkeys = 0, allDetails = 0;
-    
     S3BucketContext bucketContext =
     {
         0,
@@ -438,58 +859,86 @@ int __s3fs_clear_bucket(const char *bucketName) {
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        &timeoutsG[S3FS_METADATA]
     };
 
     S3ListBucketHandler listBucketHandler =
     {
-        { &responsePropertiesCallback, &responseCompleteCallback },
-        &traverseBucketCallback
+        { &responsePropertiesCallback, &clearListCompleteCallback },
+        &clearListCallback
     };
 
-    traverse_bucket_callback_data data;
+    S3RequestContext *context = 0;
+    if (S3_create_request_context(&context) != S3StatusOK) {
+        return -1;
+    }
 
-    snprintf(data.nextMarker, sizeof(data.nextMarker), "%s", marker);
-    data.keyCount = 0;
-    data.keylist = NULL;
-    data.allDetails = allDetails;
+    clear_bucket_callback_data data;
+    data.nextMarker[0] = 0;
+    clear_batch *inflight[CLEAR_MAX_BATCHES];
+    int inflightCount = 0;
+    int rv = 0;
 
     do {
-        data.isTruncated = 0;
+        if (!(data.filling = calloc(1, sizeof(clear_batch)))) {
+            rv = -1;
+            break;
+        }
+        // list the next page while the deletes run
+        int tries = 0;
         do {
-            S3_list_bucket(&bucketContext, prefix, data.nextMarker,
-                           delimiter, maxkeys, 0, &listBucketHandler, &data);
-        } while (S3_status_is_retryable(statusG) && should_retry());
-        if (statusG != S3StatusOK) {
+            free_clear_batch(data.filling);
+            data.isTruncated = 0;
+            data.listDone = 0;
+            data.listStart = now_ms();
+            S3_list_bucket(&bucketContext, 0,
+                           data.nextMarker[0] ? data.nextMarker : 0, 0,
+                           S3_MAX_DELETE_OBJECTS_COUNT, context,
+                           &listBucketHandler, &data);
+            while (!data.listDone) {
+                if (run_context_once(context, -1) != S3StatusOK) {
+                    data.listStatus = S3StatusInternalError;
+                    break;
+                }
+                rv |= reap_clear_batches(&bucketContext, context, inflight,
+                                         &inflightCount);
+            }
+        } while (S3_status_is_retryable(data.listStatus) &&
+                 should_retry(&tries));
+        if (data.listStatus != S3StatusOK || !data.listDone) {
+            free_clear_batch(data.filling);
+            free(data.filling);
+            rv = -1;
             break;
         }
-    } while (data.isTruncated && (!maxkeys || (data.keyCount < maxkeys)));
-
-    int rv = statusG == S3StatusOK ? 0 : -1;
-
-    S3_deinitialize();
-
-    struct node *klist = data.keylist;
 
-    // try to remove objects
-    if (rv == 0) {
-        while (klist) {
-            struct node *el = klist;
-            int thisrv = __s3fs_remove_object(bucketName, el->key);
-            if (thisrv < 0) {
-                rv = -1;
-            }
-            klist = klist->next;
+        // hand the page to a batch delete, once one is free
+        if (!data.filling->count) {
+            free(data.filling);
+            continue;
+        }
+        while ((inflightCount == CLEAR_MAX_BATCHES ||
+                inflightCount >= s3fs_window()) &&
+               run_context_once(context, -1) == S3StatusOK) {
+            rv |= reap_clear_batches(&bucketContext, context, inflight,
+                                     &inflightCount);
         }
+        inflight[inflightCount++] = data.filling;
+        submit_clear_batch(&bucketContext, context, data.filling);
+    } while (data.isTruncated);
+
+    // wait for the last deletes
+    while (inflightCount && run_context_once(context, -1) == S3StatusOK) {
+        rv |= reap_clear_batches(&bucketContext, context, inflight,
+                                 &inflightCount);
     }
-
-    // free keylist
-    klist = data.keylist;
-    while (klist) {
-        struct node *el = klist;
-        klist = klist->next;
-        free(el->key);
-        free(el);
+    S3_destroy_request_context(context);
+    // anything still listed here never finished
+    while (inflightCount) {
+        free_clear_batch(inflight[--inflightCount]);
+        free(inflight[inflightCount]);
+        rv = -1;
     }
 
     return rv;
@@ -541,13 +990,18 @@ int putObjectDataCallback(int bufferSize, char *buffer,
 }
 
 ssize_t s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength) {
-    s3fs_lock();
-    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength);
-    s3fs_unlock();
+    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength, 0, 0);
+    retire_flights(bucketName, key);
     return rv;
 }
 
-ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength)
+ssize_t s3fs_put_object_info(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength, const s3fs_meta_t *meta, s3fs_object_info_t *info) {
+    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength, meta, info);
+    retire_flights(bucketName, key);
+    return rv;
+}
+
+ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength, const s3fs_meta_t *meta, s3fs_object_info_t *info)
 {
     const char *cacheControl = 0, *contentType = 0, *md5 = 0;
     const char *contentDispositionFilename = 0, *contentEncoding = 0;
@@ -555,8 +1009,13 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
     S3CannedAcl cannedAcl = S3CannedAclPrivate;
     int metaPropertiesCount = 0;
     S3NameValue metaProperties[S3_MAX_METADATA_COUNT];
+    char metaValues[META_FIELDS][32];
     int noStatus = 0;
 
+    if (meta) {
+        metaPropertiesCount = encode_meta(meta, metaProperties, metaValues);
+    }
+
     put_object_callback_data data;
     memset(&data, 0, sizeof(put_object_callback_data));
     data.data = buf;
@@ -565,6 +1024,10 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
 
     data.contentLength = data.originalContentLength = contentLength;
 
+    const S3RequestTimeouts *timeouts =
+        &timeoutsG[(contentLength <= SMALL_OBJECT_BYTES) ?
+                   S3FS_METADATA : S3FS_DATA];
+
     S3_init();
     
     S3BucketContext bucketContext =
@@ -574,7 +1037,8 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        timeouts
     };
 
     S3PutProperties putProperties =
@@ -596,10 +1060,18 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
         &putObjectDataCallback
     };
 
+    int tries = 0;
     do {
+        // each try sends the whole object again
+        data.data = buf;
+        data.contentLength = contentLength;
+        data.written = 0;
+        memset(&responseInfoG, 0, sizeof(responseInfoG));
+        responseInfoG.lastModified = -1;
+        requestStartG = now_ms();
         S3_put_object(&bucketContext, key, contentLength, &putProperties, 0,
                       &putObjectHandler, &data);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    } while (S3_status_is_retryable(statusG) && should_retry(&tries));
 
     int result = data.written;
 
@@ -612,7 +1084,10 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
                 "input\n", (unsigned long long) data.contentLength);
     }
 
-    S3_deinitialize();
+    if (result >= 0 && info) {
+        *info = responseInfoG;
+    }
+
     return result;
 }
 
@@ -655,20 +1130,514 @@ S3Status getObjectDataCallback(int bufferSize, const char *buffer,
 }
 
 
+// Concurrent GETs of the same key, range and conditions share a single
+// transfer (a "flight"): the first caller makes the request, and the
+// others wait for it and get their own copy of its result.  A flight
+// stops taking on waiters once the object has been written (it may have
+// been answered from before the write).
+
+typedef struct get_flight {
+    const char *bucketName;     // the leader's strings; it outlives us
+    const char *key;
+    const char *ifNotMatch;
+    int64_t ifModifiedSince;
+    ssize_t start_byte, byte_count;
+    int done;
+    int retired;                // no longer in flightsG
+    int waiters;
+    ssize_t status;
+    S3Status lastStatus;        // what s3 answered, for s3fs_last_missing
+    uint8_t *buf;               // a copy for the waiters, once done
+    s3fs_object_info_t info;
+    pthread_cond_t cond;
+    struct get_flight *next;
+} get_flight_t;
+
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static get_flight_t *flightsG = NULL;
+static unsigned long coalescedG = 0;
+
+static int same_string(const char *a, const char *b) {
+    return (!a && !b) || (a && b && strcmp(a, b) == 0);
+}
+
+static get_flight_t *find_flight(const char *bucketName, const char *key,
+                                 ssize_t start_byte, ssize_t byte_count,
+                                 const char *ifNotMatch,
+                                 int64_t ifModifiedSince) {
+    get_flight_t *f = flightsG;
+    while (f && !(strcmp(f->key, key) == 0 &&
+                  strcmp(f->bucketName, bucketName) == 0 &&
+                  f->start_byte == start_byte &&
+                  f->byte_count == byte_count &&
+                  same_string(f->ifNotMatch, ifNotMatch) &&
+                  f->ifModifiedSince == ifModifiedSince)) {
+        f = f->next;
+    }
+    return f;
+}
+
+static void retire_flights(const char *bucketName, const char *key) {
+    pthread_mutex_lock(&flight_lock);
+    get_flight_t **pp = &flightsG;
+    while (*pp) {
+        get_flight_t *f = *pp;
+        if (strcmp(f->key, key) == 0 &&
+            strcmp(f->bucketName, bucketName) == 0) {
+            *pp = f->next;
+            f->retired = 1;
+        } else {
+            pp = &f->next;
+        }
+    }
+    pthread_mutex_unlock(&flight_lock);
+}
+
+/* Wait for flight f to land and take a copy of its result. */
+static ssize_t join_flight(get_flight_t *f, uint8_t **buf,
+                           s3fs_object_info_t *info) {
+    f->waiters++;
+    coalescedG++;
+    while (!f->done) {
+        pthread_cond_wait(&f->cond, &flight_lock);
+    }
+    ssize_t status = f->status;
+    lastStatusG = f->lastStatus;
+    if (status > 0) {
+        *buf = malloc(status);
+        if (*buf) {
+            memcpy(*buf, f->buf, status);
+        } else {
+            status = -1;
+        }
+    } else if (status == 0) {
+        *buf = NULL;
+    }
+    if (status >= 0 || status == S3FS_NOT_MODIFIED) {
+        if (info) {
+            *info = f->info;
+        }
+    }
+    if (--f->waiters == 0) {
+        pthread_cond_destroy(&f->cond);
+        free(f->buf);
+        free(f);
+    }
+    return status;
+}
+
 ssize_t s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, 
                         ssize_t start_byte, ssize_t byte_count) {
-    s3fs_lock();
-    ssize_t rv = __s3fs_get_object(bucketName, key, buf, start_byte, byte_count);
-    s3fs_unlock();
+    return s3fs_get_object_if(bucketName, key, buf, start_byte, byte_count,
+                              0, 0);
+}
+
+ssize_t s3fs_get_object_if(const char *bucketName, const char *key, uint8_t **buf,
+                           ssize_t start_byte, ssize_t byte_count,
+                           const s3fs_conditions_t *conditions,
+                           s3fs_object_info_t *info) {
+    const char *ifNotMatch = conditions ? conditions->ifNotMatch : 0;
+    int64_t ifModifiedSince = conditions ? conditions->ifModifiedSince : -1;
+
+    pthread_mutex_lock(&flight_lock);
+    get_flight_t *f = find_flight(bucketName, key, start_byte, byte_count,
+                                  ifNotMatch, ifModifiedSince);
+    if (f) {
+        ssize_t rv = join_flight(f, buf, info);
+        pthread_mutex_unlock(&flight_lock);
+        return rv;
+    }
+    f = malloc(sizeof(get_flight_t));
+    if (f) {
+        memset(f, 0, sizeof(get_flight_t));
+        f->bucketName = bucketName;
+        f->key = key;
+        f->ifNotMatch = ifNotMatch;
+        f->ifModifiedSince = ifModifiedSince;
+        f->start_byte = start_byte;
+        f->byte_count = byte_count;
+        pthread_cond_init(&f->cond, NULL);
+        f->next = flightsG;
+        flightsG = f;
+    }
+    pthread_mutex_unlock(&flight_lock);
+
+    s3fs_object_info_t flight_info;
+    ssize_t rv = __s3fs_get_object(bucketName, key, buf, start_byte, byte_count, conditions, &flight_info);
+    if (info && (rv >= 0 || rv == S3FS_NOT_MODIFIED)) {
+        *info = flight_info;
+    }
+    if (!f) {
+        return rv;
+    }
+
+    // land the flight; the waiters copy from a copy, since our caller
+    // may free its buffer as soon as we return
+    pthread_mutex_lock(&flight_lock);
+    if (!f->retired) {
+        get_flight_t **pp = &flightsG;
+        while (*pp != f) {
+            pp = &(*pp)->next;
+        }
+        *pp = f->next;
+    }
+    f->status = rv;
+    f->lastStatus = lastStatusG;
+    f->info = flight_info;
+    if (f->waiters > 0 && rv > 0) {
+        f->buf = malloc(rv);
+        if (f->buf) {
+            memcpy(f->buf, *buf, rv);
+        } else {
+            f->status = -1;
+        }
+    }
+    f->done = 1;
+    if (f->waiters == 0) {
+        pthread_cond_destroy(&f->cond);
+        free(f);
+    } else {
+        pthread_cond_broadcast(&f->cond);
+    }
+    pthread_mutex_unlock(&flight_lock);
     return rv;
 }
 
+unsigned long s3fs_coalesced_gets() {
+    pthread_mutex_lock(&flight_lock);
+    unsigned long n = coalescedG;
+    pthread_mutex_unlock(&flight_lock);
+    return n;
+}
+
+// hedged GETs ---------------------------------------------------------------
+
+// A GET of a small object (see is_small_get) that has had no response by
+// the time most GETs have (the hedge percentile of recent times to first
+// byte) is sent again, on another connection, and whichever copy comes
+// back first is taken; the other is dropped.  Hedges are kept within a
+// budget, a percentage of the GETs that could be hedged, so they add
+// little load even when s3 is slow across the board.  Hedging is off
+// until s3fs_set_hedging turns it on.
+#define HEDGE_SAMPLES 128               // times to first byte kept
+#define HEDGE_MIN_SAMPLES 32            // before hedging at all
+#define HEDGE_MIN_MS 5                  // never hedge sooner than this
+
+static pthread_mutex_t hedge_lock = PTHREAD_MUTEX_INITIALIZER;
+static int hedgePercentileG = 0;        // 0 while hedging is off
+static int hedgeBudgetG = 0;            // percent of hedgeable GETs
+static int hedgeSamplesG[HEDGE_SAMPLES];
+static unsigned long hedgeSampledG = 0; // samples taken so far
+static int64_t hedgeDelayG = -1;        // ms, -1 until there are enough
+static s3fs_hedge_stats_t hedgeStatsG;
+
+void s3fs_set_hedging(int percentile, int budget)
+{
+    pthread_mutex_lock(&hedge_lock);
+    hedgePercentileG = (percentile < 0 || percentile > 99) ? 0 : percentile;
+    hedgeBudgetG = (budget < 0) ? 0 : budget;
+    pthread_mutex_unlock(&hedge_lock);
+}
+
+void s3fs_hedge_stats(s3fs_hedge_stats_t *stats)
+{
+    pthread_mutex_lock(&hedge_lock);
+    *stats = hedgeStatsG;
+    stats->delay_ms = hedgeDelayG;
+    pthread_mutex_unlock(&hedge_lock);
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// Record how long a GET took to start answering (or, if it was dropped
+// before it did, how long it went without), refiguring the hedge delay
+// every so often
+static void hedge_sample(int64_t ms)
+{
+    pthread_mutex_lock(&hedge_lock);
+    hedgeSamplesG[hedgeSampledG++ % HEDGE_SAMPLES] = (int) ms;
+    if (hedgePercentileG && hedgeSampledG >= HEDGE_MIN_SAMPLES &&
+        hedgeSampledG % (HEDGE_MIN_SAMPLES / 4) == 0) {
+        int n = (hedgeSampledG < HEDGE_SAMPLES) ?
+            (int) hedgeSampledG : HEDGE_SAMPLES;
+        int sorted[HEDGE_SAMPLES];
+        memcpy(sorted, hedgeSamplesG, n * sizeof(int));
+        qsort(sorted, n, sizeof(int), &compare_ints);
+        hedgeDelayG = sorted[(n * hedgePercentileG) / 100];
+        if (hedgeDelayG < HEDGE_MIN_MS) {
+            hedgeDelayG = HEDGE_MIN_MS;
+        }
+    }
+    pthread_mutex_unlock(&hedge_lock);
+}
+
+// How long (ms) to give a GET of byteCount bytes (0: all of the object)
+// before hedging it; INT64_MAX if there aren't enough samples to hedge by
+// yet (the GET is only timed), or -1 if it isn't to be hedged
+static int64_t hedge_delay(uint64_t byteCount)
+{
+    if (!is_small_get(byteCount)) {
+        return -1;
+    }
+    pthread_mutex_lock(&hedge_lock);
+    int64_t delay = -1;
+    if (hedgePercentileG) {
+        hedgeStatsG.gets++;
+        delay = (hedgeDelayG >= 0) ? hedgeDelayG : INT64_MAX;
+    }
+    pthread_mutex_unlock(&hedge_lock);
+    return delay;
+}
+
+// Whether the budget has room for one more hedge (and if so, spend it)
+static int hedge_allowed()
+{
+    pthread_mutex_lock(&hedge_lock);
+    int allowed = (hedgeStatsG.hedges + 1) * 100 <=
+                  hedgeStatsG.gets * (unsigned long) hedgeBudgetG;
+    if (allowed) {
+        hedgeStatsG.hedges++;
+    }
+    else {
+        hedgeStatsG.over_budget++;
+    }
+    pthread_mutex_unlock(&hedge_lock);
+    return allowed;
+}
+
+struct hedged_get;
+
+typedef struct hedge_attempt
+{
+    struct hedged_get *get;
+    struct get_callback_data data;
+    s3fs_object_info_t info;
+    int64_t started;
+    int64_t answered;       // when the response started, or -1
+    int done;
+} hedge_attempt;
+
+typedef struct hedged_get
+{
+    hedge_attempt attempts[2];  // the GET and its hedge
+    int sent;
+    int winner;             // the attempt whose answer we take, or -1
+} hedged_get;
+
+static S3Status hedgePropertiesCallback
+    (const S3ResponseProperties *properties, void *callbackData)
+{
+    hedge_attempt *attempt = (hedge_attempt *) callbackData;
+    if (attempt->answered < 0) {
+        attempt->answered = now_ms();
+    }
+    // both attempts share the globals; keep what this one was told
+    memset(&responseInfoG, 0, sizeof(responseInfoG));
+    responseInfoG.lastModified = -1;
+    S3Status status = responsePropertiesCallback(properties, 0);
+    attempt->info = responseInfoG;
+    return status;
+}
+
+static S3Status hedgeDataCallback(int bufferSize, const char *buffer,
+                                  void *callbackData)
+{
+    hedge_attempt *attempt = (hedge_attempt *) callbackData;
+    if (attempt->answered < 0) {
+        attempt->answered = now_ms();
+    }
+    return getObjectDataCallback(bufferSize, buffer, &attempt->data);
+}
+
+// The first attempt to finish wins, unless it failed in a way that may go
+// away and the other one is still running; a loser is ignored
+static void hedgeCompleteCallback(S3Status status,
+                                  const S3ErrorDetails *error,
+                                  void *callbackData)
+{
+    hedge_attempt *attempt = (hedge_attempt *) callbackData;
+    hedged_get *get = attempt->get;
+    attempt->done = 1;
+    if (get->winner >= 0) {
+        return;
+    }
+    int i = attempt - get->attempts;
+    hedge_attempt *other = &get->attempts[1 - i];
+    if (S3_status_is_retryable(status) && get->sent == 2 && !other->done) {
+        return;
+    }
+    get->winner = i;
+    requestStartG = attempt->started;
+    responseCompleteCallback(status, error, 0);
+}
+
+// Each thread sends its hedged GETs through a request context of its own,
+// kept from one GET to the next so that the connections it opened are used
+// again; it is only thrown away to drop a loser that is still running.
+static pthread_once_t hedgeKeyOnceG = PTHREAD_ONCE_INIT;
+static pthread_key_t hedgeContextKeyG;
+
+static void hedge_context_destroy(void *context)
+{
+    S3_destroy_request_context((S3RequestContext *) context);
+}
+
+static void hedge_key_create()
+{
+    pthread_key_create(&hedgeContextKeyG, &hedge_context_destroy);
+}
+
+// The calling thread's context for hedged GETs, or 0 if it can't be made
+static S3RequestContext *hedge_context()
+{
+    pthread_once(&hedgeKeyOnceG, &hedge_key_create);
+    S3RequestContext *context =
+        (S3RequestContext *) pthread_getspecific(hedgeContextKeyG);
+    if (!context) {
+        if (S3_create_request_context(&context) != S3StatusOK) {
+            return 0;
+        }
+        if (pthread_setspecific(hedgeContextKeyG, context)) {
+            S3_destroy_request_context(context);
+            return 0;
+        }
+    }
+    return context;
+}
+
+static void send_attempt(hedged_get *get, const S3BucketContext *bucketContext,
+                         const char *key, const S3GetConditions *conditions,
+                         uint64_t startByte, uint64_t byteCount,
+                         S3RequestContext *context)
+{
+    static S3GetObjectHandler handler =
+    {
+        { &hedgePropertiesCallback, &hedgeCompleteCallback },
+        &hedgeDataCallback
+    };
+
+    hedge_attempt *attempt = &get->attempts[get->sent++];
+    attempt->get = get;
+    attempt->started = now_ms();
+    attempt->answered = -1;
+    S3_get_object(bucketContext, key, conditions, startByte, byteCount,
+                  context, &handler, attempt);
+}
+
+// Make one try of a GET, hedging it if it is slow to answer; the result
+// is left in result and the globals as S3_get_object would leave them.
+// Until there are enough samples to hedge by, the GET is sent the usual way
+// and only timed.  Returns -1 if the GET isn't to be hedged (nothing was
+// sent).
+static int hedged_get_object(const S3BucketContext *bucketContext,
+                             const char *key,
+                             const S3GetConditions *conditions,
+                             uint64_t startByte, uint64_t byteCount,
+                             struct get_callback_data *result)
+{
+    static S3GetObjectHandler timedHandler =
+    {
+        { &hedgePropertiesCallback, &responseCompleteCallback },
+        &hedgeDataCallback
+    };
+
+    int64_t delay = hedge_delay(byteCount);
+    if (delay < 0) {
+        return -1;
+    }
+
+    hedged_get get;
+    memset(&get, 0, sizeof(get));
+    get.winner = -1;
+    hedge_attempt *first = &get.attempts[0];
+    if (delay == INT64_MAX) {
+        first->started = now_ms();
+        first->answered = -1;
+        S3_get_object(bucketContext, key, conditions, startByte, byteCount,
+                      0, &timedHandler, first);
+        hedge_sample(((first->answered >= 0) ? first->answered : now_ms()) -
+                     first->started);
+        *result = first->data;
+        responseInfoG = first->info;
+        return 0;
+    }
+
+    S3RequestContext *context = hedge_context();
+    if (!context) {
+        return -1;
+    }
+    send_attempt(&get, bucketContext, key, conditions, startByte, byteCount,
+                 context);
+    int64_t hedgeAt = first->started + delay;
+    while (get.winner < 0) {
+        int64_t wait = -1;
+        if (get.sent == 1 && first->answered < 0 && hedgeAt != INT64_MAX) {
+            int64_t now = now_ms();
+            if (now < hedgeAt) {
+                wait = hedgeAt - now;
+            }
+            else {
+                if (hedge_allowed()) {
+                    send_attempt(&get, bucketContext, key, conditions,
+                                 startByte, byteCount, context);
+                }
+                hedgeAt = INT64_MAX;
+            }
+        }
+        S3Status status = run_context_once(context, wait);
+        if (status != S3StatusOK && get.winner < 0) {
+            responseCompleteCallback(status, 0, 0);
+            break;
+        }
+    }
+    hedge_sample(((first->answered >= 0) ? first->answered : now_ms()) -
+                 first->started);
+
+    // drop the loser, if it is still running
+    int running = 0;
+    for (int i = 0; i < get.sent; i++) {
+        running += !get.attempts[i].done;
+    }
+    if (running) {
+        pthread_setspecific(hedgeContextKeyG, 0);
+        S3_destroy_request_context(context);
+    }
+
+    hedge_attempt *winner = first;
+    if (get.winner == 1) {
+        winner = &get.attempts[1];
+        pthread_mutex_lock(&hedge_lock);
+        hedgeStatsG.wins++;
+        pthread_mutex_unlock(&hedge_lock);
+    }
+    for (int i = 0; i < get.sent; i++) {
+        if (&get.attempts[i] != winner) {
+            free(get.attempts[i].data.buf);
+        }
+    }
+    *result = winner->data;
+    responseInfoG = winner->info;
+    return 0;
+}
+
 ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, 
-                        ssize_t start_byte, ssize_t byte_count) {
+                        ssize_t start_byte, ssize_t byte_count,
+                        const s3fs_conditions_t *conditions,
+                        s3fs_object_info_t *info) {
 
     int64_t ifModifiedSince = -1, ifNotModifiedSince = -1;
     const char *ifMatch = 0, *ifNotMatch = 0;
+    if (conditions) {
+        ifModifiedSince = conditions->ifModifiedSince;
+        ifNotMatch = conditions->ifNotMatch;
+    }
     uint64_t startByte = start_byte, byteCount = byte_count;
+    const S3RequestTimeouts *timeouts =
+        &timeoutsG[is_small_get(byteCount) ? S3FS_METADATA : S3FS_DATA];
 
     S3_init();
 
@@ -683,7 +1652,8 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        timeouts
     };
 
     S3GetConditions getConditions =
@@ -700,13 +1670,33 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
         &getObjectDataCallback
     };
 
+    int tries = 0;
     do {
-        S3_get_object(&bucketContext, key, &getConditions, startByte,
-                      byteCount, 0, &getObjectHandler, &get_context);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+        // start over with what a failed try got
+        free(get_context.buf);
+        get_context.buf = NULL;
+        get_context.bytes_read = 0;
+        memset(&responseInfoG, 0, sizeof(responseInfoG));
+        responseInfoG.lastModified = -1;
+        requestStartG = now_ms();
+        if (hedged_get_object(&bucketContext, key, &getConditions, startByte,
+                              byteCount, &get_context) < 0) {
+            S3_get_object(&bucketContext, key, &getConditions, startByte,
+                          byteCount, 0, &getObjectHandler, &get_context);
+        }
+    } while (S3_status_is_retryable(statusG) && should_retry(&tries));
 
     ssize_t status = get_context.bytes_read;
-    if (statusG != S3StatusOK) {
+    if (statusG == S3StatusHttpErrorNotModified) {
+        // the copy the caller has is current; nothing was transferred
+        status = S3FS_NOT_MODIFIED;
+        if (get_context.buf) {
+            free (get_context.buf);
+        }
+        if (info) {
+            *info = responseInfoG;
+        }
+    } else if (statusG != S3StatusOK) {
         status = -1;
         if (get_context.buf) {
             free (get_context.buf);
@@ -714,18 +1704,18 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
         printError();
     } else {
         *buf = get_context.buf; 
+        if (info) {
+            *info = responseInfoG;
+        }
     }
 
-    S3_deinitialize();
-
     return status;
 }
 
 
 int s3fs_remove_object(const char *bucketName, const char *key) {
-    s3fs_lock();
     int rv = __s3fs_remove_object(bucketName, key);
-    s3fs_unlock();
+    retire_flights(bucketName, key);
     return rv;
 }
 
@@ -738,7 +1728,8 @@ int __s3fs_remove_object(const char *bucketName, const char *key) {
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        &timeoutsG[S3FS_METADATA]
     };
 
     S3ResponseHandler responseHandler =
@@ -747,9 +1738,11 @@ int __s3fs_remove_object(const char *bucketName, const char *key) {
         &responseCompleteCallback
     };
 
+    int tries = 0;
     do {
+        requestStartG = now_ms();
         S3_delete_object(&bucketContext, key, 0, &responseHandler, 0);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    } while (S3_status_is_retryable(statusG) && should_retry(&tries));
 
     int result = statusG == S3StatusOK ? 0 : -1;
 
@@ -758,7 +1751,295 @@ int __s3fs_remove_object(const char *bucketName, const char *key) {
         printError();
     }
 
-    S3_deinitialize();
-
     return result;    
 }
+
+
+// remove objects ------------------------------------------------------------
+
+typedef struct remove_objects_callback_data
+{
+    const char **keys;
+    int count;
+    int *results;
+} remove_objects_callback_data;
+
+static S3Status removeObjectsCallback(const char *key, const char *code,
+                                      const char *message, void *callbackData)
+{
+    remove_objects_callback_data *data =
+        (remove_objects_callback_data *) callbackData;
+    int i;
+    for (i = 0; i < data->count; i++) {
+        if (!strcmp(data->keys[i], key)) {
+            data->results[i] = -1;
+            break;
+        }
+    }
+    fprintf(stderr, "S3 remove_objects: can't delete %s: %s\n", key, code);
+    return S3StatusOK;
+}
+
+int s3fs_remove_objects(const char *bucketName, const char **keys, int count,
+                        int *results) {
+    int rv = __s3fs_remove_objects(bucketName, keys, count, results);
+    int i;
+    for (i = 0; i < count; i++) {
+        retire_flights(bucketName, keys[i]);
+    }
+    return rv;
+}
+
+int __s3fs_remove_objects(const char *bucketName, const char **keys,
+                          int count, int *results) {
+    S3_init();
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG,
+        &timeoutsG[S3FS_METADATA]
+    };
+
+    S3DeleteObjectsHandler handler =
+    {
+        { 0, &responseCompleteCallback },
+        &removeObjectsCallback
+    };
+
+    int result = 0, first;
+    for (first = 0; first < count; first += S3_MAX_DELETE_OBJECTS_COUNT) {
+        int n = count - first, i;
+        if (n > S3_MAX_DELETE_OBJECTS_COUNT) {
+            n = S3_MAX_DELETE_OBJECTS_COUNT;
+        }
+        remove_objects_callback_data data =
+        {
+            &(keys[first]), n, &(results[first])
+        };
+        int tries = 0;
+        do {
+            memset(&(results[first]), 0, n * sizeof(int));
+            requestStartG = now_ms();
+            S3_delete_objects(&bucketContext, n, &(keys[first]), 0,
+                              &handler, &data);
+        } while (S3_status_is_retryable(statusG) && should_retry(&tries));
+
+        if (statusG != S3StatusOK) {
+            printError();
+            for (i = 0; i < n; i++) {
+                results[first + i] = -1;
+            }
+        }
+        for (i = 0; i < n; i++) {
+            if (results[first + i] < 0) {
+                result = -1;
+            }
+        }
+    }
+
+    return result;
+}
+
+
+// head object ---------------------------------------------------------------
+
+int s3fs_head_object(const char *bucketName, const char *key,
+                     s3fs_meta_t *meta, int64_t *size) {
+    return __s3fs_head_object(bucketName, key, meta, size);
+}
+
+int __s3fs_head_object(const char *bucketName, const char *key,
+                       s3fs_meta_t *meta, int64_t *size) {
+    S3_init();
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG,
+        &timeoutsG[S3FS_METADATA]
+    };
+
+    S3ResponseHandler responseHandler =
+    {
+        &responsePropertiesCallback,
+        &responseCompleteCallback
+    };
+
+    int tries = 0;
+    do {
+        memset(&responseMetaG, 0, sizeof(responseMetaG));
+        responseMetaFieldsG = 0;
+        responseContentLengthG = 0;
+        requestStartG = now_ms();
+        S3_head_object(&bucketContext, key, 0, &responseHandler, 0);
+    } while (S3_status_is_retryable(statusG) && should_retry(&tries));
+
+    int result = -1;
+    if (statusG == S3StatusOK) {
+        *size = responseContentLengthG;
+        *meta = responseMetaG;
+        result = (responseMetaFieldsG == META_FIELDS) ? 0 : 1;
+    }
+    else if (statusG != S3StatusHttpErrorNotFound) {
+        printError();
+    }
+
+    return result;
+}
+
+
+// warm connections ----------------------------------------------------------
+
+// Opening a connection costs a DNS lookup and the TCP and TLS handshakes, so
+// connections are opened ahead of need by sending HEADs all at once, each
+// from a thread of its own.  A curl handle keeps its connection, and when
+// the thread exits its handle goes to libs3's shared pool of them, where
+// the requests that come next pick it up.  It doesn't matter whether the
+// key exists, only that s3 answered.
+
+#define WARM_MAX 64
+
+typedef struct {
+    const S3BucketContext *bucketContext;
+    S3Status status;
+} warm_job_t;
+
+static void warmCompleteCallback(S3Status status,
+                                 const S3ErrorDetails *error,
+                                 void *callbackData)
+{
+    (void) error;
+
+    ((warm_job_t *) callbackData)->status = status;
+}
+
+static void *warm_thread(void *arg)
+{
+    warm_job_t *job = (warm_job_t *) arg;
+    S3ResponseHandler responseHandler =
+    {
+        0,
+        &warmCompleteCallback
+    };
+
+    S3_head_object(job->bucketContext, "/", 0, &responseHandler, job);
+    return NULL;
+}
+
+int s3fs_warm_connections(const char *bucketName, int count) {
+    return __s3fs_warm_connections(bucketName, count);
+}
+
+int __s3fs_warm_connections(const char *bucketName, int count) {
+    if (count > WARM_MAX) {
+        count = WARM_MAX;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+
+    S3_init();
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG,
+        &timeoutsG[S3FS_METADATA]
+    };
+
+    warm_job_t jobs[WARM_MAX];
+    pthread_t threads[WARM_MAX];
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        jobs[i].bucketContext = &bucketContext;
+        jobs[i].status = S3StatusInterrupted;
+        if (pthread_create(&threads[i], NULL, warm_thread, &jobs[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    int answered = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        if (jobs[i].status == S3StatusOK ||
+            jobs[i].status >= S3StatusErrorAccessDenied) {
+            answered++;
+        }
+    }
+
+    return answered;
+}
+
+
+// set metadata --------------------------------------------------------------
+
+// Replacing an object's metadata is a copy of the object onto itself with
+// new headers; s3 does that without sending the data anywhere.
+
+int s3fs_set_meta(const char *bucketName, const char *key,
+                  const s3fs_meta_t *meta) {
+    int rv = __s3fs_set_meta(bucketName, key, meta);
+    retire_flights(bucketName, key);
+    return rv;
+}
+
+int __s3fs_set_meta(const char *bucketName, const char *key,
+                    const s3fs_meta_t *meta) {
+    S3_init();
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG,
+        &timeoutsG[S3FS_DATA]
+    };
+
+    S3NameValue metaProperties[META_FIELDS];
+    char metaValues[META_FIELDS][32];
+    S3PutProperties putProperties =
+    {
+        0,
+        0,
+        0,
+        0,
+        0,
+        -1,
+        S3CannedAclPrivate,
+        encode_meta(meta, metaProperties, metaValues),
+        metaProperties
+    };
+
+    S3ResponseHandler responseHandler =
+    {
+        &responsePropertiesCallback,
+        &responseCompleteCallback
+    };
+
+    int tries = 0;
+    do {
+        requestStartG = now_ms();
+        S3_copy_object(&bucketContext, key, bucketName, key, &putProperties,
+                       0, 0, 0, 0, &responseHandler, 0);
+    } while (S3_status_is_retryable(statusG) && should_retry(&tries));
+
+    int result = statusG == S3StatusOK ? 0 : -1;
+    if (statusG != S3StatusOK) {
+        printError();
+    }
+
+    return result;
+}
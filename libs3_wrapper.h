@@ -14,12 +14,41 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+// room for an ETag as s3 returns it (quoted hex digest, maybe "-parts")
+#define S3FS_ETAG_SIZE 128
+
+// returned by the conditional GET when the object is unchanged
+#define S3FS_NOT_MODIFIED (-2)
+
+// what s3 told us about an object's version in a response
+typedef struct {
+    char eTag[S3FS_ETAG_SIZE];  // "" if none was sent
+    int64_t lastModified;       // seconds since the epoch, or -1
+} s3fs_object_info_t;
+
+// s3fs metadata for a file or directory, stored on its object as
+// x-amz-meta-* headers so it can be read back with a HEAD request
+typedef struct {
+    uint64_t ino;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    int64_t mtime;
+} s3fs_meta_t;
+
+// conditions for s3fs_get_object_if; unused ones are NULL/-1
+typedef struct {
+    const char *ifNotMatch;     // only send the object if its ETag differs
+    int64_t ifModifiedSince;    // ... or if it changed after this time
+} s3fs_conditions_t;
+
 /* 
  * Initialize credentials.  This function looks for two shell environment
  * variables: "S3_ACCESS_KEY_ID" and "S3_SECRET_ACCESS_KEY".  If they
  * exist, the function returns 0.  Otherwise it returns -1.
  * This function must be called before any other library functions
- * are called.
+ * are called.  After that, requests may be made from any number of
+ * threads at once.
  */
 int s3fs_init_credentials();
 
@@ -54,6 +83,86 @@ int s3fs_clear_bucket(const char *bucket);
 ssize_t s3fs_get_object(const char *bucket, const char *key, uint8_t **buf, 
                         ssize_t start_byte, ssize_t byte_count);
 
+/*
+ * Conditional version of s3fs_get_object.  If the object doesn't satisfy
+ * conditions (NULL means no conditions), i.e. the caller's copy is still
+ * current, nothing is transferred, S3FS_NOT_MODIFIED is returned and
+ * *buf is left alone.  Unless info is NULL, the ETag and Last-Modified
+ * time s3 sent back are stored there, on a 304 as well as on success.
+ *
+ * Both GET functions coalesce concurrent calls: a call for the same key,
+ * range and conditions as one already in progress doesn't make a request
+ * of its own, but waits for that one and gets a copy of its result.
+ */
+ssize_t s3fs_get_object_if(const char *bucket, const char *key, uint8_t **buf,
+                           ssize_t start_byte, ssize_t byte_count,
+                           const s3fs_conditions_t *conditions,
+                           s3fs_object_info_t *info);
+
+/* How many GETs so far were served by joining one already in progress. */
+unsigned long s3fs_coalesced_gets();
+
+/*
+ * Requests are either metadata requests (HEADs, deletes, and GETs and PUTs
+ * of small objects), or bulk data requests, and each class has timeouts of
+ * its own (see S3RequestTimeouts in libs3.h).  A request that times out
+ * fails like one whose connection dropped, and is retried.  Set them
+ * before the first request.
+ */
+#define S3FS_METADATA 0
+#define S3FS_DATA 1
+#define S3FS_REQUEST_CLASSES 2
+
+void s3fs_set_timeouts(int request_class, const S3RequestTimeouts *timeouts);
+
+/*
+ * Keep up to per_thread finished requests (with their curl handles and any
+ * connection they hold open) for re-use in a cache of each thread's own, and
+ * up to pool more in a pool shared by all threads; see
+ * S3_set_request_cache_size in libs3.h.  Only takes effect if called before
+ * the first request.
+ */
+void s3fs_set_handle_caches(int per_thread, int pool);
+
+/*
+ * Negotiate HTTP/2 with s3 (enable != 0), so that the requests that bulk
+ * operations send together (s3fs_clear_bucket's batch deletes, hedged
+ * GETs) share connections instead of taking one each; other requests go
+ * one at a time over a connection of their own either way.  See
+ * S3_set_http2 in libs3.h.  Only takes effect if called before the first
+ * request.
+ */
+void s3fs_set_http2(int enable);
+
+/* How requests have been re-used so far. */
+void s3fs_handle_stats(S3RequestCacheStats *stats);
+
+/*
+ * GETs and PUTs of up to 64 KB are of small objects.  A whole-object GET
+ * is taken to be of a large one, unless the calling thread says its
+ * objects are small (small != 0).  Returns the previous setting.
+ */
+int s3fs_set_small_gets(int small);
+
+/*
+ * Hedge GETs of small objects: one that hasn't started to answer by the
+ * time percentile percent of recent GETs had is sent a second time, and
+ * the first answer to arrive is taken.  At most budget percent of the
+ * GETs that qualify are hedged.  A percentile of 0 turns hedging off
+ * (the default).
+ */
+void s3fs_set_hedging(int percentile, int budget);
+
+typedef struct {
+    unsigned long gets;         // GETs that qualified
+    unsigned long hedges;       // ... of which were hedged
+    unsigned long wins;         // ... and answered by the hedge first
+    unsigned long over_budget;  // slow, but the budget was spent
+    int64_t delay_ms;           // current hedge delay, or -1 if unknown
+} s3fs_hedge_stats_t;
+
+void s3fs_hedge_stats(s3fs_hedge_stats_t *stats);
+
 /* 
  * Write a full object to s3.  The object is written to the given bucket,
  * with the given key.  Only writing of complete files/objects is
@@ -68,6 +177,31 @@ ssize_t s3fs_get_object(const char *bucket, const char *key, uint8_t **buf,
 ssize_t s3fs_put_object(const char *bucket, const char *key, 
                         const uint8_t *buf, ssize_t byte_count); 
 
+/*
+ * s3fs_put_object, also storing meta (unless it is NULL) on the object as
+ * metadata headers, and the new object's ETag (and Last-Modified time, if
+ * s3 sent one) in info (unless it is NULL) on success.
+ */
+ssize_t s3fs_put_object_info(const char *bucket, const char *key,
+                             const uint8_t *buf, ssize_t byte_count,
+                             const s3fs_meta_t *meta,
+                             s3fs_object_info_t *info);
+
+/*
+ * Fetch the metadata headers and size of an object without its contents.
+ * Returns 0 with *meta and *size filled in, 1 if the object exists but
+ * doesn't carry (all of) our metadata (only *size is meaningful then), or
+ * -1 if there is no such object or on error.
+ */
+int s3fs_head_object(const char *bucket, const char *key, s3fs_meta_t *meta,
+                     int64_t *size);
+
+/*
+ * Replace the metadata headers of an existing object, without
+ * transferring its contents.  Returns 0 on success and -1 on failure.
+ */
+int s3fs_set_meta(const char *bucket, const char *key, const s3fs_meta_t *meta);
+
 /* 
  * Remove a given object from the given bucket.
  *
@@ -75,4 +209,76 @@ ssize_t s3fs_put_object(const char *bucket, const char *key,
  */ 
 int s3fs_remove_object(const char *bucket, const char *key);
 
+/*
+ * Remove count objects from the given bucket, up to 1000 of them per
+ * request to s3 (a multi-object delete).  results[i] is set to 0 if
+ * keys[i] is gone (or never existed) and to -1 if it couldn't be removed.
+ *
+ * This function returns 0 if all of them were removed and -1 otherwise.
+ */
+int s3fs_remove_objects(const char *bucket, const char **keys, int count,
+                        int *results);
+
+/*
+ * A request that fails with an error that may go away (a timeout, a 5xx,
+ * SlowDown) is tried again a few times, backing off for a random time
+ * before each retry; other requests go ahead meanwhile.
+ *
+ * Make requests from the calling thread give up at the first such error
+ * instead (nowait != 0), for callers that would rather schedule the retry
+ * themselves than wait for it.  Returns the previous setting.
+ */
+int s3fs_set_retry_nowait(int nowait);
+
+/*
+ * Whether the last request made by the calling thread failed with an error
+ * that may go away if it is tried again.
+ */
+int s3fs_last_retryable();
+
+/*
+ * Whether the last request made by the calling thread failed because the
+ * object isn't there (s3 answered 404), as opposed to an error that says
+ * nothing about whether it is.
+ */
+int s3fs_last_missing();
+
+/*
+ * How long to wait (ms) before trying a request again after tries failed
+ * tries: a random time of up to a limit that doubles with every try.
+ */
+int s3fs_backoff_ms(int tries);
+
+/*
+ * How many requests bulk work (batch deletes, background uploads, queued
+ * removals) should keep in flight right now.  The window adapts to how s3
+ * is coping: it opens up while responses come back quickly and without
+ * errors, stops opening while they are slow, and is cut in half by
+ * SlowDown responses, timeouts and failed connections.  Requests made
+ * from FUSE handlers aren't limited by it.
+ */
+int s3fs_window();
+
+typedef struct {
+    int window;                 // right now
+    int max_window;             // the largest it has been
+    unsigned long increases;
+    unsigned long decreases;
+    unsigned long slowdowns;    // SlowDown (503) responses
+    unsigned long timeouts;     // requests that timed out
+} s3fs_window_stats_t;
+
+void s3fs_window_stats(s3fs_window_stats_t *stats);
+
+/* How long (ms) it has been since the last response came back from s3. */
+int64_t s3fs_idle_ms();
+
+/*
+ * Open count connections to bucket's endpoint (or freshen count open
+ * ones), by sending that many HEAD requests at once; the connections stay
+ * open for the requests that follow.  Returns how many were answered, or
+ * -1 on error.
+ */
+int s3fs_warm_connections(const char *bucket, int count);
+
 #endif // __LIBS3_WRAPPER_H__
@@ -2,15 +2,27 @@
    fuse system tutorial. */
 
 #include "s3fs.h"
+#include "s3fs_dir.h"
+#include "s3fs_dircache.h"
+#include "s3fs_async.h"
+#include "s3fs_cache.h"
+#include "s3fs_checkpoint.h"
+#include "s3fs_delq.h"
+#include "s3fs_inode.h"
+#include "s3fs_mem.h"
+#include "s3fs_notify.h"
+#include "s3fs_warm.h"
+#include "s3fs_writeback.h"
 #include "libs3_wrapper.h"
 
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <fuse.h>
-#include <libgen.h>
+#include <fuse_lowlevel.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,260 +30,1634 @@
 #include <sys/types.h>
 #include <sys/xattr.h>
 
-#define GET_PRIVATE_DATA ((s3context_t *) fuse_get_context()->private_data)
+#define GET_PRIVATE_DATA(req) ((s3context_t *) fuse_req_userdata(req))
 #define ENTRY_SIZE (sizeof(entry_t))
 
 /*
- * For each function below, if you need to return an error,
- * read the appropriate man page for the call and see what
- * error codes make sense for the type of failure you want
- * to convey.  For example, many of the calls below return
- * -EIO (an I/O error), since there are no S3 calls yet
- * implemented.  (Note that you need to return the negative
- * value for an error code.)
+ * We use the low-level FUSE interface: the kernel names files by inode
+ * number (or by parent inode number plus name), and every callback
+ * answers with one of the fuse_reply_* functions rather than a return
+ * value.  The internal helpers below still return 0 or a negative errno
+ * value; the callbacks turn those into fuse_reply_err(req, -rv).
+ *
+ * Inode numbers are assigned when a file or directory is created and
+ * stored in its directory record, so they are stable.  s3fs_inode.c maps
+ * the inodes the kernel currently knows about to their s3 keys (paths).
+ */
+
+/* *************************************** */
+/*        Object helpers                   */
+/* *************************************** */
+
+/*
+ * s3fs_get_object_if, going through the object cache.  Without
+ * conditions of its own from the caller, if we have a copy of key we
+ * only ask s3 to send the object if its ETag has changed.  Full objects
+ * we receive are cached; a range of a changed object isn't, and the stale
+ * copy is dropped.  Returns the object's size, -1 on error, or
+ * S3FS_NOT_MODIFIED if the caller's conditions say its copy is current.
+ */
+static ssize_t cached_get_object(s3context_t *ctx, const char *key,
+                                 uint8_t **buf, ssize_t start_byte,
+                                 ssize_t byte_count,
+                                 const s3fs_conditions_t *conditions,
+                                 s3fs_object_info_t *info) {
+    s3fs_object_info_t local_info;
+    if (!info) {
+        info = &local_info;
+    }
+    char etag[S3FS_ETAG_SIZE];
+    s3fs_conditions_t disk_conditions = { etag, -1 };
+    int cached = 0;
+    if (!conditions && cache_etag(key, etag, sizeof(etag)) == 0) {
+        cached = 1;
+        conditions = &disk_conditions;
+    }
+
+    ssize_t len = s3fs_get_object_if(ctx->s3bucket, key, buf, start_byte,
+                                     byte_count, conditions, info);
+    if (len == S3FS_NOT_MODIFIED && cached) {
+        len = cache_read(key, etag, buf, start_byte, byte_count);
+        if (len >= 0) {
+            return len;
+        }
+        // the copy was evicted under us; fetch the object for real
+        cached = 0;
+        len = s3fs_get_object_if(ctx->s3bucket, key, buf, start_byte,
+                                 byte_count, NULL, info);
+    }
+    if (len < 0) {
+        return len;
+    }
+    if (start_byte == 0 && byte_count == 0) {
+        cache_store(key, info->eTag, *buf, len);
+    } else if (cached) {
+        cache_invalidate(key);
+    }
+    return len;
+}
+
+/*
+ * cached_get_object, within the memory budget.  A range's buffer is
+ * reserved up front, which may wait for memory to free up; a whole
+ * object's size isn't known in advance, so it is only charged once it
+ * has arrived.  The buffer returned stays charged until the caller hands
+ * it to free_object, or to the write-back buffer with uncharge_object.
+ */
+static ssize_t get_object_if(s3context_t *ctx, const char *key, uint8_t **buf,
+                             ssize_t start_byte, ssize_t byte_count,
+                             const s3fs_conditions_t *conditions,
+                             s3fs_object_info_t *info) {
+    mem_reserve(MEM_INFLIGHT, byte_count);
+    ssize_t len = cached_get_object(ctx, key, buf, start_byte, byte_count,
+                                    conditions, info);
+    if (byte_count == 0) {
+        if (len > 0) {
+            mem_charge(MEM_INFLIGHT, len);
+        }
+    } else {
+        mem_release(MEM_INFLIGHT, len > 0 ? byte_count - len : byte_count);
+    }
+    return len;
+}
+
+/* Give back the charge on len bytes get_object_if returned. */
+static void uncharge_object(ssize_t len) {
+    if (len > 0) {
+        mem_release(MEM_INFLIGHT, len);
+    }
+}
+
+/* Free a buffer of len bytes get_object_if returned. */
+static void free_object(uint8_t *buf, ssize_t len) {
+    free(buf);
+    uncharge_object(len);
+}
+
+static ssize_t get_object(s3context_t *ctx, const char *key, uint8_t **buf,
+                          ssize_t start_byte, ssize_t byte_count) {
+    return get_object_if(ctx, key, buf, start_byte, byte_count, NULL, NULL);
+}
+
+/*
+ * s3fs_put_object, writing through the object cache and within the
+ * memory budget (the body is reserved while it is sent).  meta is stored
+ * on the object as metadata headers, and the new object's version goes
+ * in info unless that is NULL.
+ */
+static ssize_t put_object_info(s3context_t *ctx, const char *key,
+                               const uint8_t *buf, ssize_t len,
+                               const s3fs_meta_t *meta,
+                               s3fs_object_info_t *info) {
+    s3fs_object_info_t local_info;
+    if (!info) {
+        info = &local_info;
+    }
+    // a removal still queued would take the new object with it
+    delq_cancel(key);
+    mem_reserve(MEM_INFLIGHT, len);
+    ssize_t rv = s3fs_put_object_info(ctx->s3bucket, key, buf, len, meta,
+                                      info);
+    mem_release(MEM_INFLIGHT, len);
+    if (rv < 0) {
+        cache_invalidate(key);
+    } else {
+        cache_store(key, info->eTag, buf, len);
+    }
+    return rv;
+}
+
+static ssize_t put_object(s3context_t *ctx, const char *key,
+                          const uint8_t *buf, ssize_t len,
+                          const s3fs_meta_t *meta) {
+    return put_object_info(ctx, key, buf, len, meta, NULL);
+}
+
+/*
+ * The metadata headers for entry idx of dir.
+ */
+static void entry_meta(const s3dir_t *dir, int idx, s3fs_meta_t *meta) {
+    meta->ino = dir->ino[idx];
+    meta->mode = dir->mode[idx];
+    meta->uid = dir->uid[idx];
+    meta->gid = dir->gid[idx];
+    meta->mtime = dir->mtime[idx];
+}
+
+static void stat_meta(const struct stat *statbuf, s3fs_meta_t *meta) {
+    meta->ino = statbuf->st_ino;
+    meta->mode = statbuf->st_mode;
+    meta->uid = statbuf->st_uid;
+    meta->gid = statbuf->st_gid;
+    meta->mtime = statbuf->st_mtime;
+}
+
+/*
+ * s3fs_remove_object, dropping any cached copy.
+ */
+static int remove_object(s3context_t *ctx, const char *key) {
+    cache_invalidate(key);
+    return s3fs_remove_object(ctx->s3bucket, key);
+}
+
+/*
+ * The delete queue's remove function: one multi-object delete per
+ * batch.
+ */
+static void remove_objects(void *arg, char **keys, int count, int *results) {
+    s3context_t *ctx = (s3context_t *)arg;
+    for (int i = 0; i < count; i++) {
+        cache_invalidate(keys[i]);
+    }
+    s3fs_remove_objects(ctx->s3bucket, (const char **)keys, count, results);
+}
+
+/*
+ * Have the object at key removed in the background, now that nothing
+ * refers to it.  If the delete queue can't take it, remove it right away.
+ */
+static void queue_remove(s3context_t *ctx, const char *key) {
+    cache_invalidate(key);
+    if (delq_push(key) < 0 && remove_object(ctx, key) < 0) {
+        fprintf(stderr, "can't remove %s, leaving it behind\n", key);
+    }
+}
+
+
+/* *************************************** */
+/*        Directory helpers                */
+/* *************************************** */
+
+/*
+ * Someone else changed a directory we had cached from old to new: tell
+ * the kernel to forget names that went away or now refer to something
+ * else, and attributes that changed.  Entries keep their relative order
+ * in a directory object (removals close up the gap, additions go at the
+ * end), so a single merge-like pass by inode number finds the changes.
+ */
+static void notify_dir_changes(const s3dir_t *old, const s3dir_t *new) {
+    uint64_t parent = new->ino[0];
+    if (old->mtime[0] != new->mtime[0] || old->mode[0] != new->mode[0]) {
+        notify_inval_inode(parent);
+    }
+    int i = 1, j = 1;
+    for (; i < old->count; i++) {
+        if (j < new->count && old->ino[i] == new->ino[j]) {
+            if (strcmp(s3dir_name(old, i), s3dir_name(new, j)) != 0) {
+                notify_inval_entry(parent, s3dir_name(old, i));
+            }
+            if (old->size[i] != new->size[j] ||
+                old->mtime[i] != new->mtime[j] ||
+                old->mode[i] != new->mode[j]) {
+                notify_inval_inode(old->ino[i]);
+            }
+            j++;
+        } else {
+            notify_inval_entry(parent, s3dir_name(old, i));
+            notify_inval_inode(old->ino[i]);
+        }
+    }
+}
+
+/*
+ * Every change to a directory is a load, modify, store cycle on its
+ * object, and callbacks and the write-back flusher run on several threads
+ * at once, so each cycle holds the lock of the directories it changes.
+ * Paths hash onto a fixed set of locks; a thread holds one set of them at
+ * a time, taken in index order.  While it does, it doesn't wait for
+ * memory: the flusher, which frees memory, may need one of those locks.
+ */
+#define DIR_LOCKS 64
+
+static pthread_mutex_t dir_locks[DIR_LOCKS];
+static __thread int dir_heldG;      // this thread holds directory locks
+static __thread int dir_nowaitG;    // its mem_set_nowait before that
+
+static void dir_locks_init() {
+    for (int i = 0; i < DIR_LOCKS; i++) {
+        pthread_mutex_init(&dir_locks[i], NULL);
+    }
+}
+
+/* Mark the locks for the n paths (NULL ones are skipped) in held. */
+static void dir_lock_set(const char **paths, int n, char *held) {
+    memset(held, 0, DIR_LOCKS);
+    for (int i = 0; i < n; i++) {
+        if (paths[i]) {
+            unsigned int h = 5381;
+            for (const char *p = paths[i]; *p; p++) {
+                h = ((h << 5) + h) + (unsigned char)*p;
+            }
+            held[h % DIR_LOCKS] = 1;
+        }
+    }
+}
+
+static void lock_dirs(const char **paths, int n) {
+    char held[DIR_LOCKS];
+    dir_lock_set(paths, n, held);
+    for (int i = 0; i < DIR_LOCKS; i++) {
+        if (held[i]) {
+            pthread_mutex_lock(&dir_locks[i]);
+        }
+    }
+    dir_heldG = 1;
+    dir_nowaitG = mem_set_nowait(1);
+}
+
+static void unlock_dirs(const char **paths, int n) {
+    char held[DIR_LOCKS];
+    dir_lock_set(paths, n, held);
+    mem_set_nowait(dir_nowaitG);
+    dir_heldG = 0;
+    for (int i = DIR_LOCKS - 1; i >= 0; i--) {
+        if (held[i]) {
+            pthread_mutex_unlock(&dir_locks[i]);
+        }
+    }
+}
+
+static void lock_dir(const char *path) {
+    lock_dirs(&path, 1);
+}
+
+static void unlock_dir(const char *path) {
+    unlock_dirs(&path, 1);
+}
+
+/*
+ * load_dir's cache miss: revalidate or download the directory object at
+ * path.  Called with the directory's lock.
+ */
+static int fetch_dir(s3context_t *ctx, const char *path, s3dir_t *dir) {
+    s3fs_object_info_t info;
+    int cached = dircache_lookup(path, dir, &info);
+    if (cached == DIRCACHE_FRESH) {
+        return 0;
+    }
+
+    // revalidate an expired copy rather than downloading it again
+    s3fs_conditions_t conditions = { NULL, -1 };
+    if (cached == DIRCACHE_STALE) {
+        if (info.eTag[0]) {
+            conditions.ifNotMatch = info.eTag;
+        } else {
+            conditions.ifModifiedSince = info.lastModified;
+        }
+    }
+
+    uint8_t *buffer = NULL;
+    int old_small = s3fs_set_small_gets(1);     // directories are small
+    ssize_t len = get_object_if(ctx, path, &buffer, 0, 0,
+                                cached == DIRCACHE_STALE ? &conditions : NULL,
+                                &info);
+    s3fs_set_small_gets(old_small);
+    if (len == S3FS_NOT_MODIFIED) {
+        dircache_revalidated(path, (size_t)dir->count * ENTRY_SIZE);
+        return 0;
+    }
+    if (len < 0) {
+        if (cached == DIRCACHE_STALE) {
+            s3dir_free(dir);
+        }
+        // only a 404 says there is no such directory
+        return s3fs_last_missing() ? -ENOENT : -EIO;
+    }
+
+    s3dir_t fetched;
+    s3dir_init(&fetched);
+    int rv = s3dir_decode(&fetched, buffer, len);
+    if (rv == 0) {
+        ckpt_note_dir(path, buffer, len, &info);
+    }
+    free_object(buffer, len);
+    if (rv < 0) {
+        s3dir_free(&fetched);
+        if (cached == DIRCACHE_STALE) {
+            s3dir_free(dir);
+        }
+        return -EIO;
+    }
+    if (cached == DIRCACHE_STALE) {
+        notify_dir_changes(dir, &fetched);
+        s3dir_free(dir);
+    }
+    *dir = fetched;
+    dircache_put(path, dir, &info);
+    return 0;
+}
+
+/*
+ * Fetch the directory object at path (from the directory cache if we
+ * have it) and decode it into dir.  Returns 0 on success (dir must then
+ * be freed with s3dir_free), -ENOENT if there is no such object, or -EIO
+ * if it couldn't be fetched or isn't a well-formed directory.
+ */
+static int load_dir(s3context_t *ctx, const char *path, s3dir_t *dir) {
+    if (delq_pending(path)) {
+        return -ENOENT;     // removed, but the object isn't gone yet
+    }
+    if (dircache_get(path, dir) == 0) {
+        return 0;
+    }
+    // what we fetch mustn't replace a newer copy that a change stores in
+    // the meantime, so fetching takes the directory's lock (unless this
+    // thread is making a change, and holds it already)
+    int lock = !dir_heldG;
+    if (lock) {
+        lock_dir(path);
+    }
+    int rv = fetch_dir(ctx, path, dir);
+    if (lock) {
+        unlock_dir(path);
+    }
+    return rv;
+}
+
+/*
+ * Encode dir and write it back to s3 at path.  Returns 0 or -EIO.
+ */
+static int store_dir(s3context_t *ctx, const char *path, s3dir_t *dir) {
+    uint8_t *buffer = NULL;
+    ssize_t len = s3dir_encode(dir, &buffer);
+    if (len < 0) {
+        return -ENOMEM;
+    }
+    s3fs_object_info_t info;
+    s3fs_meta_t meta;
+    entry_meta(dir, 0, &meta);
+    ssize_t rv = put_object_info(ctx, path, buffer, len, &meta, &info);
+    if (rv >= 0) {
+        ckpt_note_dir(path, buffer, len, &info);
+    }
+    free(buffer);
+    if (rv < 0) {
+        // the kernel may have been told about changes that didn't stick
+        dircache_invalidate(path);
+        notify_inval_inode(dir->ino[0]);
+        return -EIO;
+    }
+    dircache_put(path, dir, &info);
+    return 0;
+}
+
+/*
+ * A fresh inode number for a new file or directory.  A persistent mount
+ * must have it covered by a checkpoint before it goes into a directory.
+ */
+static uint64_t new_ino() {
+    uint64_t ino = inode_alloc();
+    ckpt_cover_ino(ino);
+    return ino;
+}
+
+/*
+ * Fetch count entries of the directory object at path, starting with
+ * entry first, using a ranged GET.  Entries are fixed-size records, so
+ * a page of them is just a byte range of the object.  On success the
+ * page is decoded into page (index 0 is entry first) and the number of
+ * entries fetched is returned; otherwise -ENOENT or -EIO.
+ */
+static int load_dir_page(s3context_t *ctx, const char *path, int first,
+                         int count, s3dir_t *page) {
+    uint8_t *buffer = NULL;
+    ssize_t len = get_object(ctx, path, &buffer,
+                                  (ssize_t)first * ENTRY_SIZE,
+                                  (ssize_t)count * ENTRY_SIZE);
+    if (len < 0) {
+        return -ENOENT;
+    }
+
+    s3dir_init(page);
+    int rv = s3dir_decode(page, buffer, len);
+    free_object(buffer, len);
+    if (rv < 0) {
+        s3dir_free(page);
+        return -EIO;
+    }
+    return page->count;
+}
+
+/* Put the path of directory parent in *dir_path (malloc'ed). */
+static int parent_path(fuse_ino_t parent, char **dir_path) {
+    char type;
+    *dir_path = inode_path(parent, &type);
+    if (!*dir_path) {
+        return -ESTALE;
+    }
+    if (type != 'd') {
+        free(*dir_path);
+        return -ENOTDIR;
+    }
+    return 0;
+}
+
+/* Load the directory at dir_path and find name in it, as load_parent. */
+static int load_entry(s3context_t *ctx, const char *dir_path,
+                      const char *name, s3dir_t *dir, int *idx) {
+    int rv = load_dir(ctx, dir_path, dir);
+    if (rv < 0) {
+        return rv;
+    }
+    *idx = s3dir_find(dir, name);
+    if (*idx == 0) {
+        *idx = -1;
+    }
+    return 0;
+}
+
+/*
+ * Load directory parent (an inode) and find name in it.  On success
+ * returns 0 with the directory in *dir, its path in *dir_path (malloc'ed;
+ * the caller frees both) and the entry's index in *idx, which is -1 if
+ * there is no such entry.  "." is never matched.
+ */
+static int load_parent(s3context_t *ctx, fuse_ino_t parent, const char *name,
+                       s3dir_t *dir, char **dir_path, int *idx) {
+    int rv = parent_path(parent, dir_path);
+    if (rv == 0 && (rv = load_entry(ctx, *dir_path, name, dir, idx)) < 0) {
+        free(*dir_path);
+    }
+    return rv;
+}
+
+/*
+ * load_parent for a change to the directory: on success its lock is held
+ * as well, until the caller's unlock_dir(*dir_path).
+ */
+static int lock_parent(s3context_t *ctx, fuse_ino_t parent, const char *name,
+                       s3dir_t *dir, char **dir_path, int *idx) {
+    int rv = parent_path(parent, dir_path);
+    if (rv < 0) {
+        return rv;
+    }
+    lock_dir(*dir_path);
+    if ((rv = load_entry(ctx, *dir_path, name, dir, idx)) < 0) {
+        unlock_dir(*dir_path);
+        free(*dir_path);
+    }
+    return rv;
+}
+
+/*
+ * Lock the directory that inode ino is listed in, for a change to its
+ * entry.  Returns 0 with the directory's path in *dir_path and ino's name
+ * in *name (both malloc'ed), or -ESTALE if ino is unknown.  The inode may
+ * be renamed while we wait for the lock, in which case we go after its
+ * new directory.
+ */
+static int lock_entry_dir(fuse_ino_t ino, char **dir_path, char **name) {
+    for (;;) {
+        uint64_t parent, parent_now;
+        *name = inode_name(ino, &parent);
+        if (!*name) {
+            return -ESTALE;
+        }
+        int rv = parent_path(parent, dir_path);
+        if (rv < 0) {
+            free(*name);
+            return rv;
+        }
+        lock_dir(*dir_path);
+        char *name_now = inode_name(ino, &parent_now);
+        int moved = !name_now || parent_now != parent ||
+                    strcmp(name_now, *name) != 0;
+        free(name_now);
+        if (!moved) {
+            return 0;
+        }
+        unlock_dir(*dir_path);
+        free(*dir_path);
+        free(*name);
+    }
+}
+
+/* The path of name in directory dir_path (malloc'ed), or NULL. */
+static char *child_path(const char *dir_path, const char *name) {
+    size_t len = strlen(dir_path) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path) {
+        snprintf(path, len, "%s%s%s", dir_path,
+                 strcmp(dir_path, "/") == 0 ? "" : "/", name);
+    }
+    return path;
+}
+
+/* Drop the unwritten data of a file that is going away. */
+static void discard_dirty(fuse_ino_t ino) {
+    uint8_t *buf;
+    size_t len;
+    time_t mtime;
+    if (wb_take(ino, &buf, &len, &mtime) == 0) {
+        free(buf);
+    }
+}
+
+/*
+ * A file with unwritten data has the size and mtime of its buffer.
  */
+static void dirty_stat(struct stat *statbuf) {
+    off_t size;
+    time_t mtime;
+    if (wb_attr(statbuf->st_ino, &size, &mtime) == 0) {
+        statbuf->st_size = size;
+        statbuf->st_mtime = mtime;
+    }
+}
+
+/*
+ * Fill in statbuf for entry idx of directory dir, whose path is dir_path.
+ * A file's metadata is all in its directory record; a directory's own
+ * metadata lives in the "." entry of its object.
+ */
+static int entry_stat(s3context_t *ctx, const s3dir_t *dir,
+                      const char *dir_path, int idx, struct stat *statbuf) {
+    if (dir->type[idx] != 'd') {
+        s3dir_stat(dir, idx, statbuf);
+        dirty_stat(statbuf);
+        return 0;
+    }
+
+    char *path = child_path(dir_path, s3dir_name(dir, idx));
+    if (!path) {
+        return -ENOMEM;
+    }
+
+    s3dir_t child;
+    int rv = load_dir(ctx, path, &child);
+    free(path);
+    if (rv < 0) {
+        return rv;
+    }
+    s3dir_stat(&child, 0, statbuf);
+    statbuf->st_ino = dir->ino[idx];
+    s3dir_free(&child);
+    return 0;
+}
+
+/*
+ * Fill in statbuf for the object at path from the metadata headers on the
+ * object, with a HEAD request, when the directory it lives in isn't
+ * cached: that's one small round trip instead of downloading the whole
+ * directory.  An expired copy of the directory is as good: revalidating
+ * it is a round trip of the same size (a 304 with no body), after which
+ * its other entries are fresh too.  Returns -1 if the directory is
+ * cached, or the object is missing or doesn't carry our metadata, in
+ * which case the caller goes through the directory instead.  The access
+ * and change times aren't stored on the object and read as the mtime.
+ */
+static int head_stat(s3context_t *ctx, const char *dir_path, const char *path,
+                     struct stat *statbuf) {
+    if (dircache_has(dir_path) || delq_pending(path)) {
+        return -1;
+    }
+    s3fs_meta_t meta;
+    int64_t size;
+    if (s3fs_head_object(ctx->s3bucket, path, &meta, &size) != 0 ||
+        meta.ino == 0) {
+        return -1;
+    }
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_ino = meta.ino;
+    statbuf->st_mode = meta.mode;
+    statbuf->st_nlink = 1;
+    statbuf->st_uid = meta.uid;
+    statbuf->st_gid = meta.gid;
+    statbuf->st_size = size;
+    statbuf->st_atime = meta.mtime;
+    statbuf->st_mtime = meta.mtime;
+    statbuf->st_ctime = meta.mtime;
+    dirty_stat(statbuf);
+    return 0;
+}
+
+/*
+ * Get the attributes of inode ino.
+ */
+static int inode_stat(s3context_t *ctx, fuse_ino_t ino, struct stat *statbuf) {
+    s3dir_t dir;
+    int rv;
+    if (ino == S3FS_ROOT_INO) {
+        if ((rv = load_dir(ctx, "/", &dir)) < 0) {
+            return rv;
+        }
+        s3dir_stat(&dir, 0, statbuf);
+        statbuf->st_ino = S3FS_ROOT_INO;
+        s3dir_free(&dir);
+        return 0;
+    }
+
+    uint64_t parent;
+    char *name = inode_name(ino, &parent);
+    if (!name) {
+        return -ESTALE;
+    }
+    char *dir_path = NULL;
+    int idx = -1;
+    rv = load_parent(ctx, parent, name, &dir, &dir_path, &idx);
+    free(name);
+    if (rv < 0) {
+        return rv;
+    }
+    rv = (idx > 0) ? entry_stat(ctx, &dir, dir_path, idx, statbuf) : -ENOENT;
+    s3dir_free(&dir);
+    free(dir_path);
+    return rv;
+}
+
+/*
+ * Tell the kernel about entry idx of directory parent, and take the
+ * lookup reference that goes with it.
+ */
+static void reply_entry(fuse_req_t req, fuse_ino_t parent, const char *name,
+                        char type, const struct stat *statbuf) {
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.ino = statbuf->st_ino;
+    e.attr = *statbuf;
+    e.attr_timeout = ctx->attr_timeout;
+    e.entry_timeout = ctx->entry_timeout;
+    if (inode_remember(e.ino, parent, name, type) < 0) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    fuse_reply_entry(req, &e);
+}
+
+/*
+ * Update the size and times recorded for file ino, named name in
+ * directory dir_path, whose lock the caller holds: the file was modified
+ * at mtime.  A negative newsize leaves the size alone.
+ */
+static int set_file_entry(s3context_t *ctx, const char *dir_path,
+                          const char *name, fuse_ino_t ino, off_t newsize,
+                          time_t mtime) {
+    s3dir_t dir;
+    int idx = -1;
+    int rv = load_entry(ctx, dir_path, name, &dir, &idx);
+    if (rv < 0) {
+        return rv;
+    }
+    if (idx < 0 || dir.ino[idx] != ino) {
+        rv = -ENOENT;
+    } else {
+        if (newsize >= 0) {
+            dir.size[idx] = newsize;
+        }
+        dir.atime[idx] = time(NULL);
+        dir.mtime[idx] = mtime;
+        rv = store_dir(ctx, dir_path, &dir);
+        // our own change goes through the kernel's page cache, so the
+        // pages it holds are still current
+        inode_same_version(ino, mtime, dir.size[idx]);
+    }
+    s3dir_free(&dir);
+    return rv;
+}
+
+/*
+ * Note that file ino was accessed.  That isn't worth a round trip to s3
+ * on its own: the time is only recorded in the cached copy of its
+ * directory, and goes out with the next store_dir of that.
+ */
+static void touch_file(fuse_ino_t ino) {
+    uint64_t parent;
+    char *name = inode_name(ino, &parent);
+    char *dir_path = name ? inode_path(parent, NULL) : NULL;
+    if (dir_path) {
+        dircache_touch(dir_path, name, time(NULL));
+    }
+    free(name);
+    free(dir_path);
+}
+
+/*
+ * Resize the file object at path to newsize bytes, zero filling, and give
+ * it metadata meta.
+ */
+static int truncate_object(s3context_t *ctx, const char *path, off_t newsize,
+                           const s3fs_meta_t *meta) {
+    uint8_t *buffer = NULL;
+    ssize_t old_size = get_object(ctx, path, &buffer, 0, 0);
+    if (old_size < 0)
+        return -EIO;
+
+    uint8_t *new_buff = calloc(newsize ? newsize : 1, 1);
+    if (!new_buff) {
+        free_object(buffer, old_size);
+        return -ENOMEM;
+    }
+    memcpy(new_buff, buffer, old_size < newsize ? old_size : newsize);
+    free_object(buffer, old_size);
+
+    ssize_t put = put_object(ctx, path, new_buff, newsize, meta);
+    free(new_buff);
+    return put < 0 ? -EIO : 0;
+}
+
+/*
+ * Write a buffered file back (the write-back flusher's callback): upload
+ * its contents, then record its new size and mtime in its directory.
+ * Both happen under the directory's lock, so that a rename or unlink of
+ * the file can't come in between.  The file goes wherever it is now,
+ * which may not be the path its data was buffered under; if the kernel
+ * has forgotten it (or it has been detached), that path is all we have.
+ * A file no longer listed there was removed, and its data is dropped.
+ */
+static int flush_file(void *arg, uint64_t ino, const char *path,
+                      const uint8_t *data, size_t len,
+                      const s3fs_meta_t *meta) {
+    s3context_t *ctx = (s3context_t *)arg;
+    char *dir_path, *name;
+    int rv = lock_entry_dir(ino, &dir_path, &name);
+    if (rv == -ESTALE) {
+        const char *slash = strrchr(path, '/');
+        dir_path = (slash == path) ? strdup("/") : strndup(path, slash - path);
+        name = strdup(slash + 1);
+        if (!dir_path || !name) {
+            free(dir_path);
+            free(name);
+            return -ENOMEM;
+        }
+        lock_dir(dir_path);
+        rv = 0;
+    }
+    if (rv < 0) {
+        return rv;
+    }
+    s3dir_t dir;
+    int idx = -1;
+    char *file_path = NULL;
+    if ((rv = load_entry(ctx, dir_path, name, &dir, &idx)) < 0) {
+        goto out;
+    }
+    int listed = (idx > 0 && dir.ino[idx] == ino);
+    s3dir_free(&dir);
+    if (!listed) {
+        goto out;   // unlinked or replaced since: the data went with it
+    }
+    file_path = child_path(dir_path, name);
+    if (!file_path) {
+        rv = -ENOMEM;
+    } else if (put_object(ctx, file_path, data, len, meta) < 0) {
+        rv = -EIO;
+    } else {
+        rv = set_file_entry(ctx, dir_path, name, ino, len, meta->mtime);
+    }
+
+out:
+    unlock_dir(dir_path);
+    free(file_path);
+    free(dir_path);
+    free(name);
+    return rv;
+}
+
 
 /* *************************************** */
 /*        Stage 1 callbacks                */
 /* *************************************** */
 
+/*
+ * The largest inode number in the tree under directory path.  This walks
+ * every directory, so it is only for a bucket that holds a file system
+ * but no checkpoint to say how far its inode numbers go.
+ */
+static uint64_t scan_max_ino(s3context_t *ctx, const char *path) {
+    s3dir_t dir;
+    if (load_dir(ctx, path, &dir) < 0) {
+        return 0;
+    }
+    uint64_t max = dir.ino[0];
+    for (int i = 1; i < dir.count; i++) {
+        uint64_t ino = dir.ino[i];
+        if (dir.type[i] == 'd') {
+            size_t len = strlen(path) + strlen(s3dir_name(&dir, i)) + 2;
+            char *child = malloc(len);
+            if (child) {
+                snprintf(child, len, "%s%s%s", path,
+                         strcmp(path, "/") == 0 ? "" : "/",
+                         s3dir_name(&dir, i));
+                uint64_t sub = scan_max_ino(ctx, child);
+                ino = (sub > ino) ? sub : ino;
+                free(child);
+            }
+        }
+        max = (ino > max) ? ino : max;
+    }
+    s3dir_free(&dir);
+    return max;
+}
+
+/*
+ * Cache a directory from the checkpoint's snapshot, to be revalidated
+ * when it is first used.
+ */
+static void seed_dir(void *arg, const char *path, const uint8_t *buf,
+                     size_t len, const s3fs_object_info_t *info) {
+    s3dir_t dir;
+    s3dir_init(&dir);
+    if (s3dir_decode(&dir, buf, len) == 0) {
+        dircache_seed(path, &dir, info);
+    }
+    s3dir_free(&dir);
+}
+
+/*
+ * Set up the root directory.  Normally the bucket is emptied first and
+ * the root created afresh; a persistent mount (-o persist) keeps what is
+ * there and carries on from its checkpoint, loading directories only as
+ * they are looked up.  It only creates a root in a bucket that has
+ * neither a root nor a checkpoint: if the root can't be read, or has gone
+ * missing from under a checkpoint, the mount fails rather than write an
+ * empty root over the tree.
+ */
+static void init_root(s3context_t *ctx) {
+    if (ctx->persist) {
+        int loaded = ckpt_load(ctx->s3bucket, seed_dir, ctx);
+        s3dir_t root;
+        int rv = load_dir(ctx, "/", &root);
+        if (rv == 0) {
+            s3dir_free(&root);
+            if (loaded < 0) {
+                fprintf(stderr, "fs_init --- no checkpoint; scanning the "
+                        "tree for inode numbers\n");
+                inode_reserve(scan_max_ino(ctx, "/"));
+            } else if (loaded == CKPT_RECOVERED) {
+                fprintf(stderr, "fs_init --- last mount wasn't unmounted "
+                        "cleanly; recovering from its checkpoint\n");
+            }
+            ckpt_start(ctx->checkpoint_interval);
+            return;
+        }
+        if (rv != -ENOENT || loaded >= 0) {
+            if (rv != -ENOENT) {
+                fprintf(stderr, "fs_init --- can't read the root directory: "
+                        "%s; not mounting\n", strerror(-rv));
+            } else {
+                fprintf(stderr, "fs_init --- the bucket has a checkpoint but "
+                        "no root directory; not mounting\n");
+            }
+            // and fs_destroy writes no checkpoint over the one we found
+            ctx->failed = 1;
+            fuse_session_exit(fuse_chan_session(ctx->ch));
+            return;
+        }
+    } else {
+        s3fs_clear_bucket(ctx->s3bucket);
+    }
+
+    s3dir_t root;
+    s3dir_init(&root);
+    s3dir_add(&root, 'd', ".", S3FS_ROOT_INO,
+              S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR, 0, time(NULL));
+    if (store_dir(ctx, "/", &root) < 0) {
+        fprintf(stderr, "fs_init --- failed to create root directory\n");
+    }
+    s3dir_free(&root);
+    if (ctx->persist) {
+        ckpt_start(ctx->checkpoint_interval);
+    }
+}
+
 /*
  * Initialize the file system.  This is called once upon
  * file system startup.
  */
-void *fs_init(struct fuse_conn_info *conn)
+void fs_init(void *userdata, struct fuse_conn_info *conn)
 {
     fprintf(stderr, "fs_init --- initializing file system.\n");
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    s3fs_clear_bucket(ctx->s3bucket);
-    
-    const char *key = "/";
-    time_t curr_time = time(NULL);
-    entry_t *root = (entry_t *)malloc(ENTRY_SIZE);
-    
-    root->type = 'd';
-    strncpy(root->name, ".", 1);
-    root->mode = (S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR);
-    root->links = 1;
-    root->uid = getuid();
-    root->gid = getgid();
-    root->atime = curr_time;
-    root->mtime = curr_time;
-    root->ctime = curr_time;
-    
-    int success = (int)s3fs_put_object(ctx->s3bucket, key, (uint8_t *)root, ENTRY_SIZE);       
-    printf("initialized / \n");
-    free(root);
-    if (success == -1)
-        return -EIO;
-    printf("PARTYYYYYYYYYYYY TIME!!!");
-    return ctx;
+    s3context_t *ctx = (s3context_t *)userdata;
+    mem_init((uint64_t)ctx->mem_limit << 20);
+    dir_locks_init();
+    dircache_init(DIRCACHE_TTL, DIRCACHE_MAX_DIRS);
+    if (cache_init((uint64_t)ctx->ram_cache_size << 20, ctx->cache_dir,
+                   (uint64_t)ctx->cache_size << 20) < 0) {
+        fprintf(stderr, "fs_init --- can't use cache directory %s\n",
+                ctx->cache_dir);
+    }
+    // under memory pressure, the RAM tier has a disk tier to fall back
+    // on, so it gives way before decoded directories do
+    mem_register_reclaim(cache_reclaim);
+    mem_register_reclaim(dircache_reclaim);
+    S3RequestTimeouts meta_timeouts = {
+        ctx->meta_connect_timeout, ctx->meta_first_byte_timeout,
+        ctx->meta_timeout, 0, 0
+    };
+    S3RequestTimeouts data_timeouts = {
+        ctx->data_connect_timeout, ctx->data_first_byte_timeout,
+        ctx->data_timeout, 0, 0
+    };
+    s3fs_set_handle_caches(ctx->handle_cache, ctx->handle_pool);
+    s3fs_set_http2(ctx->http2);
+    s3fs_set_timeouts(S3FS_METADATA, &meta_timeouts);
+    s3fs_set_timeouts(S3FS_DATA, &data_timeouts);
+    if (ctx->hedge) {
+        s3fs_set_hedging(ctx->hedge_percentile, ctx->hedge_budget);
+    }
+    // the root lookup below is the first request; have connections ready
+    warm_init(ctx->s3bucket, ctx->warm_connections, ctx->keepalive);
+    inode_table_init();
+    notify_init(ctx->ch);
+    async_init(ctx->async_requests);
+    wb_init(flush_file, ctx, ctx->dirty_age, (uint64_t)ctx->dirty_bytes << 20);
+    char log_path[BUFFERSIZE];
+    const char *delete_log = ctx->delete_log;
+    if (!delete_log && ctx->cache_dir) {
+        snprintf(log_path, sizeof(log_path), "%s/%s", ctx->cache_dir,
+                 DELETE_LOG_NAME);
+        delete_log = log_path;
+    }
+    delq_init(remove_objects, ctx, delete_log, ctx->async_requests);
+    // dirty data is only freed by writing it back, so it goes last
+    mem_register_reclaim(wb_reclaim);
+
+    // every write is a separate request into the write-back buffer, so
+    // take writes in as few pieces as the kernel allows
+    if (conn->capable & FUSE_CAP_BIG_WRITES) {
+        conn->want |= FUSE_CAP_BIG_WRITES;
+    }
+
+    init_root(ctx);
+}
+
+/*
+ * Clean up filesystem -- free any allocated data.
+ * Called once on filesystem exit.
+ */
+void fs_destroy(void *userdata) {
+    fprintf(stderr, "fs_destroy --- shutting down file system.\n");
+    warm_destroy();
+    wb_destroy();
+    delq_destroy();
+    async_destroy();
+    // everything is in s3 now
+    if (!((s3context_t *)userdata)->failed) {
+        ckpt_stop();
+    }
+
+    wb_stats_t wstats;
+    wb_stats(&wstats);
+    fprintf(stderr, "fs_destroy --- write-back: %lu writes, %lu files "
+            "(%llu bytes) written back, %lu failures, %lu retries\n",
+            wstats.writes, wstats.flushes,
+            (unsigned long long)wstats.flushed_bytes, wstats.errors,
+            wstats.retries);
+    ckpt_stats_t kstats;
+    ckpt_stats(&kstats);
+    if (kstats.writes || kstats.failures) {
+        fprintf(stderr, "fs_destroy --- checkpoints: %lu written (last "
+                "#%llu, %lu with deltas, %lu compactions), %lu failures, "
+                "%lu directories loaded\n", kstats.writes,
+                (unsigned long long)kstats.seq, kstats.deltas,
+                kstats.compactions, kstats.failures, kstats.dirs_loaded);
+    }
+    delq_stats_t qstats;
+    delq_stats(&qstats);
+    fprintf(stderr, "fs_destroy --- delete queue: %lu queued (%lu from an "
+            "earlier mount), %lu removed in %lu batches, %lu cancelled, "
+            "%lu failures\n",
+            qstats.queued, qstats.replayed, qstats.deleted, qstats.batches,
+            qstats.cancelled, qstats.errors);
+    dircache_stats_t stats;
+    dircache_stats(&stats);
+    fprintf(stderr, "fs_destroy --- directory cache: %lu hits, %lu misses, "
+            "%lu of %lu revalidations not modified (%llu bytes saved)\n",
+            stats.hits, stats.misses, stats.not_modified,
+            stats.revalidations, stats.bytes_saved);
+    cache_stats_t cstats;
+    cache_stats(&cstats);
+    unsigned long lookups = cstats.ram_hits + cstats.disk_hits + cstats.misses;
+    fprintf(stderr, "fs_destroy --- object cache: %lu RAM hits (%.1f%%), "
+            "%lu disk hits (%.1f%%), %lu misses, %lu promotions, "
+            "%lu demotions\n",
+            cstats.ram_hits, lookups ? 100.0 * cstats.ram_hits / lookups : 0.0,
+            cstats.disk_hits,
+            lookups ? 100.0 * cstats.disk_hits / lookups : 0.0,
+            cstats.misses, cstats.promotions, cstats.demotions);
+    fprintf(stderr, "fs_destroy --- %lu GETs joined one already in flight\n",
+            s3fs_coalesced_gets());
+    s3fs_hedge_stats_t hstats;
+    s3fs_hedge_stats(&hstats);
+    if (hstats.hedges || hstats.over_budget) {
+        fprintf(stderr, "fs_destroy --- hedged GETs: %lu of %lu (%lu "
+                "answered by the hedge), %lu over budget, delay %lld ms\n",
+                hstats.hedges, hstats.gets, hstats.wins, hstats.over_budget,
+                (long long)hstats.delay_ms);
+    }
+    S3RequestCacheStats rstats;
+    s3fs_handle_stats(&rstats);
+    fprintf(stderr, "fs_destroy --- request handles: %llu reused from the "
+            "thread's cache, %llu from the pool, %llu created, %llu "
+            "destroyed, %llu contended\n",
+            (unsigned long long)rstats.threadHits,
+            (unsigned long long)rstats.poolHits,
+            (unsigned long long)rstats.created,
+            (unsigned long long)rstats.destroyed,
+            (unsigned long long)rstats.contended);
+    warm_stats_t arstats;
+    warm_stats(&arstats);
+    fprintf(stderr, "fs_destroy --- warm connections: %lu opened at mount, "
+            "%lu keepalive rounds, %lu HEADs unanswered\n",
+            arstats.opened, arstats.refreshes, arstats.failures);
+    s3fs_window_stats_t wnstats;
+    s3fs_window_stats(&wnstats);
+    fprintf(stderr, "fs_destroy --- request window: %d now (max %d), "
+            "%lu increases, %lu cuts, %lu SlowDowns, %lu timeouts\n",
+            wnstats.window, wnstats.max_window, wnstats.increases,
+            wnstats.decreases, wnstats.slowdowns, wnstats.timeouts);
+    mem_stats_t mstats;
+    mem_stats(&mstats);
+    fprintf(stderr, "fs_destroy --- memory: peak %llu of %llu bytes, "
+            "%llu reclaimed from caches, %lu waits\n",
+            (unsigned long long)mstats.peak, (unsigned long long)mstats.limit,
+            (unsigned long long)mstats.reclaimed, mstats.waits);
+
+    notify_destroy();
+    dircache_destroy();
+    cache_destroy();
+    inode_table_destroy();
+    mem_destroy();
+}
+
+
+/*
+ * Look up a directory entry by name and get its attributes.  Each
+ * successful lookup takes a reference on the inode that the kernel
+ * hands back through forget.
+ */
+void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    fprintf(stderr, "fs_lookup(parent=%lu, name=\"%s\")\n", parent, name);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    // try the object's own metadata first if the parent isn't cached
+    struct stat statbuf;
+    char type;
+    char *dir_path = inode_path(parent, &type);
+    char *path = inode_child_path(parent, name);
+    int found = dir_path && path && type == 'd' && strcmp(name, ".") != 0 &&
+                strcmp(name, "..") != 0 &&
+                head_stat(ctx, dir_path, path, &statbuf) == 0;
+    free(dir_path);
+    free(path);
+    if (found) {
+        inode_reserve(statbuf.st_ino);
+        reply_entry(req, parent, name, S_ISDIR(statbuf.st_mode) ? 'd' : 'f',
+                    &statbuf);
+        return;
+    }
+
+    s3dir_t dir;
+    dir_path = NULL;
+    int idx = -1;
+    int rv = load_parent(ctx, parent, name, &dir, &dir_path, &idx);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+
+    rv = (idx > 0) ? entry_stat(ctx, &dir, dir_path, idx, &statbuf) : -ENOENT;
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+    } else {
+        reply_entry(req, parent, name, dir.type[idx], &statbuf);
+    }
+    s3dir_free(&dir);
+    free(dir_path);
+}
+
+
+/*
+ * Drop nlookup references to an inode.
+ */
+void fs_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    inode_forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+
+/*
+ * Get file attributes.  Similar to the stat() call
+ * (and uses the same structure).  The st_dev and st_blksize
+ * fields are ignored in the struct (and do not need to be
+ * filled in).
+ */
+void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_getattr(ino=%lu)\n", ino);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    struct stat statbuf;
+    int rv = -1;
+    if (ino != S3FS_ROOT_INO) {
+        uint64_t parent;
+        char *path = inode_path(ino, NULL);
+        char *name = inode_name(ino, &parent);
+        char *dir_path = name ? inode_path(parent, NULL) : NULL;
+        if (path && dir_path &&
+            head_stat(ctx, dir_path, path, &statbuf) == 0 &&
+            statbuf.st_ino == ino) {
+            rv = 0;
+        }
+        free(path);
+        free(name);
+        free(dir_path);
+    }
+    if (rv < 0) {
+        rv = inode_stat(ctx, ino, &statbuf);
+    }
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+    fuse_reply_attr(req, &statbuf, ctx->attr_timeout);
+}
+
+
+/*
+ * fs_setattr's changes to file ino, named name in directory dir_path,
+ * whose lock the caller holds.
+ */
+static int set_file_attr(s3context_t *ctx, fuse_ino_t ino,
+                         const char *dir_path, const char *name,
+                         const struct stat *attr, int to_set) {
+    char *path = child_path(dir_path, name);
+    if (!path) {
+        return -ENOMEM;
+    }
+    int rv = 0;
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        struct stat statbuf;
+        s3fs_meta_t meta;
+        time_t curr_time = time(NULL);
+        rv = inode_stat(ctx, ino, &statbuf);
+        if (rv == 0) {
+            stat_meta(&statbuf, &meta);
+            meta.mtime = curr_time;
+            rv = truncate_object(ctx, path, attr->st_size, &meta);
+        }
+        if (rv == 0) {
+            rv = set_file_entry(ctx, dir_path, name, ino, attr->st_size,
+                                curr_time);
+        }
+    }
+
+    // mode and times are plain columns of the directory record
+    if (rv == 0 && (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_ATIME |
+                              FUSE_SET_ATTR_MTIME))) {
+        s3dir_t dir;
+        int idx = -1;
+        rv = load_entry(ctx, dir_path, name, &dir, &idx);
+        if (rv == 0) {
+            if (idx < 0 || dir.ino[idx] != ino) {
+                rv = -ENOENT;
+            } else {
+                if (to_set & FUSE_SET_ATTR_MODE)
+                    dir.mode[idx] = S_IFREG | (attr->st_mode & 07777);
+                if (to_set & FUSE_SET_ATTR_ATIME)
+                    dir.atime[idx] = attr->st_atime;
+                if (to_set & FUSE_SET_ATTR_MTIME)
+                    dir.mtime[idx] = attr->st_mtime;
+                dir.ctime[idx] = time(NULL);
+                rv = store_dir(ctx, dir_path, &dir);
+            }
+            // keep the object's metadata headers in step (access
+            // times aren't among them)
+            if (rv == 0 &&
+                (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_MTIME))) {
+                s3fs_meta_t meta;
+                entry_meta(&dir, idx, &meta);
+                rv = s3fs_set_meta(ctx->s3bucket, path, &meta) < 0 ? -EIO : 0;
+            }
+            s3dir_free(&dir);
+        }
+    }
+    free(path);
+    return rv;
+}
+
+/*
+ * chmod and utime on the directory ino.  A directory's mode and times
+ * live in the "." entry of its own object, so that's what changes; the
+ * directory is locked under its current path, which a rename could
+ * change while we wait for the lock.
+ */
+static int set_dir_attr(s3context_t *ctx, fuse_ino_t ino,
+                        const struct stat *attr, int to_set) {
+    char *path;
+    for (;;) {
+        char type;
+        path = inode_path(ino, &type);
+        if (!path) {
+            return -ESTALE;
+        }
+        lock_dir(path);
+        char *path_now = inode_path(ino, &type);
+        int moved = !path_now || strcmp(path_now, path) != 0;
+        free(path_now);
+        if (!moved) {
+            break;
+        }
+        unlock_dir(path);
+        free(path);
+    }
+
+    s3dir_t dir;
+    int rv = load_dir(ctx, path, &dir);
+    if (rv == 0) {
+        if (to_set & FUSE_SET_ATTR_MODE)
+            dir.mode[0] = S_IFDIR | (attr->st_mode & 07777);
+        if (to_set & FUSE_SET_ATTR_ATIME)
+            dir.atime[0] = attr->st_atime;
+        if (to_set & FUSE_SET_ATTR_MTIME)
+            dir.mtime[0] = attr->st_mtime;
+        dir.ctime[0] = time(NULL);
+        rv = store_dir(ctx, path, &dir);
+        s3dir_free(&dir);
+    }
+    unlock_dir(path);
+    free(path);
+    return rv;
 }
 
 /*
- * Clean up filesystem -- free any allocated data.
- * Called once on filesystem exit.
+ * Set file attributes.  This covers truncate/ftruncate (a new size) on
+ * regular files, and chmod and utime on files and directories;
+ * ownership changes aren't supported.
  */
-void fs_destroy(void *userdata) {
-    fprintf(stderr, "fs_destroy --- shutting down file system.\n");
-    free(userdata);
-}
+void fs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+                struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_setattr(ino=%lu, to_set=0x%x)\n", ino, to_set);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    if (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
 
+    char type;
+    char *path = inode_path(ino, &type);
+    if (!path) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    free(path);
+    // the changes below go straight to s3, after any unwritten data
+    int rv = (type != 'd') ? wb_sync(ino) : 0;
+    if (type == 'd') {
+        if (to_set & FUSE_SET_ATTR_SIZE) {
+            rv = -EISDIR;
+        } else if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_ATIME |
+                             FUSE_SET_ATTR_MTIME)) {
+            rv = set_dir_attr(ctx, ino, attr, to_set);
+        }
+    } else if (rv == 0 && (to_set & (FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_MODE |
+                                     FUSE_SET_ATTR_ATIME |
+                                     FUSE_SET_ATTR_MTIME))) {
+        char *dir_path, *name;
+        rv = lock_entry_dir(ino, &dir_path, &name);
+        if (rv == 0) {
+            rv = set_file_attr(ctx, ino, dir_path, name, attr, to_set);
+            unlock_dir(dir_path);
+            free(dir_path);
+            free(name);
+        }
+    }
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
 
-/* 
- * Get file attributes.  Similar to the stat() call
- * (and uses the same structure).  The st_dev, st_blksize,
- * and st_ino fields are ignored in the struct (and 
- * do not need to be filled in).
- */
-
-int fs_getattr(const char *path, struct stat *statbuf) {
-    fprintf(stderr, "fs_getattr(path=\"%s\")\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    
-    char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));
-
-    entry_t *buffer = NULL;    
-    
-    int success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&buffer, 0, 0);
-    if(success < 0)
-    {
-        printf(stderr, "directory %s does not exist\n", path_name);
-        return -ENOENT;
+    struct stat statbuf;
+    rv = inode_stat(ctx, ino, &statbuf);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
     }
-    
-    int num_entries = success/ENTRY_SIZE;
-    entry_t * curr_dir = (entry_t *) buffer;
-    free(buffer);
-    
-    int i = 0;
-    for(; i < num_entries; i++)
-    {
-        if(0 == strncmp(curr_dir[i].name, base_name, 256))
-        {
-            if(curr_dir[i].type == 'f')
-            {       
-				statbuf->st_dev = 0;
-				statbuf->st_ino = 0;
-                statbuf->st_mode = curr_dir[i].mode;
-                statbuf->st_nlink = curr_dir[i].links;
-                statbuf->st_uid = curr_dir[i].uid;
-                statbuf->st_gid = curr_dir[i].gid;
-                statbuf->st_rdev = 0;
-                statbuf->st_size = curr_dir[i].size;
-				statbuf->st_blksize = 0;
-				statbuf->st_blocks = 0;
-                statbuf->st_atime = curr_dir[i].atime;
-                statbuf->st_mtime = curr_dir[i].mtime;
-                statbuf->st_ctime = curr_dir[i].ctime;
-                return 0; //success!
-            }
-            else if(curr_dir[i].type == 'd')
-            {
-                success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)buffer, 0, ENTRY_SIZE);
-                if(success < 0)
-                {
-                    printf(stderr, "directory %s does not exist\n", base_name);
-                    return -ENOENT;
-                }
-
-                entry_t *dot = (entry_t *)buffer;
-                free(buffer);
-
-                statbuf->st_dev = 0;
-				statbuf->st_ino = 0;
-                statbuf->st_mode = dot[0].mode;
-                statbuf->st_nlink = dot[0].links;
-                statbuf->st_uid = dot[0].uid;
-                statbuf->st_gid = dot[0].gid;
-                statbuf->st_rdev = 0;
-                statbuf->st_size = dot[0].size;
-				statbuf->st_blksize = 0;
-				statbuf->st_blocks = 0;
-                statbuf->st_atime = dot[0].atime;
-                statbuf->st_mtime = dot[0].mtime;
-                statbuf->st_ctime = dot[0].ctime;
-                return 0; //success!
-            }
-        } 
-    } 
-    return -EIO;
+    fuse_reply_attr(req, &statbuf, ctx->attr_timeout);
 }
 
+
 /*
  * Open directory
  *
  * This method should check if the open operation is permitted for
  * this directory
+ *
+ * We only fetch the "." entry here (unless the whole directory is
+ * already cached), to learn how many entries fs_readdir will page
+ * through; that count is kept in a s3dirhandle_t in fi->fh.
  */
-int fs_opendir(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "\n******fs_opendir(path=\"%s\")*******\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    
-    char type = entry_type(path);
-    if(type == 'z')
-        return -ENOENT;
-    if(type == 'd')
-        return -EISDIR;
- 
-    char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));    
-
-    entry_t *buffer = NULL;
-    int success = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-    if (success < 0)
-    {
-        free(buffer);
-    	return -EIO;
-    }
-    
-    //reset access time
-    time_t curr_time = time(NULL);
-    buffer[0].atime = curr_time;
-
-    //put directory back into the bucket
-    int overwrite = (int)s3fs_put_object(ctx->s3bucket, path, (uint8_t *)buffer, success);
-    if (overwrite < 0)
-    {
-        free(buffer);
-        printf("fs_opendir(path=\"%s\" error trying to put directory back into the bucket)\n", path);
-        return -EIO;
+void fs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_opendir(ino=%lu)\n", ino);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    char type;
+    char *path = inode_path(ino, &type);
+    if (!path) {
+        fuse_reply_err(req, ESTALE);
+        return;
     }
-    free(buffer);
-	printf("\n*****got through opendir******");
-	return 0;
+    if (type != 'd') {
+        free(path);
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    s3dirhandle_t *dh = calloc(1, sizeof(s3dirhandle_t));
+    if (!dh) {
+        free(path);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    s3dir_t dir;
+    if (dircache_get(path, &dir) == 0) {
+        dh->count = dir.count;
+        //reset access time
+        dircache_touch(path, ".", time(NULL));
+    } else {
+        int rv = load_dir_page(ctx, path, 0, 1, &dir);
+        if (rv < 0) {
+            free(path);
+            free(dh);
+            fuse_reply_err(req, -rv);
+            return;
+        }
+        dh->count = dir.size[0] / ENTRY_SIZE;
+    }
+    s3dir_free(&dir);
+    free(path);
+
+    fi->fh = (uint64_t)(uintptr_t)dh;
+    fuse_reply_open(req, fi);
+}
+
+
+/*
+ * Note that entry idx, with inode number ino, went into a readdir reply
+ * (or was next in line).  Without memory to spare we just don't, and
+ * resuming after it falls back on its position.
+ */
+static void mark_entry(s3dirhandle_t *dh, int idx, uint64_t ino) {
+    if (dh->num_marks == dh->marks_cap) {
+        int cap = dh->marks_cap ? dh->marks_cap * 2 : 64;
+        s3dirmark_t *tmp = realloc(dh->marks, cap * sizeof(s3dirmark_t));
+        if (!tmp) {
+            return;
+        }
+        dh->marks = tmp;
+        dh->marks_cap = cap;
+    }
+    dh->marks[dh->num_marks].idx = idx;
+    dh->marks[dh->num_marks].ino = ino;
+    dh->num_marks++;
+}
+
+/*
+ * Add entries [from, dir->count) of dir to the reply buffer buf, which
+ * already holds *len of its size bytes, and mark them in dh.  base is the
+ * index of dir's first entry within the whole directory object, which is
+ * what the offsets are computed from.  Returns nonzero once buf is full.
+ */
+static int fill_entries(fuse_req_t req, s3dirhandle_t *dh, char *buf,
+                        size_t size, size_t *len, const s3dir_t *dir,
+                        int base, int from) {
+    struct stat statbuf;
+    int i = from;
+    for (; i < dir->count; i++) {
+        s3dir_stat(dir, i, &statbuf);
+        size_t need = fuse_add_direntry(req, buf + *len, size - *len,
+                                        s3dir_name(dir, i), &statbuf,
+                                        base + i + 2);
+        mark_entry(dh, base + i, dir->ino[i]);
+        if (need > size - *len) {
+            return 1;
+        }
+        *len += need;
+    }
+    return 0;
+}
+
+/*
+ * Where to carry on reading the directory at path after the entry with
+ * offset cookie offset.  A cookie is the entry's position in the
+ * directory object, and removing an entry moves everything after it one
+ * place towards the start.  So if the cookie came from the last reply, we
+ * look for the entry it was handed out for, or failing that (it was
+ * removed, as when rm -r empties a directory while reading it) for the
+ * first entry after it that we handed out or had next in line, where they
+ * are now.  whole is the directory, or NULL if it is read in pages.
+ */
+static int resume_index(s3context_t *ctx, const char *path,
+                        const s3dirhandle_t *dh, const s3dir_t *whole,
+                        off_t offset) {
+    int k = 0;
+    while (k < dh->num_marks && dh->marks[k].idx + 2 != offset) {
+        k++;
+    }
+    if (k == dh->num_marks) {
+        return (int)offset - 1;
+    }
+
+    // entries don't move further than a page between two calls, or we
+    // give up and go by position
+    int oldest = dh->marks[k].idx, newest = dh->marks[dh->num_marks - 1].idx;
+    int base = whole ? 0 : oldest - READDIR_PAGE_ENTRIES;
+    if (base < 0) {
+        base = 0;
+    }
+    s3dir_t page;
+    const s3dir_t *dir = whole;
+    if (!whole) {
+        if (load_dir_page(ctx, path, base, newest - base + 1, &page) < 0) {
+            return (int)offset - 1;
+        }
+        dir = &page;
+    }
+    int first = (int)offset - 1;
+    for (int m = k; m < dh->num_marks; m++) {
+        int i = dh->marks[m].idx - base;
+        int stop = i - READDIR_PAGE_ENTRIES;
+        if (i >= dir->count) {
+            i = dir->count - 1;
+        }
+        while (i >= 0 && i >= stop && dir->ino[i] != dh->marks[m].ino) {
+            i--;
+        }
+        if (i >= 0 && i >= stop) {
+            first = base + i + (m == k ? 1 : 0);
+            break;
+        }
+    }
+    if (!whole) {
+        s3dir_free(&page);
+    }
+    return first;
 }
 
 
 /*
- * Read directory.  See the project description for how to use the filler
- * function for filling in directory items.
+ * Read directory.
+ *
+ * We hand the kernel full attributes out of the directory records, and
+ * use the offset interface so a large directory is returned over several
+ * calls: offset 1 is "..", and entry i of the directory object is offset
+ * i + 2 when it is handed out.  Positions shift as entries are removed,
+ * so resume_index works out where a later call carries on.  Unless the
+ * directory is cached or small, entries are streamed in pages of
+ * READDIR_PAGE_ENTRIES with ranged GETs, starting at the requested
+ * offset, so neither the time to the first entry nor memory use depends
+ * on how big the directory is.
  */
-int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
-         struct fuse_file_info *fi)
+void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                struct fuse_file_info *fi)
 {
-    fprintf(stderr, "\n******fs_readdir(path=\"%s\", buf=%p, offset=%d)*******\n",
-          path, buf, (int)offset);
-    s3context_t *ctx = GET_PRIVATE_DATA;
+    fprintf(stderr, "fs_readdir(ino=%lu, size=%d, offset=%d)\n",
+            ino, (int)size, (int)offset);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+    s3dirhandle_t *dh = (s3dirhandle_t *)(uintptr_t)fi->fh;
+
+    char *path = inode_path(ino, NULL);
+    char *buf = malloc(size);
+    if (!path || !buf) {
+        free(path);
+        free(buf);
+        fuse_reply_err(req, path ? ENOMEM : ESTALE);
+        return;
+    }
+    size_t len = 0;
+    int first = 0;
+
+    if (offset < 1) {
+        struct stat statbuf;
+        memset(&statbuf, 0, sizeof(struct stat));
+        statbuf.st_mode = S_IFDIR;
+        len = fuse_add_direntry(req, buf, size, "..", &statbuf, 1);
+        if (len > size) {
+            len = 0;
+            goto reply;
+        }
+        offset = 1;
+    }
 
-    char type = entry_type(path);
-    if(type == 'z')
-        return -ENOENT;
-    if(type == 'd')
-        return -EISDIR;
-    
-    entry_t *buffer = NULL;
-
-    int success = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-    if (success < 0)
-    {
-        free(buffer);
-        return -EIO;
+    s3dir_t dir;
+    int whole = (dircache_get(path, &dir) == 0);
+    if (!whole && dh->count <= READDIR_PAGE_ENTRIES) {
+        // small enough for one GET, which also primes the directory
+        // cache for the lookups that usually follow
+        int rv = load_dir(ctx, path, &dir);
+        if (rv < 0) {
+            free(path);
+            free(buf);
+            fuse_reply_err(req, -rv);
+            return;
+        }
+        whole = 1;
+    }
+    first = (offset > 1) ?
+            resume_index(ctx, path, dh, whole ? &dir : NULL, offset) : 0;
+    dh->num_marks = 0;
+    if (whole) {
+        fill_entries(req, dh, buf, size, &len, &dir, 0, first);
+        s3dir_free(&dir);
+        goto reply;
     }
 
-	int num_entries = (int)success/ENTRY_SIZE;
-	entry_t *entries = (entry_t *)buffer;
-	int i = 0;
-	for (; i < num_entries; i++)
-	{
-		if (filler(buf, entries[i].name, NULL, 0) != 0)
-		{
-			free(buffer);
-			return -ENOMEM;
-		}
-	}
-
-	time_t curr_time = time(NULL);
-    entries[0].atime = curr_time;
-    success = (int)s3fs_put_object(ctx->s3bucket, path, (uint8_t *)entries, (ssize_t)success);
-    if(success < 0)
-        return -EIO;
+    while (first < dh->count) {
+        int want = dh->count - first;
+        if (want > READDIR_PAGE_ENTRIES) {
+            want = READDIR_PAGE_ENTRIES;
+        }
+        int got = load_dir_page(ctx, path, first, want, &dir);
+        if (got < 0 && first > 0) {
+            // entries may have been removed since the directory was
+            // opened, leaving nothing at first
+            got = load_dir_page(ctx, path, 0, 1, &dir);
+            if (got > 0) {
+                dh->count = dir.size[0] / ENTRY_SIZE;
+                s3dir_free(&dir);
+                got = (first >= dh->count) ? 0 : -EIO;
+            }
+        }
+        if (got <= 0) {
+            if (got < 0 && len == 0) {
+                free(path);
+                free(buf);
+                fuse_reply_err(req, -got);
+                return;
+            }
+            break;
+        }
+        int full = fill_entries(req, dh, buf, size, &len, &dir, first, 0);
+        s3dir_free(&dir);
+        if (full || got < want) {
+            break;
+        }
+        first += got;
+    }
 
-	free(buffer);
-	printf("\n*****got through readdir*****");
-	return 0; 
+reply:
+    fuse_reply_buf(req, buf, len);
+    free(path);
+    free(buf);
 }
 
 
 /*
  * Release directory.
  */
-int fs_releasedir(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "\n******fs_releasedir(path=\"%s\")******\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;/*
-    uint8_t *buffer = NULL;
-    ssize_t success = 0;
-    success = s3fs_get_object(ctx->s3bucket, path, &buffer, 0, 0);
-    free(buffer);    
-    if (success < 0)
-        return -ENOENT;
-	printf("\n******got through releasedir*******\n"); */
-    return 0;
+void fs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_releasedir(ino=%lu)\n", ino);
+    s3dirhandle_t *dh = (s3dirhandle_t *)(uintptr_t)fi->fh;
+    free(dh->marks);
+    free(dh);
+    fi->fh = 0;
+    fuse_reply_err(req, 0);
 }
 
 
-/* 
+/*
  * Create a new directory.
  *
  * Note that the mode argument may not have the type specification
@@ -279,197 +1665,130 @@ int fs_releasedir(const char *path, struct fuse_file_info *fi) {
  * correct directory type bits (for setting in the metadata)
  * use mode|S_IFDIR.
  */
-int fs_mkdir(const char *path, mode_t mode) {
-    fprintf(stderr, "fs_mkdir(path=\"%s\", mode=0%3o)\n", path, mode);
-    s3context_t *ctx = GET_PRIVATE_DATA;
+void fs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    fprintf(stderr, "fs_mkdir(parent=%lu, name=\"%s\", mode=0%3o)\n",
+            parent, name, mode);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
     mode |= S_IFDIR;
-    
-    entry_t *buffer = NULL;
-    ssize_t success = s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-    if(success >=  0)
-    {
-		free(buffer);
-        return -EEXIST;
-    } 
-	free(buffer);
-
-    char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));
-    
-    success = s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&buffer, 0, 0);
-	int num_entries = success/ENTRY_SIZE;
-	entry_t * new_parent = (entry_t *)malloc(success + ENTRY_SIZE);
-	entry_t *old_parent = (entry_t *)buffer;
-	free(buffer);
-
-	int i = 0;
-	for(; i < num_entries; i++)
-	{
-		//copy old entries over
-		new_parent[i] = old_parent[i];
-    }
-	//reset size of parent directory, alter times
+
+    s3dir_t dir;
+    char *dir_path = NULL;
+    int idx = -1;
+    int rv = lock_parent(ctx, parent, name, &dir, &dir_path, &idx);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+    char *path = inode_child_path(parent, name);
+    if (idx >= 0) {
+        rv = -EEXIST;
+        goto out;
+    }
+
+    uint64_t ino = new_ino();
     time_t curr_time = time(NULL);
-    new_parent[0].size = (num_entries + 1)*ENTRY_SIZE;
-    new_parent[0].atime = curr_time;
-    new_parent[0].mtime = curr_time;
-	//create new entry
-	strncpy(new_parent[i].name, base_name, 256);
-	new_parent[i].type = 'd';
-	
-	success = (int)s3fs_put_object(ctx->s3bucket, path_name, (uint8_t *)new_parent, success + ENTRY_SIZE);
-	free(new_parent);
-    if(success < 0)
-	{
-		return -EIO;
-	}
-	
-	entry_t *new_dir = (entry_t *)malloc(ENTRY_SIZE);
-	strncpy(new_dir[0].name, ".", 256);
-	new_dir[0].type = 'd';
-	new_dir[0].mode = (S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR);
-    new_dir[0].links = 1;
-    new_dir[0].uid = getuid();
-    new_dir[0].gid = getgid();
-    new_dir[0].size =  ENTRY_SIZE;
-    new_dir[0].atime = curr_time;
-    new_dir[0].mtime = curr_time;
-    new_dir[0].ctime = curr_time;
-
-	success = (int)s3fs_put_object(ctx->s3bucket, path, (uint8_t *)new_dir, ENTRY_SIZE);
-    free(new_dir);
-	if(success < 0)
-		return -EIO;
-
-    //return success
-	printf("\n*******got through mkdir******\n");
-    return 0;
+    idx = s3dir_add(&dir, 'd', name, ino, mode, 0, curr_time);
+    if (idx < 0 || !path) {
+        rv = -ENAMETOOLONG;
+        goto out;
+    }
+    dir.atime[0] = curr_time;
+    dir.mtime[0] = curr_time;
+
+    s3dir_t new_dir;
+    s3dir_init(&new_dir);
+    s3dir_add(&new_dir, 'd', ".", ino, mode, 0, curr_time);
+    rv = store_dir(ctx, path, &new_dir);
+    s3dir_free(&new_dir);
+    if (rv == 0) {
+        rv = store_dir(ctx, dir_path, &dir);
+    }
+    if (rv == 0) {
+        struct stat statbuf;
+        s3dir_stat(&dir, idx, &statbuf);
+        reply_entry(req, parent, name, 'd', &statbuf);
+    }
+
+out:
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+    }
+    s3dir_free(&dir);
+    unlock_dir(dir_path);
+    free(dir_path);
+    free(path);
 }
 
 
 /*
- * Remove a directory. 
+ * Check that the directory at path has nothing in it but ".": returns 0,
+ * -ENOTEMPTY, or an error from loading it.
  */
-int fs_rmdir(const char *path) {
-    fprintf(stderr, "fs_rmdir(path=\"%s\")\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    entry_t *buffer = NULL;
-    int success = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-    if (success < 0)
-    {
-        free(buffer);
-        return -ENOENT;
-    }
-
-    //check type
-    if (entry_type(path) != 'd')
-    {
-        free(buffer);
-        printf("fs_rmdir(path=\"%s\" is not a directory)\n", path);
-        return -ENOTDIR;
+static int check_empty(s3context_t *ctx, const char *path) {
+    s3dir_t dir;
+    int rv = load_dir(ctx, path, &dir);
+    if (rv < 0) {
+        return rv;
     }
+    rv = (dir.count > 1) ? -ENOTEMPTY : 0;
+    s3dir_free(&dir);
+    return rv;
+}
 
-    //check if the directory is empty
-    if (success != ENTRY_SIZE)     //directory not empty
-    {
-        printf("fs_rmdir(path=\"%s\" is not empty)\n", path);
-        free(buffer);
-        return -EIO;
+/*
+ * Remove a directory.
+ */
+void fs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    fprintf(stderr, "fs_rmdir(parent=%lu, name=\"%s\")\n", parent, name);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    s3dir_t dir;
+    char *dir_path = NULL;
+    int idx = -1;
+    int rv = parent_path(parent, &dir_path);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
     }
-    free(buffer);
-    
-    //remove directory
-    if(s3fs_remove_object(ctx->s3bucket, path) != 0)
-    {
-        printf("fs_rmdir(path=\"%s\" error while trying to remove directory)\n",path);
-        return -EIO;
+    // nothing may be added to the directory while we check that it's empty
+    char *path = inode_child_path(parent, name);
+    const char *locked[] = { dir_path, path };
+    lock_dirs(locked, 2);
+    if ((rv = load_entry(ctx, dir_path, name, &dir, &idx)) < 0) {
+        unlock_dirs(locked, 2);
+        fuse_reply_err(req, -rv);
+        free(dir_path);
+        free(path);
+        return;
     }
-    printf("fs_rmdir(path=\"%s\" Directory was successfully removed)\n", path);
-    const char *path_name = dirname(strdup(path));
-    const char *base_name = basename(strdup(path));
-    entry_t *parent = NULL;
-    int parent_size = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&parent, 0, 0);
-    if (parent_size < 0)
-    {
-        printf(stderr, "fs_rmdir(path=\"%s\" could not get parent directory)\n", path_name);
-        return -EIO;
+    if (idx < 0 || dir.type[idx] != 'd' || !path) {
+        rv = (idx < 0 || !path) ? -ENOENT : -ENOTDIR;
+        goto out;
     }
 
-    int num_entries = parent_size / ENTRY_SIZE;
-    int new_size = ENTRY_SIZE * (num_entries - 1);
-    entry_t *new_parent = (entry_t *)malloc(new_size);
-    parent = (entry_t *)parent;
-    
-    //transfer parent directory info to new_parent directory while leaving out the removed directory
-    int j = 1;
-    int i = 0;
-    for (; i < num_entries; i++)
-    {
-        if (strcmp(parent[i].name, base_name) == 0)
-        {
-            if (j != num_entries)
-            {
-                while (j < num_entries)
-                {
-                    new_parent[i] = parent[j]; //copying next index of old parent to current
-                    i++;                             //index of new parent
-                    j++;
-                }
-            }
-            break;
-        }
-        new_parent[i] = parent[i];  //copies old parent entry to new parent entry
-        j++;
+    if ((rv = check_empty(ctx, path)) < 0) {
+        goto out;
     }
-    free(parent);
-    
-    //change the size in the metadata for the new parent
-    new_parent[0].size = new_size;
 
-    //adjust last access and modification time of parent directory
+    // once the parent no longer lists it, the object can go at leisure
+    uint64_t ino = dir.ino[idx];
     time_t curr_time = time(NULL);
-    new_parent[0].atime = curr_time;
-    new_parent[0].mtime = curr_time;
-    
-    //put new_parent back into the bucket
-    success = (int)s3fs_put_object(ctx->s3bucket, path_name, (uint8_t *)new_parent, new_size);
-    if (success < 0)
-    {
-        printf(stderr, "fs_rmdir(path=\"%s\" Error passing new parent into bucket)\n", path_name);
-        return -EIO;
-    }   
-    return 0;
-}
+    s3dir_remove(&dir, idx);
+    dir.atime[0] = curr_time;
+    dir.mtime[0] = curr_time;
+    if ((rv = store_dir(ctx, dir_path, &dir)) == 0) {
+        inode_detach(ino);
+        dircache_invalidate(path);
+        ckpt_forget_dir(path);
+        queue_remove(ctx, path);
+    }
 
-char entry_type(const char *path)
-{
-	s3context_t *ctx = GET_PRIVATE_DATA;
-	
-	char ret_val = 'z';
-	entry_t *buffer = NULL;	
-	int success = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-	if(success < 0)
-	{
-		free(buffer);
-		return ret_val;
-	}	
-
-	char *path_name = dirname(strdup(path));
-	char *base_name = basename(strdup(path));
-
-	success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&buffer, 0, 0);
-	int num_entries = success/(int)ENTRY_SIZE;
-
-	int i = 0;
-	for(;i < num_entries; i++)
-	{
-		if(0 == strncmp(buffer[i].name, base_name, 256))
-		{		
-			ret_val = buffer[i].type;
-			return ret_val;		
-		}	
-	}
-	return ret_val;
+out:
+    fuse_reply_err(req, -rv);
+    s3dir_free(&dir);
+    unlock_dirs(locked, 2);
+    free(dir_path);
+    free(path);
 }
 
 /* *************************************** */
@@ -477,163 +1796,173 @@ char entry_type(const char *path)
 /* *************************************** */
 
 
-/* 
+/*
  * Create a file "node".  When a new file is created, this
- * function will get called.  
+ * function will get called.
  * This is called for creation of all non-directory, non-symlink
  * nodes.  You *only* need to handle creation of regular
  * files here.  (See the man page for mknod (2).)
  */
-int fs_mknod(const char *path, mode_t mode, dev_t dev) {
-    fprintf(stderr, "fs_mknod(path=\"%s\", mode=0%3o)\n", path, mode);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-	
-	uint8_t *buffer = NULL;
-	int success = (int)s3fs_get_object(ctx->s3bucket, path, &buffer, 0, 0);
-	if(success >= 0)
-		return -EEXIST;
-	
-	char *path_name = dirname(strdup(path));
-	char *file_name = basename(strdup(path));
-
-	success = (int)s3fs_get_object(ctx->s3bucket, path_name, &buffer, 0, 0);
-	if(success < 0)
-		return -EIO;
-
-	//update the directory
-	int num_entries = success/ENTRY_SIZE;
-	entry_t *new_dir = (entry_t *)malloc((num_entries + 1)*ENTRY_SIZE);
-	entry_t *old_dir = (entry_t *)buffer;
-	free(buffer);
-		
-	int i = 0;
-	for(;i < num_entries; i++)
-	{
-		new_dir[i] = old_dir[i];
-	}
-
-	time_t curr_time = time(NULL);
-	new_dir[0].size = ENTRY_SIZE*(num_entries + 1);
-	new_dir[0].atime = curr_time;
-	new_dir[0].mtime = curr_time;
-
-	strncpy(new_dir[i].name, file_name, 256);
-	new_dir[i].type = 'f';
-	new_dir[i].mode = mode;
-	new_dir[i].links = 1;
-	new_dir[i].uid = getuid();
-	new_dir[i].gid = getgid();
-	new_dir[i].size = 0;
-	new_dir[i].atime = curr_time;
-	new_dir[i].mtime = curr_time;
-	new_dir[i].ctime = curr_time;
-
-	uint8_t *blob_new_dir = (uint8_t *) new_dir;
-	free(new_dir);
-	success = (int)s3fs_put_object(ctx->s3bucket, path_name, blob_new_dir, sizeof(blob_new_dir));
-	if(success < 0)
-		return -EIO;
- 
-	//s3 the file
-	success = (int)s3fs_put_object(ctx->s3bucket, file_name, NULL, 0);
-	if(success < 0)
-    	return -EIO;
-	return 0;
-}
-
-
-/* 
+void fs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+              mode_t mode, dev_t rdev) {
+    fprintf(stderr, "fs_mknod(parent=%lu, name=\"%s\", mode=0%3o)\n",
+            parent, name, mode);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+    if (!S_ISREG(mode)) {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
+
+    s3dir_t dir;
+    char *dir_path = NULL;
+    int idx = -1;
+    int rv = lock_parent(ctx, parent, name, &dir, &dir_path, &idx);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+    char *path = inode_child_path(parent, name);
+    if (idx >= 0) {
+        rv = -EEXIST;
+        goto out;
+    }
+
+    time_t curr_time = time(NULL);
+    idx = s3dir_add(&dir, 'f', name, new_ino(), mode, 0, curr_time);
+    if (idx < 0 || !path) {
+        rv = -ENAMETOOLONG;
+        goto out;
+    }
+    dir.atime[0] = curr_time;
+    dir.mtime[0] = curr_time;
+
+    //s3 the file
+    s3fs_meta_t meta;
+    entry_meta(&dir, idx, &meta);
+    if (put_object(ctx, path, NULL, 0, &meta) < 0) {
+        rv = -EIO;
+    } else {
+        rv = store_dir(ctx, dir_path, &dir);
+    }
+    if (rv == 0) {
+        struct stat statbuf;
+        s3dir_stat(&dir, idx, &statbuf);
+        reply_entry(req, parent, name, 'f', &statbuf);
+    }
+
+out:
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+    }
+    s3dir_free(&dir);
+    unlock_dir(dir_path);
+    free(dir_path);
+    free(path);
+}
+
+
+/*
  * File open operation
  * No creation, or truncation flags (O_CREAT, O_EXCL, O_TRUNC)
  * will be passed to open().  Open should check if the operation
- * is permitted for the given flags.  
- * 
- * Optionally open may also return an arbitrary filehandle in the 
+ * is permitted for the given flags.
+ *
+ * Optionally open may also return an arbitrary filehandle in the
  * fuse_file_info structure (fi->fh).
  * which will be passed to all file operations.
- * (In stages 1 and 2, you are advised to keep this function very,
- * very simple.)
- */
-int fs_open(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_open(path\"%s\")\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-
-	char type = entry_type(path);
-	if(type == 'z')
-		return -ENOENT;
-	if(type == 'd')
-		return -EISDIR;
-
-    entry_t *buffer = NULL;
-	char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));
-    
-    int success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&buffer, 0, 0);
-	if(success < 0)
-		return -EIO;
-	int num_entries = sizeof(buffer)/(int)ENTRY_SIZE;
-
-	time_t curr_time = time(NULL);
-	int i = 0;
-	for(;i < num_entries; i++)
-	{
-		if(0 == strncmp(buffer[i].name, base_name, 256))
-			buffer[i].atime = curr_time;
-	}	
-	
-    int overwrite = (int)s3fs_put_object(ctx->s3bucket, path_name, (uint8_t *)buffer, success);
-    free(buffer);
-    if (overwrite < 0)
-        return -EIO;
-    return 0;   //file is in the bucket! yay!
+ */
+void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_open(ino=%lu)\n", ino);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    char type;
+    char *path = inode_path(ino, &type);
+    if (!path) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    free(path);
+    if (type == 'd') {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+
+    struct stat statbuf;
+    int rv = inode_stat(ctx, ino, &statbuf);
+    if (rv == 0) {
+        touch_file(ino);
+    }
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+
+    // with kernel_cache, pages cached from an earlier open are kept as
+    // long as the object hasn't changed since then
+    int same = inode_same_version(ino, statbuf.st_mtime, statbuf.st_size);
+    fi->keep_cache = ctx->kernel_cache && same;
+    fuse_reply_open(req, fi);
 }
 
 
-/* 
+/*
  * Read data from an open file
  *
  * Read should return exactly the number of bytes requested except
  * on EOF or error, otherwise the rest of the data will be
- * substituted with zeroes.  
- */
-int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_read(path=\"%s\", buf=%p, size=%d, offset=%d)\n",
-          path, buf, (int)size, (int)offset);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-	
-	char type = entry_type(path);
-	if(type == 'z')
-		return -ENOENT;
-	if(type == 'd')
-		return -EISDIR;
-
-    int ret_val = (int)s3fs_get_object(ctx->s3bucket, path, &buf, (ssize_t)offset, size);
-	if(ret_val < 0)
-		return -EIO;	
-
-    entry_t *buffer = NULL;
-	char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));
-    
-    int success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&buffer, 0, 0);
-	if(success < 0)
-		return -EIO;
-	int num_entries = success/ENTRY_SIZE;
-    buffer = (entry_t *)buffer;
-
-	time_t curr_time = time(NULL);
-	int i = 0;
-	for(;i < num_entries; i++)
-	{
-		if(0 == strncmp(buffer[i].name, base_name, 256))
-			buffer[i].atime = curr_time;
-	}	
-	success = (int)s3fs_put_object(ctx->s3bucket, path_name, (uint8_t *)buffer, (ssize_t)success);		
-    free(buffer);
-    if (success < 0)
-        return -EIO;
+ * substituted with zeroes.
+ */
+void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+             struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_read(ino=%lu, size=%d, offset=%d)\n",
+            ino, (int)size, (int)offset);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    // unwritten data is newer than anything on s3
+    char *dirty = malloc(size ? size : 1);
+    ssize_t got_dirty = dirty ? wb_read(ino, dirty, size, offset) : -1;
+    if (got_dirty >= 0) {
+        fuse_reply_buf(req, dirty, got_dirty);
+        free(dirty);
+        touch_file(ino);
+        return;
+    }
+    free(dirty);
+
+    struct stat statbuf;
+    int rv = inode_stat(ctx, ino, &statbuf);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+    if (S_ISDIR(statbuf.st_mode)) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+    if (offset >= statbuf.st_size || size == 0) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (offset + (off_t)size > statbuf.st_size)
+        size = statbuf.st_size - offset;
 
-    return ret_val;
+    char *path = inode_path(ino, NULL);
+    if (!path) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    uint8_t *buffer = NULL;
+    ssize_t got = get_object(ctx, path, &buffer,
+                                  (ssize_t)offset, (ssize_t)size);
+    free(path);
+    if (got < 0) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    fuse_reply_buf(req, (const char *)buffer, got);
+    free_object(buffer, got);
+
+    touch_file(ino);
 }
 
 
@@ -643,75 +1972,42 @@ int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
  * Write should return exactly the number of bytes requested
  * except on error.
  */
-int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_write(path=\"%s\", buf=%p, size=%d, offset=%d)\n",
-          path, buf, (int)size, (int)offset);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-
-	char type = entry_type(path);
-	if(type == 'z')
-		return -ENOENT;
-	if(type == 'd')
-		return -EISDIR;
-
-	char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));
-    
-    ssize_t buffer = NULL;
-    int success = (int)s3fs_get_object(ctx->s3bucket, path, &buffer, 0, 0);
-    
-    if (success < 0)
-    {
-        free(buffer);
-        return -EIO;
-    }
-
-    ssize_t new_buffsize = 0;
-    if (success > offset + size)
-        new_buffsize = (ssize_t)success;
-    else
-        new_buffsize = (ssize_t)(offset + size);
-
-    uint8_t *new_buff = (uint8_t *)malloc(new_buffsize);
-    if (success < offset + size)
-    {
-        memcpy(new_buff, buffer, offset);
-        memcpy(&new_buff[offset], buf, size);
-        memcpy(&new_buff[offset+size], buffer, new_buffsize - size - offset);
-    }
-    else
-    {
-        memcpy(new_buff, buffer, offset);
-        memcpy(&new_buff[offset], buf, size);
+void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+              off_t offset, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_write(ino=%lu, size=%d, offset=%d)\n",
+            ino, (int)size, (int)offset);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    // writes only go to the file's write-back buffer; the first one since
+    // the file was last written back loads its current contents (and the
+    // flusher may write it back again between loading and writing)
+    time_t curr_time = time(NULL);
+    for (int tries = 0;
+         wb_write(ino, buf, size, offset, curr_time) < 0; tries++) {
+        struct stat statbuf;
+        int rv = (tries < 3) ? inode_stat(ctx, ino, &statbuf) : -EIO;
+        char *path = (rv == 0) ? inode_path(ino, NULL) : NULL;
+        if (rv == 0 && !path) {
+            rv = -ESTALE;
+        }
+        uint8_t *buffer = NULL;
+        ssize_t len = (rv == 0) ? get_object(ctx, path, &buffer, 0, 0) : 0;
+        if (len < 0) {
+            rv = -EIO;
+        }
+        if (rv < 0) {
+            free(path);
+            fuse_reply_err(req, -rv);
+            return;
+        }
+        s3fs_meta_t meta;
+        stat_meta(&statbuf, &meta);
+        // the write-back buffer accounts for it from here on
+        uncharge_object(len);
+        wb_load(ino, path, &meta, buffer, len);
+        free(path);
     }
-    free(buffer);
-    
-    success = (int)s3fs_put_object(ctx->s3bucket, path, (uint8_t *)new_buff, (ssize_t)success);
-    free(new_buff);
-    if (success < 0)
-        return -EIO;
-    
-    entry_t * wbuffer= NULL; 
-    success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&wbuffer, 0, 0);
-	if(success < 0)
-		return -EIO;
-	int num_entries = success/(int)ENTRY_SIZE;
-    wbuffer = (entry_t *)wbuffer;
-
-	time_t curr_time = time(NULL);
-	int i = 0;
-	for(;i < num_entries; i++)
-	{
-		if(0 == strncmp(wbuffer[i].name, base_name, 256))
-			wbuffer[i].size = new_buffsize;
-			wbuffer[i].atime = curr_time;
-			wbuffer[i].mtime = curr_time;
-	}	
-	success = (int)s3fs_put_object(ctx->s3bucket, path_name, (uint8_t *)buffer, (ssize_t)success);		
-    if (success < 0)
-        return -EIO;
-
-    return (int)size;
+    fuse_reply_write(req, size);
 }
 
 
@@ -720,178 +2016,301 @@ int fs_write(const char *path, const char *buf, size_t size, off_t offset, struc
  *
  * Release is called when there are no more references to an open
  * file: all file descriptors are closed and all memory mappings
- * are unmapped.  
+ * are unmapped.
  *
  * For every open() call there will be exactly one release() call
  * with the same flags and file descriptor.  It is possible to
  * have a file opened more than once, in which case only the last
  * release will mean, that no more reads/writes will happen on the
- * file.  The return value of release is ignored.
+ * file.
  */
-int fs_release(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_release(path=\"%s\")\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    entry_t *buffer = NULL;
-    int success = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-    free(buffer);
-    if (success < 0)
-        return -EIO;
-    return success;
+void fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_release(ino=%lu)\n", ino);
+    fuse_reply_err(req, 0);
 }
 
+/*
+ * Flush is called on each close() of a file descriptor (so possibly more
+ * than once per open, e.g. after dup()).  Only written data is ever
+ * buffered, so this writes the file back if it is dirty, which gives
+ * close-to-open consistency and lets close() report write-back errors.
+ * A file that was only read costs nothing.
+ */
+void fs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_flush(ino=%lu)\n", ino);
+    fuse_reply_err(req, -wb_sync(ino));
+}
 
 /*
- * Rename a file.
+ * Make a file durable: reply once s3 has acknowledged both its contents
+ * and its directory record.  Namespace changes (create, rename, unlink)
+ * are already synchronous, so only buffered data is outstanding, and only
+ * this file's is written.  fdatasync needs the record as well, since it
+ * holds the file's size.  If a write-back of the file is already in
+ * flight we wait for it, and if it failed (the data stays dirty) we retry
+ * and report the outcome.
  */
-int fs_rename(const char *path, const char *newpath) {
-    fprintf(stderr, "fs_rename(fpath=\"%s\", newpath=\"%s\")\n", path, newpath);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    entry_t *buffer = NULL;
-    char *path_name = dirname(strdup(path));
-    char *base_name = basename(strdup(path));
-    char *new_basename = basename(strdup(newpath));
-    int got_obj = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&buffer, 0, 0);
-    if (got_obj < 0)
-    {
-        free(buffer);
-        return -EIO;        //did not get file
-    }
-    int removed = s3fs_remove_object(ctx->s3bucket, path);
-    if (removed < 0)
-    {
-        free(buffer);
-        return -EIO;       //error removing the file
-    }   
-    int success = (int)s3fs_put_object(ctx->s3bucket, newpath, buffer, got_obj);
-    if (success < 0)
-    {
-        free(buffer);
-        return -EIO;        //error putting in object with new pathname
-    }
-    free(buffer);
+void fs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+              struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_fsync(ino=%lu, datasync=%d)\n", ino, datasync);
+    fuse_reply_err(req, -wb_sync(ino));
+}
 
-    //update parent directory
-    entry_t *parent_buffer = NULL;
-    int parent_success = (int)s3fs_get_object(ctx->s3bucket, path_name, (uint8_t **)&parent_buffer, 0, 0);
-    if (parent_success < 0)
-    {
-        free(parent_buffer);
-        return -EIO;  
-    }  
-    int num_entries = (int)parent_success / ENTRY_SIZE;
-    int i = 0;
-    for (; i < num_entries; i++)
-    {
-        if (strcmp(parent_buffer[i].name, base_name) == 0)
-            strncpy(parent_buffer[i].name, new_basename, 256);
-    }
-    got_obj = (int)s3fs_put_object(ctx->s3bucket, path_name, parent_buffer, parent_success);
-    if (got_obj < 0)
-    {
-        free(parent_buffer);
-        return -EIO;
+/*
+ * Make a directory durable.  Its own object is written synchronously by
+ * every operation that changes its entries, so what remains are the
+ * size and mtime updates of buffered files in it, which are written back
+ * along with their data.
+ */
+void fs_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                 struct fuse_file_info *fi) {
+    fprintf(stderr, "fs_fsyncdir(ino=%lu, datasync=%d)\n", ino, datasync);
+    char type;
+    char *path = inode_path(ino, &type);
+    if (!path) {
+        fuse_reply_err(req, ESTALE);
+        return;
     }
-    return 0;
-    
+    int rv = (type == 'd') ? wb_sync_dir(path) : -ENOTDIR;
+    free(path);
+    fuse_reply_err(req, -rv);
 }
 
 
 /*
- * Remove a file.
+ * Rename a file.
+ *
+ * Directories are keyed by their full path, so renaming a non-empty
+ * directory would mean re-keying its whole subtree.  We return EXDEV in
+ * that case, which makes mv(1) fall back to copy-and-delete.  As with
+ * rename(2), a directory can only replace an empty directory.
  */
-int fs_unlink(const char *path) {
-    fprintf(stderr, "fs_unlink(path=\"%s\")\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    char *parent_path = dirname(strdup(path));
-    char *file_name = basename(strdup(path));
-    
-    //check if the path is to a file
-    if (entry_type(path) != 'f')
-    {
-        printf("fs_unlink(path=\"%s\" is not a file)\n", path);
-        return -EIO;
+void fs_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+               fuse_ino_t newparent, const char *newname) {
+    fprintf(stderr, "fs_rename(parent=%lu, name=\"%s\", newparent=%lu, "
+            "newname=\"%s\")\n", parent, name, newparent, newname);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    s3dir_t dir, new_dir;
+    char *dir_path = NULL, *new_dir_path = NULL;
+    int idx = -1, new_idx = -1;
+    int same_parent = (parent == newparent);
+    int rv = parent_path(parent, &dir_path);
+    if (rv == 0 && !same_parent &&
+        (rv = parent_path(newparent, &new_dir_path)) < 0) {
+        free(dir_path);
     }
-    
-    //update parent directory
-    entry_t *buffer = NULL;
-    int parent_size = (int)s3fs_get_object(ctx->s3bucket, parent_path, (uint8_t **)&buffer, 0, 0);
-    if (parent_size < 0)
-    {
-        free(buffer);
-        return -ENOENT;
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
     }
-    int num_entries = (int)parent_size / (int)ENTRY_SIZE;
-    int new_parent_size = (int)ENTRY_SIZE * (num_entries - 1);
-    entry_t *parent = (entry_t *)buffer;
-    entry_t *new_parent = (entry_t *)malloc(new_parent_size);
-    int i = 0;
-    int j = 1;
-    for (; i < num_entries; i++)
-    {
-        if (strcmp(parent[i].name, file_name) == 0)
-        {
-            if (j != num_entries)
-            {
-                while (j < num_entries)
-                {
-                    new_parent[i] = parent[j];
-                    j++;
-                    i++;
-                }
-            }
-            break;
+
+    // both directories are locked, and so are both names, in case either
+    // is a directory that must stay empty
+    char *path = inode_child_path(parent, name);
+    char *newpath = inode_child_path(newparent, newname);
+    const char *locked[] = { dir_path, new_dir_path, path, newpath };
+    lock_dirs(locked, 4);
+    if ((rv = load_entry(ctx, dir_path, name, &dir, &idx)) < 0) {
+        goto out_unlock;
+    }
+    if (idx < 0) {
+        rv = -ENOENT;
+        goto out_dir;
+    }
+
+    // when both names share a parent, work on a single copy of it
+    s3dir_t *dst = &dir;
+    if (!same_parent) {
+        rv = load_entry(ctx, new_dir_path, newname, &new_dir, &new_idx);
+        if (rv < 0) {
+            goto out_dir;
         }
-        new_parent[i] = parent[i];
-        j++;
+        dst = &new_dir;
+    } else {
+        new_idx = s3dir_find(&dir, newname);
+    }
+    if (!path || !newpath) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    if (new_idx == idx && same_parent) {
+        rv = 0;  // renaming something to itself
+        goto out;
     }
 
-    //remove file
-    int removed = s3fs_remove_object(ctx->s3bucket, path);
-    if (removed < 0)
-        return -EIO;    //error while trying to remove file
+    // a file's unwritten data moves with it
+    uint8_t *buffer = NULL;
+    ssize_t len;
+    size_t dirty_len;
+    time_t dirty_mtime;
+    int dirty = (dir.type[idx] == 'f' &&
+                 wb_take(dir.ino[idx], &buffer, &dirty_len, &dirty_mtime) == 0);
+    if (dirty) {
+        len = dirty_len;
+        dir.size[idx] = dirty_len;
+        dir.mtime[idx] = dirty_mtime;
+    } else {
+        len = get_object(ctx, path, &buffer, 0, 0);
+    }
+    if (len < 0) {
+        rv = -EIO;
+        goto out;
+    }
+    if (dir.type[idx] == 'd' && len > (ssize_t)ENTRY_SIZE) {
+        free_object(buffer, len);
+        rv = -EXDEV;
+        goto out;
+    }
+    s3fs_meta_t meta;
+    entry_meta(&dir, idx, &meta);
+    if (new_idx > 0 && dst->type[new_idx] != dir.type[idx]) {
+        rv = (dir.type[idx] == 'd') ? -ENOTDIR : -EISDIR;
+    } else if (new_idx > 0 && dst->type[new_idx] == 'd') {
+        rv = check_empty(ctx, newpath);
+    }
+    if (rv == 0 && put_object(ctx, newpath, buffer, len, &meta) < 0) {
+        rv = -EIO;
+    }
+    if (rv < 0) {
+        if (dirty) {
+            // still under the old name
+            wb_load(dir.ino[idx], path, &meta, buffer, len);
+        } else {
+            free_object(buffer, len);
+        }
+        goto out;
+    }
+    dircache_invalidate(newpath);
 
-    //update new_parent size, access and modified time
-    new_parent[0].size = new_parent_size;
-    
+    // carry the entry's metadata (and inode number) over to its new
+    // name, replacing whatever was there before
+    uint64_t ino = dir.ino[idx];
+    char type = dir.type[idx];
+    uint64_t replaced = 0;
     time_t curr_time = time(NULL);
-    new_parent[0].atime = curr_time;
-    new_parent[0].mtime = curr_time;
+    if (new_idx > 0) {
+        replaced = dst->ino[new_idx];
+        s3dir_remove(dst, new_idx);
+        if (same_parent && new_idx < idx) {
+            idx--;
+        }
+    }
+    int added = 0;      // the new name is in a stored directory
+    if (same_parent) {
+        rv = s3dir_rename(&dir, idx, newname) < 0 ? -ENAMETOOLONG : 0;
+    } else {
+        int n = s3dir_add(&new_dir, dir.type[idx], newname, ino,
+                          dir.mode[idx], dir.size[idx], curr_time);
+        if (n < 0) {
+            rv = -ENAMETOOLONG;
+        } else {
+            new_dir.mtime[n] = dir.mtime[idx];
+            new_dir.atime[n] = dir.atime[idx];
+            new_dir.uid[n] = dir.uid[idx];
+            new_dir.gid[n] = dir.gid[idx];
+            s3dir_remove(&dir, idx);
+        }
+    }
 
-    int overwrite = (int)s3fs_put_object(ctx->s3bucket, parent_path, (uint8_t *)new_parent, new_parent_size);
-    free(buffer);
-    if (overwrite < 0)
-    {
-        fprintf(stderr, "fs_unlink(path=\"%s\" failed to put new_parent in the bucket)\n", parent_path);
-        return -EIO;
+    // the new name goes in first, so that a failure in between leaves the
+    // file under both names rather than neither
+    dir.mtime[0] = curr_time;
+    dst->mtime[0] = curr_time;
+    if (rv == 0 && !same_parent) {
+        rv = store_dir(ctx, new_dir_path, &new_dir);
+        added = (rv == 0);
     }
-    printf("\n~~~~~~~~~~~Successfully unlinked file \"%s\"~~~~~~~~~~~~~~~ \n",path);
-    return 0;
-}
-/*
- * Change the size of a file.
- */
-int fs_truncate(const char *path, off_t newsize) {
-    fprintf(stderr, "fs_truncate(path=\"%s\", newsize=%d)\n", path, (int)newsize);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    entry_t *file = NULL;
-    int success = (int)s3fs_get_object(ctx->s3bucket, path, (uint8_t **)&file, 0, 0);
-    if (success < 0)
-        return -ENOENT;
-    
-        
-    return -EIO;
+    if (rv == 0) {
+        rv = store_dir(ctx, dir_path, &dir);
+        added = added || (rv == 0);
+    }
+    if (rv < 0) {
+        // the old name still has the file; a new object nothing lists is
+        // removed (one that replaced a file can't be put back)
+        if (!added && new_idx < 0) {
+            queue_remove(ctx, newpath);
+        }
+        if (dirty) {
+            wb_load(ino, path, &meta, buffer, len);
+        } else {
+            free_object(buffer, len);
+        }
+        goto out;
+    }
+    free_object(buffer, dirty ? 0 : len);
+
+    if (replaced) {
+        // the replaced file may still be open; its cached attributes
+        // and pages (and any unwritten data) are gone with it
+        notify_inval_inode(replaced);
+        discard_dirty(replaced);
+        inode_detach(replaced);
+    }
+    inode_rename(ino, newparent, newname);
+    queue_remove(ctx, path);
+    dircache_invalidate(path);
+    if (type == 'd') {
+        ckpt_forget_dir(path);
+        ckpt_forget_dir(newpath);
+    }
+
+out:
+    if (!same_parent) {
+        s3dir_free(&new_dir);
+    }
+out_dir:
+    s3dir_free(&dir);
+out_unlock:
+    unlock_dirs(locked, 4);
+    fuse_reply_err(req, -rv);
+    free(dir_path);
+    free(new_dir_path);
+    free(path);
+    free(newpath);
 }
 
 
 /*
- * Change the size of an open file.  Very similar to fs_truncate (and,
- * depending on your implementation), you could possibly treat it the
- * same as fs_truncate.
+ * Remove a file.
  */
-int fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_ftruncate(path=\"%s\", offset=%d)\n", path, (int)offset);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    return -EIO;
+void fs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    fprintf(stderr, "fs_unlink(parent=%lu, name=\"%s\")\n", parent, name);
+    s3context_t *ctx = GET_PRIVATE_DATA(req);
+
+    s3dir_t dir;
+    char *dir_path = NULL;
+    int idx = -1;
+    int rv = lock_parent(ctx, parent, name, &dir, &dir_path, &idx);
+    if (rv < 0) {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+    char *path = inode_child_path(parent, name);
+    if (idx < 0 || dir.type[idx] != 'f' || !path) {
+        rv = (idx < 0 || !path) ? -ENOENT : -EISDIR;
+        goto out;
+    }
+
+    // the name goes now; the object goes once the parent no longer
+    // lists it, in the background
+    uint64_t ino = dir.ino[idx];
+    discard_dirty(ino);
+    time_t curr_time = time(NULL);
+    s3dir_remove(&dir, idx);
+    dir.atime[0] = curr_time;
+    dir.mtime[0] = curr_time;
+    if ((rv = store_dir(ctx, dir_path, &dir)) == 0) {
+        inode_detach(ino);
+        queue_remove(ctx, path);
+    }
+
+out:
+    fuse_reply_err(req, -rv);
+    s3dir_free(&dir);
+    unlock_dir(dir_path);
+    free(dir_path);
+    free(path);
 }
 
 
@@ -899,22 +2318,25 @@ int fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
  * Check file access permissions.  For now, just return 0 (success!)
  * Later, actually check permissions (don't bother initially).
  */
-int fs_access(const char *path, int mask) {
-    fprintf(stderr, "fs_access(path=\"%s\", mask=0%o)\n", path, mask);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    return 0;
+void fs_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+    fprintf(stderr, "fs_access(ino=%lu, mask=0%o)\n", ino, mask);
+    fuse_reply_err(req, 0);
 }
 
 
 /*
  * The struct that contains pointers to all our callback
- * functions.  Those that are currently NULL aren't 
+ * functions.  Those that are currently NULL aren't
  * intended to be implemented in this project.
  */
-struct fuse_operations s3fs_ops = {
+struct fuse_lowlevel_ops s3fs_ops = {
+  .init        = fs_init,       // initialize filesystem
+  .destroy     = fs_destroy,    // cleanup/destroy filesystem
+  .lookup      = fs_lookup,     // look up a name in a directory
+  .forget      = fs_forget,     // drop inode lookup references
   .getattr     = fs_getattr,    // get file attributes
+  .setattr     = fs_setattr,    // truncate, chmod, utime
   .readlink    = NULL,          // read a symbolic link
-  .getdir      = NULL,          // deprecated function
   .mknod       = fs_mknod,      // create a file
   .mkdir       = fs_mkdir,      // create a directory
   .unlink      = fs_unlink,     // remove/unlink a file
@@ -922,40 +2344,69 @@ struct fuse_operations s3fs_ops = {
   .symlink     = NULL,          // create a symbolic link
   .rename      = fs_rename,     // rename a file
   .link        = NULL,          // we don't support hard links
-  .chmod       = NULL,          // change mode bits: not implemented
-  .chown       = NULL,          // change ownership: not implemented
-  .truncate    = fs_truncate,   // truncate a file's size
-  .utime       = NULL,          // update stat times for a file: not implemented
   .open        = fs_open,       // open a file
   .read        = fs_read,       // read contents from an open file
   .write       = fs_write,      // write contents to an open file
-  .statfs      = NULL,          // file sys stat: not implemented
-  .flush       = NULL,          // flush file to stable storage: not implemented
+  .flush       = fs_flush,      // write back a file's data on close
   .release     = fs_release,    // release/close file
-  .fsync       = NULL,          // sync file to disk: not implemented
+  .fsync       = fs_fsync,      // write back a file's data
+  .opendir     = fs_opendir,    // open directory entry
+  .readdir     = fs_readdir,    // read directory entry
+  .releasedir  = fs_releasedir, // release/close directory
+  .fsyncdir    = fs_fsyncdir,   // write back buffered files' records
+  .statfs      = NULL,          // file sys stat: not implemented
   .setxattr    = NULL,          // not implemented
   .getxattr    = NULL,          // not implemented
   .listxattr   = NULL,          // not implemented
   .removexattr = NULL,          // not implemented
-  .opendir     = fs_opendir,    // open directory entry
-  .readdir     = fs_readdir,    // read directory entry
-  .releasedir  = fs_releasedir, // release/close directory
-  .fsyncdir    = NULL,          // sync dirent to disk: not implemented
-  .init        = fs_init,       // initialize filesystem
-  .destroy     = fs_destroy,    // cleanup/destroy filesystem
   .access      = fs_access,     // check access permissions for a file
-  .create      = NULL,          // not implemented
-  .ftruncate   = fs_ftruncate,  // truncate the file
-  .fgetattr    = NULL           // not implemented
+  .create      = NULL,          // not implemented; the kernel uses mknod+open
 };
 
 
 
-/* 
- * You shouldn't need to change anything here.  If you need to
- * add more items to the filesystem context object (which currently
- * only has the S3 bucket name), you might want to initialize that
- * here (but you could also reasonably do that in fs_init).
+/*
+ * Our own mount options; fuse_opt_parse takes these out of the argument
+ * list, leaving the rest for fuse_mount and fuse_lowlevel_new.
+ */
+static const struct fuse_opt s3fs_opts[] = {
+    { "entry_timeout=%lf", offsetof(s3context_t, entry_timeout), 0 },
+    { "attr_timeout=%lf",  offsetof(s3context_t, attr_timeout), 0 },
+    { "kernel_cache",      offsetof(s3context_t, kernel_cache), 1 },
+    { "no_kernel_cache",   offsetof(s3context_t, kernel_cache), 0 },
+    { "cache_dir=%s",      offsetof(s3context_t, cache_dir), 0 },
+    { "cache_size=%lu",    offsetof(s3context_t, cache_size), 0 },
+    { "ram_cache_size=%lu", offsetof(s3context_t, ram_cache_size), 0 },
+    { "mem_limit=%lu",     offsetof(s3context_t, mem_limit), 0 },
+    { "dirty_age=%d",      offsetof(s3context_t, dirty_age), 0 },
+    { "dirty_bytes=%lu",   offsetof(s3context_t, dirty_bytes), 0 },
+    { "async_requests=%d", offsetof(s3context_t, async_requests), 0 },
+    { "delete_log=%s",     offsetof(s3context_t, delete_log), 0 },
+    { "persist",           offsetof(s3context_t, persist), 1 },
+    { "checkpoint_interval=%d", offsetof(s3context_t, checkpoint_interval), 0 },
+    { "hedge",             offsetof(s3context_t, hedge), 1 },
+    { "hedge_percentile=%d", offsetof(s3context_t, hedge_percentile), 0 },
+    { "hedge_budget=%d",   offsetof(s3context_t, hedge_budget), 0 },
+    { "meta_connect_timeout=%d", offsetof(s3context_t, meta_connect_timeout), 0 },
+    { "meta_first_byte_timeout=%d",
+      offsetof(s3context_t, meta_first_byte_timeout), 0 },
+    { "meta_timeout=%d",   offsetof(s3context_t, meta_timeout), 0 },
+    { "data_connect_timeout=%d", offsetof(s3context_t, data_connect_timeout), 0 },
+    { "data_first_byte_timeout=%d",
+      offsetof(s3context_t, data_first_byte_timeout), 0 },
+    { "data_timeout=%d",   offsetof(s3context_t, data_timeout), 0 },
+    { "handle_cache=%d",   offsetof(s3context_t, handle_cache), 0 },
+    { "handle_pool=%d",    offsetof(s3context_t, handle_pool), 0 },
+    { "http2",             offsetof(s3context_t, http2), 1 },
+    { "warm_connections=%d", offsetof(s3context_t, warm_connections), 0 },
+    { "keepalive=%d",      offsetof(s3context_t, keepalive), 0 },
+    FUSE_OPT_END
+};
+
+
+/*
+ * Set up the low-level FUSE session (the pieces fuse_main would do
+ * for a path-based file system) and run it.
  */
 int main(int argc, char *argv[]) {
     // don't allow anything to continue if we're running as root.  bad stuff.
@@ -986,12 +2437,72 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Initializing s3 credentials\n");
     s3fs_init_credentials(s3key, s3secret);
 
-    fprintf(stderr, "Totally clearing s3 bucket\n");
-    s3fs_clear_bucket(s3bucket);
-
     fprintf(stderr, "Starting up FUSE file system.\n");
-    int fuse_stat = fuse_main(argc, argv, &s3fs_ops, stateinfo);
-    fprintf(stderr, "Startup function (fuse_main) returned %d\n", fuse_stat);
-    
-    return fuse_stat;
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char *mountpoint = NULL;
+    int multithreaded = 0, foreground = 0;
+    int err = -1;
+
+    // big requests by default; anything given on the command line comes
+    // later in the list and wins
+    char io_opts[128];
+    snprintf(io_opts, sizeof(io_opts), "-omax_read=%d,max_write=%d,big_writes",
+             S3FS_MAX_IO, S3FS_MAX_IO);
+    stateinfo->entry_timeout = ENTRY_TIMEOUT;
+    stateinfo->attr_timeout = ATTR_TIMEOUT;
+    stateinfo->kernel_cache = 1;
+    stateinfo->cache_size = DISKCACHE_SIZE_MB;
+    stateinfo->ram_cache_size = RAMCACHE_SIZE_MB;
+    stateinfo->mem_limit = MEM_LIMIT_MB;
+    stateinfo->dirty_age = DIRTY_AGE;
+    stateinfo->dirty_bytes = DIRTY_BYTES_MB;
+    stateinfo->async_requests = ASYNC_REQUESTS;
+    stateinfo->checkpoint_interval = CHECKPOINT_INTERVAL;
+    stateinfo->hedge_percentile = HEDGE_PERCENTILE;
+    stateinfo->hedge_budget = HEDGE_BUDGET;
+    stateinfo->meta_connect_timeout = META_CONNECT_TIMEOUT_MS;
+    stateinfo->meta_first_byte_timeout = META_FIRST_BYTE_TIMEOUT_MS;
+    stateinfo->meta_timeout = META_TIMEOUT_MS;
+    stateinfo->data_connect_timeout = DATA_CONNECT_TIMEOUT_MS;
+    stateinfo->data_first_byte_timeout = DATA_FIRST_BYTE_TIMEOUT_MS;
+    stateinfo->data_timeout = DATA_TIMEOUT_MS;
+    stateinfo->handle_cache = HANDLE_CACHE;
+    stateinfo->handle_pool = HANDLE_POOL;
+    stateinfo->warm_connections = WARM_CONNECTIONS;
+    stateinfo->keepalive = KEEPALIVE_IDLE;
+    if (fuse_opt_insert_arg(&args, 1, io_opts) == -1 ||
+        fuse_opt_parse(&args, stateinfo, s3fs_opts, NULL) == -1 ||
+        fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+                           &foreground) == -1) {
+        fuse_opt_free_args(&args);
+        return -1;
+    }
+
+    struct fuse_chan *ch = fuse_mount(mountpoint, &args);
+    stateinfo->ch = ch;
+    if (ch) {
+        struct fuse_session *se = fuse_lowlevel_new(&args, &s3fs_ops,
+                                                    sizeof(s3fs_ops),
+                                                    stateinfo);
+        if (se) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                fuse_daemonize(foreground);
+                err = multithreaded ? fuse_session_loop_mt(se)
+                                    : fuse_session_loop(se);
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    fprintf(stderr, "FUSE session loop returned %d\n", err);
+
+    free(mountpoint);
+    fuse_opt_free_args(&args);
+    free(stateinfo->cache_dir);
+    free(stateinfo->delete_log);
+    free(stateinfo);
+    return err ? 1 : 0;
 }
@@ -17,9 +17,115 @@
 
 #define BUFFERSIZE 1024
 
+// how long (seconds) and how many decoded directories we keep cached
+#define DIRCACHE_TTL 30
+#define DIRCACHE_MAX_DIRS 4096
+
+// directories bigger than this are streamed through readdir in pages
+#define READDIR_PAGE_ENTRIES 256
+
+// defaults for how long (seconds) the kernel may cache names and
+// attributes we hand it; local changes are invalidated explicitly
+#define ENTRY_TIMEOUT 30.0
+#define ATTR_TIMEOUT 30.0
+
+// default size caps (MB) of the object cache's RAM tier and of its
+// on-disk tier (-o cache_dir=DIR)
+#define RAMCACHE_SIZE_MB 64
+#define DISKCACHE_SIZE_MB 1024
+
+// default ceiling (MB) on memory held for caches, dirty data and
+// transfers together; 0 means no limit (-o mem_limit=MB)
+#define MEM_LIMIT_MB 512
+
+// written data is buffered and written back once it has been dirty this
+// long (seconds, -o dirty_age=SECONDS) or there is more than this much
+// (MB, -o dirty_bytes=MB) of it, with at most this many uploads running
+// at once (-o async_requests=N)
+#define DIRTY_AGE 5
+#define DIRTY_BYTES_MB 64
+#define ASYNC_REQUESTS 4
+
+// unlink and rmdir queue the removal of the object, logging it in this
+// file of the cache directory unless -o delete_log=FILE says otherwise
+#define DELETE_LOG_NAME "deletes.log"
+
+// without -o persist every mount starts with an empty bucket; with it, a
+// mount picks up from the metadata checkpoint, which is rewritten this
+// often (seconds, -o checkpoint_interval=SECONDS) while mounted
+#define CHECKPOINT_INTERVAL 60
+
+// with -o hedge, a GET of a directory or a small file that hasn't started
+// to answer by this percentile of recent times to first byte is sent again
+// (-o hedge_percentile=N), for at most this percentage of such GETs
+// (-o hedge_budget=PERCENT)
+#define HEDGE_PERCENTILE 95
+#define HEDGE_BUDGET 5
+
+// how long (ms) a metadata request (a HEAD, a delete, a GET or PUT of a
+// directory or small file) and a bulk data transfer may take to connect
+// (-o meta_connect_timeout=MS, -o data_connect_timeout=MS), to start
+// answering once the request is sent (-o meta_first_byte_timeout=MS,
+// -o data_first_byte_timeout=MS)
+// and in all (-o meta_timeout=MS, -o data_timeout=MS); 0 leaves libs3's
+// default, which is no limit beyond aborting stalled transfers
+#define META_CONNECT_TIMEOUT_MS 2000
+#define META_FIRST_BYTE_TIMEOUT_MS 5000
+#define META_TIMEOUT_MS 10000
+#define DATA_CONNECT_TIMEOUT_MS 5000
+#define DATA_FIRST_BYTE_TIMEOUT_MS 30000
+#define DATA_TIMEOUT_MS 0
+
+// finished requests kept for re-use, with their connections: this many in
+// each thread's own cache (-o handle_cache=N), and this many more in a pool
+// shared by all threads (-o handle_pool=N)
+#define HANDLE_CACHE 4
+#define HANDLE_POOL 32
+
+// connections opened at mount time, before the first request needs one
+// (-o warm_connections=N, 0 for none), and kept open by HEADs over them
+// once nothing else has gone to s3 for this many seconds (-o keepalive=
+// SECONDS, 0 to let them time out)
+#define WARM_CONNECTIONS 4
+#define KEEPALIVE_IDLE 15
+
+// largest read/write request we ask the kernel for (its own limit)
+#define S3FS_MAX_IO (128 * 1024)
+
+struct fuse_chan;
+
 // store filesystem state information in this struct
 typedef struct {
     char s3bucket[BUFFERSIZE];
+    struct fuse_chan *ch;   // for cache invalidation notifications
+    double entry_timeout;   // -o entry_timeout=SECONDS
+    double attr_timeout;    // -o attr_timeout=SECONDS
+    int kernel_cache;       // keep file pages across opens (-o kernel_cache)
+    char *cache_dir;        // on-disk object cache, if any (-o cache_dir=DIR)
+    unsigned long cache_size;   // its size cap in MB (-o cache_size=MB)
+    unsigned long ram_cache_size;   // RAM tier cap in MB (-o ram_cache_size=MB)
+    unsigned long mem_limit;    // memory budget in MB (-o mem_limit=MB)
+    int dirty_age;              // write-back age in seconds (-o dirty_age=)
+    unsigned long dirty_bytes;  // write-back threshold in MB (-o dirty_bytes=)
+    int async_requests;         // concurrent background requests
+    char *delete_log;           // intent log of queued deletes (-o delete_log=)
+    int persist;                // keep the bucket's contents (-o persist)
+    int checkpoint_interval;    // seconds between checkpoints, if persistent
+    int failed;                 // fs_init couldn't read the existing root
+    int hedge;                  // hedge slow small GETs (-o hedge)
+    int hedge_percentile;       // ... after this percentile of first bytes
+    int hedge_budget;           // ... for at most this percent of them
+    int meta_connect_timeout;   // metadata request timeouts (ms)
+    int meta_first_byte_timeout;
+    int meta_timeout;
+    int data_connect_timeout;   // bulk data request timeouts (ms)
+    int data_first_byte_timeout;
+    int data_timeout;
+    int handle_cache;           // requests kept per thread (-o handle_cache=N)
+    int handle_pool;            // ... and shared (-o handle_pool=N)
+    int http2;                  // HTTP/2 for bulk requests (-o http2)
+    int warm_connections;       // opened at mount (-o warm_connections=N)
+    int keepalive;              // idle seconds before refreshing them
 } s3context_t;
 
 /*
@@ -27,13 +133,27 @@ typedef struct {
  * type) should go here.
  */
 
-char entry_type(const char *path);
+// an entry handed out by readdir: its index in the directory object at
+// the time, which its offset cookie is made of, and its inode number
+typedef struct {
+    int idx;
+    uint64_t ino;
+} s3dirmark_t;
+
+// per-open-directory state, kept in fi->fh from opendir to releasedir
+typedef struct {
+    int count;      // entries in the directory object when it was opened
+    s3dirmark_t *marks;     // the entries in the last readdir reply, and
+    int num_marks;          // the one that didn't fit, if any
+    int marks_cap;
+} s3dirhandle_t;
 
 typedef struct {
     char type;
     char name[256];
 
     //metadata
+    uint64_t ino;   //inode number, stable for the life of the file
     mode_t mode;    //protection
     nlink_t links;  //hard links
     uid_t uid;      //user ID of owner
@@ -0,0 +1,191 @@
+/*
+ * Background request engine for s3fs; see s3fs_async.h.
+ */
+
+#include "s3fs_async.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ASYNC_MAX_WORKERS 64
+
+typedef struct async_job {
+    async_fn fn;
+    void *arg;
+    struct timespec due;        // when a delayed job may run
+    struct async_job *next;
+} async_job_t;
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+static async_job_t *queue_head = NULL, *queue_tail = NULL;
+static async_job_t *delayed = NULL;     // delayed jobs, soonest first
+static pthread_t workersG[ASYNC_MAX_WORKERS];
+static int num_workers = 0;
+static int runningG = 0;
+static int stoppingG = 0;
+
+static int before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Called with async_lock. */
+static void append(async_job_t *job) {
+    job->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+}
+
+/*
+ * Queue the delayed jobs whose time has come, or all of them once we are
+ * stopping (a retry isn't worth holding up an unmount for).  Called with
+ * async_lock.
+ */
+static void queue_due() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    while (delayed && (stoppingG || !before(&now, &delayed->due))) {
+        async_job_t *job = delayed;
+        delayed = job->next;
+        append(job);
+    }
+}
+
+static void *async_main(void *arg) {
+    pthread_mutex_lock(&async_lock);
+    for (;;) {
+        queue_due();
+        while (!queue_head && !stoppingG) {
+            if (delayed) {
+                pthread_cond_timedwait(&async_cond, &async_lock,
+                                       &delayed->due);
+            } else {
+                pthread_cond_wait(&async_cond, &async_lock);
+            }
+            queue_due();
+        }
+        if (!queue_head) {
+            break;      // stopping, and the queue is drained
+        }
+        async_job_t *job = queue_head;
+        queue_head = job->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&async_lock);
+
+        job->fn(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&async_lock);
+    }
+    pthread_mutex_unlock(&async_lock);
+    return NULL;
+}
+
+void async_init(int workers) {
+    if (workers < 1) {
+        workers = 1;
+    } else if (workers > ASYNC_MAX_WORKERS) {
+        workers = ASYNC_MAX_WORKERS;
+    }
+    pthread_mutex_lock(&async_lock);
+    stoppingG = 0;
+    runningG = 1;
+    pthread_mutex_unlock(&async_lock);
+    for (num_workers = 0; num_workers < workers; num_workers++) {
+        if (pthread_create(&workersG[num_workers], NULL, async_main,
+                           NULL) != 0) {
+            fprintf(stderr, "async: can't start worker thread\n");
+            break;
+        }
+    }
+    if (num_workers == 0) {
+        pthread_mutex_lock(&async_lock);
+        runningG = 0;
+        pthread_mutex_unlock(&async_lock);
+    }
+}
+
+void async_destroy() {
+    pthread_mutex_lock(&async_lock);
+    if (!runningG) {
+        pthread_mutex_unlock(&async_lock);
+        return;
+    }
+    stoppingG = 1;
+    pthread_cond_broadcast(&async_cond);
+    pthread_mutex_unlock(&async_lock);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workersG[i], NULL);
+    }
+    num_workers = 0;
+    pthread_mutex_lock(&async_lock);
+    runningG = 0;
+    pthread_mutex_unlock(&async_lock);
+}
+
+int async_submit(async_fn fn, void *arg) {
+    async_job_t *job = malloc(sizeof(async_job_t));
+    if (!job) {
+        return -1;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&async_lock);
+    if (!runningG || stoppingG) {
+        pthread_mutex_unlock(&async_lock);
+        free(job);
+        return -1;
+    }
+    append(job);
+    pthread_cond_signal(&async_cond);
+    pthread_mutex_unlock(&async_lock);
+    return 0;
+}
+
+int async_submit_after(async_fn fn, void *arg, int delay_ms) {
+    if (delay_ms <= 0) {
+        return async_submit(fn, arg);
+    }
+    async_job_t *job = malloc(sizeof(async_job_t));
+    if (!job) {
+        return -1;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    clock_gettime(CLOCK_REALTIME, &job->due);
+    job->due.tv_sec += delay_ms / 1000;
+    job->due.tv_nsec += (long)(delay_ms % 1000) * 1000000;
+    if (job->due.tv_nsec >= 1000000000) {
+        job->due.tv_sec++;
+        job->due.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&async_lock);
+    if (!runningG || stoppingG) {
+        pthread_mutex_unlock(&async_lock);
+        free(job);
+        return -1;
+    }
+    async_job_t **pp = &delayed;
+    while (*pp && !before(&job->due, &(*pp)->due)) {
+        pp = &(*pp)->next;
+    }
+    job->next = *pp;
+    *pp = job;
+    // a worker may have to wait for this one instead
+    pthread_cond_signal(&async_cond);
+    pthread_mutex_unlock(&async_lock);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef __S3FS_ASYNC_H__
+#define __S3FS_ASYNC_H__
+
+/*
+ * Background request engine.
+ *
+ * Work that shouldn't hold up a FUSE request (uploads of dirty files and
+ * the like) is queued here and run by a fixed pool of worker threads, so
+ * no more than that many background s3 requests are ever outstanding at
+ * once.  Jobs run in the order they were submitted, though with more than
+ * one worker they may finish in any order.
+ *
+ * All functions are thread-safe.
+ */
+
+typedef void (*async_fn)(void *arg);
+
+/* Start that many worker threads (at least one). */
+void async_init(int workers);
+
+/* Run whatever is still queued, then stop the workers. */
+void async_destroy();
+
+/*
+ * Queue fn(arg) to run on a worker.  Returns 0, or -1 if the engine isn't
+ * running or memory ran out (fn hasn't been queued then).
+ */
+int async_submit(async_fn fn, void *arg);
+
+/*
+ * Queue fn(arg) to run on a worker once delay_ms have passed, without
+ * tying up a worker meanwhile; for retrying a job after a backoff.  Jobs
+ * still waiting when the engine stops are run right away.  Returns as
+ * async_submit does.
+ */
+int async_submit_after(async_fn fn, void *arg, int delay_ms);
+
+#endif // __S3FS_ASYNC_H__
@@ -0,0 +1,446 @@
+/*
+ * Tiered object cache for s3fs; see s3fs_cache.h.
+ *
+ * The RAM tier is a hash table of objects, each held in a single
+ * allocation along with its key, and linked into a ring for eviction.
+ * Every hit bumps an object's use count (up to CACHE_MAX_FREQ); the clock
+ * hand decrements counts as it passes and demotes the first object it
+ * finds at zero, so a hot object survives several sweeps while one that
+ * was used once goes on the next.  Demoted objects are written to the
+ * disk tier outside the lock.
+ *
+ * Hits on objects that are only on disk are counted in "ghost" entries
+ * (a key and a count, no data), kept on a FIFO list of at most
+ * CACHE_GHOSTS; the CACHE_PROMOTE_HITS'th hit promotes the object.
+ *
+ * The RAM tier's bytes count against the global memory budget as clean
+ * data, and cache_reclaim demotes objects when the budget runs short.
+ */
+
+#include "s3fs_cache.h"
+#include "s3fs_diskcache.h"
+#include "s3fs_mem.h"
+#include "libs3_wrapper.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_BUCKETS 4096
+#define CACHE_MAX_FREQ 3
+#define CACHE_PROMOTE_HITS 2
+#define CACHE_GHOSTS 4096
+
+// no single object may take more than this share of the RAM tier
+#define CACHE_MAX_OBJECT_SHARE 8
+
+typedef struct cache_entry {
+    char *key;                  // points into the same allocation
+    char etag[S3FS_ETAG_SIZE];
+    uint8_t *data;              // ... as does this; NULL for a ghost
+    size_t len;
+    int freq;                   // use count; -1 for a ghost never to promote
+    struct cache_entry *hnext;              // hash chain
+    struct cache_entry *prev, *next;        // ring, or ghost FIFO
+} cache_entry_t;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t *buckets[CACHE_BUCKETS];
+static cache_entry_t *hand = NULL;
+static cache_entry_t *ghost_head = NULL, *ghost_tail = NULL;
+static int num_ghosts = 0;
+static uint64_t max_bytesG = 0;
+static cache_stats_t statsG;
+
+static unsigned int hash_key(const char *key) {
+    unsigned int h = 5381;
+    while (*key) {
+        h = ((h << 5) + h) + (unsigned char)*key++;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+static size_t entry_bytes(const cache_entry_t *e) {
+    return sizeof(cache_entry_t) + strlen(e->key) + 1 + e->len;
+}
+
+static cache_entry_t *new_entry(const char *key, const char *etag,
+                                const uint8_t *buf, size_t len) {
+    size_t key_len = strlen(key) + 1;
+    cache_entry_t *e = malloc(sizeof(cache_entry_t) + key_len + len);
+    if (!e) {
+        return NULL;
+    }
+    memset(e, 0, sizeof(cache_entry_t));
+    e->key = (char *)(e + 1);
+    memcpy(e->key, key, key_len);
+    strncpy(e->etag, etag ? etag : "", sizeof(e->etag) - 1);
+    if (buf) {
+        e->data = (uint8_t *)e->key + key_len;
+        memcpy(e->data, buf, len);
+        e->len = len;
+    }
+    return e;
+}
+
+static cache_entry_t *find_entry(const char *key, unsigned int h) {
+    cache_entry_t *e = buckets[h];
+    while (e && strcmp(e->key, key) != 0) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+static void unhash(cache_entry_t *e) {
+    cache_entry_t **pp = &buckets[hash_key(e->key)];
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+}
+
+static void ring_insert(cache_entry_t *e) {
+    if (!hand) {
+        e->prev = e->next = e;
+        hand = e;
+    } else {
+        // just behind the hand, i.e. the last to be considered
+        e->next = hand;
+        e->prev = hand->prev;
+        hand->prev->next = e;
+        hand->prev = e;
+    }
+    statsG.ram_bytes += entry_bytes(e);
+    statsG.ram_objects++;
+    mem_charge(MEM_CACHE, entry_bytes(e));
+}
+
+static void ring_remove(cache_entry_t *e) {
+    if (e->next == e) {
+        hand = NULL;
+    } else {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+        if (hand == e) {
+            hand = e->next;
+        }
+    }
+    statsG.ram_bytes -= entry_bytes(e);
+    statsG.ram_objects--;
+    mem_release(MEM_CACHE, entry_bytes(e));
+}
+
+static void ghost_unlink(cache_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        ghost_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        ghost_tail = e->prev;
+    }
+    num_ghosts--;
+}
+
+/* Take e out of the table, whichever tier it stands for. */
+static void remove_entry(cache_entry_t *e) {
+    unhash(e);
+    if (e->data) {
+        ring_remove(e);
+    } else {
+        ghost_unlink(e);
+    }
+}
+
+static void ghost_push(cache_entry_t *e) {
+    e->prev = NULL;
+    e->next = ghost_head;
+    if (ghost_head) {
+        ghost_head->prev = e;
+    }
+    ghost_head = e;
+    if (!ghost_tail) {
+        ghost_tail = e;
+    }
+    num_ghosts++;
+    while (num_ghosts > CACHE_GHOSTS) {
+        cache_entry_t *old = ghost_tail;
+        remove_entry(old);
+        free(old);
+    }
+}
+
+/* Take the next victim out of the ring, or return NULL if it's empty. */
+static cache_entry_t *evict_one() {
+    while (hand) {
+        cache_entry_t *e = hand;
+        if (e->freq > 0) {
+            e->freq--;
+            hand = e->next;
+            continue;
+        }
+        remove_entry(e);
+        statsG.demotions++;
+        return e;
+    }
+    return NULL;
+}
+
+/*
+ * Make room for bytes more in RAM by taking objects out of the ring;
+ * they are chained through hnext onto the returned list, for the caller
+ * to demote once it has dropped the lock.
+ */
+static cache_entry_t *evict(uint64_t bytes) {
+    cache_entry_t *victims = NULL, *e;
+    while (statsG.ram_bytes + bytes > max_bytesG && (e = evict_one())) {
+        e->hnext = victims;
+        victims = e;
+    }
+    return victims;
+}
+
+/* Write evicted objects to the disk tier, unless it has them already. */
+static void demote(cache_entry_t *victims) {
+    while (victims) {
+        cache_entry_t *e = victims;
+        victims = e->hnext;
+        char etag[S3FS_ETAG_SIZE];
+        if (diskcache_etag(e->key, etag, sizeof(etag)) < 0 ||
+            strcmp(etag, e->etag) != 0) {
+            diskcache_store(e->key, e->etag, e->data, e->len);
+        }
+        free(e);
+    }
+}
+
+/*
+ * Put a copy of buf into RAM as key's contents with use count freq.
+ * Unless replace is set, a copy already in RAM wins.  Returns 0, or -1
+ * if the object doesn't fit.
+ */
+static int ram_insert(const char *key, const char *etag, const uint8_t *buf,
+                      size_t len, int freq, int replace) {
+    cache_entry_t *n = new_entry(key, etag, buf ? buf : (uint8_t *)"", len);
+    if (!n) {
+        return -1;
+    }
+    n->freq = freq;
+
+    pthread_mutex_lock(&cache_lock);
+    if (entry_bytes(n) > max_bytesG / CACHE_MAX_OBJECT_SHARE) {
+        pthread_mutex_unlock(&cache_lock);
+        free(n);
+        return -1;
+    }
+    unsigned int h = hash_key(key);
+    cache_entry_t *e = find_entry(key, h);
+    if (e && e->data && !replace) {
+        pthread_mutex_unlock(&cache_lock);
+        free(n);
+        return 0;
+    }
+    if (e) {
+        remove_entry(e);
+        free(e);
+    }
+    cache_entry_t *victims = evict(entry_bytes(n));
+    n->hnext = buckets[h];
+    buckets[h] = n;
+    ring_insert(n);
+    pthread_mutex_unlock(&cache_lock);
+
+    demote(victims);
+    return 0;
+}
+
+int cache_init(uint64_t ram_bytes, const char *disk_dir, uint64_t disk_bytes) {
+    pthread_mutex_lock(&cache_lock);
+    max_bytesG = ram_bytes;
+    pthread_mutex_unlock(&cache_lock);
+    if (disk_dir) {
+        return diskcache_init(disk_dir, disk_bytes);
+    }
+    return 0;
+}
+
+void cache_destroy() {
+    // whatever is in RAM is written out for the next mount
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t *victims = NULL;
+    while (hand) {
+        cache_entry_t *e = hand;
+        remove_entry(e);
+        e->hnext = victims;
+        victims = e;
+    }
+    while (ghost_head) {
+        cache_entry_t *e = ghost_head;
+        remove_entry(e);
+        free(e);
+    }
+    max_bytesG = 0;
+    pthread_mutex_unlock(&cache_lock);
+
+    demote(victims);
+    diskcache_destroy();
+}
+
+int cache_etag(const char *key, char *etag, size_t etag_size) {
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t *e = find_entry(key, hash_key(key));
+    if (e && e->data) {
+        strncpy(etag, e->etag, etag_size - 1);
+        etag[etag_size - 1] = '\0';
+        pthread_mutex_unlock(&cache_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (diskcache_etag(key, etag, etag_size) == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache_lock);
+    statsG.misses++;
+    pthread_mutex_unlock(&cache_lock);
+    return -1;
+}
+
+ssize_t cache_read(const char *key, const char *etag, uint8_t **buf,
+                   ssize_t start_byte, ssize_t byte_count) {
+    unsigned int h = hash_key(key);
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t *e = find_entry(key, h);
+    if (e && e->data && strcmp(e->etag, etag) == 0) {
+        size_t start = start_byte, count = byte_count;
+        if (start_byte == 0 && byte_count == 0) {
+            count = e->len;
+        }
+        if (start > e->len) {
+            start = e->len;
+        }
+        if (count > e->len - start) {
+            count = e->len - start;
+        }
+        uint8_t *data = NULL;
+        if (count > 0) {
+            if (!(data = malloc(count))) {
+                pthread_mutex_unlock(&cache_lock);
+                return -1;
+            }
+            memcpy(data, e->data + start, count);
+        }
+        if (e->freq < CACHE_MAX_FREQ) {
+            e->freq++;
+        }
+        statsG.ram_hits++;
+        pthread_mutex_unlock(&cache_lock);
+        *buf = data;
+        return count;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    ssize_t len = diskcache_read(key, etag, buf, start_byte, byte_count);
+    pthread_mutex_lock(&cache_lock);
+    if (len < 0) {
+        statsG.misses++;
+        pthread_mutex_unlock(&cache_lock);
+        return len;
+    }
+    statsG.disk_hits++;
+
+    // count the hit, and see whether the object has earned a place in RAM
+    int promote = 0;
+    e = find_entry(key, h);
+    if (!e && max_bytesG > 0) {
+        e = new_entry(key, NULL, NULL, 0);
+        if (e) {
+            e->hnext = buckets[h];
+            buckets[h] = e;
+            ghost_push(e);
+        }
+    }
+    if (e && !e->data && e->freq >= 0 &&
+        ++e->freq >= CACHE_PROMOTE_HITS) {
+        promote = 1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (!promote) {
+        return len;
+    }
+
+    uint8_t *full = *buf;
+    ssize_t full_len = len;
+    if (start_byte != 0 || byte_count != 0) {
+        full_len = diskcache_read(key, etag, &full, 0, 0);
+    }
+    int rv = -1;
+    if (full_len >= 0) {
+        rv = ram_insert(key, etag, full, full_len, CACHE_PROMOTE_HITS, 0);
+    }
+    if (full != *buf) {
+        free(full);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if (rv == 0) {
+        statsG.promotions++;
+    } else if ((e = find_entry(key, h)) && !e->data) {
+        e->freq = -1;   // too big for RAM; don't try again
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return len;
+}
+
+void cache_store(const char *key, const char *etag, const uint8_t *buf,
+                 size_t len) {
+    // an object without an ETag can't be revalidated, so it's useless
+    if (!etag || !etag[0]) {
+        cache_invalidate(key);
+        return;
+    }
+    if (ram_insert(key, etag, buf, len, 0, 1) < 0) {
+        // too big for RAM: straight to disk, dropping any older RAM copy
+        pthread_mutex_lock(&cache_lock);
+        cache_entry_t *e = find_entry(key, hash_key(key));
+        if (e) {
+            remove_entry(e);
+            free(e);
+        }
+        pthread_mutex_unlock(&cache_lock);
+        diskcache_store(key, etag, buf, len);
+    }
+}
+
+void cache_invalidate(const char *key) {
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t *e = find_entry(key, hash_key(key));
+    if (e) {
+        remove_entry(e);
+        free(e);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    diskcache_invalidate(key);
+}
+
+uint64_t cache_reclaim(uint64_t bytes) {
+    cache_entry_t *victims = NULL, *e;
+    uint64_t freed = 0;
+    pthread_mutex_lock(&cache_lock);
+    while (freed < bytes && (e = evict_one())) {
+        freed += entry_bytes(e);
+        e->hnext = victims;
+        victims = e;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    demote(victims);
+    return freed;
+}
+
+void cache_stats(cache_stats_t *stats) {
+    pthread_mutex_lock(&cache_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&cache_lock);
+}
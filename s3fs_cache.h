@@ -0,0 +1,74 @@
+#ifndef __S3FS_CACHE_H__
+#define __S3FS_CACHE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The object cache for s3fs: a RAM tier in front of the on-disk tier
+ * (s3fs_diskcache.h), in front of s3 itself.  Every object body s3fs
+ * fetches goes through it, whether it's file contents for fs_read or a
+ * directory object behind fs_getattr, fs_lookup and fs_readdir.
+ *
+ * As with the disk tier, a cached copy is only ever used after
+ * revalidating its ETag with s3; the tiers just decide where the bytes
+ * come from when s3 says they are current.  Objects move between the
+ * tiers by how often they are used: an object hit a few times on disk is
+ * promoted to RAM, and when the RAM tier is full the least frequently
+ * used objects are demoted to disk.  New objects (fetched from or written
+ * to s3) go to RAM first, and everything still in RAM is written to disk
+ * on cache_destroy so that the next mount doesn't start cold.
+ *
+ * All functions are thread-safe.  A RAM size of 0 and no disk directory
+ * make every lookup miss.
+ */
+
+typedef struct {
+    unsigned long ram_hits;     // reads served from RAM
+    unsigned long disk_hits;    // ... from the disk tier
+    unsigned long misses;       // lookups with no usable copy
+    unsigned long promotions;   // objects moved from disk to RAM
+    unsigned long demotions;    // ... and from RAM to disk
+    uint64_t ram_bytes;         // held in RAM now
+    unsigned long ram_objects;
+} cache_stats_t;
+
+/*
+ * Keep up to ram_bytes of objects in RAM and, if disk_dir is non-NULL, up
+ * to disk_bytes in disk_dir (see diskcache_init).  Returns 0, or -1 if
+ * disk_dir is unusable (the RAM tier still works then).
+ */
+int cache_init(uint64_t ram_bytes, const char *disk_dir, uint64_t disk_bytes);
+void cache_destroy();
+
+/*
+ * If key is cached in either tier, copy its ETag into etag (etag_size
+ * bytes) and return 0; otherwise return -1.
+ */
+int cache_etag(const char *key, char *etag, size_t etag_size);
+
+/*
+ * Read byte_count bytes at start_byte (the whole object if both are 0) of
+ * the cached copy of key, which must have ETag etag, into a malloc'ed
+ * buffer *buf.  Returns the number of bytes read (*buf is NULL if that is
+ * 0), or -1 if there is no such copy.
+ */
+ssize_t cache_read(const char *key, const char *etag, uint8_t **buf,
+                   ssize_t start_byte, ssize_t byte_count);
+
+/* Cache len bytes from buf as the contents of key, with ETag etag. */
+void cache_store(const char *key, const char *etag, const uint8_t *buf,
+                 size_t len);
+
+/* Drop any cached copy of key from both tiers. */
+void cache_invalidate(const char *key);
+
+/*
+ * Demote up to bytes of the RAM tier to disk; returns the bytes freed.
+ * This is the object cache's reclaim function for the memory budget.
+ */
+uint64_t cache_reclaim(uint64_t bytes);
+
+void cache_stats(cache_stats_t *stats);
+
+#endif // __S3FS_CACHE_H__
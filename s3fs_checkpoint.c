@@ -0,0 +1,896 @@
+/*
+ * Metadata checkpoints for s3fs; see s3fs_checkpoint.h.
+ *
+ * The header object is a few lines of text:
+ *
+ *     s3fs-checkpoint 2
+ *     seq N            incremented by every write
+ *     next_ino N       the next inode number, when it was written
+ *     ino_limit N      no inode number at or above this is in use
+ *     clean 0|1        written by an unmount
+ *     base N           seq of the checkpoint that wrote the segments, or 0
+ *     deltas K N...    seqs of the deltas written since, oldest first
+ *
+ * A mount carries on from ino_limit, which for a clean checkpoint is just
+ * next_ino, and otherwise leaves room for the lease.
+ *
+ * Segments and deltas are sequences of records, "d <len> <path> <len>
+ * <etag> <last-modified> <len>\n<directory object>\n" for a directory and
+ * "r <len> <path>\n" (deltas only) for one that was removed.  A directory
+ * belongs to the segment of its top-level subtree, so a change deep in
+ * one subtree rewrites one segment.  The header is only ever written
+ * after the segments and deltas it names, and the deltas a compaction
+ * made redundant are removed after the header that no longer names them.
+ *
+ * Every directory we know of (from the snapshot or since) has an entry in
+ * a hash table, with its version, so that fetching an unchanged directory
+ * again isn't taken for a change.  Entries changed since the base also
+ * hold the directory object itself until it is folded into a segment.
+ */
+
+#include "s3fs_checkpoint.h"
+#include "s3fs_inode.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the header's key; paths all start with a "/", so this isn't one, nor
+// are the segments' and deltas' keys, which start with it too
+#define CKPT_KEY ".s3fs-checkpoint"
+#define CKPT_MAGIC "s3fs-checkpoint"
+#define CKPT_VERSION 2
+
+// inode numbers a checkpoint allows for beyond those handed out
+#define CKPT_INO_LEASE 65536
+
+// segments the base of the snapshot is split into
+#define CKPT_SEGMENTS 16
+
+// the deltas are folded into the base once there are this many of them,
+// or once the directories they hold add up to this many bytes
+#define CKPT_MAX_DELTAS 16
+#define CKPT_MAX_PENDING (8 * 1024 * 1024)
+
+#define CKPT_BUCKETS 4096
+
+typedef struct ckpt_dir {
+    char *path;
+    s3fs_object_info_t info;
+    uint8_t *blob;          // directory object, if changed since the base
+    size_t len;             // ... and its length, counted in pendingG
+    int changed;            // since the base
+    int removed;            // ... by being removed
+    int unsaved;            // not in a delta yet
+    uint64_t delta;         // seq of the delta being written with it
+    int snapped;            // taken by the compaction under way
+    unsigned int gen;       // bumped by every change
+    struct ckpt_dir *hnext;
+} ckpt_dir_t;
+
+// a changed directory, as a compaction took it out of the table
+typedef struct {
+    ckpt_dir_t *dir;
+    uint8_t *blob;
+    size_t len;
+    s3fs_object_info_t info;
+    int removed;
+    unsigned int gen;
+} ckpt_snap_t;
+
+// a growable buffer for writing records
+typedef struct {
+    uint8_t *data;
+    size_t len, cap;
+} ckpt_buf_t;
+
+// a position in a buffer of records being read
+typedef struct {
+    const uint8_t *p, *end;
+} ckpt_reader_t;
+
+typedef struct {
+    char type;
+    char *path;             // malloc'ed
+    s3fs_object_info_t info;
+    const uint8_t *blob;
+    size_t len;
+    const uint8_t *start;   // the whole record
+    size_t record_len;
+} ckpt_rec_t;
+
+// held while writing a checkpoint; protects everything but the table
+static pthread_mutex_t ckpt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ckpt_cond = PTHREAD_COND_INITIALIZER;
+static char *bucketG = NULL;
+static uint64_t ino_limitG = 0;
+static uint64_t written_inoG = 0;   // next_ino in the last checkpoint
+static uint64_t baseG = 0;
+static uint64_t deltasG[CKPT_MAX_DELTAS];
+static int num_deltasG = 0;
+static int intervalG = 0;
+static pthread_t ckpt_thread;
+static int runningG = 0;
+static int stoppingG = 0;
+static ckpt_stats_t statsG;
+
+// protects the table of directories; taken after ckpt_lock
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+static ckpt_dir_t *buckets[CKPT_BUCKETS];
+static int trackingG = 0;
+static int unsavedG = 0;            // entries not in a delta yet
+static uint64_t pendingG = 0;       // bytes of directories changed
+
+static unsigned int hash_path(const char *path) {
+    unsigned int h = 5381;
+    while (*path) {
+        h = ((h << 5) + h) + (unsigned char)*path++;
+    }
+    return h % CKPT_BUCKETS;
+}
+
+/* The segment of path's top-level subtree. */
+static int segment_of(const char *path) {
+    unsigned int h = 5381;
+    for (const char *p = path + 1; *p && *p != '/'; p++) {
+        h = ((h << 5) + h) + (unsigned char)*p;
+    }
+    return h % CKPT_SEGMENTS;
+}
+
+static void segment_key(int seg, char *key, size_t size) {
+    snprintf(key, size, "%s.seg.%02d", CKPT_KEY, seg);
+}
+
+static void delta_key(uint64_t seq, char *key, size_t size) {
+    snprintf(key, size, "%s.delta.%" PRIu64, CKPT_KEY, seq);
+}
+
+static int same_version(const s3fs_object_info_t *a,
+                        const s3fs_object_info_t *b) {
+    if (a->eTag[0] || b->eTag[0]) {
+        return strcmp(a->eTag, b->eTag) == 0;
+    }
+    return a->lastModified >= 0 && a->lastModified == b->lastModified;
+}
+
+/* Called with tree_lock. */
+static ckpt_dir_t *find_dir(const char *path) {
+    ckpt_dir_t *e = buckets[hash_path(path)];
+    while (e && strcmp(e->path, path) != 0) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+/* Called with tree_lock.  Returns NULL if out of memory. */
+static ckpt_dir_t *add_dir(const char *path) {
+    ckpt_dir_t *e = calloc(1, sizeof(ckpt_dir_t));
+    if (!e || !(e->path = strdup(path))) {
+        free(e);
+        return NULL;
+    }
+    e->info.lastModified = -1;
+    unsigned int h = hash_path(path);
+    e->hnext = buckets[h];
+    buckets[h] = e;
+    return e;
+}
+
+/* Called with tree_lock. */
+static void drop_dir(ckpt_dir_t *e) {
+    ckpt_dir_t **pp = &buckets[hash_path(e->path)];
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+    if (e->unsaved) {
+        unsavedG--;
+    }
+    if (e->changed) {
+        pendingG -= e->len;
+    }
+    free(e->blob);
+    free(e->path);
+    free(e);
+}
+
+/* Forget every directory.  Called with tree_lock. */
+static void clear_table() {
+    for (int i = 0; i < CKPT_BUCKETS; i++) {
+        while (buckets[i]) {
+            drop_dir(buckets[i]);
+        }
+    }
+    unsavedG = 0;
+    pendingG = 0;
+}
+
+/*
+ * Record a change to e: blob (taken over) of len bytes, or its removal if
+ * blob is NULL.  Called with tree_lock.
+ */
+static void change_dir(ckpt_dir_t *e, uint8_t *blob, size_t len,
+                       const s3fs_object_info_t *info) {
+    if (e->changed) {
+        pendingG -= e->len;
+    }
+    free(e->blob);
+    e->blob = blob;
+    e->len = blob ? len : 0;
+    e->removed = !blob;
+    if (info) {
+        e->info = *info;
+    }
+    e->changed = 1;
+    pendingG += e->len;
+    if (!e->unsaved) {
+        e->unsaved = 1;
+        unsavedG++;
+    }
+    e->gen++;
+}
+
+static int buf_append(ckpt_buf_t *b, const void *data, size_t len) {
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len) {
+            cap *= 2;
+        }
+        uint8_t *grown = realloc(b->data, cap);
+        if (!grown) {
+            return -1;
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+/* Append the record for a directory (blob != NULL) or its removal. */
+static int put_record(ckpt_buf_t *b, const char *path,
+                      const s3fs_object_info_t *info, const uint8_t *blob,
+                      size_t len) {
+    char head[S3FS_ETAG_SIZE + 64];
+    size_t path_len = strlen(path);
+    int n = snprintf(head, sizeof(head), "%c %zu ", blob ? 'd' : 'r',
+                     path_len);
+    if (buf_append(b, head, n) < 0 || buf_append(b, path, path_len) < 0) {
+        return -1;
+    }
+    if (!blob) {
+        return buf_append(b, "\n", 1);
+    }
+    n = snprintf(head, sizeof(head), " %zu %s %" PRId64 " %zu\n",
+                 strlen(info->eTag), info->eTag, info->lastModified, len);
+    if (buf_append(b, head, n) < 0 || buf_append(b, blob, len) < 0) {
+        return -1;
+    }
+    return buf_append(b, "\n", 1);
+}
+
+/* Read a number ended by sep. */
+static int read_num(ckpt_reader_t *r, int64_t *num, char sep) {
+    int neg = (r->p < r->end && *r->p == '-');
+    if (neg) {
+        r->p++;
+    }
+    const uint8_t *start = r->p;
+    int64_t n = 0;
+    while (r->p < r->end && *r->p >= '0' && *r->p <= '9') {
+        n = n * 10 + (*r->p++ - '0');
+    }
+    if (r->p == start || r->p == r->end || *r->p++ != sep) {
+        return -1;
+    }
+    *num = neg ? -n : n;
+    return 0;
+}
+
+/* Read len bytes followed by sep. */
+static const uint8_t *read_bytes(ckpt_reader_t *r, int64_t len, char sep) {
+    if (len < 0 || r->end - r->p < len + 1 || r->p[len] != sep) {
+        return NULL;
+    }
+    const uint8_t *bytes = r->p;
+    r->p += len + 1;
+    return bytes;
+}
+
+/*
+ * Read the next record into rec (free rec->path after).  Returns 1, or 0
+ * at the end, or -1 if the rest is malformed.
+ */
+static int read_record(ckpt_reader_t *r, ckpt_rec_t *rec) {
+    if (r->p == r->end) {
+        return 0;
+    }
+    memset(rec, 0, sizeof(*rec));
+    rec->start = r->p;
+    rec->info.lastModified = -1;
+    int64_t len;
+    const uint8_t *path;
+    if (r->end - r->p < 2 || (*r->p != 'd' && *r->p != 'r') ||
+        r->p[1] != ' ') {
+        return -1;
+    }
+    rec->type = *r->p;
+    r->p += 2;
+    if (read_num(r, &len, ' ') < 0 ||
+        !(path = read_bytes(r, len, rec->type == 'd' ? ' ' : '\n'))) {
+        return -1;
+    }
+    if (rec->type == 'd') {
+        int64_t etag_len, blob_len;
+        const uint8_t *etag;
+        if (read_num(r, &etag_len, ' ') < 0 || etag_len >= S3FS_ETAG_SIZE ||
+            !(etag = read_bytes(r, etag_len, ' ')) ||
+            read_num(r, &rec->info.lastModified, ' ') < 0 ||
+            read_num(r, &blob_len, '\n') < 0 ||
+            !(rec->blob = read_bytes(r, blob_len, '\n'))) {
+            return -1;
+        }
+        memcpy(rec->info.eTag, etag, etag_len);
+        rec->info.eTag[etag_len] = '\0';
+        rec->len = blob_len;
+    }
+    if (!(rec->path = strndup((const char *)path, len))) {
+        return -1;
+    }
+    rec->record_len = r->p - rec->start;
+    return 1;
+}
+
+/* Write the header.  Called with ckpt_lock. */
+static int write_ckpt(uint64_t next_ino, uint64_t ino_limit, int clean) {
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf),
+                       "%s %d\nseq %" PRIu64 "\nnext_ino %" PRIu64 "\n"
+                       "ino_limit %" PRIu64 "\nclean %d\nbase %" PRIu64
+                       "\ndeltas %d", CKPT_MAGIC, CKPT_VERSION,
+                       statsG.seq + 1, next_ino, ino_limit, clean, baseG,
+                       num_deltasG);
+    for (int i = 0; i < num_deltasG; i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, " %" PRIu64,
+                        deltasG[i]);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "\n");
+    if (s3fs_put_object(bucketG, CKPT_KEY, (uint8_t *)buf, len) < 0) {
+        fprintf(stderr, "checkpoint: can't write checkpoint %" PRIu64 "\n",
+                statsG.seq + 1);
+        statsG.failures++;
+        return -1;
+    }
+    statsG.seq++;
+    statsG.writes++;
+    ino_limitG = ino_limit;
+    written_inoG = next_ino;
+    return 0;
+}
+
+/* A checkpoint of the mounted file system.  Called with ckpt_lock. */
+static int write_mounted() {
+    uint64_t next_ino = inode_next();
+    uint64_t limit = next_ino + CKPT_INO_LEASE;
+    return write_ckpt(next_ino, limit > ino_limitG ? limit : ino_limitG, 0);
+}
+
+/* The final checkpoint.  Called with ckpt_lock. */
+static int write_clean() {
+    uint64_t next_ino = inode_next();
+    return write_ckpt(next_ino, next_ino, 1);
+}
+
+/*
+ * Write the directories changed since the last delta as a new one, and
+ * a checkpoint naming it.  Called with ckpt_lock.
+ */
+static int write_delta() {
+    uint64_t seq = statsG.seq + 1;
+    ckpt_buf_t out = { NULL, 0, 0 };
+    int rv = 0;
+    pthread_mutex_lock(&tree_lock);
+    for (int i = 0; i < CKPT_BUCKETS && rv == 0; i++) {
+        for (ckpt_dir_t *e = buckets[i]; e && rv == 0; e = e->hnext) {
+            if (e->unsaved) {
+                rv = put_record(&out, e->path, &e->info, e->blob, e->len);
+                e->unsaved = 0;
+                e->delta = seq;
+                unsavedG--;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tree_lock);
+
+    if (rv == 0) {
+        char key[64];
+        delta_key(seq, key, sizeof(key));
+        rv = s3fs_put_object(bucketG, key, out.data, out.len) < 0 ? -1 : 0;
+        if (rv < 0) {
+            fprintf(stderr, "checkpoint: can't write delta %" PRIu64 "\n",
+                    seq);
+            statsG.failures++;
+        }
+    }
+    free(out.data);
+    if (rv == 0) {
+        deltasG[num_deltasG++] = seq;
+        if ((rv = write_mounted()) == 0) {
+            statsG.deltas++;
+            return 0;
+        }
+        num_deltasG--;
+    }
+
+    // the next delta has to have them
+    pthread_mutex_lock(&tree_lock);
+    for (int i = 0; i < CKPT_BUCKETS; i++) {
+        for (ckpt_dir_t *e = buckets[i]; e; e = e->hnext) {
+            if (e->delta == seq && !e->unsaved) {
+                e->unsaved = 1;
+                unsavedG++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tree_lock);
+    return -1;
+}
+
+/*
+ * Rewrite segment seg of the base with the count changed directories in
+ * snaps that belong to it.  Called with ckpt_lock.
+ */
+static int write_segment(int seg, ckpt_snap_t *snaps, int count) {
+    char key[64];
+    segment_key(seg, key, sizeof(key));
+    uint8_t *old = NULL;
+    ssize_t old_len = 0;
+    if (baseG != 0 &&
+        (old_len = s3fs_get_object(bucketG, key, &old, 0, 0)) < 0) {
+        free(old);
+        return -1;
+    }
+
+    // what's unchanged, then what's changed
+    ckpt_buf_t out = { NULL, 0, 0 };
+    ckpt_reader_t r = { old, old + (old_len > 0 ? old_len : 0) };
+    ckpt_rec_t rec;
+    int rv = 0, got;
+    while (rv == 0 && (got = read_record(&r, &rec)) > 0) {
+        pthread_mutex_lock(&tree_lock);
+        ckpt_dir_t *e = find_dir(rec.path);
+        int replaced = e && e->snapped;
+        pthread_mutex_unlock(&tree_lock);
+        if (!replaced) {
+            rv = buf_append(&out, rec.start, rec.record_len);
+        }
+        free(rec.path);
+    }
+    for (int i = 0; i < count && rv == 0; i++) {
+        if (segment_of(snaps[i].dir->path) == seg && !snaps[i].removed) {
+            rv = put_record(&out, snaps[i].dir->path, &snaps[i].info,
+                            snaps[i].blob, snaps[i].len);
+        }
+    }
+    free(old);
+    if (rv == 0 && s3fs_put_object(bucketG, key, out.data, out.len) < 0) {
+        fprintf(stderr, "checkpoint: can't write segment %d\n", seg);
+        rv = -1;
+    }
+    free(out.data);
+    return rv;
+}
+
+/*
+ * Fold everything changed since the base into it, rewriting just the
+ * segments with changes, and write a checkpoint with no deltas.  Called
+ * with ckpt_lock.
+ */
+static int compact(int clean) {
+    // take the changes out of the table; anything changed from here on
+    // is left for the next delta
+    ckpt_snap_t *snaps = NULL;
+    int count = 0, cap = 0, rv = 0;
+    int touched[CKPT_SEGMENTS] = { 0 };
+    pthread_mutex_lock(&tree_lock);
+    for (int i = 0; i < CKPT_BUCKETS && rv == 0; i++) {
+        for (ckpt_dir_t *e = buckets[i]; e; e = e->hnext) {
+            if (!e->changed) {
+                continue;
+            }
+            if (count == cap) {
+                cap = cap ? cap * 2 : 64;
+                ckpt_snap_t *n = realloc(snaps, cap * sizeof(ckpt_snap_t));
+                if (!n) {
+                    rv = -1;
+                    break;
+                }
+                snaps = n;
+            }
+            ckpt_snap_t *s = &snaps[count++];
+            s->dir = e;
+            s->blob = e->blob;
+            s->len = e->len;
+            s->info = e->info;
+            s->removed = e->removed;
+            s->gen = e->gen;
+            e->blob = NULL;
+            e->snapped = 1;
+            if (e->unsaved) {
+                e->unsaved = 0;
+                unsavedG--;
+            }
+            touched[segment_of(e->path)] = 1;
+        }
+    }
+    pthread_mutex_unlock(&tree_lock);
+
+    for (int seg = 0; seg < CKPT_SEGMENTS && rv == 0; seg++) {
+        if (touched[seg] || baseG == 0) {
+            rv = write_segment(seg, snaps, count);
+        }
+    }
+
+    uint64_t old_base = baseG;
+    uint64_t old_deltas[CKPT_MAX_DELTAS];
+    int old_num_deltas = num_deltasG;
+    memcpy(old_deltas, deltasG, sizeof(old_deltas));
+    if (rv == 0) {
+        baseG = statsG.seq + 1;
+        num_deltasG = 0;
+        rv = clean ? write_clean() : write_mounted();
+        if (rv < 0) {
+            baseG = old_base;
+            num_deltasG = old_num_deltas;
+        }
+    }
+
+    pthread_mutex_lock(&tree_lock);
+    for (int i = 0; i < count; i++) {
+        ckpt_dir_t *e = snaps[i].dir;
+        e->snapped = 0;
+        if (e->gen != snaps[i].gen) {
+            // changed again meanwhile, and that isn't in the base
+            free(snaps[i].blob);
+            if (rv < 0 && !e->unsaved) {
+                e->unsaved = 1;
+                unsavedG++;
+            }
+        } else if (rv < 0) {
+            e->blob = snaps[i].blob;
+            if (!e->unsaved) {
+                e->unsaved = 1;
+                unsavedG++;
+            }
+        } else if (snaps[i].removed) {
+            drop_dir(e);
+        } else {
+            free(snaps[i].blob);
+            pendingG -= e->len;
+            e->len = 0;
+            e->changed = 0;
+        }
+    }
+    pthread_mutex_unlock(&tree_lock);
+    free(snaps);
+
+    if (rv < 0) {
+        fprintf(stderr, "checkpoint: can't fold deltas into the base\n");
+        return -1;
+    }
+    statsG.compactions++;
+
+    // the deltas are redundant now
+    if (old_num_deltas > 0) {
+        char keys[CKPT_MAX_DELTAS][64];
+        const char *key_ptrs[CKPT_MAX_DELTAS];
+        int results[CKPT_MAX_DELTAS];
+        for (int i = 0; i < old_num_deltas; i++) {
+            delta_key(old_deltas[i], keys[i], sizeof(keys[i]));
+            key_ptrs[i] = keys[i];
+        }
+        s3fs_remove_objects(bucketG, key_ptrs, old_num_deltas, results);
+    }
+    return 0;
+}
+
+/* Bring the checkpoint up to date.  Called with ckpt_lock. */
+static void update() {
+    pthread_mutex_lock(&tree_lock);
+    int unsaved = unsavedG;
+    int fold = pendingG >= CKPT_MAX_PENDING;
+    pthread_mutex_unlock(&tree_lock);
+
+    if (unsaved && num_deltasG < CKPT_MAX_DELTAS && !fold) {
+        write_delta();
+    } else if (unsaved || fold) {
+        compact(0);
+    } else if (inode_next() != written_inoG) {
+        write_mounted();
+    }
+}
+
+static void *ckpt_main(void *arg) {
+    pthread_mutex_lock(&ckpt_lock);
+    while (!stoppingG) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += intervalG;
+        pthread_cond_timedwait(&ckpt_cond, &ckpt_lock, &deadline);
+        if (!stoppingG) {
+            update();
+        }
+    }
+    pthread_mutex_unlock(&ckpt_lock);
+    return NULL;
+}
+
+/*
+ * Apply the records of a delta to the table, as changes since the base.
+ * Called with tree_lock.
+ */
+static void replay_delta(const uint8_t *buf, size_t len) {
+    ckpt_reader_t r = { buf, buf + len };
+    ckpt_rec_t rec;
+    int got;
+    while ((got = read_record(&r, &rec)) > 0) {
+        ckpt_dir_t *e = find_dir(rec.path);
+        uint8_t *blob = NULL;
+        if (rec.type == 'd' && !(blob = malloc(rec.len ? rec.len : 1))) {
+            free(rec.path);
+            break;
+        }
+        if (blob) {
+            memcpy(blob, rec.blob, rec.len);
+        }
+        if (e || (e = add_dir(rec.path))) {
+            change_dir(e, blob, rec.len, rec.type == 'd' ? &rec.info : NULL);
+            e->unsaved = 0;
+            unsavedG--;
+        } else {
+            free(blob);
+        }
+        free(rec.path);
+    }
+    if (got < 0) {
+        fprintf(stderr, "checkpoint: ignoring the rest of a malformed "
+                "delta\n");
+    }
+}
+
+/*
+ * Hand the directories in a segment to dir, except those the deltas
+ * replaced, and remember their versions.  Called with tree_lock.
+ */
+static void load_segment(const uint8_t *buf, size_t len, ckpt_dir_fn dir,
+                         void *arg) {
+    ckpt_reader_t r = { buf, buf + len };
+    ckpt_rec_t rec;
+    int got;
+    while ((got = read_record(&r, &rec)) > 0) {
+        ckpt_dir_t *e;
+        if (rec.type == 'd' && !find_dir(rec.path) &&
+            (e = add_dir(rec.path))) {
+            e->info = rec.info;
+            dir(arg, rec.path, rec.blob, rec.len, &rec.info);
+            statsG.dirs_loaded++;
+        }
+        free(rec.path);
+    }
+    if (got < 0) {
+        fprintf(stderr, "checkpoint: ignoring the rest of a malformed "
+                "segment\n");
+    }
+}
+
+/* Read the snapshot named by the header.  Called with ckpt_lock. */
+static void load_tree(ckpt_dir_fn dir, void *arg) {
+    uint8_t *buf;
+    ssize_t len;
+    char key[64];
+    pthread_mutex_lock(&tree_lock);
+    for (int i = 0; i < num_deltasG; i++) {
+        buf = NULL;
+        delta_key(deltasG[i], key, sizeof(key));
+        if ((len = s3fs_get_object(bucketG, key, &buf, 0, 0)) >= 0) {
+            replay_delta(buf, len);
+        } else {
+            fprintf(stderr, "checkpoint: can't read delta %" PRIu64 "\n",
+                    deltasG[i]);
+        }
+        free(buf);
+    }
+    for (int seg = 0; seg < CKPT_SEGMENTS && baseG != 0; seg++) {
+        buf = NULL;
+        segment_key(seg, key, sizeof(key));
+        if ((len = s3fs_get_object(bucketG, key, &buf, 0, 0)) >= 0) {
+            load_segment(buf, len, dir, arg);
+        } else {
+            fprintf(stderr, "checkpoint: can't read segment %d\n", seg);
+        }
+        free(buf);
+    }
+    for (int i = 0; i < CKPT_BUCKETS; i++) {
+        for (ckpt_dir_t *e = buckets[i]; e; e = e->hnext) {
+            if (e->changed && !e->removed) {
+                dir(arg, e->path, e->blob, e->len, &e->info);
+                statsG.dirs_loaded++;
+            }
+        }
+    }
+    trackingG = 1;
+    pthread_mutex_unlock(&tree_lock);
+}
+
+int ckpt_load(const char *bucket, ckpt_dir_fn dir, void *arg) {
+    pthread_mutex_lock(&ckpt_lock);
+    free(bucketG);
+    bucketG = strdup(bucket);
+    memset(&statsG, 0, sizeof(statsG));
+    baseG = 0;
+    num_deltasG = 0;
+    pthread_mutex_lock(&tree_lock);
+    clear_table();
+    trackingG = 1;
+    pthread_mutex_unlock(&tree_lock);
+    pthread_mutex_unlock(&ckpt_lock);
+
+    uint8_t *buf = NULL;
+    ssize_t len = s3fs_get_object(bucket, CKPT_KEY, &buf, 0, 0);
+    if (len <= 0) {
+        free(buf);
+        return -1;
+    }
+    char *text = realloc(buf, len + 1);
+    if (!text) {
+        free(buf);
+        return -1;
+    }
+    text[len] = '\0';
+
+    char magic[32];
+    int version, clean, n, used = 0;
+    uint64_t seq, next_ino, ino_limit, base = 0;
+    uint64_t deltas[CKPT_MAX_DELTAS];
+    int num_deltas = 0;
+    n = sscanf(text, "%31s %d seq %" SCNu64 " next_ino %" SCNu64
+               " ino_limit %" SCNu64 " clean %d%n", magic, &version, &seq,
+               &next_ino, &ino_limit, &clean, &used);
+    int ok = (n == 6 && strcmp(magic, CKPT_MAGIC) == 0 &&
+              version >= 1 && version <= CKPT_VERSION &&
+              ino_limit >= next_ino);
+    if (ok && version >= 2) {
+        // the snapshot; version 1 had none
+        char *p = text + used;
+        ok = (sscanf(p, " base %" SCNu64 " deltas %d%n", &base, &num_deltas,
+                     &used) == 2 &&
+              num_deltas >= 0 && num_deltas <= CKPT_MAX_DELTAS);
+        for (int i = 0; ok && i < num_deltas; i++) {
+            p += used;
+            ok = (sscanf(p, " %" SCNu64 "%n", &deltas[i], &used) == 1);
+        }
+    }
+    free(text);
+    if (!ok) {
+        fprintf(stderr, "checkpoint: ignoring malformed checkpoint\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ckpt_lock);
+    statsG.seq = seq;
+    ino_limitG = ino_limit;
+    baseG = base;
+    num_deltasG = num_deltas;
+    memcpy(deltasG, deltas, num_deltas * sizeof(uint64_t));
+    pthread_mutex_unlock(&ckpt_lock);
+    if (ino_limit > S3FS_ROOT_INO) {
+        inode_reserve(ino_limit - 1);
+    }
+
+    pthread_mutex_lock(&ckpt_lock);
+    load_tree(dir, arg);
+    pthread_mutex_unlock(&ckpt_lock);
+    return clean ? CKPT_CLEAN : CKPT_RECOVERED;
+}
+
+int ckpt_start(int interval) {
+    pthread_mutex_lock(&ckpt_lock);
+    // the deltas replayed by ckpt_load go into the base right away
+    int rv = (num_deltasG > 0) ? compact(0) : -1;
+    if (rv < 0) {
+        rv = write_mounted();
+    }
+    intervalG = interval;
+    stoppingG = 0;
+    pthread_mutex_unlock(&ckpt_lock);
+    if (interval > 0) {
+        if (pthread_create(&ckpt_thread, NULL, ckpt_main, NULL) != 0) {
+            fprintf(stderr, "checkpoint: can't start checkpoint thread\n");
+        } else {
+            runningG = 1;
+        }
+    }
+    return rv;
+}
+
+void ckpt_cover_ino(uint64_t ino) {
+    pthread_mutex_lock(&ckpt_lock);
+    if (bucketG && ino >= ino_limitG) {
+        write_ckpt(ino + 1, ino + 1 + CKPT_INO_LEASE, 0);
+    }
+    pthread_mutex_unlock(&ckpt_lock);
+}
+
+void ckpt_note_dir(const char *path, const uint8_t *buf, size_t len,
+                   const s3fs_object_info_t *info) {
+    pthread_mutex_lock(&tree_lock);
+    if (!trackingG) {
+        pthread_mutex_unlock(&tree_lock);
+        return;
+    }
+    ckpt_dir_t *e = find_dir(path);
+    if (e && !e->removed && same_version(&e->info, info)) {
+        pthread_mutex_unlock(&tree_lock);
+        return;
+    }
+    uint8_t *blob = malloc(len ? len : 1);
+    if (blob && (e || (e = add_dir(path)))) {
+        memcpy(blob, buf, len);
+        change_dir(e, blob, len, info);
+    } else {
+        free(blob);
+    }
+    pthread_mutex_unlock(&tree_lock);
+}
+
+void ckpt_forget_dir(const char *path) {
+    pthread_mutex_lock(&tree_lock);
+    ckpt_dir_t *e;
+    if (trackingG && ((e = find_dir(path)) || (e = add_dir(path))) &&
+        !e->removed) {
+        change_dir(e, NULL, 0, NULL);
+    }
+    pthread_mutex_unlock(&tree_lock);
+}
+
+void ckpt_stop() {
+    if (runningG) {
+        pthread_mutex_lock(&ckpt_lock);
+        stoppingG = 1;
+        pthread_cond_signal(&ckpt_cond);
+        pthread_mutex_unlock(&ckpt_lock);
+        pthread_join(ckpt_thread, NULL);
+        runningG = 0;
+    }
+
+    pthread_mutex_lock(&ckpt_lock);
+    if (bucketG) {
+        pthread_mutex_lock(&tree_lock);
+        int changed = (unsavedG > 0 || num_deltasG > 0);
+        pthread_mutex_unlock(&tree_lock);
+        if (!changed || compact(1) < 0) {
+            // what the deltas don't have is left out of the snapshot,
+            // which is merely out of date
+            write_clean();
+        }
+        free(bucketG);
+        bucketG = NULL;
+    }
+
+    pthread_mutex_lock(&tree_lock);
+    trackingG = 0;
+    clear_table();
+    pthread_mutex_unlock(&tree_lock);
+    pthread_mutex_unlock(&ckpt_lock);
+}
+
+void ckpt_stats(ckpt_stats_t *stats) {
+    pthread_mutex_lock(&ckpt_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&ckpt_lock);
+}
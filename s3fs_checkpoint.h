@@ -0,0 +1,95 @@
+#ifndef __S3FS_CHECKPOINT_H__
+#define __S3FS_CHECKPOINT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libs3_wrapper.h"
+
+/*
+ * Metadata checkpoints, for mounting a file system that is already in the
+ * bucket.
+ *
+ * The tree itself lives in the directory objects, which are loaded lazily
+ * as paths are looked up, so a mount needs a checkpoint for one thing they
+ * don't hold: how far inode numbers have been handed out.  That goes into
+ * a small header object in the bucket (under a key that isn't a path),
+ * written when the file system is mounted and unmounted, every interval
+ * seconds while it is mounted, and whenever inode numbers run past what
+ * the last checkpoint allowed for.  A checkpoint written while mounted
+ * leaves room for a lease of inode numbers beyond those handed out so far,
+ * so after a crash the next mount carries on past any number that may be
+ * in use.
+ *
+ * The checkpoint also keeps a snapshot of the directory objects, with the
+ * version (ETag) of each, so that a mount can start with every directory
+ * cached instead of downloading them one lookup at a time.  The snapshot
+ * is a base, split into segments by top-level subtree, plus the deltas
+ * (directories written or removed) since.  A delta is written every
+ * interval in which a directory changed; once there are enough of them,
+ * they are folded into the base, rewriting only the segments they touch.
+ * Nothing depends on the snapshot being current: what it hands out is
+ * only a copy of some version of a directory, to be revalidated against
+ * s3 before use, so a snapshot that a crash left behind is as good as
+ * any.
+ *
+ * All functions are thread-safe.
+ */
+
+#define CKPT_CLEAN 0        // the last mount was unmounted cleanly
+#define CKPT_RECOVERED 1    // it wasn't; we carry on past its lease
+
+typedef struct {
+    uint64_t seq;               // of the last checkpoint written
+    unsigned long writes;       // checkpoints written by this mount
+    unsigned long failures;
+    unsigned long deltas;       // of which added a delta
+    unsigned long compactions;  // ... or folded the deltas into the base
+    unsigned long dirs_loaded;  // directories handed out by ckpt_load
+} ckpt_stats_t;
+
+/*
+ * The directory object at path, of version info, is len bytes at buf;
+ * called by ckpt_load for each directory in the snapshot.
+ */
+typedef void (*ckpt_dir_fn)(void *arg, const char *path, const uint8_t *buf,
+                            size_t len, const s3fs_object_info_t *info);
+
+/*
+ * Read the checkpoint in bucket and move the inode allocator past every
+ * number it covers, then hand each directory in its snapshot (the base
+ * with the deltas replayed on top) to dir(arg, ...).  Returns CKPT_CLEAN
+ * or CKPT_RECOVERED, or -1 if there is no (usable) checkpoint.  From
+ * here on, changes to directories are tracked for the next checkpoint.
+ */
+int ckpt_load(const char *bucket, ckpt_dir_fn dir, void *arg);
+
+/*
+ * Write the checkpoint of the mounted file system, and from then on every
+ * interval seconds (if interval > 0).  Returns 0, or -1 if it couldn't be
+ * written.
+ */
+int ckpt_start(int interval);
+
+/*
+ * Inode number ino has just been handed out; make sure a checkpoint covers
+ * it before it is used.
+ */
+void ckpt_cover_ino(uint64_t ino);
+
+/*
+ * The directory object at path is now the len bytes at buf, of version
+ * info (just written to or fetched from s3).
+ */
+void ckpt_note_dir(const char *path, const uint8_t *buf, size_t len,
+                   const s3fs_object_info_t *info);
+
+/* The directory object at path is gone (or no longer a directory). */
+void ckpt_forget_dir(const char *path);
+
+/* Write the final checkpoint, marked clean, and stop. */
+void ckpt_stop();
+
+void ckpt_stats(ckpt_stats_t *stats);
+
+#endif // __S3FS_CHECKPOINT_H__
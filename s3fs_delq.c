@@ -0,0 +1,475 @@
+/*
+ * Background delete queue for s3fs; see s3fs_delq.h.
+ *
+ * Keys are kept in a hash table, and those waiting to be removed are also
+ * on a FIFO queue.  Drain jobs on the request engine take keys off the
+ * queue in batches (a key being removed is marked running, and stays in
+ * the table until it's done), so the queue is worked on by up to jobs
+ * threads at once.  A key whose removal keeps failing is left in the
+ * table as failed: it still counts as pending, and it stays in the log
+ * so the next mount tries again.  Until then, a key whose removal failed
+ * waits out a backoff on a second list, which a delayed job puts back on
+ * the queue, so that no worker sleeps through it.
+ *
+ * The intent log is a text file of records "D <len> <key>\n" (remove key)
+ * and "C <len> <key>\n" (key was removed, or written again, so forget the
+ * earlier D).  Every record is on disk before we act on it.  The log is
+ * emptied whenever nothing is pending, and rewritten when it is replayed.
+ */
+
+#include "s3fs_delq.h"
+#include "s3fs_async.h"
+#include "libs3_wrapper.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DELQ_BUCKETS 1024
+
+// most keys handed to the remove function at once (also s3's limit for a
+// multi-object delete)
+#define DELQ_BATCH 1000
+
+// a key is tried this many times before it's left for the next mount
+#define DELQ_MAX_TRIES 3
+
+#define DELQ_QUEUED 0
+#define DELQ_RUNNING 1
+#define DELQ_FAILED 2
+#define DELQ_WAITING 3      // to be queued again after a backoff
+
+typedef struct delq_entry {
+    char *key;
+    int state;
+    int tries;
+    struct delq_entry *hnext;           // hash chain
+    struct delq_entry *prev, *next;     // queue or wait list
+} delq_entry_t;
+
+static pthread_mutex_t delq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delq_cond = PTHREAD_COND_INITIALIZER;
+static delq_entry_t *buckets[DELQ_BUCKETS];
+static delq_entry_t *queue_head = NULL, *queue_tail = NULL;
+static int queue_lenG = 0;      // keys on the queue
+static delq_entry_t *wait_head = NULL;
+static int wait_triesG = 0;     // most tries of a key on the wait list
+static int retry_jobG = 0;      // a retry job is waiting to run
+static int pendingG = 0;        // keys in the table
+static int jobsG = 0;           // drain jobs submitted and not finished
+static int max_jobsG = 1;
+static delq_remove_fn removeG = NULL;
+static void *argG = NULL;
+static FILE *logG = NULL;
+static delq_stats_t statsG;
+
+static unsigned int hash_key(const char *key) {
+    unsigned int h = 5381;
+    while (*key) {
+        h = ((h << 5) + h) + (unsigned char)*key++;
+    }
+    return h % DELQ_BUCKETS;
+}
+
+static delq_entry_t *find_entry(const char *key) {
+    delq_entry_t *e = buckets[hash_key(key)];
+    while (e && strcmp(e->key, key) != 0) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+static void queue_append(delq_entry_t *e) {
+    e->state = DELQ_QUEUED;
+    e->next = NULL;
+    e->prev = queue_tail;
+    if (queue_tail) {
+        queue_tail->next = e;
+    } else {
+        queue_head = e;
+    }
+    queue_tail = e;
+    queue_lenG++;
+}
+
+static void queue_unlink(delq_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        queue_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        queue_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+    queue_lenG--;
+}
+
+static void wait_add(delq_entry_t *e) {
+    e->state = DELQ_WAITING;
+    e->prev = NULL;
+    e->next = wait_head;
+    if (wait_head) {
+        wait_head->prev = e;
+    }
+    wait_head = e;
+    if (e->tries > wait_triesG) {
+        wait_triesG = e->tries;
+    }
+}
+
+static void wait_unlink(delq_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        wait_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+/* Put every key on the wait list back on the queue.  Called with delq_lock. */
+static void requeue_waiting() {
+    while (wait_head) {
+        delq_entry_t *e = wait_head;
+        wait_unlink(e);
+        queue_append(e);
+    }
+    wait_triesG = 0;
+}
+
+/* Add key to the table (not to the queue).  Returns NULL if out of memory. */
+static delq_entry_t *add_entry(const char *key) {
+    delq_entry_t *e = calloc(1, sizeof(delq_entry_t));
+    if (!e || !(e->key = strdup(key))) {
+        free(e);
+        return NULL;
+    }
+    unsigned int h = hash_key(key);
+    e->hnext = buckets[h];
+    buckets[h] = e;
+    pendingG++;
+    return e;
+}
+
+/* Take e out of the table and free it; it must be off the queue. */
+static void drop_entry(delq_entry_t *e) {
+    delq_entry_t **pp = &buckets[hash_key(e->key)];
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+    pendingG--;
+    free(e->key);
+    free(e);
+}
+
+/* Append a record to the log; it is durable after log_sync. */
+static int log_write(FILE *log, char type, const char *key) {
+    if (!log) {
+        return 0;
+    }
+    return fprintf(log, "%c %zu %s\n", type, strlen(key), key) < 0 ? -1 : 0;
+}
+
+static int log_sync(FILE *log) {
+    if (!log) {
+        return 0;
+    }
+    if (fflush(log) != 0 || fdatasync(fileno(log)) != 0) {
+        fprintf(stderr, "delq: can't write the delete log\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Empty the log if it no longer says anything.  Called with delq_lock. */
+static void log_trim() {
+    if (logG && pendingG == 0 && ftruncate(fileno(logG), 0) != 0) {
+        fprintf(stderr, "delq: can't truncate the delete log\n");
+    }
+}
+
+/*
+ * Queue whatever the log at path says is still pending.  A record cut
+ * short by a crash ends the log.
+ */
+static void replay(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
+    }
+    char type;
+    size_t len;
+    while (fscanf(f, "%c %zu", &type, &len) == 2 && fgetc(f) == ' ') {
+        char *key = malloc(len + 1);
+        if (!key || fread(key, 1, len, f) != len || fgetc(f) != '\n') {
+            free(key);
+            break;
+        }
+        key[len] = '\0';
+        delq_entry_t *e = find_entry(key);
+        if (type == 'D' && !e && (e = add_entry(key))) {
+            queue_append(e);
+            statsG.queued++;
+            statsG.replayed++;
+        } else if (type == 'C' && e) {
+            queue_unlink(e);
+            drop_entry(e);
+            statsG.queued--;
+            statsG.replayed--;
+        }
+        free(key);
+    }
+    fclose(f);
+}
+
+/* Replace the log at path with one holding just what's queued. */
+static int rewrite_log(const char *path) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        return -1;
+    }
+    int rv = 0;
+    for (delq_entry_t *e = queue_head; e && rv == 0; e = e->next) {
+        rv = log_write(f, 'D', e->key);
+    }
+    if (rv == 0) {
+        rv = log_sync(f);
+    }
+    if (fclose(f) != 0 || rv < 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void drain_job(void *arg);
+static void retry_job(void *arg);
+
+/* The most drain jobs to have running right now. */
+static int job_limit() {
+    int window = s3fs_window();
+    return (window < max_jobsG) ? window : max_jobsG;
+}
+
+/*
+ * Start drain jobs for what is queued, as many as the concurrency window
+ * allows.  Called with delq_lock.
+ */
+static void kick() {
+    int limit = job_limit();
+    while (jobsG < limit && jobsG < queue_lenG) {
+        if (async_submit(drain_job, NULL) < 0) {
+            break;
+        }
+        jobsG++;
+    }
+}
+
+/*
+ * Have the keys on the wait list queued again after a backoff.  Called
+ * with delq_lock.
+ */
+static void schedule_retry() {
+    if (retry_jobG || !wait_head) {
+        return;
+    }
+    if (async_submit_after(retry_job, NULL,
+                           s3fs_backoff_ms(wait_triesG)) == 0) {
+        retry_jobG = 1;
+    } else {
+        requeue_waiting();
+    }
+}
+
+static void retry_job(void *arg) {
+    pthread_mutex_lock(&delq_lock);
+    retry_jobG = 0;
+    requeue_waiting();
+    kick();
+    pthread_mutex_unlock(&delq_lock);
+}
+
+/*
+ * Remove queued keys until the queue is empty, or until the concurrency
+ * window shrinks below the jobs running.  Each pass takes an even share
+ * of the queue (up to a full batch), so that a short queue is still
+ * spread over all the jobs.
+ */
+static void drain_job(void *arg) {
+    delq_entry_t *batch[DELQ_BATCH];
+    char *keys[DELQ_BATCH];
+    int results[DELQ_BATCH];
+    int limit;
+
+    pthread_mutex_lock(&delq_lock);
+    while (queue_head && jobsG <= (limit = job_limit())) {
+        int n = (queue_lenG + limit - 1) / limit;
+        if (n > DELQ_BATCH) {
+            n = DELQ_BATCH;
+        }
+        for (int i = 0; i < n; i++) {
+            delq_entry_t *e = queue_head;
+            queue_unlink(e);
+            e->state = DELQ_RUNNING;
+            batch[i] = e;
+            keys[i] = e->key;
+        }
+        pthread_mutex_unlock(&delq_lock);
+
+        // a failed key waits out its backoff here rather than in the call
+        int old = s3fs_set_retry_nowait(1);
+        removeG(argG, keys, n, results);
+        s3fs_set_retry_nowait(old);
+
+        pthread_mutex_lock(&delq_lock);
+        statsG.batches++;
+        for (int i = 0; i < n; i++) {
+            delq_entry_t *e = batch[i];
+            if (results[i] == 0) {
+                log_write(logG, 'C', e->key);
+                drop_entry(e);
+                statsG.deleted++;
+                continue;
+            }
+            statsG.errors++;
+            if (++e->tries < DELQ_MAX_TRIES) {
+                wait_add(e);
+            } else {
+                fprintf(stderr, "delq: can't remove %s, leaving it for "
+                        "the next mount\n", e->key);
+                e->state = DELQ_FAILED;
+            }
+        }
+        log_sync(logG);
+        log_trim();
+        schedule_retry();
+        pthread_cond_broadcast(&delq_cond);
+    }
+    jobsG--;
+    pthread_cond_broadcast(&delq_cond);
+    pthread_mutex_unlock(&delq_lock);
+}
+
+int delq_init(delq_remove_fn remove, void *arg, const char *log_path,
+              int jobs) {
+    pthread_mutex_lock(&delq_lock);
+    memset(&statsG, 0, sizeof(statsG));
+    removeG = remove;
+    argG = arg;
+    max_jobsG = (jobs < 1) ? 1 : jobs;
+    int rv = 0;
+    if (log_path) {
+        replay(log_path);
+        if (rewrite_log(log_path) < 0 || !(logG = fopen(log_path, "a"))) {
+            fprintf(stderr, "delq: can't use delete log %s\n", log_path);
+            rv = -1;
+        }
+    }
+    kick();
+    pthread_mutex_unlock(&delq_lock);
+    return rv;
+}
+
+void delq_destroy() {
+    pthread_mutex_lock(&delq_lock);
+    kick();
+    while (queue_head || wait_head || jobsG > 0) {
+        // no more waiting out backoffs
+        requeue_waiting();
+        if (jobsG == 0) {
+            // the request engine is gone; drain here
+            jobsG++;
+            pthread_mutex_unlock(&delq_lock);
+            drain_job(NULL);
+            pthread_mutex_lock(&delq_lock);
+        } else {
+            pthread_cond_wait(&delq_cond, &delq_lock);
+        }
+    }
+    // what's left failed, and stays in the log
+    for (int i = 0; i < DELQ_BUCKETS; i++) {
+        while (buckets[i]) {
+            drop_entry(buckets[i]);
+        }
+    }
+    if (logG) {
+        fclose(logG);
+        logG = NULL;
+    }
+    pthread_mutex_unlock(&delq_lock);
+}
+
+int delq_push(const char *key) {
+    pthread_mutex_lock(&delq_lock);
+    delq_entry_t *e = find_entry(key);
+    if (e) {
+        // already logged; give a failed key another go
+        if (e->state == DELQ_FAILED) {
+            e->tries = 0;
+            queue_append(e);
+            kick();
+        }
+        pthread_mutex_unlock(&delq_lock);
+        return 0;
+    }
+    if (!(e = add_entry(key))) {
+        pthread_mutex_unlock(&delq_lock);
+        return -1;
+    }
+    if (log_write(logG, 'D', key) < 0 || log_sync(logG) < 0) {
+        drop_entry(e);
+        pthread_mutex_unlock(&delq_lock);
+        return -1;
+    }
+    queue_append(e);
+    statsG.queued++;
+    kick();
+    pthread_mutex_unlock(&delq_lock);
+    return 0;
+}
+
+int delq_pending(const char *key) {
+    pthread_mutex_lock(&delq_lock);
+    int pending = (find_entry(key) != NULL);
+    pthread_mutex_unlock(&delq_lock);
+    return pending;
+}
+
+void delq_cancel(const char *key) {
+    pthread_mutex_lock(&delq_lock);
+    delq_entry_t *e;
+    while ((e = find_entry(key)) && e->state == DELQ_RUNNING) {
+        pthread_cond_wait(&delq_cond, &delq_lock);
+    }
+    if (e) {
+        if (e->state == DELQ_QUEUED) {
+            queue_unlink(e);
+        } else if (e->state == DELQ_WAITING) {
+            wait_unlink(e);
+        }
+        // must be on disk before the key is written, or a replay could
+        // remove the new object
+        log_write(logG, 'C', key);
+        log_sync(logG);
+        drop_entry(e);
+        statsG.cancelled++;
+        log_trim();
+    }
+    pthread_mutex_unlock(&delq_lock);
+}
+
+void delq_stats(delq_stats_t *stats) {
+    pthread_mutex_lock(&delq_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&delq_lock);
+}
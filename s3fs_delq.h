@@ -0,0 +1,68 @@
+#ifndef __S3FS_DELQ_H__
+#define __S3FS_DELQ_H__
+
+/*
+ * Background delete queue.
+ *
+ * unlink and rmdir take a name out of its directory right away, but
+ * leave removing the object itself to this queue, which removes them in
+ * batches from the background request engine (s3fs_async.h).  Until an
+ * object is gone, it is still "pending": callers must not look at it
+ * (it no longer exists as far as the file system is concerned), and
+ * creating an object under the same key cancels its removal first.
+ *
+ * Each queued key is recorded in an intent log on local disk before it
+ * is queued, and marked done once s3 has removed it, so deletes that a
+ * crash interrupted are queued again by the next delq_init.  Without a
+ * log the queue still works, but only lasts as long as the mount.
+ *
+ * All functions are thread-safe.
+ */
+
+/*
+ * Remove the count objects in keys from s3, setting results[i] to 0 if
+ * keys[i] is gone and to -1 if its removal failed.
+ */
+typedef void (*delq_remove_fn)(void *arg, char **keys, int count,
+                               int *results);
+
+typedef struct {
+    unsigned long queued;       // keys pushed (or replayed from the log)
+    unsigned long replayed;     // of which left over from an earlier mount
+    unsigned long deleted;
+    unsigned long batches;      // calls of the remove function
+    unsigned long cancelled;    // keys written again before removal
+    unsigned long errors;       // failed removals (retried, then left)
+} delq_stats_t;
+
+/*
+ * Start the queue, removing objects with remove(arg, ...) from at most
+ * jobs background jobs at once.  log_path (or NULL for none) is the
+ * intent log; whatever it says is still pending is queued again.
+ * Returns 0, or -1 if the log can't be used (the queue then runs
+ * without one).
+ */
+int delq_init(delq_remove_fn remove, void *arg, const char *log_path,
+              int jobs);
+
+/* Remove everything still queued, then stop. */
+void delq_destroy();
+
+/*
+ * Queue the removal of key.  Returns 0, or -1 if it couldn't be recorded
+ * in the log (nothing was queued; the caller should remove key itself).
+ */
+int delq_push(const char *key);
+
+/* Whether key is queued for removal (or being removed). */
+int delq_pending(const char *key);
+
+/*
+ * Take key off the queue because it is about to be written again,
+ * waiting out a removal already in progress.
+ */
+void delq_cancel(const char *key);
+
+void delq_stats(delq_stats_t *stats);
+
+#endif // __S3FS_DELQ_H__
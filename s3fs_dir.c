@@ -0,0 +1,308 @@
+/*
+ * Struct-of-arrays directory model for s3fs; see s3fs_dir.h.
+ */
+
+#include "s3fs.h"
+#include "s3fs_dir.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ENTRY_SIZE (sizeof(entry_t))
+#define NAME_MAX_LEN (sizeof(((entry_t *)0)->name) - 1)
+
+void s3dir_init(s3dir_t *dir) {
+    memset(dir, 0, sizeof(s3dir_t));
+}
+
+void s3dir_free(s3dir_t *dir) {
+    free(dir->names);
+    free(dir->name_off);
+    free(dir->type);
+    free(dir->ino);
+    free(dir->mode);
+    free(dir->size);
+    free(dir->mtime);
+    free(dir->links);
+    free(dir->uid);
+    free(dir->gid);
+    free(dir->atime);
+    free(dir->ctime);
+    s3dir_init(dir);
+}
+
+/*
+ * Grow every column to hold at least want entries.
+ */
+static int reserve_entries(s3dir_t *dir, int want) {
+    if (want <= dir->capacity) {
+        return 0;
+    }
+    int cap = dir->capacity ? dir->capacity : 8;
+    while (cap < want) {
+        cap *= 2;
+    }
+
+#define grow_column(col)                                                 \
+    do {                                                                 \
+        void *tmp = realloc(dir->col, cap * sizeof(*(dir->col)));        \
+        if (!tmp) {                                                      \
+            return -1;                                                   \
+        }                                                                \
+        dir->col = tmp;                                                  \
+    } while (0)
+
+    grow_column(name_off);
+    grow_column(type);
+    grow_column(ino);
+    grow_column(mode);
+    grow_column(size);
+    grow_column(mtime);
+    grow_column(links);
+    grow_column(uid);
+    grow_column(gid);
+    grow_column(atime);
+    grow_column(ctime);
+#undef grow_column
+
+    dir->capacity = cap;
+    return 0;
+}
+
+/*
+ * Copy name into the arena and return its offset, or -1.
+ */
+static ssize_t arena_append(s3dir_t *dir, const char *name) {
+    size_t len = strnlen(name, NAME_MAX_LEN) + 1;
+    if (dir->names_len + len > dir->names_cap) {
+        size_t cap = dir->names_cap ? dir->names_cap : 256;
+        while (cap < dir->names_len + len) {
+            cap *= 2;
+        }
+        char *tmp = realloc(dir->names, cap);
+        if (!tmp) {
+            return -1;
+        }
+        dir->names = tmp;
+        dir->names_cap = cap;
+    }
+    size_t off = dir->names_len;
+    memcpy(dir->names + off, name, len - 1);
+    dir->names[off + len - 1] = '\0';
+    dir->names_len += len;
+    return (ssize_t)off;
+}
+
+/*
+ * Squeeze out the holes left behind by removals and renames.  Names are
+ * rewritten in entry order, so this also restores scan locality.
+ */
+static void arena_compact(s3dir_t *dir) {
+    size_t cap = dir->names_len - dir->names_dead + 1;
+    char *packed = malloc(cap);
+    if (!packed) {
+        return; // not fatal; we just keep the holes for now
+    }
+    size_t len = 0;
+    int i = 0;
+    for (; i < dir->count; i++) {
+        const char *name = s3dir_name(dir, i);
+        size_t n = strlen(name) + 1;
+        memcpy(packed + len, name, n);
+        dir->name_off[i] = (uint32_t)len;
+        len += n;
+    }
+    free(dir->names);
+    dir->names = packed;
+    dir->names_len = len;
+    dir->names_cap = cap;
+    dir->names_dead = 0;
+}
+
+int s3dir_decode(s3dir_t *dir, const uint8_t *buf, ssize_t len) {
+    if (len < (ssize_t)ENTRY_SIZE || len % ENTRY_SIZE != 0) {
+        return -1;
+    }
+    int num_entries = len / ENTRY_SIZE;
+    if (reserve_entries(dir, num_entries) < 0) {
+        return -1;
+    }
+
+    const entry_t *entries = (const entry_t *)buf;
+    int i = 0;
+    for (; i < num_entries; i++) {
+        ssize_t off = arena_append(dir, entries[i].name);
+        if (off < 0) {
+            return -1;
+        }
+        dir->name_off[i] = (uint32_t)off;
+        dir->type[i] = entries[i].type;
+        dir->ino[i] = entries[i].ino;
+        dir->mode[i] = entries[i].mode;
+        dir->size[i] = entries[i].size;
+        dir->mtime[i] = entries[i].mtime;
+        dir->links[i] = entries[i].links;
+        dir->uid[i] = entries[i].uid;
+        dir->gid[i] = entries[i].gid;
+        dir->atime[i] = entries[i].atime;
+        dir->ctime[i] = entries[i].ctime;
+    }
+    dir->count = num_entries;
+    return 0;
+}
+
+ssize_t s3dir_encode(s3dir_t *dir, uint8_t **buf) {
+    ssize_t len = dir->count * ENTRY_SIZE;
+    entry_t *entries = calloc(dir->count, ENTRY_SIZE);
+    if (!entries) {
+        return -1;
+    }
+
+    dir->size[0] = len;
+    int i = 0;
+    for (; i < dir->count; i++) {
+        entries[i].type = dir->type[i];
+        strncpy(entries[i].name, s3dir_name(dir, i), NAME_MAX_LEN);
+        entries[i].ino = dir->ino[i];
+        entries[i].mode = dir->mode[i];
+        entries[i].links = dir->links[i];
+        entries[i].uid = dir->uid[i];
+        entries[i].gid = dir->gid[i];
+        entries[i].size = dir->size[i];
+        entries[i].atime = dir->atime[i];
+        entries[i].mtime = dir->mtime[i];
+        entries[i].ctime = dir->ctime[i];
+    }
+    *buf = (uint8_t *)entries;
+    return len;
+}
+
+int s3dir_copy(s3dir_t *dst, const s3dir_t *src) {
+    s3dir_init(dst);
+    if (reserve_entries(dst, src->count) < 0) {
+        s3dir_free(dst);
+        return -1;
+    }
+    dst->names = malloc(src->names_len ? src->names_len : 1);
+    if (!dst->names) {
+        s3dir_free(dst);
+        return -1;
+    }
+    memcpy(dst->names, src->names, src->names_len);
+    dst->names_len = dst->names_cap = src->names_len;
+    dst->names_dead = src->names_dead;
+
+#define copy_column(col) \
+    memcpy(dst->col, src->col, src->count * sizeof(*(src->col)))
+    copy_column(name_off);
+    copy_column(type);
+    copy_column(ino);
+    copy_column(mode);
+    copy_column(size);
+    copy_column(mtime);
+    copy_column(links);
+    copy_column(uid);
+    copy_column(gid);
+    copy_column(atime);
+    copy_column(ctime);
+#undef copy_column
+    dst->count = src->count;
+    return 0;
+}
+
+int s3dir_find(const s3dir_t *dir, const char *name) {
+    int i = 0;
+    for (; i < dir->count; i++) {
+        if (strcmp(s3dir_name(dir, i), name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int s3dir_add(s3dir_t *dir, char type, const char *name, uint64_t ino,
+              mode_t mode, off_t size, time_t now) {
+    if (strlen(name) > NAME_MAX_LEN) {
+        return -1;
+    }
+    if (reserve_entries(dir, dir->count + 1) < 0) {
+        return -1;
+    }
+    ssize_t off = arena_append(dir, name);
+    if (off < 0) {
+        return -1;
+    }
+
+    int i = dir->count++;
+    dir->name_off[i] = (uint32_t)off;
+    dir->type[i] = type;
+    dir->ino[i] = ino;
+    dir->mode[i] = mode;
+    dir->size[i] = size;
+    dir->mtime[i] = now;
+    dir->links[i] = 1;
+    dir->uid[i] = getuid();
+    dir->gid[i] = getgid();
+    dir->atime[i] = now;
+    dir->ctime[i] = now;
+    return i;
+}
+
+void s3dir_remove(s3dir_t *dir, int idx) {
+    if (idx <= 0 || idx >= dir->count) {
+        return;
+    }
+    dir->names_dead += strlen(s3dir_name(dir, idx)) + 1;
+
+    int tail = dir->count - idx - 1;
+#define shift_column(col) \
+    memmove(&dir->col[idx], &dir->col[idx + 1], tail * sizeof(*(dir->col)))
+    shift_column(name_off);
+    shift_column(type);
+    shift_column(ino);
+    shift_column(mode);
+    shift_column(size);
+    shift_column(mtime);
+    shift_column(links);
+    shift_column(uid);
+    shift_column(gid);
+    shift_column(atime);
+    shift_column(ctime);
+#undef shift_column
+    dir->count--;
+
+    if (dir->names_dead > dir->names_len / 2) {
+        arena_compact(dir);
+    }
+}
+
+int s3dir_rename(s3dir_t *dir, int idx, const char *name) {
+    if (strlen(name) > NAME_MAX_LEN) {
+        return -1;
+    }
+    size_t old_len = strlen(s3dir_name(dir, idx)) + 1;
+    ssize_t off = arena_append(dir, name);
+    if (off < 0) {
+        return -1;
+    }
+    dir->name_off[idx] = (uint32_t)off;
+    dir->names_dead += old_len;
+    if (dir->names_dead > dir->names_len / 2) {
+        arena_compact(dir);
+    }
+    return 0;
+}
+
+void s3dir_stat(const s3dir_t *dir, int idx, struct stat *statbuf) {
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_ino = dir->ino[idx];
+    statbuf->st_mode = dir->mode[idx];
+    statbuf->st_nlink = dir->links[idx];
+    statbuf->st_uid = dir->uid[idx];
+    statbuf->st_gid = dir->gid[idx];
+    statbuf->st_size = dir->size[idx];
+    statbuf->st_atime = dir->atime[idx];
+    statbuf->st_mtime = dir->mtime[idx];
+    statbuf->st_ctime = dir->ctime[idx];
+}
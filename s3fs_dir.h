@@ -0,0 +1,94 @@
+#ifndef __S3FS_DIR_H__
+#define __S3FS_DIR_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * In-memory directory model for s3fs.
+ *
+ * A directory object on s3 is an array of fixed-size entry_t records (see
+ * s3fs.h); that is the on-wire format and it does not change here.  Once a
+ * directory has been fetched, though, we decode it into a struct-of-arrays
+ * form: entry names are packed back-to-back (NUL terminated) in a single
+ * arena and found through an offset table, and each metadata field lives in
+ * its own contiguous column.  Scanning for a name only touches the offset
+ * table and the arena, and scanning sizes or modes only touches one column,
+ * instead of dragging a 300+ byte entry_t through the cache for each entry.
+ *
+ * Entry 0 is always the directory's own "." entry, as in the wire format.
+ */
+typedef struct {
+    int count;          // number of entries (including ".")
+    int capacity;       // allocated length of each column
+
+    // name arena + offset table
+    char *names;
+    size_t names_len;   // bytes in use (including holes left by removals)
+    size_t names_cap;
+    size_t names_dead;  // bytes in holes; compacted when this grows large
+    uint32_t *name_off;
+
+    // hot metadata columns
+    char *type;
+    uint64_t *ino;
+    mode_t *mode;
+    off_t *size;
+    time_t *mtime;
+
+    // cold metadata columns; only needed for stat and for re-encoding
+    nlink_t *links;
+    uid_t *uid;
+    gid_t *gid;
+    time_t *atime;
+    time_t *ctime;
+} s3dir_t;
+
+#define s3dir_name(d, i) ((d)->names + (d)->name_off[(i)])
+
+void s3dir_init(s3dir_t *dir);
+void s3dir_free(s3dir_t *dir);
+
+/*
+ * Decode a wire-format directory blob (an array of entry_t) into dir, which
+ * must have been initialized.  Returns 0 on success, -1 on a malformed blob
+ * or allocation failure.
+ */
+int s3dir_decode(s3dir_t *dir, const uint8_t *buf, ssize_t len);
+
+/*
+ * Encode dir into a freshly malloc'ed wire-format blob, returned through
+ * buf.  The "." entry's size is updated to the encoded length.  Returns the
+ * blob length, or -1 on allocation failure.
+ */
+ssize_t s3dir_encode(s3dir_t *dir, uint8_t **buf);
+
+/*
+ * Make dst (uninitialized) a deep copy of src.  Returns 0 on success, -1
+ * on allocation failure (dst is left empty).
+ */
+int s3dir_copy(s3dir_t *dst, const s3dir_t *src);
+
+/* Return the index of the named entry, or -1 if there is none. */
+int s3dir_find(const s3dir_t *dir, const char *name);
+
+/*
+ * Append a new entry with inode number ino, owned by the calling user,
+ * with all three times set to now.  Returns its index, or -1 on
+ * allocation failure or a name that does not fit in the wire format.
+ */
+int s3dir_add(s3dir_t *dir, char type, const char *name, uint64_t ino,
+              mode_t mode, off_t size, time_t now);
+
+/* Remove entry idx (never 0), keeping the remaining entries in order. */
+void s3dir_remove(s3dir_t *dir, int idx);
+
+/* Rename entry idx.  Returns 0 on success, -1 on failure. */
+int s3dir_rename(s3dir_t *dir, int idx, const char *name);
+
+/* Fill in a struct stat from entry idx. */
+void s3dir_stat(const s3dir_t *dir, int idx, struct stat *statbuf);
+
+#endif // __S3FS_DIR_H__
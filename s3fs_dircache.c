@@ -0,0 +1,306 @@
+/*
+ * Decoded-directory cache for s3fs; see s3fs_dircache.h.
+ *
+ * A chained hash table for lookups plus a doubly-linked LRU list for
+ * eviction once more than max_dirs directories are cached.  Cached
+ * directories count against the global memory budget as clean data, and
+ * dircache_reclaim drops the least recently used ones under pressure.
+ */
+
+#include "s3fs_dircache.h"
+#include "s3fs_mem.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DIRCACHE_BUCKETS 1024
+
+typedef struct dircache_entry {
+    char *path;
+    s3dir_t dir;
+    size_t bytes;               // charged to the memory budget
+    s3fs_object_info_t info;    // version of the object, if known
+    time_t expires;
+    struct dircache_entry *hnext;           // hash chain
+    struct dircache_entry *prev, *next;     // LRU list, most recent first
+} dircache_entry_t;
+
+static pthread_mutex_t dircache_lock = PTHREAD_MUTEX_INITIALIZER;
+static dircache_entry_t *buckets[DIRCACHE_BUCKETS];
+static dircache_entry_t *lru_head = NULL, *lru_tail = NULL;
+static int num_dirs = 0;
+static int ttlG = 0;
+static int max_dirsG = 0;
+static dircache_stats_t statsG;
+
+static unsigned int hash_path(const char *path) {
+    unsigned int h = 5381;
+    while (*path) {
+        h = ((h << 5) + h) + (unsigned char)*path++;
+    }
+    return h % DIRCACHE_BUCKETS;
+}
+
+static void lru_unlink(dircache_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        lru_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        lru_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(dircache_entry_t *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) {
+        lru_head->prev = e;
+    }
+    lru_head = e;
+    if (!lru_tail) {
+        lru_tail = e;
+    }
+}
+
+static dircache_entry_t *find_entry(const char *path, unsigned int h) {
+    dircache_entry_t *e = buckets[h];
+    while (e && strcmp(e->path, path) != 0) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+/* Roughly what a decoded directory takes up. */
+static size_t dir_bytes(const s3dir_t *dir) {
+    size_t per_entry = sizeof(uint32_t) + sizeof(char) + sizeof(uint64_t) +
+                       sizeof(mode_t) + sizeof(off_t) + 3 * sizeof(time_t) +
+                       sizeof(nlink_t) + sizeof(uid_t) + sizeof(gid_t);
+    return sizeof(dircache_entry_t) + dir->names_cap +
+           (size_t)dir->capacity * per_entry;
+}
+
+static void remove_entry(dircache_entry_t *e) {
+    dircache_entry_t **pp = &buckets[hash_path(e->path)];
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+    lru_unlink(e);
+    mem_release(MEM_CACHE, e->bytes);
+    s3dir_free(&e->dir);
+    free(e->path);
+    free(e);
+    num_dirs--;
+}
+
+void dircache_init(int ttl, int max_dirs) {
+    pthread_mutex_lock(&dircache_lock);
+    ttlG = ttl;
+    max_dirsG = max_dirs;
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_destroy() {
+    pthread_mutex_lock(&dircache_lock);
+    while (lru_head) {
+        remove_entry(lru_head);
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+static int has_version(const dircache_entry_t *e) {
+    return e->info.eTag[0] || e->info.lastModified >= 0;
+}
+
+int dircache_get(const char *path, s3dir_t *dir) {
+    int rv = -1;
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry_t *e = find_entry(path, hash_path(path));
+    if (e && e->expires <= time(NULL)) {
+        // keep it around for dircache_lookup to revalidate
+        if (!has_version(e)) {
+            remove_entry(e);
+        }
+        e = NULL;
+    }
+    if (e && s3dir_copy(dir, &e->dir) == 0) {
+        lru_unlink(e);
+        lru_push_front(e);
+        statsG.hits++;
+        rv = 0;
+    }
+    pthread_mutex_unlock(&dircache_lock);
+    return rv;
+}
+
+int dircache_lookup(const char *path, s3dir_t *dir, s3fs_object_info_t *info) {
+    int rv = -1;
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry_t *e = find_entry(path, hash_path(path));
+    if (e && e->expires <= time(NULL) && !has_version(e)) {
+        remove_entry(e);
+        e = NULL;
+    }
+    if (e && s3dir_copy(dir, &e->dir) == 0) {
+        lru_unlink(e);
+        lru_push_front(e);
+        if (e->expires > time(NULL)) {
+            statsG.hits++;
+            rv = DIRCACHE_FRESH;
+        } else {
+            *info = e->info;
+            statsG.revalidations++;
+            rv = DIRCACHE_STALE;
+        }
+    } else {
+        statsG.misses++;
+    }
+    pthread_mutex_unlock(&dircache_lock);
+    return rv;
+}
+
+int dircache_has(const char *path) {
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry_t *e = find_entry(path, hash_path(path));
+    int has = e && (e->expires > time(NULL) || has_version(e));
+    pthread_mutex_unlock(&dircache_lock);
+    return has;
+}
+
+void dircache_put(const char *path, const s3dir_t *dir,
+                  const s3fs_object_info_t *info) {
+    if (ttlG <= 0 || max_dirsG <= 0) {
+        return;
+    }
+
+    // do the copying outside the lock
+    dircache_entry_t *n = malloc(sizeof(dircache_entry_t));
+    if (!n) {
+        return;
+    }
+    if (s3dir_copy(&n->dir, dir) < 0) {
+        free(n);
+        return;
+    }
+    n->path = strdup(path);
+    n->bytes = dir_bytes(&n->dir) + strlen(path) + 1;
+    n->expires = time(NULL) + ttlG;
+    n->prev = n->next = NULL;
+    if (info) {
+        n->info = *info;
+    } else {
+        memset(&n->info, 0, sizeof(n->info));
+        n->info.lastModified = -1;
+    }
+
+    pthread_mutex_lock(&dircache_lock);
+    unsigned int h = hash_path(path);
+    dircache_entry_t *e = find_entry(path, h);
+    if (e) {
+        if (!info) {
+            n->expires = e->expires;
+            n->info = e->info;
+        }
+        remove_entry(e);
+    }
+    n->hnext = buckets[h];
+    buckets[h] = n;
+    lru_push_front(n);
+    mem_charge(MEM_CACHE, n->bytes);
+    num_dirs++;
+    while (num_dirs > max_dirsG) {
+        remove_entry(lru_tail);
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_touch(const char *path, const char *name, time_t atime) {
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry_t *e = find_entry(path, hash_path(path));
+    int idx = e ? s3dir_find(&e->dir, name) : -1;
+    if (idx >= 0) {
+        e->dir.atime[idx] = atime;
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_seed(const char *path, const s3dir_t *dir,
+                   const s3fs_object_info_t *info) {
+    if (ttlG <= 0 || max_dirsG <= 0 ||
+        (!info->eTag[0] && info->lastModified < 0)) {
+        return;
+    }
+    dircache_entry_t *n = malloc(sizeof(dircache_entry_t));
+    if (!n) {
+        return;
+    }
+    if (s3dir_copy(&n->dir, dir) < 0) {
+        free(n);
+        return;
+    }
+    n->path = strdup(path);
+    n->bytes = dir_bytes(&n->dir) + strlen(path) + 1;
+    n->expires = 0;
+    n->info = *info;
+    n->prev = n->next = NULL;
+
+    pthread_mutex_lock(&dircache_lock);
+    unsigned int h = hash_path(path);
+    if (num_dirs >= max_dirsG || find_entry(path, h)) {
+        pthread_mutex_unlock(&dircache_lock);
+        s3dir_free(&n->dir);
+        free(n->path);
+        free(n);
+        return;
+    }
+    n->hnext = buckets[h];
+    buckets[h] = n;
+    lru_push_front(n);
+    mem_charge(MEM_CACHE, n->bytes);
+    num_dirs++;
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_revalidated(const char *path, size_t saved_bytes) {
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry_t *e = find_entry(path, hash_path(path));
+    if (e) {
+        e->expires = time(NULL) + ttlG;
+    }
+    statsG.not_modified++;
+    statsG.bytes_saved += saved_bytes;
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+void dircache_invalidate(const char *path) {
+    pthread_mutex_lock(&dircache_lock);
+    dircache_entry_t *e = find_entry(path, hash_path(path));
+    if (e) {
+        remove_entry(e);
+    }
+    pthread_mutex_unlock(&dircache_lock);
+}
+
+uint64_t dircache_reclaim(uint64_t bytes) {
+    uint64_t freed = 0;
+    pthread_mutex_lock(&dircache_lock);
+    while (freed < bytes && lru_tail) {
+        freed += lru_tail->bytes;
+        remove_entry(lru_tail);
+    }
+    pthread_mutex_unlock(&dircache_lock);
+    return freed;
+}
+
+void dircache_stats(dircache_stats_t *stats) {
+    pthread_mutex_lock(&dircache_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&dircache_lock);
+}
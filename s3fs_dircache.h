@@ -0,0 +1,104 @@
+#ifndef __S3FS_DIRCACHE_H__
+#define __S3FS_DIRCACHE_H__
+
+#include "s3fs_dir.h"
+#include "libs3_wrapper.h"
+
+/*
+ * A small cache of decoded directories, keyed by path.
+ *
+ * Every metadata operation in s3fs starts by fetching the parent directory
+ * object, so without this an `ls -l` of a directory with N entries
+ * downloads that directory N+1 times.  Directories stay cached for ttl
+ * seconds after they were fetched; local updates are written through, so
+ * only changes made by some other client are subject to the ttl.
+ *
+ * Once the ttl runs out an entry isn't simply dropped: we remember which
+ * version of the object (ETag, Last-Modified) it is, so the caller can
+ * revalidate it with a conditional GET, which costs a 304 with no body
+ * rather than another download of the directory if nothing has changed.
+ *
+ * All functions are thread-safe.  Cached directories are handed out as
+ * deep copies, so callers may modify what they get back.
+ */
+
+void dircache_init(int ttl, int max_dirs);
+void dircache_destroy();
+
+#define DIRCACHE_FRESH 0
+#define DIRCACHE_STALE 1
+
+/*
+ * Copy the cached directory at path into dir (uninitialized).  Returns 0
+ * on a hit, -1 on a miss or an expired entry.
+ */
+int dircache_get(const char *path, s3dir_t *dir);
+
+/*
+ * Like dircache_get, but an expired entry whose version is known is
+ * copied out as well: the return value is DIRCACHE_FRESH for a hit,
+ * DIRCACHE_STALE (with the version in *info) for an entry that must be
+ * revalidated before use, or -1 for a miss.
+ */
+int dircache_lookup(const char *path, s3dir_t *dir, s3fs_object_info_t *info);
+
+/*
+ * Whether dircache_lookup would find path (fresh, or expired but ready to
+ * revalidate), without copying it out or counting a hit.
+ */
+int dircache_has(const char *path);
+
+/*
+ * Cache a copy of dir under path.  If info is non-NULL, dir is the version
+ * of the object described by info that was just fetched from or written
+ * to s3, and the entry's ttl restarts.  Otherwise dir only carries local,
+ * unpersisted updates (such as access times), and the existing version
+ * and expiry time are kept.
+ */
+void dircache_put(const char *path, const s3dir_t *dir,
+                  const s3fs_object_info_t *info);
+
+/*
+ * Set the access time of entry name ("." for the directory itself) in the
+ * cached copy of path, if there is one.  Like a dircache_put without
+ * info, this is a local update that goes out with the next store of the
+ * directory, but it is made in place, so it never undoes a newer copy.
+ */
+void dircache_touch(const char *path, const char *name, time_t atime);
+
+/*
+ * Cache a copy of dir, which is the version of the object at path
+ * described by info as of some time ago (from a checkpoint): it is
+ * handed out only to be revalidated, like an expired entry.  Nothing is
+ * done if path is cached already or the cache is full.
+ */
+void dircache_seed(const char *path, const s3dir_t *dir,
+                   const s3fs_object_info_t *info);
+
+/*
+ * s3 confirmed that the cached version of path is current, which saved
+ * downloading saved_bytes: restart the entry's ttl.
+ */
+void dircache_revalidated(const char *path, size_t saved_bytes);
+
+/* Drop any cached copy of path. */
+void dircache_invalidate(const char *path);
+
+/*
+ * Drop least recently used directories until bytes have been freed (or
+ * the cache is empty); returns the bytes freed.  This is the directory
+ * cache's reclaim function for the memory budget.
+ */
+uint64_t dircache_reclaim(uint64_t bytes);
+
+typedef struct {
+    unsigned long hits;             // served within the ttl
+    unsigned long misses;           // nothing usable cached
+    unsigned long revalidations;    // expired entries handed out to check
+    unsigned long not_modified;     // ... that turned out to be current
+    unsigned long long bytes_saved; // downloads those saved
+} dircache_stats_t;
+
+void dircache_stats(dircache_stats_t *stats);
+
+#endif // __S3FS_DIRCACHE_H__
@@ -0,0 +1,425 @@
+/*
+ * Persistent object cache for s3fs; see s3fs_diskcache.h.
+ *
+ * Cache files are named after a 64-bit hash of the key and start with a
+ * small header, then the key, the ETag and the object's bytes.  New files
+ * are written under a temporary name, synced to disk and only then
+ * renamed into place, so a crash never leaves a half-written entry (or
+ * one whose blocks never made it to disk) behind under a real name.
+ * Readers check the key and ETag in the file itself, since the index can
+ * change between looking an entry up and opening its file.
+ *
+ * The index is a hash table of entries that are also linked into a ring
+ * for CLOCK eviction: a hit sets an entry's reference bit, and the clock
+ * hand clears reference bits until it finds an entry without one to evict.
+ */
+
+#include "s3fs_diskcache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DISKCACHE_MAGIC 0x73336463  // "s3dc"
+#define DISKCACHE_BUCKETS 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t key_len;
+    uint32_t etag_len;
+    uint32_t reserved;
+    uint64_t size;          // object bytes following the key and ETag
+} diskcache_header_t;
+
+typedef struct diskcache_entry {
+    uint64_t hash;          // of the key; also names the file
+    char *key;
+    char *etag;
+    uint64_t bytes;         // size of the whole file
+    int ref;                // CLOCK reference bit
+    struct diskcache_entry *hnext;          // hash chain
+    struct diskcache_entry *prev, *next;    // CLOCK ring
+} diskcache_entry_t;
+
+static pthread_mutex_t diskcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static diskcache_entry_t *buckets[DISKCACHE_BUCKETS];
+static diskcache_entry_t *hand = NULL;
+static char *dirG = NULL;
+static uint64_t max_bytesG = 0;
+static uint64_t total_bytes = 0;
+static unsigned int tmp_counter = 0;
+
+static uint64_t hash_key(const char *key) {
+    uint64_t h = 14695981039346656037ULL;     // FNV-1a
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void entry_file(uint64_t hash, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx.obj", dirG, (unsigned long long)hash);
+}
+
+static diskcache_entry_t *find_entry(uint64_t hash) {
+    diskcache_entry_t *e = buckets[hash % DISKCACHE_BUCKETS];
+    while (e && e->hash != hash) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+static void ring_insert(diskcache_entry_t *e) {
+    if (!hand) {
+        e->prev = e->next = e;
+        hand = e;
+    } else {
+        // just behind the hand, so it is the last to be considered
+        e->next = hand;
+        e->prev = hand->prev;
+        hand->prev->next = e;
+        hand->prev = e;
+    }
+}
+
+static void ring_remove(diskcache_entry_t *e) {
+    if (e->next == e) {
+        hand = NULL;
+    } else {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+        if (hand == e) {
+            hand = e->next;
+        }
+    }
+}
+
+/*
+ * Take e out of the index; if unlink_file, remove its file too.
+ */
+static void remove_entry(diskcache_entry_t *e, int unlink_file) {
+    diskcache_entry_t **pp = &buckets[e->hash % DISKCACHE_BUCKETS];
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+    ring_remove(e);
+    total_bytes -= e->bytes;
+    if (unlink_file) {
+        char path[1024];
+        entry_file(e->hash, path, sizeof(path));
+        unlink(path);
+    }
+    free(e->key);
+    free(e->etag);
+    free(e);
+}
+
+static void add_entry(diskcache_entry_t *e) {
+    diskcache_entry_t *old = find_entry(e->hash);
+    if (old) {
+        // same file name; it has already been replaced on disk
+        remove_entry(old, 0);
+    }
+    e->hnext = buckets[e->hash % DISKCACHE_BUCKETS];
+    buckets[e->hash % DISKCACHE_BUCKETS] = e;
+    ring_insert(e);
+    total_bytes += e->bytes;
+}
+
+static void evict() {
+    while (total_bytes > max_bytesG && hand) {
+        if (hand->ref) {
+            hand->ref = 0;
+            hand = hand->next;
+        } else {
+            remove_entry(hand, 1);
+        }
+    }
+}
+
+static diskcache_entry_t *new_entry(uint64_t hash, const char *key,
+                                    const char *etag, uint64_t bytes) {
+    diskcache_entry_t *e = calloc(1, sizeof(diskcache_entry_t));
+    if (!e) {
+        return NULL;
+    }
+    e->hash = hash;
+    e->key = strdup(key);
+    e->etag = strdup(etag);
+    e->bytes = bytes;
+    if (!e->key || !e->etag) {
+        free(e->key);
+        free(e->etag);
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+/*
+ * Read the header, key and ETag of an open cache file.  Returns 0 and
+ * malloc'ed *key and *etag, or -1 if the file isn't a valid entry.
+ */
+static int read_header(int fd, diskcache_header_t *hdr, char **key,
+                       char **etag) {
+    if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+        hdr->magic != DISKCACHE_MAGIC ||
+        hdr->key_len > 65536 || hdr->etag_len > 65536) {
+        return -1;
+    }
+    *key = malloc(hdr->key_len + 1);
+    *etag = malloc(hdr->etag_len + 1);
+    if (!*key || !*etag ||
+        pread(fd, *key, hdr->key_len, sizeof(*hdr)) != hdr->key_len ||
+        pread(fd, *etag, hdr->etag_len, sizeof(*hdr) + hdr->key_len)
+            != hdr->etag_len) {
+        free(*key);
+        free(*etag);
+        *key = *etag = NULL;
+        return -1;
+    }
+    (*key)[hdr->key_len] = '\0';
+    (*etag)[hdr->etag_len] = '\0';
+    return 0;
+}
+
+/*
+ * Index the entries left in the cache directory by an earlier mount,
+ * throwing away temporary and damaged files.
+ */
+static void scan_dir() {
+    DIR *d = opendir(dirG);
+    if (!d) {
+        return;
+    }
+    struct dirent *de;
+    char path[1024];
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len > 4 && strcmp(de->d_name + len - 4, ".tmp") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", dirG, de->d_name);
+            unlink(path);
+            continue;
+        }
+        if (len != 20 || strcmp(de->d_name + 16, ".obj") != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dirG, de->d_name);
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        diskcache_header_t hdr;
+        char *key = NULL, *etag = NULL;
+        struct stat st;
+        int ok = (read_header(fd, &hdr, &key, &etag) == 0);
+        if (ok) {
+            ok = fstat(fd, &st) == 0 &&
+                 (uint64_t)st.st_size == sizeof(hdr) + hdr.key_len +
+                                         hdr.etag_len + hdr.size;
+        }
+        close(fd);
+
+        char expect[32];
+        if (ok) {
+            snprintf(expect, sizeof(expect), "%016llx.obj",
+                     (unsigned long long)hash_key(key));
+            ok = (strcmp(expect, de->d_name) == 0);
+        }
+        diskcache_entry_t *e = NULL;
+        if (ok) {
+            e = new_entry(hash_key(key), key, etag, st.st_size);
+        }
+        if (e) {
+            add_entry(e);
+        } else {
+            unlink(path);
+        }
+        free(key);
+        free(etag);
+    }
+    closedir(d);
+}
+
+int diskcache_init(const char *dir, uint64_t max_bytes) {
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        perror("diskcache: mkdir");
+        return -1;
+    }
+    pthread_mutex_lock(&diskcache_lock);
+    dirG = strdup(dir);
+    max_bytesG = max_bytes;
+    if (dirG) {
+        scan_dir();
+        evict();
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+    return dirG ? 0 : -1;
+}
+
+void diskcache_destroy() {
+    pthread_mutex_lock(&diskcache_lock);
+    while (hand) {
+        remove_entry(hand, 0);
+    }
+    free(dirG);
+    dirG = NULL;
+    pthread_mutex_unlock(&diskcache_lock);
+}
+
+int diskcache_etag(const char *key, char *etag, size_t etag_size) {
+    int rv = -1;
+    pthread_mutex_lock(&diskcache_lock);
+    diskcache_entry_t *e = dirG ? find_entry(hash_key(key)) : NULL;
+    if (e && strcmp(e->key, key) == 0) {
+        snprintf(etag, etag_size, "%s", e->etag);
+        rv = 0;
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+    return rv;
+}
+
+ssize_t diskcache_read(const char *key, const char *etag, uint8_t **buf,
+                       ssize_t start_byte, ssize_t byte_count) {
+    char path[1024];
+    uint64_t hash = hash_key(key);
+    pthread_mutex_lock(&diskcache_lock);
+    diskcache_entry_t *e = dirG ? find_entry(hash) : NULL;
+    if (!e || strcmp(e->key, key) != 0 || strcmp(e->etag, etag) != 0) {
+        pthread_mutex_unlock(&diskcache_lock);
+        return -1;
+    }
+    e->ref = 1;
+    entry_file(hash, path, sizeof(path));
+    pthread_mutex_unlock(&diskcache_lock);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        diskcache_invalidate(key);
+        return -1;
+    }
+    diskcache_header_t hdr;
+    char *file_key = NULL, *file_etag = NULL;
+    if (read_header(fd, &hdr, &file_key, &file_etag) < 0) {
+        close(fd);
+        diskcache_invalidate(key);
+        return -1;
+    }
+    int same = (strcmp(file_key, key) == 0 && strcmp(file_etag, etag) == 0);
+    free(file_key);
+    free(file_etag);
+    if (!same) {
+        // replaced since we looked it up
+        close(fd);
+        return -1;
+    }
+
+    uint64_t start = start_byte, count = byte_count;
+    if (start_byte == 0 && byte_count == 0) {
+        count = hdr.size;
+    }
+    if (start > hdr.size) {
+        start = hdr.size;
+    }
+    if (count > hdr.size - start) {
+        count = hdr.size - start;
+    }
+
+    *buf = NULL;
+    if (count == 0) {
+        close(fd);
+        return 0;
+    }
+    uint8_t *data = malloc(count);
+    off_t data_off = sizeof(hdr) + hdr.key_len + hdr.etag_len;
+    if (!data ||
+        pread(fd, data, count, data_off + start) != (ssize_t)count) {
+        free(data);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    *buf = data;
+    return count;
+}
+
+void diskcache_store(const char *key, const char *etag, const uint8_t *buf,
+                     size_t len) {
+    diskcache_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DISKCACHE_MAGIC;
+    hdr.key_len = strlen(key);
+    hdr.etag_len = strlen(etag);
+    hdr.size = len;
+    uint64_t bytes = sizeof(hdr) + hdr.key_len + hdr.etag_len + len;
+    uint64_t hash = hash_key(key);
+
+    char path[1024], tmp[1024];
+    pthread_mutex_lock(&diskcache_lock);
+    if (!dirG || bytes > max_bytesG || !etag[0]) {
+        pthread_mutex_unlock(&diskcache_lock);
+        return;
+    }
+    entry_file(hash, path, sizeof(path));
+    int n = snprintf(tmp, sizeof(tmp), "%s.%u.tmp", path, tmp_counter++);
+    pthread_mutex_unlock(&diskcache_lock);
+    if (n < 0 || n >= (int)sizeof(tmp)) {
+        return;
+    }
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    int ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+             write(fd, key, hdr.key_len) == hdr.key_len &&
+             write(fd, etag, hdr.etag_len) == hdr.etag_len;
+    size_t done = 0;
+    while (ok && done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        ok = (n > 0);
+        done += ok ? n : 0;
+    }
+    // the data must be on disk before the name is: a crash after the
+    // rename could otherwise leave a file of the right size holding
+    // garbage, which the ETag in its header would vouch for
+    ok = ok && fdatasync(fd) == 0;
+    if (close(fd) < 0 || !ok) {
+        unlink(tmp);
+        return;
+    }
+
+    diskcache_entry_t *e = new_entry(hash, key, etag, bytes);
+    pthread_mutex_lock(&diskcache_lock);
+    if (!e || !dirG || rename(tmp, path) < 0) {
+        pthread_mutex_unlock(&diskcache_lock);
+        unlink(tmp);
+        if (e) {
+            free(e->key);
+            free(e->etag);
+            free(e);
+        }
+        return;
+    }
+    add_entry(e);
+    evict();
+    pthread_mutex_unlock(&diskcache_lock);
+}
+
+void diskcache_invalidate(const char *key) {
+    pthread_mutex_lock(&diskcache_lock);
+    diskcache_entry_t *e = dirG ? find_entry(hash_key(key)) : NULL;
+    if (e && strcmp(e->key, key) == 0) {
+        remove_entry(e, 1);
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+}
@@ -0,0 +1,51 @@
+#ifndef __S3FS_DISKCACHE_H__
+#define __S3FS_DISKCACHE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A persistent cache of object bodies (files and directory blobs) in a
+ * local directory, so that a restarted mount doesn't start cold.
+ *
+ * Each cached object is one file in the cache directory holding its key,
+ * its ETag and its bytes.  An entry is only ever used after revalidating
+ * its ETag with s3 (a conditional GET), so a hit costs a 304 round trip
+ * instead of a download.  When the cache grows past its size cap, entries
+ * are evicted in CLOCK order (an approximation of LRU).
+ *
+ * All functions are thread-safe and do nothing (or miss) if the cache
+ * hasn't been initialized.
+ */
+
+/*
+ * Use dir (created if needed) as the cache directory, holding at most
+ * max_bytes of objects.  Whatever a previous mount left there is indexed
+ * and reused.  Returns 0, or -1 if dir is unusable.
+ */
+int diskcache_init(const char *dir, uint64_t max_bytes);
+void diskcache_destroy();
+
+/*
+ * If key is cached, copy its ETag into etag (etag_size bytes) and
+ * return 0; otherwise return -1.
+ */
+int diskcache_etag(const char *key, char *etag, size_t etag_size);
+
+/*
+ * Read byte_count bytes at start_byte (the whole object if both are 0) of
+ * the cached copy of key, which must have ETag etag, into a malloc'ed
+ * buffer *buf.  Returns the number of bytes read (*buf is NULL if that is
+ * 0), or -1 if there is no such copy.
+ */
+ssize_t diskcache_read(const char *key, const char *etag, uint8_t **buf,
+                       ssize_t start_byte, ssize_t byte_count);
+
+/* Cache len bytes from buf as the contents of key, with ETag etag. */
+void diskcache_store(const char *key, const char *etag, const uint8_t *buf,
+                     size_t len);
+
+/* Drop any cached copy of key. */
+void diskcache_invalidate(const char *key);
+
+#endif // __S3FS_DISKCACHE_H__
@@ -0,0 +1,238 @@
+/*
+ * Inode table for s3fs; see s3fs_inode.h.
+ */
+
+#include "s3fs_inode.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INODE_BUCKETS 4096
+
+typedef struct s3inode {
+    uint64_t ino;
+    uint64_t nlookup;
+    char type;
+    uint64_t parent;
+    char *path;         // NULL once detached
+    size_t name_off;    // the inode's own name starts at path + name_off
+    time_t mtime;       // version of the file the kernel has cached
+    off_t size;
+    struct s3inode *hnext;
+} s3inode_t;
+
+static pthread_mutex_t inode_lock = PTHREAD_MUTEX_INITIALIZER;
+static s3inode_t *buckets[INODE_BUCKETS];
+static uint64_t next_inoG = S3FS_ROOT_INO + 1;
+
+static s3inode_t *find_inode(uint64_t ino) {
+    s3inode_t *n = buckets[ino % INODE_BUCKETS];
+    while (n && n->ino != ino) {
+        n = n->hnext;
+    }
+    return n;
+}
+
+/* ino's entry, if it is known and hasn't been detached. */
+static s3inode_t *find_named(uint64_t ino) {
+    s3inode_t *n = find_inode(ino);
+    return (n && n->path) ? n : NULL;
+}
+
+static size_t name_offset(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) + 1 : 0;
+}
+
+static char *join_path(const char *parent, const char *name) {
+    size_t len = strlen(parent) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path) {
+        snprintf(path, len, "%s%s%s", parent,
+                 strcmp(parent, "/") == 0 ? "" : "/", name);
+    }
+    return path;
+}
+
+void inode_table_init() {
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *root = calloc(1, sizeof(s3inode_t));
+    root->ino = S3FS_ROOT_INO;
+    root->nlookup = 1;  // the kernel never forgets the root
+    root->type = 'd';
+    root->path = strdup("/");
+    buckets[S3FS_ROOT_INO % INODE_BUCKETS] = root;
+    pthread_mutex_unlock(&inode_lock);
+}
+
+void inode_table_destroy() {
+    pthread_mutex_lock(&inode_lock);
+    int i = 0;
+    for (; i < INODE_BUCKETS; i++) {
+        while (buckets[i]) {
+            s3inode_t *n = buckets[i];
+            buckets[i] = n->hnext;
+            free(n->path);
+            free(n);
+        }
+    }
+    pthread_mutex_unlock(&inode_lock);
+}
+
+uint64_t inode_alloc() {
+    pthread_mutex_lock(&inode_lock);
+    uint64_t ino = next_inoG++;
+    pthread_mutex_unlock(&inode_lock);
+    return ino;
+}
+
+void inode_reserve(uint64_t ino) {
+    pthread_mutex_lock(&inode_lock);
+    if (ino >= next_inoG) {
+        next_inoG = ino + 1;
+    }
+    pthread_mutex_unlock(&inode_lock);
+}
+
+uint64_t inode_next() {
+    pthread_mutex_lock(&inode_lock);
+    uint64_t ino = next_inoG;
+    pthread_mutex_unlock(&inode_lock);
+    return ino;
+}
+
+int inode_remember(uint64_t ino, uint64_t parent, const char *name, char type) {
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *p = find_named(parent);
+    char *path = p ? join_path(p->path, name) : NULL;
+    if (!path) {
+        pthread_mutex_unlock(&inode_lock);
+        return -1;
+    }
+
+    s3inode_t *n = find_inode(ino);
+    if (!n) {
+        n = calloc(1, sizeof(s3inode_t));
+        if (!n) {
+            free(path);
+            pthread_mutex_unlock(&inode_lock);
+            return -1;
+        }
+        n->ino = ino;
+        n->hnext = buckets[ino % INODE_BUCKETS];
+        buckets[ino % INODE_BUCKETS] = n;
+    }
+    free(n->path);
+    n->path = path;
+    n->name_off = name_offset(path);
+    n->parent = parent;
+    n->type = type;
+    n->nlookup++;
+    if (ino >= next_inoG) {
+        next_inoG = ino + 1;
+    }
+    pthread_mutex_unlock(&inode_lock);
+    return 0;
+}
+
+void inode_forget(uint64_t ino, uint64_t nlookup) {
+    if (ino == S3FS_ROOT_INO) {
+        return;
+    }
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t **pp = &buckets[ino % INODE_BUCKETS];
+    while (*pp && (*pp)->ino != ino) {
+        pp = &(*pp)->hnext;
+    }
+    s3inode_t *n = *pp;
+    if (n) {
+        n->nlookup = (nlookup >= n->nlookup) ? 0 : n->nlookup - nlookup;
+        if (n->nlookup == 0) {
+            *pp = n->hnext;
+            free(n->path);
+            free(n);
+        }
+    }
+    pthread_mutex_unlock(&inode_lock);
+}
+
+char *inode_path(uint64_t ino, char *type) {
+    char *path = NULL;
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *n = find_named(ino);
+    if (n) {
+        path = strdup(n->path);
+        if (type) {
+            *type = n->type;
+        }
+    }
+    pthread_mutex_unlock(&inode_lock);
+    return path;
+}
+
+char *inode_name(uint64_t ino, uint64_t *parent) {
+    char *name = NULL;
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *n = find_named(ino);
+    if (n && ino != S3FS_ROOT_INO) {
+        name = strdup(n->path + n->name_off);
+        *parent = n->parent;
+    }
+    pthread_mutex_unlock(&inode_lock);
+    return name;
+}
+
+char *inode_child_path(uint64_t parent, const char *name) {
+    char *path = NULL;
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *p = find_named(parent);
+    if (p) {
+        path = join_path(p->path, name);
+    }
+    pthread_mutex_unlock(&inode_lock);
+    return path;
+}
+
+int inode_same_version(uint64_t ino, time_t mtime, off_t size) {
+    int same = 0;
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *n = find_inode(ino);
+    if (n) {
+        same = (n->mtime == mtime && n->size == size);
+        n->mtime = mtime;
+        n->size = size;
+    }
+    pthread_mutex_unlock(&inode_lock);
+    return same;
+}
+
+void inode_rename(uint64_t ino, uint64_t newparent, const char *newname) {
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *n = find_named(ino);
+    s3inode_t *p = find_named(newparent);
+    if (n && p) {
+        char *path = join_path(p->path, newname);
+        if (path) {
+            free(n->path);
+            n->path = path;
+            n->name_off = name_offset(path);
+            n->parent = newparent;
+        }
+    }
+    pthread_mutex_unlock(&inode_lock);
+}
+
+void inode_detach(uint64_t ino) {
+    if (ino == S3FS_ROOT_INO) {
+        return;
+    }
+    pthread_mutex_lock(&inode_lock);
+    s3inode_t *n = find_inode(ino);
+    if (n) {
+        free(n->path);
+        n->path = NULL;
+    }
+    pthread_mutex_unlock(&inode_lock);
+}
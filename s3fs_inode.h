@@ -0,0 +1,92 @@
+#ifndef __S3FS_INODE_H__
+#define __S3FS_INODE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Inode table for the low-level FUSE interface.
+ *
+ * The kernel refers to files by inode number; we need the s3 key (full
+ * path) for each.  Every inode the kernel knows about (i.e. that we have
+ * returned from lookup, mkdir, mknod, ...) has an entry here holding its
+ * current path and a lookup count.  The entry goes away when the kernel
+ * forgets the last reference.  Inode numbers themselves are stored in the
+ * directory records, so they are stable for the life of the file.
+ *
+ * All functions are thread-safe.
+ */
+
+#define S3FS_ROOT_INO 1
+
+void inode_table_init();
+void inode_table_destroy();
+
+/*
+ * Hand out a fresh inode number for a new file or directory.
+ */
+uint64_t inode_alloc();
+
+/*
+ * Make sure that inode numbers handed out from now on are larger than
+ * ino (used when inode numbers are found in existing metadata).
+ */
+void inode_reserve(uint64_t ino);
+
+/* The inode number inode_alloc would hand out next. */
+uint64_t inode_next();
+
+/*
+ * Note that the kernel has looked up ino, named name in directory parent.
+ * Adds the inode to the table (or updates its name) and bumps its lookup
+ * count.  Returns 0, or -1 if parent is unknown or memory runs out.
+ */
+int inode_remember(uint64_t ino, uint64_t parent, const char *name, char type);
+
+/*
+ * Drop nlookup references to ino, removing it once none are left.
+ */
+void inode_forget(uint64_t ino, uint64_t nlookup);
+
+/*
+ * Copy the current path of ino into a freshly malloc'ed string, and its
+ * type ('d' or 'f') into *type if type is non-NULL.  Returns NULL if the
+ * inode is unknown or detached.
+ */
+char *inode_path(uint64_t ino, char *type);
+
+/*
+ * Copy the name of ino within its parent directory into a freshly
+ * malloc'ed string and store the parent's inode number in *parent.
+ * Returns NULL if the inode is unknown, detached or the root.
+ */
+char *inode_name(uint64_t ino, uint64_t *parent);
+
+/*
+ * Build the path of name within directory parent (malloc'ed), or NULL if
+ * parent is unknown or detached.
+ */
+char *inode_child_path(uint64_t parent, const char *name);
+
+/*
+ * Record (mtime, size) as the version of file ino whose pages the kernel
+ * now holds.  Returns nonzero if that is the version recorded last time,
+ * i.e. the kernel's cached pages are still good.
+ */
+int inode_same_version(uint64_t ino, time_t mtime, off_t size);
+
+/*
+ * ino has been renamed to newname in directory newparent.
+ */
+void inode_rename(uint64_t ino, uint64_t newparent, const char *newname);
+
+/*
+ * ino's name is gone: it was unlinked, removed, or replaced by a rename.
+ * Its entry stays until the kernel forgets it, but without a path, so
+ * what is still done through the inode fails (with ESTALE) instead of
+ * reaching whatever takes its old name.
+ */
+void inode_detach(uint64_t ino);
+
+#endif // __S3FS_INODE_H__
@@ -0,0 +1,123 @@
+/*
+ * Global memory budget for s3fs; see s3fs_mem.h.
+ */
+
+#include "s3fs_mem.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define MEM_MAX_RECLAIMERS 8
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mem_cond = PTHREAD_COND_INITIALIZER;
+static mem_reclaim_fn reclaimers[MEM_MAX_RECLAIMERS];
+static int num_reclaimers = 0;
+static mem_stats_t statsG;
+static __thread int nowaitG = 0;
+
+static uint64_t total_used() {
+    uint64_t total = 0;
+    for (int c = 0; c < MEM_CLASSES; c++) {
+        total += statsG.used[c];
+    }
+    return total;
+}
+
+static void account(mem_class_t c, uint64_t bytes) {
+    statsG.used[c] += bytes;
+    uint64_t total = total_used();
+    if (total > statsG.peak) {
+        statsG.peak = total;
+    }
+}
+
+/* Ask the caches for bytes, lock not held.  Returns what they freed. */
+static uint64_t reclaim(uint64_t bytes) {
+    pthread_mutex_lock(&mem_lock);
+    int n = num_reclaimers;
+    mem_reclaim_fn fns[MEM_MAX_RECLAIMERS];
+    memcpy(fns, reclaimers, sizeof(fns));
+    pthread_mutex_unlock(&mem_lock);
+
+    uint64_t freed = 0;
+    for (int i = 0; i < n && freed < bytes; i++) {
+        freed += fns[i](bytes - freed);
+    }
+    return freed;
+}
+
+void mem_init(uint64_t limit) {
+    pthread_mutex_lock(&mem_lock);
+    memset(&statsG, 0, sizeof(statsG));
+    statsG.limit = limit;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_destroy() {
+    pthread_mutex_lock(&mem_lock);
+    num_reclaimers = 0;
+    statsG.limit = 0;
+    pthread_cond_broadcast(&mem_cond);
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_register_reclaim(mem_reclaim_fn fn) {
+    pthread_mutex_lock(&mem_lock);
+    if (num_reclaimers < MEM_MAX_RECLAIMERS) {
+        reclaimers[num_reclaimers++] = fn;
+    }
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_reserve(mem_class_t c, uint64_t bytes) {
+    pthread_mutex_lock(&mem_lock);
+    while (statsG.limit && total_used() + bytes > statsG.limit) {
+        // clean data goes first
+        uint64_t need = total_used() + bytes - statsG.limit;
+        pthread_mutex_unlock(&mem_lock);
+        uint64_t freed = reclaim(need);
+        pthread_mutex_lock(&mem_lock);
+        statsG.reclaimed += freed;
+        if (!statsG.limit || total_used() + bytes <= statsG.limit) {
+            break;
+        }
+        if (freed == 0) {
+            // nothing clean left; wait for dirty or in-flight memory,
+            // unless there is none that could ever come back
+            if (nowaitG ||
+                statsG.used[MEM_DIRTY] + statsG.used[MEM_INFLIGHT] == 0) {
+                break;
+            }
+            statsG.waits++;
+            pthread_cond_wait(&mem_cond, &mem_lock);
+        }
+    }
+    account(c, bytes);
+    pthread_mutex_unlock(&mem_lock);
+}
+
+int mem_set_nowait(int nowait) {
+    int old = nowaitG;
+    nowaitG = nowait;
+    return old;
+}
+
+void mem_charge(mem_class_t c, uint64_t bytes) {
+    pthread_mutex_lock(&mem_lock);
+    account(c, bytes);
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_release(mem_class_t c, uint64_t bytes) {
+    pthread_mutex_lock(&mem_lock);
+    statsG.used[c] -= (bytes < statsG.used[c]) ? bytes : statsG.used[c];
+    pthread_cond_broadcast(&mem_cond);
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_stats(mem_stats_t *stats) {
+    pthread_mutex_lock(&mem_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&mem_lock);
+}
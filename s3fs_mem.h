@@ -0,0 +1,72 @@
+#ifndef __S3FS_MEM_H__
+#define __S3FS_MEM_H__
+
+#include <stdint.h>
+
+/*
+ * Global memory budget.
+ *
+ * Everything s3fs holds in memory on behalf of the file system is
+ * accounted here against one ceiling: cached data (the object cache's RAM
+ * tier and decoded directories), dirty data not yet written to s3, and
+ * the buffers of transfers in flight.  Cached data is clean and can be
+ * dropped at any time, so when a new transfer needs room the caches are
+ * asked to shrink first (through their reclaim functions, in the order
+ * they were registered).  Only if that isn't enough does the transfer
+ * wait for dirty or in-flight memory to be released.
+ *
+ * All functions are thread-safe.  A limit of 0 means no limit (usage is
+ * still tracked).
+ */
+
+typedef enum {
+    MEM_CACHE,      // clean, reclaimable
+    MEM_DIRTY,      // modified, released once written back
+    MEM_INFLIGHT,   // request and response bodies of s3 transfers
+    MEM_CLASSES
+} mem_class_t;
+
+/*
+ * Drop up to bytes of clean cached data and return how much was freed.
+ * Called without any of the budget's locks held.
+ */
+typedef uint64_t (*mem_reclaim_fn)(uint64_t bytes);
+
+typedef struct {
+    uint64_t limit;
+    uint64_t used[MEM_CLASSES];
+    uint64_t peak;              // highest total seen
+    uint64_t reclaimed;         // bytes dropped from caches under pressure
+    unsigned long waits;        // times a reservation had to wait
+} mem_stats_t;
+
+void mem_init(uint64_t limit);
+void mem_destroy();
+
+void mem_register_reclaim(mem_reclaim_fn fn);
+
+/*
+ * Account bytes of class c, making room first if that would exceed the
+ * limit: caches are reclaimed, and if that isn't enough the caller waits
+ * for other memory to be released.  A reservation is granted over the
+ * limit if there is nothing left to wait for, so one oversized request
+ * can't wait forever.  Must not be called with a cache's lock held.
+ */
+void mem_reserve(mem_class_t c, uint64_t bytes);
+
+/*
+ * Make mem_reserve in the calling thread never wait (nowait != 0) or
+ * behave normally again; returns the previous setting.  Threads that
+ * write dirty data back must not wait, as they are what frees memory.
+ */
+int mem_set_nowait(int nowait);
+
+/* Account bytes of class c without ever waiting (e.g. for caches). */
+void mem_charge(mem_class_t c, uint64_t bytes);
+
+/* Give back bytes of class c charged or reserved earlier. */
+void mem_release(mem_class_t c, uint64_t bytes);
+
+void mem_stats(mem_stats_t *stats);
+
+#endif // __S3FS_MEM_H__
@@ -0,0 +1,138 @@
+/*
+ * Kernel cache invalidation for s3fs; see s3fs_notify.h.
+ */
+
+#include "s3fs.h"
+#include "s3fs_notify.h"
+
+#include <errno.h>
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct notify {
+    uint64_t ino;       // the inode, or the parent directory for an entry
+    char *name;         // NULL for an inode invalidation
+    struct notify *next;
+} notify_t;
+
+static pthread_mutex_t notify_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notify_cond = PTHREAD_COND_INITIALIZER;
+static notify_t *queue_head = NULL, *queue_tail = NULL;
+static struct fuse_chan *chanG = NULL;
+static pthread_t notify_thread;
+static int stoppingG = 0;
+
+static void *notify_main(void *arg) {
+    pthread_mutex_lock(&notify_lock);
+    for (;;) {
+        while (!queue_head && !stoppingG) {
+            pthread_cond_wait(&notify_cond, &notify_lock);
+        }
+        if (stoppingG) {
+            // the channel may already be detached from the session;
+            // whatever is left is moot once we unmount
+            break;
+        }
+        notify_t *n = queue_head;
+        queue_head = n->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&notify_lock);
+
+        // ENOENT just means the kernel had nothing cached
+        int rv;
+        if (n->name) {
+            rv = fuse_lowlevel_notify_inval_entry(chanG, n->ino, n->name,
+                                                  strlen(n->name));
+        } else {
+            rv = fuse_lowlevel_notify_inval_inode(chanG, n->ino, 0, 0);
+        }
+        if (rv < 0 && rv != -ENOENT) {
+            fprintf(stderr, "notify: invalidating inode %lu failed (%d)\n",
+                    (unsigned long)n->ino, rv);
+        }
+        free(n->name);
+        free(n);
+
+        pthread_mutex_lock(&notify_lock);
+    }
+    while (queue_head) {
+        notify_t *n = queue_head;
+        queue_head = n->next;
+        free(n->name);
+        free(n);
+    }
+    queue_tail = NULL;
+    pthread_mutex_unlock(&notify_lock);
+    return NULL;
+}
+
+static void enqueue(uint64_t ino, const char *name) {
+    notify_t *n = malloc(sizeof(notify_t));
+    if (!n) {
+        return;
+    }
+    n->ino = ino;
+    n->name = name ? strdup(name) : NULL;
+    n->next = NULL;
+    if (name && !n->name) {
+        free(n);
+        return;
+    }
+
+    pthread_mutex_lock(&notify_lock);
+    if (!chanG || stoppingG) {
+        pthread_mutex_unlock(&notify_lock);
+        free(n->name);
+        free(n);
+        return;
+    }
+    if (queue_tail) {
+        queue_tail->next = n;
+    } else {
+        queue_head = n;
+    }
+    queue_tail = n;
+    pthread_cond_signal(&notify_cond);
+    pthread_mutex_unlock(&notify_lock);
+}
+
+void notify_init(struct fuse_chan *ch) {
+    pthread_mutex_lock(&notify_lock);
+    chanG = ch;
+    stoppingG = 0;
+    pthread_mutex_unlock(&notify_lock);
+    if (pthread_create(&notify_thread, NULL, notify_main, NULL) != 0) {
+        fprintf(stderr, "notify: can't start thread; "
+                "kernel caches won't be invalidated\n");
+        pthread_mutex_lock(&notify_lock);
+        chanG = NULL;
+        pthread_mutex_unlock(&notify_lock);
+    }
+}
+
+void notify_destroy() {
+    pthread_mutex_lock(&notify_lock);
+    int running = (chanG != NULL);
+    stoppingG = 1;
+    pthread_cond_signal(&notify_cond);
+    pthread_mutex_unlock(&notify_lock);
+    if (running) {
+        pthread_join(notify_thread, NULL);
+    }
+    pthread_mutex_lock(&notify_lock);
+    chanG = NULL;
+    pthread_mutex_unlock(&notify_lock);
+}
+
+void notify_inval_entry(uint64_t parent, const char *name) {
+    enqueue(parent, name);
+}
+
+void notify_inval_inode(uint64_t ino) {
+    enqueue(ino, NULL);
+}
@@ -0,0 +1,33 @@
+#ifndef __S3FS_NOTIFY_H__
+#define __S3FS_NOTIFY_H__
+
+#include <stdint.h>
+
+struct fuse_chan;
+
+/*
+ * Kernel cache invalidation.
+ *
+ * With long entry/attr timeouts and kernel_cache the kernel answers most
+ * stat()s and reads itself, so whenever we change something behind its
+ * back (a file replaced by a rename, a directory we failed to store, an
+ * object that changed on s3) we have to tell it to drop what it cached.
+ *
+ * The kernel may be holding locks on behalf of the request we are in the
+ * middle of serving, and a notification that needs one of those locks
+ * would deadlock.  So the functions below only queue the notification; a
+ * helper thread delivers it once the request has been answered.
+ *
+ * All functions are thread-safe, and do nothing before notify_init.
+ */
+
+void notify_init(struct fuse_chan *ch);
+void notify_destroy();
+
+/* Forget the name name in directory parent (dentry and lookup result). */
+void notify_inval_entry(uint64_t parent, const char *name);
+
+/* Forget the attributes and all cached data pages of ino. */
+void notify_inval_inode(uint64_t ino);
+
+#endif // __S3FS_NOTIFY_H__
@@ -0,0 +1,1168 @@
+/*
+ * Offline unit checks for the parts of s3fs that don't need a bucket or a
+ * mount: the in-memory directory model and its wire format, the inode
+ * table, the delete queue's intent log, the checkpoint format (read and
+ * written through an in-memory bucket), the write-back buffer, the
+ * object cache's RAM and disk tiers, and the memory budget.
+ *
+ * Unlike libs3_wrapper_test, these need no credentials; run them after
+ * any change to the modules they cover.  Each failed check is printed,
+ * and the exit status is nonzero if any failed.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libs3_wrapper.h"
+#include "s3fs.h"
+#include "s3fs_dir.h"
+#include "s3fs_inode.h"
+#include "s3fs_delq.h"
+#include "s3fs_checkpoint.h"
+#include "s3fs_writeback.h"
+#include "s3fs_mem.h"
+#include "s3fs_diskcache.h"
+#include "s3fs_cache.h"
+
+static int checksG = 0;
+static int failuresG = 0;
+
+#define CHECK(cond) do { \
+        checksG++; \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failuresG++; \
+        } \
+    } while (0)
+
+/*
+ * Stand-ins for the parts of libs3_wrapper that the modules under test
+ * call, so that this links without libs3.
+ */
+int s3fs_set_retry_nowait(int nowait) {
+    return 0;
+}
+
+int s3fs_backoff_ms(int tries) {
+    return 0;
+}
+
+int s3fs_window() {
+    return 1;
+}
+
+int s3fs_last_retryable() {
+    return 0;
+}
+
+#define BUCKET_OBJECTS 64
+
+// the in-memory bucket
+static struct {
+    char *key;
+    uint8_t *data;
+    ssize_t len;
+} objectsG[BUCKET_OBJECTS];
+
+static int find_object(const char *key) {
+    for (int i = 0; i < BUCKET_OBJECTS; i++) {
+        if (objectsG[i].key && strcmp(objectsG[i].key, key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void clear_bucket() {
+    for (int i = 0; i < BUCKET_OBJECTS; i++) {
+        free(objectsG[i].key);
+        free(objectsG[i].data);
+        objectsG[i].key = NULL;
+        objectsG[i].data = NULL;
+    }
+}
+
+ssize_t s3fs_get_object(const char *bucket, const char *key, uint8_t **buf,
+                        ssize_t start_byte, ssize_t byte_count) {
+    int i = find_object(key);
+    if (i < 0) {
+        return -1;
+    }
+    *buf = NULL;
+    if (objectsG[i].len > 0) {
+        *buf = malloc(objectsG[i].len);
+        memcpy(*buf, objectsG[i].data, objectsG[i].len);
+    }
+    return objectsG[i].len;
+}
+
+ssize_t s3fs_put_object(const char *bucket, const char *key,
+                        const uint8_t *buf, ssize_t byte_count) {
+    int i = find_object(key);
+    if (i < 0) {
+        for (i = 0; i < BUCKET_OBJECTS && objectsG[i].key; i++) {
+        }
+        if (i == BUCKET_OBJECTS) {
+            return -1;
+        }
+        objectsG[i].key = strdup(key);
+    }
+    free(objectsG[i].data);
+    objectsG[i].data = malloc(byte_count ? byte_count : 1);
+    if (byte_count > 0) {
+        memcpy(objectsG[i].data, buf, byte_count);
+    }
+    objectsG[i].len = byte_count;
+    return byte_count;
+}
+
+int s3fs_remove_objects(const char *bucket, const char **keys, int count,
+                        int *results) {
+    for (int n = 0; n < count; n++) {
+        int i = find_object(keys[n]);
+        if (i >= 0) {
+            free(objectsG[i].key);
+            free(objectsG[i].data);
+            objectsG[i].key = NULL;
+            objectsG[i].data = NULL;
+        }
+        results[n] = 0;
+    }
+    return 0;
+}
+
+/* Put the string text in the bucket under key. */
+static void put_text(const char *key, const char *text) {
+    s3fs_put_object("bucket", key, (const uint8_t *)text, strlen(text));
+}
+
+/* Whether the object at key holds exactly text. */
+static int object_is(const char *key, const char *text) {
+    int i = find_object(key);
+    return i >= 0 && objectsG[i].len == (ssize_t)strlen(text) &&
+           memcmp(objectsG[i].data, text, objectsG[i].len) == 0;
+}
+
+/* Read the whole file at path into a malloc'ed string (NULL if missing). */
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+    char *text = calloc(1, 4096);
+    if (text) {
+        fread(text, 1, 4095, f);
+    }
+    fclose(f);
+    return text;
+}
+
+/* Whether the file at path holds exactly text. */
+static int has_text(const char *path, const char *text) {
+    char *got = read_file(path);
+    int same = got && strcmp(got, text) == 0;
+    free(got);
+    return same;
+}
+
+/*
+ * Directories: a round trip through the wire format keeps every entry and
+ * its order, removing an entry keeps the rest in order (also once the
+ * name arena is compacted), and malformed blobs are refused.
+ */
+static void test_dir() {
+    s3dir_t dir, copy;
+    uint8_t *buf = NULL;
+    char name[32];
+
+    s3dir_init(&dir);
+    CHECK(s3dir_add(&dir, 'd', ".", 1, S_IFDIR | 0755, 0, 100) == 0);
+    CHECK(s3dir_add(&dir, 'f', "a", 2, S_IFREG | 0644, 10, 100) == 1);
+    CHECK(s3dir_add(&dir, 'd', "b", 3, S_IFDIR | 0755, 0, 200) == 2);
+    CHECK(s3dir_add(&dir, 'f', "c", 4, S_IFREG | 0600, 30, 300) == 3);
+
+    ssize_t len = s3dir_encode(&dir, &buf);
+    CHECK(len == 4 * (ssize_t)sizeof(entry_t));
+    CHECK(dir.size[0] == len);
+
+    s3dir_init(&copy);
+    CHECK(s3dir_decode(&copy, buf, len) == 0);
+    CHECK(copy.count == 4);
+    for (int i = 0; i < dir.count && i < copy.count; i++) {
+        CHECK(strcmp(s3dir_name(&copy, i), s3dir_name(&dir, i)) == 0);
+        CHECK(copy.type[i] == dir.type[i]);
+        CHECK(copy.ino[i] == dir.ino[i]);
+        CHECK(copy.mode[i] == dir.mode[i]);
+        CHECK(copy.size[i] == dir.size[i]);
+        CHECK(copy.mtime[i] == dir.mtime[i]);
+    }
+    CHECK(s3dir_find(&copy, "c") == 3);
+    CHECK(s3dir_find(&copy, "d") == -1);
+    s3dir_free(&copy);
+
+    // a truncated blob, or one that isn't whole entries
+    s3dir_init(&copy);
+    CHECK(s3dir_decode(&copy, buf, 0) < 0);
+    CHECK(s3dir_decode(&copy, buf, len - 1) < 0);
+    s3dir_free(&copy);
+    free(buf);
+
+    // "." can't be removed, and the rest keep their order
+    s3dir_remove(&dir, 0);
+    CHECK(dir.count == 4);
+    s3dir_remove(&dir, s3dir_find(&dir, "b"));
+    CHECK(dir.count == 3);
+    CHECK(s3dir_find(&dir, "b") == -1);
+    CHECK(s3dir_find(&dir, "a") == 1 && dir.ino[1] == 2);
+    CHECK(s3dir_find(&dir, "c") == 2 && dir.ino[2] == 4);
+    CHECK(dir.size[2] == 30);
+
+    CHECK(s3dir_rename(&dir, 1, "renamed") == 0);
+    CHECK(s3dir_find(&dir, "a") == -1);
+    CHECK(s3dir_find(&dir, "renamed") == 1);
+
+    // enough removals to compact the arena
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "file%03d", i);
+        CHECK(s3dir_add(&dir, 'f', name, 100 + i, S_IFREG | 0644, i, 0) ==
+              3 + i);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        snprintf(name, sizeof(name), "file%03d", i);
+        s3dir_remove(&dir, s3dir_find(&dir, name));
+    }
+    CHECK(dir.count == 53);
+    for (int i = 1; i < 100; i += 2) {
+        snprintf(name, sizeof(name), "file%03d", i);
+        int idx = s3dir_find(&dir, name);
+        CHECK(idx == 3 + i / 2);
+        CHECK(idx >= 0 && dir.ino[idx] == (uint64_t)(100 + i) &&
+              dir.size[idx] == i);
+    }
+
+    // and the result survives a round trip too
+    len = s3dir_encode(&dir, &buf);
+    s3dir_init(&copy);
+    CHECK(len > 0 && s3dir_decode(&copy, buf, len) == 0);
+    CHECK(copy.count == dir.count);
+    for (int i = 0; i < dir.count && i < copy.count; i++) {
+        CHECK(strcmp(s3dir_name(&copy, i), s3dir_name(&dir, i)) == 0);
+        CHECK(copy.ino[i] == dir.ino[i]);
+    }
+    s3dir_free(&copy);
+    free(buf);
+    s3dir_free(&dir);
+}
+
+/* Whether the path of ino is path (NULL for none). */
+static int has_path(uint64_t ino, const char *path) {
+    char *p = inode_path(ino, NULL);
+    int same = (p && path) ? strcmp(p, path) == 0 : p == path;
+    free(p);
+    return same;
+}
+
+/*
+ * Inodes: paths follow renames, and an inode whose name was unlinked or
+ * replaced keeps its entry but no longer resolves to a path, nor lends
+ * one to anything under it, until the kernel forgets it.
+ */
+static void test_inode() {
+    uint64_t parent = 0;
+    char type = 0;
+    char *s;
+
+    inode_table_init();
+    CHECK(has_path(S3FS_ROOT_INO, "/"));
+    CHECK(inode_name(S3FS_ROOT_INO, &parent) == NULL);
+
+    CHECK(inode_remember(10, S3FS_ROOT_INO, "d", 'd') == 0);
+    CHECK(inode_remember(11, 10, "f", 'f') == 0);
+    CHECK(inode_remember(12, 99, "orphan", 'f') < 0);
+    CHECK(inode_next() == 12);
+    s = inode_path(11, &type);
+    CHECK(s && strcmp(s, "/d/f") == 0 && type == 'f');
+    free(s);
+    s = inode_name(11, &parent);
+    CHECK(s && strcmp(s, "f") == 0 && parent == 10);
+    free(s);
+    s = inode_child_path(10, "g");
+    CHECK(s && strcmp(s, "/d/g") == 0);
+    free(s);
+
+    // across directories
+    inode_rename(11, S3FS_ROOT_INO, "g");
+    CHECK(has_path(11, "/g"));
+    s = inode_name(11, &parent);
+    CHECK(s && strcmp(s, "g") == 0 && parent == S3FS_ROOT_INO);
+    free(s);
+
+    // replaced by a rename: the new file takes the name, the old inode
+    // doesn't follow it
+    CHECK(inode_remember(12, 10, "h", 'f') == 0);
+    inode_detach(11);
+    inode_rename(12, S3FS_ROOT_INO, "g");
+    CHECK(has_path(12, "/g"));
+    CHECK(has_path(11, NULL));
+    CHECK(inode_name(11, &parent) == NULL);
+    inode_rename(11, 10, "back");
+    CHECK(has_path(11, NULL));
+
+    // an unlinked (removed) directory resolves nothing under it
+    inode_detach(10);
+    CHECK(has_path(10, NULL));
+    CHECK(inode_child_path(10, "x") == NULL);
+    CHECK(inode_remember(13, 10, "x", 'f') < 0);
+
+    // the root can't be detached
+    inode_detach(S3FS_ROOT_INO);
+    CHECK(has_path(S3FS_ROOT_INO, "/"));
+
+    // a detached inode is gone once forgotten, and its number isn't
+    // handed out again
+    inode_forget(11, 1);
+    CHECK(has_path(11, NULL));
+    CHECK(inode_alloc() >= 13);
+    inode_reserve(1000);
+    CHECK(inode_next() == 1001);
+
+    // the kernel's cached version of a file
+    CHECK(!inode_same_version(12, 5, 100));
+    CHECK(inode_same_version(12, 5, 100));
+    CHECK(!inode_same_version(12, 5, 101));
+    inode_table_destroy();
+}
+
+// what the delete queue asked to remove, and which key always fails
+static char removedG[1024];
+static int fail_triesG = 0;
+static const char *failingG = NULL;
+
+static void record_remove(void *arg, char **keys, int count, int *results) {
+    for (int i = 0; i < count; i++) {
+        if (failingG && strcmp(keys[i], failingG) == 0) {
+            fail_triesG++;
+            results[i] = -1;
+        } else {
+            size_t len = strlen(removedG);
+            snprintf(removedG + len, sizeof(removedG) - len, "%s,", keys[i]);
+            results[i] = 0;
+        }
+    }
+}
+
+/*
+ * The delete queue's intent log: replaying it queues what was pushed and
+ * never cancelled or removed (a record cut short ends it), the log is
+ * rewritten with just that, and a key whose removal keeps failing stays
+ * in it for the next mount.  The request engine isn't running, so the
+ * queue is only drained by delq_destroy.
+ */
+static void test_delq() {
+    char dir[] = "/tmp/s3fs_test.XXXXXX";
+    char log[64];
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(log, sizeof(log), "%s/deletes.log", dir);
+
+    FILE *f = fopen(log, "w");
+    CHECK(f != NULL);
+    if (!f) {
+        return;
+    }
+    fputs("D 2 /a\nD 2 /b\nC 2 /a\nD 2 /c\nD 7 /sp ace\nD 2 /d", f);
+    fclose(f);
+
+    delq_stats_t stats;
+    CHECK(delq_init(record_remove, NULL, log, 2) == 0);
+    delq_stats(&stats);
+    CHECK(stats.replayed == 3 && stats.queued == 3);
+    CHECK(!delq_pending("/a"));
+    CHECK(delq_pending("/b"));
+    CHECK(delq_pending("/c"));
+    CHECK(delq_pending("/sp ace"));
+    CHECK(!delq_pending("/d"));
+    CHECK(has_text(log, "D 2 /b\nD 2 /c\nD 7 /sp ace\n"));
+
+    // every record is in the log before it is acted on
+    CHECK(delq_push("/e") == 0);
+    CHECK(delq_push("/e") == 0);
+    CHECK(delq_pending("/e"));
+    delq_cancel("/b");
+    CHECK(!delq_pending("/b"));
+    CHECK(has_text(log, "D 2 /b\nD 2 /c\nD 7 /sp ace\nD 2 /e\nC 2 /b\n"));
+
+    failingG = "/c";
+    delq_destroy();
+    CHECK(strcmp(removedG, "/sp ace,/e,") == 0);
+    CHECK(fail_triesG == 3);
+    delq_stats(&stats);
+    CHECK(stats.deleted == 2 && stats.cancelled == 1 && stats.errors == 3);
+
+    // the next mount tries the failed key again, and once nothing is
+    // pending the log is emptied
+    removedG[0] = '\0';
+    failingG = NULL;
+    CHECK(delq_init(record_remove, NULL, log, 2) == 0);
+    delq_stats(&stats);
+    CHECK(stats.replayed == 1);
+    CHECK(delq_pending("/c"));
+    CHECK(!delq_pending("/e"));
+    delq_destroy();
+    CHECK(strcmp(removedG, "/c,") == 0);
+    CHECK(has_text(log, ""));
+
+    unlink(log);
+    rmdir(dir);
+}
+
+#define CKPT_KEY ".s3fs-checkpoint"
+
+static void count_dir(void *arg, const char *path, const uint8_t *buf,
+                      size_t len, const s3fs_object_info_t *info) {
+    (*(int *)arg)++;
+}
+
+/*
+ * The checkpoint header: a mounted file system leaves room for a lease of
+ * inode numbers beyond those handed out, a clean unmount doesn't, and a
+ * mount carries on past whatever limit the header names.  Headers of an
+ * unknown version, or that don't add up, are ignored.
+ */
+static void test_ckpt_header() {
+    char text[256];
+    int dirs = 0;
+
+    inode_table_init();
+    clear_bucket();
+    CHECK(ckpt_load("bucket", count_dir, &dirs) < 0);
+
+    uint64_t next = inode_next();
+    CHECK(ckpt_start(0) == 0);
+    snprintf(text, sizeof(text), "s3fs-checkpoint 2\nseq 1\nnext_ino %llu\n"
+             "ino_limit %llu\nclean 0\nbase 0\ndeltas 0\n",
+             (unsigned long long)next, (unsigned long long)next + 65536);
+    CHECK(object_is(CKPT_KEY, text));
+
+    // handing out a number past the lease writes a new header first
+    ckpt_cover_ino(next + 65536);
+    snprintf(text, sizeof(text), "s3fs-checkpoint 2\nseq 2\nnext_ino %llu\n"
+             "ino_limit %llu\nclean 0\nbase 0\ndeltas 0\n",
+             (unsigned long long)next + 65537,
+             (unsigned long long)next + 2 * 65536 + 1);
+    CHECK(object_is(CKPT_KEY, text));
+
+    ckpt_stop();
+    next = inode_next();
+    snprintf(text, sizeof(text), "s3fs-checkpoint 2\nseq 3\nnext_ino %llu\n"
+             "ino_limit %llu\nclean 1\nbase 0\ndeltas 0\n",
+             (unsigned long long)next, (unsigned long long)next);
+    CHECK(object_is(CKPT_KEY, text));
+    CHECK(ckpt_load("bucket", count_dir, &dirs) == CKPT_CLEAN);
+    ckpt_stop();
+
+    // one left by a crash, in the format without a snapshot
+    put_text(CKPT_KEY, "s3fs-checkpoint 1\nseq 7\nnext_ino 50\n"
+             "ino_limit 5000\nclean 0\n");
+    CHECK(ckpt_load("bucket", count_dir, &dirs) == CKPT_RECOVERED);
+    CHECK(inode_next() == 5000);
+    ckpt_stats_t stats;
+    ckpt_stats(&stats);
+    CHECK(stats.seq == 7);
+    ckpt_stop();
+    CHECK(object_is(CKPT_KEY, "s3fs-checkpoint 2\nseq 8\nnext_ino 5000\n"
+                    "ino_limit 5000\nclean 1\nbase 0\ndeltas 0\n"));
+
+    put_text(CKPT_KEY, "s3fs-checkpoint 3\nseq 1\nnext_ino 50\n"
+             "ino_limit 5000\nclean 1\nbase 0\ndeltas 0\n");
+    CHECK(ckpt_load("bucket", count_dir, &dirs) < 0);
+    put_text(CKPT_KEY, "s3fs-checkpoint 2\nseq 1\nnext_ino 9000\n"
+             "ino_limit 5000\nclean 1\nbase 0\ndeltas 0\n");
+    CHECK(ckpt_load("bucket", count_dir, &dirs) < 0);
+    put_text(CKPT_KEY, "s3fs-checkpoint 2\nseq 1\nnext_ino 9000\n"
+             "ino_limit 9000\nclean 1\nbase 0\ndeltas 17\n");
+    CHECK(ckpt_load("bucket", count_dir, &dirs) < 0);
+    CHECK(dirs == 0);
+    clear_bucket();
+    inode_table_destroy();
+}
+
+// the directories a checkpoint handed out
+#define MAX_LOADED 16
+static struct {
+    char path[64];
+    char blob[64];
+    s3fs_object_info_t info;
+} loadedG[MAX_LOADED];
+static int num_loadedG = 0;
+
+static void load_dir(void *arg, const char *path, const uint8_t *buf,
+                     size_t len, const s3fs_object_info_t *info) {
+    if (num_loadedG < MAX_LOADED && len < sizeof(loadedG[0].blob)) {
+        snprintf(loadedG[num_loadedG].path, sizeof(loadedG[0].path), "%s",
+                 path);
+        memcpy(loadedG[num_loadedG].blob, buf, len);
+        loadedG[num_loadedG].blob[len] = '\0';
+        loadedG[num_loadedG].info = *info;
+    }
+    num_loadedG++;
+}
+
+/*
+ * Whether the checkpoint handed out the directory at path with contents
+ * blob and version (etag, last_modified); if blob is NULL, whether it
+ * didn't hand out path at all.
+ */
+static int was_loaded(const char *path, const char *blob, const char *etag,
+                      int64_t last_modified) {
+    for (int i = 0; i < num_loadedG && i < MAX_LOADED; i++) {
+        if (strcmp(loadedG[i].path, path) == 0) {
+            return blob && strcmp(loadedG[i].blob, blob) == 0 &&
+                   strcmp(loadedG[i].info.eTag, etag) == 0 &&
+                   loadedG[i].info.lastModified == last_modified;
+        }
+    }
+    return !blob;
+}
+
+/* Whether some object in the bucket contains the len bytes at record. */
+static int bucket_has(const char *record, size_t len) {
+    for (int i = 0; i < BUCKET_OBJECTS; i++) {
+        for (ssize_t off = 0; objectsG[i].key && off + (ssize_t)len <=
+             objectsG[i].len; off++) {
+            if (memcmp(objectsG[i].data + off, record, len) == 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void note_dir(const char *path, const char *blob, const char *etag,
+                     int64_t last_modified) {
+    s3fs_object_info_t info;
+    snprintf(info.eTag, sizeof(info.eTag), "%s", etag);
+    info.lastModified = last_modified;
+    ckpt_note_dir(path, (const uint8_t *)blob, strlen(blob), &info);
+}
+
+/*
+ * The snapshot: the directories noted while mounted are written into the
+ * base as "d" records, a mount hands each one out with its version, and
+ * deltas (including "r" records for removed directories) are replayed on
+ * top of the base, then folded into it by the next mount.
+ */
+static void test_ckpt_snapshot() {
+    int dirs = 0;
+
+    inode_table_init();
+    clear_bucket();
+    CHECK(ckpt_load("bucket", count_dir, &dirs) < 0);
+    note_dir("/", "root", "e1", 100);
+    note_dir("/a", "dir a", "e2", 200);
+    note_dir("/a/b", "dir b", "e3", 300);
+    note_dir("/c", "dir c", "e4", 400);
+    CHECK(ckpt_start(0) == 0);
+    note_dir("/a", "dir a", "e2", 200);   // unchanged
+    ckpt_forget_dir("/c");
+    ckpt_stop();
+
+    // the records, as documented in s3fs_checkpoint.c
+    const char record[] = "d 2 /a 2 e2 200 5\ndir a\n";
+    CHECK(bucket_has(record, sizeof(record) - 1));
+    CHECK(!bucket_has("/c", 2));
+
+    num_loadedG = 0;
+    CHECK(ckpt_load("bucket", load_dir, NULL) == CKPT_CLEAN);
+    CHECK(num_loadedG == 3);
+    CHECK(was_loaded("/", "root", "e1", 100));
+    CHECK(was_loaded("/a", "dir a", "e2", 200));
+    CHECK(was_loaded("/a/b", "dir b", "e3", 300));
+    CHECK(was_loaded("/c", NULL, NULL, 0));
+    ckpt_stop();
+    ckpt_stats_t stats;
+    ckpt_stats(&stats);
+    uint64_t seq = stats.seq;
+
+    // a delta written before a crash, hand-made: /a changed, /a/b is
+    // gone, and /e (with no ETag) is new
+    char key[64], text[256];
+    snprintf(key, sizeof(key), "%s.delta.%llu", CKPT_KEY,
+             (unsigned long long)seq + 1);
+    const char delta[] = "d 2 /a 3 e22 250 5\nhello\nr 4 /a/b\n"
+                         "d 2 /e 0  -1 0\n\n";
+    s3fs_put_object("bucket", key, (const uint8_t *)delta, sizeof(delta) - 1);
+    snprintf(text, sizeof(text), "s3fs-checkpoint 2\nseq %llu\nnext_ino %llu"
+             "\nino_limit %llu\nclean 0\nbase %llu\ndeltas 1 %llu\n",
+             (unsigned long long)seq + 2, (unsigned long long)inode_next(),
+             (unsigned long long)inode_next() + 10,
+             (unsigned long long)seq, (unsigned long long)seq + 1);
+    put_text(CKPT_KEY, text);
+
+    num_loadedG = 0;
+    CHECK(ckpt_load("bucket", load_dir, NULL) == CKPT_RECOVERED);
+    CHECK(num_loadedG == 3);
+    CHECK(was_loaded("/", "root", "e1", 100));
+    CHECK(was_loaded("/a", "hello", "e22", 250));
+    CHECK(was_loaded("/a/b", NULL, NULL, 0));
+    CHECK(was_loaded("/e", "", "", -1));
+
+    // the next mount folds the delta into the base, and removes it
+    CHECK(ckpt_start(0) == 0);
+    CHECK(find_object(key) < 0);
+    ckpt_stop();
+    num_loadedG = 0;
+    CHECK(ckpt_load("bucket", load_dir, NULL) == CKPT_CLEAN);
+    CHECK(num_loadedG == 3);
+    CHECK(was_loaded("/a", "hello", "e22", 250));
+    CHECK(was_loaded("/a/b", NULL, NULL, 0));
+    CHECK(was_loaded("/e", "", "", -1));
+    ckpt_stop();
+
+    // a malformed record ends a segment, keeping what came before it
+    const char bad[] = "d 2 /x 1 x 5 3\nabc\nd 99 /y";
+    for (int i = 0; i < BUCKET_OBJECTS; i++) {
+        if (objectsG[i].key && strstr(objectsG[i].key, ".seg.")) {
+            free(objectsG[i].data);
+            objectsG[i].data = malloc(sizeof(bad) - 1);
+            memcpy(objectsG[i].data, bad, sizeof(bad) - 1);
+            objectsG[i].len = sizeof(bad) - 1;
+            break;
+        }
+    }
+    num_loadedG = 0;
+    CHECK(ckpt_load("bucket", load_dir, NULL) == CKPT_CLEAN);
+    CHECK(was_loaded("/x", "abc", "x", 5));
+    CHECK(was_loaded("/y", NULL, NULL, 0));
+    ckpt_stop();
+    clear_bucket();
+    inode_table_destroy();
+}
+
+// what the write-back buffer last wrote back, and whether that fails
+static char flushed_pathG[64];
+static uint8_t flushed_dataG[64];
+static size_t flushed_lenG = 0;
+static int64_t flushed_mtimeG = 0;
+static int flush_failsG = 0;
+
+static int record_flush(void *arg, uint64_t ino, const char *path,
+                        const uint8_t *data, size_t len,
+                        const s3fs_meta_t *meta) {
+    if (flush_failsG) {
+        return -EIO;
+    }
+    snprintf(flushed_pathG, sizeof(flushed_pathG), "%s", path);
+    flushed_lenG = len < sizeof(flushed_dataG) ? len : sizeof(flushed_dataG);
+    memcpy(flushed_dataG, data, flushed_lenG);
+    flushed_mtimeG = meta->mtime;
+    return 0;
+}
+
+static uint64_t dirty_used() {
+    mem_stats_t stats;
+    mem_stats(&stats);
+    return stats.used[MEM_DIRTY];
+}
+
+/*
+ * The write-back buffer: writes past the end grow a file (doubling its
+ * buffer, and zero-filling any hole), a file that fails to be written
+ * back stays dirty with its data intact, and a file taken out of the
+ * buffer hands its contents over.  The memory budget is charged for what
+ * the buffers allocate.  The flusher's dirty age is long enough that only
+ * wb_sync and wb_destroy write anything back.
+ */
+static void test_writeback() {
+    s3fs_meta_t meta = { 5, S_IFREG | 0644, 0, 0, 1 };
+    char buf[32];
+    off_t size;
+    time_t mtime;
+    mem_init(0);
+    wb_init(record_flush, NULL, 3600, 0);
+
+    CHECK(wb_write(5, "x", 1, 0, 2) == -1);
+    CHECK(wb_read(5, buf, sizeof(buf), 0) == -1);
+    CHECK(wb_attr(5, &size, &mtime) == -1);
+    CHECK(wb_sync(5) == 0);
+
+    uint8_t *data = malloc(5);
+    memcpy(data, "hello", 5);
+    wb_load(5, "/f", &meta, data, 5);
+    CHECK(dirty_used() == 5);
+    CHECK(wb_write(5, "J", 1, 0, 100) == 1);
+    CHECK(wb_read(5, buf, sizeof(buf), 0) == 5 &&
+          memcmp(buf, "Jello", 5) == 0);
+    CHECK(wb_attr(5, &size, &mtime) == 0 && size == 5 && mtime == 100);
+    CHECK(dirty_used() == 5);
+
+    // a write beyond the end leaves a hole of zeros
+    CHECK(wb_write(5, "xy", 2, 10, 200) == 2);
+    CHECK(wb_attr(5, &size, &mtime) == 0 && size == 12 && mtime == 200);
+    CHECK(wb_read(5, buf, sizeof(buf), 0) == 12 &&
+          memcmp(buf, "Jello\0\0\0\0\0xy", 12) == 0);
+    CHECK(wb_read(5, buf, sizeof(buf), 11) == 1 && buf[0] == 'y');
+    CHECK(wb_read(5, buf, sizeof(buf), 12) == 0);
+    CHECK(dirty_used() == 12);
+    // the buffer doubles rather than growing by each write
+    CHECK(wb_write(5, "z", 1, 12, 300) == 1);
+    CHECK(dirty_used() == 24);
+    CHECK(wb_write(5, "0123456789", 10, 13, 300) == 10);
+    CHECK(dirty_used() == 24);
+
+    // loading a file that is buffered already keeps the buffered data
+    data = malloc(3);
+    memcpy(data, "old", 3);
+    wb_load(5, "/f", &meta, data, 3);
+    CHECK(wb_read(5, buf, 3, 0) == 3 && memcmp(buf, "Jel", 3) == 0);
+    CHECK(dirty_used() == 24);
+
+    // a failed write-back leaves the file dirty and unchanged
+    flush_failsG = 1;
+    CHECK(wb_sync(5) == -EIO);
+    CHECK(wb_attr(5, &size, &mtime) == 0 && size == 23 && mtime == 300);
+    CHECK(wb_read(5, buf, sizeof(buf), 0) == 23 &&
+          memcmp(buf, "Jello\0\0\0\0\0xyz0123456789", 23) == 0);
+    CHECK(dirty_used() == 24);
+    flush_failsG = 0;
+    CHECK(wb_sync(5) == 0);
+    CHECK(strcmp(flushed_pathG, "/f") == 0 && flushed_lenG == 23 &&
+          memcmp(flushed_dataG, "Jello\0\0\0\0\0xyz0123456789", 23) == 0);
+    CHECK(flushed_mtimeG == 300);
+    CHECK(wb_attr(5, &size, &mtime) == -1);
+    CHECK(dirty_used() == 0);
+    flushed_pathG[0] = '\0';
+    CHECK(wb_sync(5) == 0);
+    CHECK(flushed_pathG[0] == '\0');
+
+    // taking a file hands over its contents without writing them back
+    uint8_t *taken;
+    size_t len;
+    CHECK(wb_take(6, &taken, &len, &mtime) == -1);
+    wb_load(6, "/g", &meta, NULL, 0);
+    CHECK(wb_write(6, "abc", 3, 0, 400) == 3);
+    CHECK(wb_take(6, &taken, &len, &mtime) == 0);
+    CHECK(len == 3 && memcmp(taken, "abc", 3) == 0 && mtime == 400);
+    free(taken);
+    CHECK(wb_take(6, &taken, &len, &mtime) == -1);
+    CHECK(wb_write(6, "d", 1, 3, 500) == -1);
+    CHECK(dirty_used() == 0);
+    CHECK(flushed_pathG[0] == '\0');
+
+    // what is still dirty is written back on the way out
+    wb_load(7, "/h", &meta, NULL, 0);
+    CHECK(wb_write(7, "last", 4, 0, 600) == 4);
+    wb_destroy();
+    CHECK(strcmp(flushed_pathG, "/h") == 0 && flushed_lenG == 4 &&
+          memcmp(flushed_dataG, "last", 4) == 0);
+    CHECK(wb_attr(7, &size, &mtime) == -1);
+    CHECK(dirty_used() == 0);
+
+    wb_stats_t stats;
+    wb_stats(&stats);
+    CHECK(stats.flushes == 2 && stats.flushed_bytes == 27);
+    CHECK(stats.errors == 1);
+    mem_destroy();
+}
+
+/* The number of files in dir whose names end in suffix. */
+static int count_files(const char *dir, const char *suffix) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name), suffix_len = strlen(suffix);
+        if (len >= suffix_len &&
+            strcmp(de->d_name + len - suffix_len, suffix) == 0) {
+            n++;
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+/* Remove the directory at path and the files in it. */
+static void remove_dir(const char *path) {
+    char file[512];
+    DIR *d = opendir(path);
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] != '.') {
+            snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+            unlink(file);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    rmdir(path);
+}
+
+/* Whether key is in the disk cache with ETag etag and 95 bytes of fill. */
+static int disk_has(const char *key, const char *etag, char fill) {
+    char got[S3FS_ETAG_SIZE];
+    uint8_t *buf = NULL;
+    if (diskcache_etag(key, got, sizeof(got)) < 0 || strcmp(got, etag)) {
+        return 0;
+    }
+    ssize_t len = diskcache_read(key, etag, &buf, 0, 0);
+    int same = (len == 95);
+    for (ssize_t i = 0; same && i < len; i++) {
+        same = (buf[i] == fill);
+    }
+    free(buf);
+    return same;
+}
+
+/*
+ * The on-disk object cache: entries are read back only under their own
+ * ETag, whole or in part; past its size cap the cache evicts in CLOCK
+ * order, sparing entries read since the hand last passed; and a later
+ * mount reindexes what an earlier one left, dropping stray temporary and
+ * corrupt files.  Every entry below is 124 bytes on disk: a 24-byte
+ * header, a 3-byte key, a 2-byte ETag and 95 bytes of data.
+ */
+static void test_diskcache() {
+    char dir[] = "/tmp/s3fs_test.XXXXXX";
+    char cache_dir[64], path[512];
+    char key[8], etag[8];
+    uint8_t data[500], *buf;
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+
+    // nothing is cached before the cache is set up
+    memset(data, 'a', sizeof(data));
+    diskcache_store("/k0", "e0", data, 95);
+    CHECK(diskcache_etag("/k0", etag, sizeof(etag)) == -1);
+
+    CHECK(diskcache_init(cache_dir, 4 * 124) == 0);
+    for (int i = 0; i < 4; i++) {
+        snprintf(key, sizeof(key), "/k%d", i);
+        snprintf(etag, sizeof(etag), "e%d", i);
+        memset(data, 'a' + i, 95);
+        diskcache_store(key, etag, data, 95);
+    }
+    CHECK(count_files(cache_dir, ".obj") == 4);
+    CHECK(count_files(cache_dir, ".tmp") == 0);
+    CHECK(disk_has("/k0", "e0", 'a'));
+    CHECK(disk_has("/k3", "e3", 'd'));
+    CHECK(diskcache_read("/k1", "e0", &buf, 0, 0) == -1);
+    CHECK(diskcache_read("/nope", "e0", &buf, 0, 0) == -1);
+    CHECK(diskcache_read("/k1", "e1", &buf, 90, 10) == 5 && buf[4] == 'b');
+    free(buf);
+    CHECK(diskcache_read("/k1", "e1", &buf, 95, 10) == 0 && buf == NULL);
+
+    // /k0, /k1 and /k3 have been read, so the hand (starting at /k0, the
+    // oldest) clears the bits of /k0 and /k1 and evicts /k2
+    memset(data, 'e', 95);
+    diskcache_store("/k4", "e4", data, 95);
+    CHECK(count_files(cache_dir, ".obj") == 4);
+    CHECK(disk_has("/k0", "e0", 'a'));
+    CHECK(disk_has("/k1", "e1", 'b'));
+    CHECK(diskcache_etag("/k2", etag, sizeof(etag)) == -1);
+    CHECK(disk_has("/k4", "e4", 'e'));
+
+    // objects bigger than the whole cache, or without an ETag, stay out
+    diskcache_store("/big", "eb", data, sizeof(data));
+    diskcache_store("/none", "", data, 95);
+    CHECK(diskcache_etag("/big", etag, sizeof(etag)) == -1);
+    CHECK(diskcache_etag("/none", etag, sizeof(etag)) == -1);
+    CHECK(count_files(cache_dir, ".obj") == 4);
+
+    // a new version replaces the old one in place
+    memset(data, 'f', 95);
+    diskcache_store("/k4", "f4", data, 95);
+    CHECK(count_files(cache_dir, ".obj") == 4);
+    CHECK(diskcache_read("/k4", "e4", &buf, 0, 0) == -1);
+    CHECK(disk_has("/k4", "f4", 'f'));
+
+    diskcache_invalidate("/k3");
+    CHECK(diskcache_etag("/k3", etag, sizeof(etag)) == -1);
+    CHECK(count_files(cache_dir, ".obj") == 3);
+
+    // the next mount picks up where this one left off
+    diskcache_destroy();
+    CHECK(diskcache_etag("/k0", etag, sizeof(etag)) == -1);
+    snprintf(path, sizeof(path), "%s/0000000000000001.obj.7.tmp", cache_dir);
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (f) {
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "%s/0000000000000001.obj", cache_dir);
+    f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (f) {
+        fputs("not a cache entry", f);
+        fclose(f);
+    }
+    CHECK(diskcache_init(cache_dir, 4 * 124) == 0);
+    CHECK(count_files(cache_dir, ".obj") == 3);
+    CHECK(count_files(cache_dir, ".tmp") == 0);
+    CHECK(disk_has("/k0", "e0", 'a'));
+    CHECK(disk_has("/k1", "e1", 'b'));
+    CHECK(disk_has("/k4", "f4", 'f'));
+    diskcache_destroy();
+
+    // ... and a smaller cap evicts down to it
+    CHECK(diskcache_init(cache_dir, 2 * 124) == 0);
+    CHECK(count_files(cache_dir, ".obj") == 2);
+    diskcache_destroy();
+
+    remove_dir(cache_dir);
+    rmdir(dir);
+}
+
+/*
+ * Read all of key (ETag etag) from the object cache and check that it's
+ * 100 bytes of fill; returns whether it was.
+ */
+static int cache_has(const char *key, const char *etag, char fill) {
+    uint8_t *buf = NULL;
+    ssize_t len = cache_read(key, etag, &buf, 0, 0);
+    int same = (len == 100);
+    for (ssize_t i = 0; same && i < len; i++) {
+        same = (buf[i] == fill);
+    }
+    free(buf);
+    return same;
+}
+
+/*
+ * The object cache's tiers: a full RAM tier demotes to disk in CLOCK
+ * order, sparing objects hit since the hand last passed; the second hit
+ * on an object that is only on disk promotes it back to RAM (unless it's
+ * too big for RAM, which stops further tries); and the memory budget is
+ * charged exactly what the RAM tier holds.  The RAM tier below holds
+ * eight objects of 100 bytes with 3-character keys.
+ */
+static void test_cache() {
+    char dir[] = "/tmp/s3fs_test.XXXXXX";
+    char cache_dir[64], key[8], etag[8];
+    uint8_t data[500];
+    cache_stats_t stats;
+    mem_stats_t mem;
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+    mem_init(0);
+
+    // what one object costs in RAM
+    memset(data, 'x', sizeof(data));
+    CHECK(cache_init(1 << 20, NULL, 0) == 0);
+    cache_store("/r0", "e0", data, 100);
+    cache_stats(&stats);
+    uint64_t size = stats.ram_bytes;
+    CHECK(stats.ram_objects == 1 && size > 100);
+    cache_invalidate("/r0");
+    cache_destroy();
+
+    CHECK(cache_init(8 * size, cache_dir, 1 << 20) == 0);
+    for (int i = 0; i < 8; i++) {
+        snprintf(key, sizeof(key), "/r%d", i);
+        snprintf(etag, sizeof(etag), "e%d", i);
+        memset(data, 'a' + i, 100);
+        cache_store(key, etag, data, 100);
+    }
+    cache_stats(&stats);
+    CHECK(stats.ram_objects == 8 && stats.ram_bytes == 8 * size);
+    CHECK(stats.demotions == 0);
+    CHECK(count_files(cache_dir, ".obj") == 0);
+
+    // /r0 was hit, so the hand passes over it and demotes /r1
+    CHECK(cache_has("/r0", "e0", 'a'));
+    memset(data, 'i', 100);
+    cache_store("/r8", "e8", data, 100);
+    cache_stats(&stats);
+    CHECK(stats.ram_hits == 1 && stats.demotions == 1);
+    CHECK(stats.ram_objects == 8);
+    CHECK(diskcache_etag("/r0", etag, sizeof(etag)) == -1);
+    CHECK(diskcache_etag("/r1", etag, sizeof(etag)) == 0 &&
+          strcmp(etag, "e1") == 0);
+    CHECK(cache_etag("/r1", etag, sizeof(etag)) == 0 &&
+          strcmp(etag, "e1") == 0);
+
+    // one hit on disk isn't enough to come back; the second one is, and
+    // /r2 makes room
+    CHECK(cache_has("/r1", "e1", 'b'));
+    cache_stats(&stats);
+    CHECK(stats.disk_hits == 1 && stats.promotions == 0);
+    uint8_t *buf = NULL;
+    CHECK(cache_read("/r1", "e1", &buf, 10, 5) == 5 && buf[4] == 'b');
+    free(buf);
+    cache_stats(&stats);
+    CHECK(stats.disk_hits == 2 && stats.promotions == 1);
+    CHECK(stats.demotions == 2 && stats.ram_objects == 8);
+    CHECK(diskcache_etag("/r2", etag, sizeof(etag)) == 0);
+    CHECK(cache_has("/r1", "e1", 'b'));
+    CHECK(cache_has("/r2", "e2", 'c'));
+    cache_stats(&stats);
+    CHECK(stats.ram_hits == 2 && stats.disk_hits == 3);
+
+    // a copy under another ETag is no copy at all
+    CHECK(cache_read("/r0", "zz", &buf, 0, 0) == -1);
+    cache_stats(&stats);
+    CHECK(stats.misses == 1);
+
+    // the memory budget sees the RAM tier, and can make it shrink
+    mem_stats(&mem);
+    CHECK(mem.used[MEM_CACHE] == 8 * size);
+    CHECK(cache_reclaim(1) == size);
+    cache_stats(&stats);
+    CHECK(stats.ram_objects == 7 && stats.demotions == 3);
+    mem_stats(&mem);
+    CHECK(mem.used[MEM_CACHE] == 7 * size);
+
+    // an object too big for RAM goes straight to disk, and stays there
+    memset(data, 'z', sizeof(data));
+    cache_store("/big", "eb", data, sizeof(data));
+    cache_stats(&stats);
+    CHECK(stats.ram_objects == 7);
+    CHECK(diskcache_etag("/big", etag, sizeof(etag)) == 0);
+    for (int i = 0; i < 3; i++) {
+        CHECK(cache_read("/big", "eb", &buf, 0, 0) == sizeof(data));
+        free(buf);
+    }
+    cache_stats(&stats);
+    CHECK(stats.promotions == 1 && stats.ram_objects == 7);
+
+    // an object without an ETag can't be cached, nor can its old copies
+    cache_store("/r0", "", data, 100);
+    CHECK(cache_etag("/r0", etag, sizeof(etag)) == -1);
+    cache_invalidate("/r2");
+    CHECK(cache_etag("/r2", etag, sizeof(etag)) == -1);
+    CHECK(diskcache_etag("/r2", etag, sizeof(etag)) == -1);
+
+    // what is in RAM at the end is saved on disk for the next mount
+    cache_destroy();
+    mem_stats(&mem);
+    CHECK(mem.used[MEM_CACHE] == 0);
+    CHECK(diskcache_init(cache_dir, 1 << 20) == 0);
+    CHECK(diskcache_etag("/r8", etag, sizeof(etag)) == 0 &&
+          strcmp(etag, "e8") == 0);
+    CHECK(diskcache_etag("/r1", etag, sizeof(etag)) == 0);
+    CHECK(diskcache_etag("/r0", etag, sizeof(etag)) == -1);
+    diskcache_destroy();
+
+    mem_destroy();
+    remove_dir(cache_dir);
+    rmdir(dir);
+}
+
+// the stand-in cache the memory budget reclaims from, and the order the
+// reclaim functions were called in
+static uint64_t cache_heldG = 0;
+static char reclaimsG[64];
+
+static uint64_t reclaim_first(uint64_t bytes) {
+    uint64_t freed = (bytes < cache_heldG) ? bytes : cache_heldG;
+    cache_heldG -= freed;
+    mem_release(MEM_CACHE, freed);
+    strcat(reclaimsG, "1,");
+    return freed;
+}
+
+static uint64_t reclaim_second(uint64_t bytes) {
+    strcat(reclaimsG, "2,");
+    return 0;
+}
+
+/* Release what's in flight once the main thread waits for it. */
+static void *release_inflight(void *arg) {
+    mem_stats_t stats;
+    do {
+        usleep(1000);
+        mem_stats(&stats);
+    } while (stats.waits == 0);
+    mem_release(MEM_INFLIGHT, *(uint64_t *)arg);
+    return NULL;
+}
+
+/*
+ * The memory budget: a reservation that would go over the limit first has
+ * the caches reclaimed, in the order they were registered and only as far
+ * as needed; then it waits for dirty or in-flight memory to be released,
+ * unless the thread mustn't wait or there is none that could come back,
+ * in which case it is granted over the limit.
+ */
+static void test_mem() {
+    mem_stats_t stats;
+    mem_init(1000);
+    mem_register_reclaim(reclaim_first);
+    mem_register_reclaim(reclaim_second);
+
+    cache_heldG = 300;
+    mem_charge(MEM_CACHE, 300);
+    mem_reserve(MEM_INFLIGHT, 600);
+    CHECK(reclaimsG[0] == '\0');
+    mem_reserve(MEM_INFLIGHT, 300);
+    CHECK(strcmp(reclaimsG, "1,") == 0);
+    mem_stats(&stats);
+    CHECK(stats.used[MEM_CACHE] == 100 && stats.used[MEM_INFLIGHT] == 900);
+    CHECK(stats.reclaimed == 200 && stats.peak == 1000);
+
+    // a thread that mustn't wait gets its memory once the caches are dry
+    reclaimsG[0] = '\0';
+    CHECK(mem_set_nowait(1) == 0);
+    mem_reserve(MEM_DIRTY, 250);
+    CHECK(mem_set_nowait(0) == 1);
+    CHECK(strcmp(reclaimsG, "1,2,1,2,") == 0);
+    mem_stats(&stats);
+    CHECK(stats.used[MEM_CACHE] == 0 && stats.used[MEM_DIRTY] == 250);
+    CHECK(stats.reclaimed == 300 && stats.peak == 1150 && stats.waits == 0);
+
+    // any other thread waits until there's room
+    pthread_t thread;
+    uint64_t inflight = 900;
+    CHECK(pthread_create(&thread, NULL, release_inflight, &inflight) == 0);
+    mem_reserve(MEM_INFLIGHT, 100);
+    pthread_join(thread, NULL);
+    mem_stats(&stats);
+    CHECK(stats.waits == 1);
+    CHECK(stats.used[MEM_INFLIGHT] == 100 && stats.used[MEM_DIRTY] == 250);
+
+    // releasing more than is used leaves nothing, not a wrapped count
+    mem_release(MEM_DIRTY, 1000);
+    mem_release(MEM_INFLIGHT, 100);
+    mem_stats(&stats);
+    CHECK(stats.used[MEM_DIRTY] == 0 && stats.used[MEM_INFLIGHT] == 0);
+
+    // with nothing to wait for, an oversized reservation goes through
+    mem_reserve(MEM_INFLIGHT, 5000);
+    mem_stats(&stats);
+    CHECK(stats.used[MEM_INFLIGHT] == 5000 && stats.peak == 5000);
+    CHECK(stats.waits == 1);
+    mem_release(MEM_INFLIGHT, 5000);
+    mem_destroy();
+
+    // without a limit, usage is only tracked
+    reclaimsG[0] = '\0';
+    mem_init(0);
+    mem_register_reclaim(reclaim_first);
+    mem_reserve(MEM_DIRTY, 1ULL << 40);
+    mem_stats(&stats);
+    CHECK(stats.used[MEM_DIRTY] == 1ULL << 40);
+    CHECK(reclaimsG[0] == '\0');
+    mem_release(MEM_DIRTY, 1ULL << 40);
+    mem_destroy();
+}
+
+int main(int argc, char **argv) {
+    test_dir();
+    test_inode();
+    test_delq();
+    test_ckpt_header();
+    test_ckpt_snapshot();
+    test_writeback();
+    test_diskcache();
+    test_cache();
+    test_mem();
+
+    printf("%d of %d checks failed.\n", failuresG, checksG);
+    return failuresG ? 1 : 0;
+}
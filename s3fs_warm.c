@@ -0,0 +1,128 @@
+/*
+ * Warm connections to s3 for s3fs; see s3fs_warm.h.
+ */
+
+#include "s3fs_warm.h"
+#include "libs3_wrapper.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static pthread_mutex_t warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warm_cond = PTHREAD_COND_INITIALIZER;
+static char *bucketG = NULL;
+static int connectionsG = 0;
+static int idleG = 0;               // ms
+static pthread_t warm_thread;
+static int runningG = 0;
+static int stoppingG = 0;
+static warm_stats_t statsG;
+
+/* Send connectionsG HEADs at once.  Called without warm_lock. */
+static int warm(const char *bucket, int connections) {
+    int answered = s3fs_warm_connections(bucket, connections);
+    if (answered < 0) {
+        answered = 0;
+    }
+    pthread_mutex_lock(&warm_lock);
+    statsG.failures += connections - answered;
+    pthread_mutex_unlock(&warm_lock);
+    return answered;
+}
+
+/*
+ * Freshen the connections once nothing has gone over them for idleG,
+ * and every idleG after that for as long as the file system stays idle
+ * (the HEADs themselves don't count as use).
+ */
+static void *warm_main(void *arg) {
+    pthread_mutex_lock(&warm_lock);
+    int64_t since_refresh = 0;
+    while (!stoppingG) {
+        int64_t idle = s3fs_idle_ms();
+        if (idle > since_refresh) {
+            idle = since_refresh;
+        }
+        int64_t wait = idleG - idle;
+        if (wait <= 0) {
+            statsG.refreshes++;
+            pthread_mutex_unlock(&warm_lock);
+            warm(bucketG, connectionsG);
+            pthread_mutex_lock(&warm_lock);
+            since_refresh = 0;
+            continue;
+        }
+
+        struct timespec start, deadline;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait / 1000;
+        deadline.tv_nsec += (wait % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&warm_cond, &warm_lock, &deadline);
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        since_refresh += (end.tv_sec - start.tv_sec) * 1000 +
+                         (end.tv_nsec - start.tv_nsec) / 1000000;
+    }
+    pthread_mutex_unlock(&warm_lock);
+    return NULL;
+}
+
+int warm_init(const char *bucket, int connections, int idle) {
+    if (connections <= 0) {
+        return 0;
+    }
+    int opened = warm(bucket, connections);
+    fprintf(stderr, "warm: %d of %d connections opened\n", opened,
+            connections);
+
+    pthread_mutex_lock(&warm_lock);
+    statsG.opened += opened;
+    if (idle <= 0 || runningG) {
+        pthread_mutex_unlock(&warm_lock);
+        return opened;
+    }
+    bucketG = strdup(bucket);
+    connectionsG = connections;
+    idleG = idle * 1000;
+    stoppingG = 0;
+    pthread_mutex_unlock(&warm_lock);
+    if (!bucketG) {
+        return opened;
+    }
+    if (pthread_create(&warm_thread, NULL, warm_main, NULL) != 0) {
+        fprintf(stderr, "warm: can't start keepalive thread\n");
+        return opened;
+    }
+    runningG = 1;
+    return opened;
+}
+
+void warm_destroy() {
+    if (runningG) {
+        pthread_mutex_lock(&warm_lock);
+        stoppingG = 1;
+        pthread_cond_signal(&warm_cond);
+        pthread_mutex_unlock(&warm_lock);
+        pthread_join(warm_thread, NULL);
+        runningG = 0;
+    }
+    pthread_mutex_lock(&warm_lock);
+    free(bucketG);
+    bucketG = NULL;
+    pthread_mutex_unlock(&warm_lock);
+}
+
+void warm_stats(warm_stats_t *stats) {
+    pthread_mutex_lock(&warm_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&warm_lock);
+}
@@ -0,0 +1,33 @@
+#ifndef __S3FS_WARM_H__
+#define __S3FS_WARM_H__
+
+/*
+ * Warm connections to s3.
+ *
+ * A request over a connection that is already open skips the DNS lookup
+ * and the TCP and TLS handshakes, several round trips in all.  So at mount
+ * time we open a few connections before the first lookup needs one, and
+ * while the file system is idle we keep them from being closed as idle,
+ * by sending cheap HEAD requests over them every so often.
+ *
+ * All functions are thread-safe.
+ */
+
+typedef struct {
+    unsigned long opened;       // connections answered at mount time
+    unsigned long refreshes;    // rounds of HEADs sent while idle
+    unsigned long failures;     // HEADs that weren't answered
+} warm_stats_t;
+
+/*
+ * Open connections connections to bucket's endpoint now, and from then on
+ * freshen them whenever no request has been made for idle seconds (if
+ * idle > 0).  Returns how many connections were opened.
+ */
+int warm_init(const char *bucket, int connections, int idle);
+
+void warm_destroy();
+
+void warm_stats(warm_stats_t *stats);
+
+#endif // __S3FS_WARM_H__
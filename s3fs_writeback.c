@@ -0,0 +1,488 @@
+/*
+ * Write-back buffering for s3fs; see s3fs_writeback.h.
+ *
+ * Buffered files live in a hash table by inode number.  Every file in the
+ * table is dirty: a file is only added by its first write and is dropped
+ * as soon as it has been written back.  A file being written back is
+ * marked busy, and writers (and anyone else who would change or drop it)
+ * wait on wb_cond until that's over, so the upload never sees a buffer
+ * change under it.
+ */
+
+#include "s3fs_writeback.h"
+#include "s3fs_async.h"
+#include "s3fs_mem.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WB_BUCKETS 256
+
+// seconds between the flusher's scans for files past their dirty age
+#define WB_TICK 1
+
+// a background write-back that fails with a transient error is retried
+// this many times in all (after a backoff) before it's left to a later scan
+#define WB_MAX_TRIES 5
+
+typedef struct wb_file {
+    uint64_t ino;
+    char *path;
+    s3fs_meta_t meta;           // mtime is that of the last write
+    uint8_t *data;
+    size_t len;
+    size_t cap;                 // allocated; this is what's charged
+    time_t dirty_since;
+    int busy;                   // being written back
+    int tries;                  // ... by a background job, so far
+    struct wb_file *next;       // hash chain
+} wb_file_t;
+
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wb_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static wb_file_t *buckets[WB_BUCKETS];
+static uint64_t dirty_bytesG = 0;
+static uint64_t pressureG = 0;      // bytes the memory budget asked for
+static int dirty_ageG = 0;
+static uint64_t max_dirtyG = 0;
+static wb_flush_fn flushG = NULL;
+static void *argG = NULL;
+static pthread_t flusher_thread;
+static int runningG = 0;
+static int stoppingG = 0;
+static int jobsG = 0;               // background write-backs under way
+static int deferredG = 0;           // the window held a write-back back
+static wb_stats_t statsG;
+
+static wb_file_t *find_file(uint64_t ino) {
+    wb_file_t *f = buckets[ino % WB_BUCKETS];
+    while (f && f->ino != ino) {
+        f = f->next;
+    }
+    return f;
+}
+
+/* Find ino, waiting out any write-back of it.  Called with wb_lock. */
+static wb_file_t *find_idle_file(uint64_t ino) {
+    wb_file_t *f;
+    while ((f = find_file(ino)) && f->busy) {
+        pthread_cond_wait(&wb_cond, &wb_lock);
+    }
+    return f;
+}
+
+static void unlink_file(wb_file_t *f) {
+    wb_file_t **pp = &buckets[f->ino % WB_BUCKETS];
+    while (*pp != f) {
+        pp = &(*pp)->next;
+    }
+    *pp = f->next;
+    dirty_bytesG -= f->len;
+    mem_release(MEM_DIRTY, f->cap);
+}
+
+/* Free f's bookkeeping; its data goes separately. */
+static void free_file(wb_file_t *f) {
+    free(f->path);
+    free(f);
+}
+
+/*
+ * Upload busy file f.  The flusher and wb_sync are what free dirty
+ * memory, so they must never wait for memory themselves.
+ */
+static int write_back(wb_file_t *f) {
+    int old = mem_set_nowait(1);
+    int rv = flushG(argG, f->ino, f->path, f->data, f->len, &f->meta);
+    mem_set_nowait(old);
+    return rv;
+}
+
+/* Wrap up write_back(f), which returned rv.  Called with wb_lock. */
+static void finish_write_back(wb_file_t *f, int rv) {
+    f->busy = 0;
+    if (rv == 0) {
+        statsG.flushes++;
+        statsG.flushed_bytes += f->len;
+        unlink_file(f);
+        free(f->data);
+        free_file(f);
+    } else {
+        fprintf(stderr, "writeback: writing %s back failed (%d), will "
+                "retry\n", f->path, rv);
+        statsG.errors++;
+    }
+    pthread_cond_broadcast(&wb_cond);
+}
+
+/*
+ * Write f back on a worker.  Rather than sleep on the worker between
+ * retries, a transient failure resubmits the job to run after a backoff
+ * (f stays busy meanwhile).
+ */
+static void write_back_job(void *arg) {
+    wb_file_t *f = (wb_file_t *)arg;
+    int old = s3fs_set_retry_nowait(1);
+    int rv = write_back(f);
+    int retryable = (rv < 0 && s3fs_last_retryable());
+    s3fs_set_retry_nowait(old);
+
+    pthread_mutex_lock(&wb_lock);
+    if (retryable && ++f->tries < WB_MAX_TRIES &&
+        async_submit_after(write_back_job, f,
+                           s3fs_backoff_ms(f->tries)) == 0) {
+        statsG.retries++;
+        pthread_mutex_unlock(&wb_lock);
+        return;
+    }
+    f->tries = 0;
+    finish_write_back(f, rv);
+    jobsG--;
+    if (deferredG) {
+        deferredG = 0;
+        pthread_cond_signal(&flusher_cond);    // room for the next one
+    }
+    pthread_mutex_unlock(&wb_lock);
+}
+
+/*
+ * Hand f to the request engine, unless as many write-backs as the
+ * concurrency window allows are already under way.  Called with wb_lock.
+ */
+static int schedule(wb_file_t *f) {
+    if (jobsG >= s3fs_window()) {
+        deferredG = 1;
+        return -1;
+    }
+    f->busy = 1;
+    if (async_submit(write_back_job, f) < 0) {
+        f->busy = 0;    // try again on the next scan
+        return -1;
+    }
+    jobsG++;
+    return 0;
+}
+
+/* The oldest dirty file not being written back already, or NULL. */
+static wb_file_t *oldest_idle() {
+    wb_file_t *oldest = NULL;
+    for (int i = 0; i < WB_BUCKETS; i++) {
+        for (wb_file_t *f = buckets[i]; f; f = f->next) {
+            if (!f->busy &&
+                (!oldest || f->dirty_since < oldest->dirty_since)) {
+                oldest = f;
+            }
+        }
+    }
+    return oldest;
+}
+
+static void *flusher_main(void *arg) {
+    pthread_mutex_lock(&wb_lock);
+    while (!stoppingG) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += WB_TICK;
+        pthread_cond_timedwait(&flusher_cond, &wb_lock, &deadline);
+        if (stoppingG) {
+            break;
+        }
+
+        // files dirty for too long
+        time_t now = time(NULL);
+        for (int i = 0; i < WB_BUCKETS; i++) {
+            for (wb_file_t *f = buckets[i]; f; f = f->next) {
+                if (!f->busy && now - f->dirty_since >= dirty_ageG) {
+                    schedule(f);
+                }
+            }
+        }
+
+        // too many dirty bytes, or memory is short: oldest first
+        uint64_t want = pressureG;
+        pressureG = 0;
+        if (max_dirtyG && dirty_bytesG > max_dirtyG &&
+            dirty_bytesG - max_dirtyG > want) {
+            want = dirty_bytesG - max_dirtyG;
+        }
+        wb_file_t *f;
+        while (want > 0 && (f = oldest_idle())) {
+            if (schedule(f) < 0) {
+                break;
+            }
+            want -= (f->cap < want) ? f->cap : want;
+        }
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return NULL;
+}
+
+void wb_init(wb_flush_fn flush, void *arg, int dirty_age,
+             uint64_t dirty_bytes) {
+    pthread_mutex_lock(&wb_lock);
+    flushG = flush;
+    argG = arg;
+    dirty_ageG = dirty_age;
+    max_dirtyG = dirty_bytes;
+    stoppingG = 0;
+    pthread_mutex_unlock(&wb_lock);
+    if (pthread_create(&flusher_thread, NULL, flusher_main, NULL) != 0) {
+        fprintf(stderr, "writeback: can't start flusher thread\n");
+        return;
+    }
+    runningG = 1;
+}
+
+void wb_destroy() {
+    if (runningG) {
+        pthread_mutex_lock(&wb_lock);
+        stoppingG = 1;
+        pthread_cond_signal(&flusher_cond);
+        pthread_mutex_unlock(&wb_lock);
+        pthread_join(flusher_thread, NULL);
+        runningG = 0;
+    }
+
+    // write back whatever is left; anything that still fails is lost
+    pthread_mutex_lock(&wb_lock);
+    for (int i = 0; i < WB_BUCKETS; i++) {
+        wb_file_t *f;
+        while ((f = buckets[i])) {
+            if (f->busy) {
+                pthread_cond_wait(&wb_cond, &wb_lock);
+                continue;
+            }
+            f->busy = 1;
+            pthread_mutex_unlock(&wb_lock);
+            int rv = write_back(f);
+            pthread_mutex_lock(&wb_lock);
+            finish_write_back(f, rv);
+            if (rv < 0) {
+                fprintf(stderr, "writeback: dropping unwritten data of "
+                        "%s\n", f->path);
+                unlink_file(f);
+                free(f->data);
+                free_file(f);
+            }
+        }
+    }
+    pthread_mutex_unlock(&wb_lock);
+}
+
+void wb_load(uint64_t ino, const char *path, const s3fs_meta_t *meta,
+             uint8_t *buf, size_t len) {
+    wb_file_t *n = malloc(sizeof(wb_file_t));
+    char *path_copy = strdup(path);
+    if (!n || !path_copy) {
+        free(n);
+        free(path_copy);
+        free(buf);
+        return;
+    }
+    memset(n, 0, sizeof(wb_file_t));
+    n->ino = ino;
+    n->path = path_copy;
+    n->meta = *meta;
+    n->data = buf;
+    n->len = n->cap = len;
+    n->dirty_since = time(NULL);
+    mem_reserve(MEM_DIRTY, len);
+
+    pthread_mutex_lock(&wb_lock);
+    if (find_file(ino)) {
+        pthread_mutex_unlock(&wb_lock);
+        mem_release(MEM_DIRTY, len);
+        free(buf);
+        free_file(n);
+        return;
+    }
+    n->next = buckets[ino % WB_BUCKETS];
+    buckets[ino % WB_BUCKETS] = n;
+    dirty_bytesG += len;
+    pthread_mutex_unlock(&wb_lock);
+}
+
+ssize_t wb_write(uint64_t ino, const char *buf, size_t size, off_t offset,
+                 time_t mtime) {
+    size_t end = offset + size;
+    uint64_t grown = 0;
+    mem_reserve(MEM_DIRTY, size);
+
+    pthread_mutex_lock(&wb_lock);
+    wb_file_t *f = find_idle_file(ino);
+    if (!f) {
+        pthread_mutex_unlock(&wb_lock);
+        mem_release(MEM_DIRTY, size);
+        return -1;
+    }
+    if (end > f->cap) {
+        size_t cap = (f->cap * 2 > end) ? f->cap * 2 : end;
+        uint8_t *data = realloc(f->data, cap);
+        if (!data) {
+            pthread_mutex_unlock(&wb_lock);
+            mem_release(MEM_DIRTY, size);
+            return -1;
+        }
+        grown = cap - f->cap;
+        f->data = data;
+        f->cap = cap;
+    }
+    if (end > f->len) {
+        if ((size_t)offset > f->len) {
+            memset(f->data + f->len, 0, offset - f->len);
+        }
+        dirty_bytesG += end - f->len;
+        f->len = end;
+    }
+    memcpy(f->data + offset, buf, size);
+    f->meta.mtime = mtime;
+    statsG.writes++;
+    if (max_dirtyG && dirty_bytesG > max_dirtyG) {
+        pthread_cond_signal(&flusher_cond);
+    }
+    pthread_mutex_unlock(&wb_lock);
+
+    // we reserved size bytes; what the buffer actually grew by counts
+    if (grown > size) {
+        mem_charge(MEM_DIRTY, grown - size);
+    } else {
+        mem_release(MEM_DIRTY, size - grown);
+    }
+    return size;
+}
+
+ssize_t wb_read(uint64_t ino, char *buf, size_t size, off_t offset) {
+    pthread_mutex_lock(&wb_lock);
+    wb_file_t *f = find_file(ino);
+    if (!f) {
+        pthread_mutex_unlock(&wb_lock);
+        return -1;
+    }
+    size_t count = 0;
+    if ((size_t)offset < f->len) {
+        count = f->len - offset;
+        if (count > size) {
+            count = size;
+        }
+        memcpy(buf, f->data + offset, count);
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return count;
+}
+
+int wb_attr(uint64_t ino, off_t *size, time_t *mtime) {
+    pthread_mutex_lock(&wb_lock);
+    wb_file_t *f = find_file(ino);
+    if (f) {
+        *size = f->len;
+        *mtime = f->meta.mtime;
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return f ? 0 : -1;
+}
+
+int wb_sync(uint64_t ino) {
+    pthread_mutex_lock(&wb_lock);
+    wb_file_t *f = find_idle_file(ino);
+    if (!f) {
+        pthread_mutex_unlock(&wb_lock);
+        return 0;
+    }
+    f->busy = 1;
+    pthread_mutex_unlock(&wb_lock);
+
+    int rv = write_back(f);
+    pthread_mutex_lock(&wb_lock);
+    finish_write_back(f, rv);
+    pthread_mutex_unlock(&wb_lock);
+    return rv;
+}
+
+/* Whether path names an entry directly in the directory dir_path. */
+static int in_dir(const char *path, const char *dir_path) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        return 0;
+    }
+    size_t len = slash - path;
+    if (len == 0) {
+        return strcmp(dir_path, "/") == 0;
+    }
+    return strlen(dir_path) == len && strncmp(path, dir_path, len) == 0;
+}
+
+int wb_sync_dir(const char *dir_path) {
+    // collect first; the table changes as files are written back
+    pthread_mutex_lock(&wb_lock);
+    size_t count = 0, cap = 0;
+    uint64_t *inos = NULL;
+    for (int i = 0; i < WB_BUCKETS; i++) {
+        for (wb_file_t *f = buckets[i]; f; f = f->next) {
+            if (!in_dir(f->path, dir_path)) {
+                continue;
+            }
+            if (count == cap) {
+                cap = cap ? cap * 2 : 16;
+                uint64_t *tmp = realloc(inos, cap * sizeof(uint64_t));
+                if (!tmp) {
+                    pthread_mutex_unlock(&wb_lock);
+                    free(inos);
+                    return -ENOMEM;
+                }
+                inos = tmp;
+            }
+            inos[count++] = f->ino;
+        }
+    }
+    pthread_mutex_unlock(&wb_lock);
+
+    int rv = 0;
+    for (size_t i = 0; i < count; i++) {
+        int err = wb_sync(inos[i]);
+        if (rv == 0) {
+            rv = err;
+        }
+    }
+    free(inos);
+    return rv;
+}
+
+int wb_take(uint64_t ino, uint8_t **buf, size_t *len, time_t *mtime) {
+    pthread_mutex_lock(&wb_lock);
+    wb_file_t *f = find_idle_file(ino);
+    if (!f) {
+        pthread_mutex_unlock(&wb_lock);
+        return -1;
+    }
+    unlink_file(f);
+    pthread_mutex_unlock(&wb_lock);
+
+    *buf = f->len ? f->data : NULL;
+    if (!f->len) {
+        free(f->data);
+    }
+    *len = f->len;
+    *mtime = f->meta.mtime;
+    free_file(f);
+    return 0;
+}
+
+uint64_t wb_reclaim(uint64_t bytes) {
+    pthread_mutex_lock(&wb_lock);
+    if (bytes > pressureG) {
+        pressureG = bytes;
+    }
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&wb_lock);
+    return 0;
+}
+
+void wb_stats(wb_stats_t *stats) {
+    pthread_mutex_lock(&wb_lock);
+    *stats = statsG;
+    pthread_mutex_unlock(&wb_lock);
+}
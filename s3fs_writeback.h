@@ -0,0 +1,109 @@
+#ifndef __S3FS_WRITEBACK_H__
+#define __S3FS_WRITEBACK_H__
+
+#include "libs3_wrapper.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Write-back buffering of file contents.
+ *
+ * The first write to a file loads its contents into a buffer here, and
+ * that and later writes only modify the buffer, so they return at memory
+ * speed.  A flusher thread writes dirty files back (the object and its
+ * directory record) once they have been dirty for dirty_age seconds, or
+ * sooner, oldest first, when more than dirty_bytes are dirty in total or
+ * the memory budget runs short.  The uploads go through the background
+ * request engine (s3fs_async.h), which bounds how many run at once.
+ * wb_sync writes one file back right away, for fsync and close.
+ *
+ * While a file is buffered, its contents, size and mtime come from here
+ * rather than from s3.  A file is dropped from the buffer once it has been
+ * written back.  Buffers count against the memory budget as dirty data.
+ *
+ * All functions are thread-safe.
+ */
+
+/*
+ * Write back len bytes of data as the new contents of file ino, found at
+ * path and with metadata meta.  Returns 0 or a negative errno value.
+ */
+typedef int (*wb_flush_fn)(void *arg, uint64_t ino, const char *path,
+                           const uint8_t *data, size_t len,
+                           const s3fs_meta_t *meta);
+
+typedef struct {
+    unsigned long flushes;      // files written back
+    uint64_t flushed_bytes;
+    unsigned long errors;       // write-backs that failed (and were retried)
+    unsigned long retries;      // failed tries resubmitted after a backoff
+    unsigned long writes;       // writes absorbed by buffers
+} wb_stats_t;
+
+/*
+ * Start the flusher, which writes files back with flush(arg, ...).  A
+ * dirty_bytes of 0 means no limit on dirty bytes.
+ */
+void wb_init(wb_flush_fn flush, void *arg, int dirty_age,
+             uint64_t dirty_bytes);
+
+/* Write back everything still dirty, then stop the flusher. */
+void wb_destroy();
+
+/*
+ * Start buffering file ino (at path, with metadata meta) with the len
+ * bytes in buf as its current contents, unless it is buffered already.
+ * buf (malloc'ed, or NULL if len is 0) is taken over either way.
+ */
+void wb_load(uint64_t ino, const char *path, const s3fs_meta_t *meta,
+             uint8_t *buf, size_t len);
+
+/*
+ * Write size bytes from buf at offset into the buffered file ino, which
+ * was modified at mtime.  Returns size, or -1 if ino isn't buffered.
+ */
+ssize_t wb_write(uint64_t ino, const char *buf, size_t size, off_t offset,
+                 time_t mtime);
+
+/*
+ * Copy up to size bytes at offset of buffered file ino into buf.  Returns
+ * the number of bytes copied, or -1 if ino isn't buffered.
+ */
+ssize_t wb_read(uint64_t ino, char *buf, size_t size, off_t offset);
+
+/* If ino is buffered, return 0 with its size and mtime; otherwise -1. */
+int wb_attr(uint64_t ino, off_t *size, time_t *mtime);
+
+/*
+ * Write file ino back now if it's dirty, and wait for that.  Returns 0,
+ * or a negative errno value if the write-back failed (the file stays
+ * dirty).
+ */
+int wb_sync(uint64_t ino);
+
+/*
+ * wb_sync for every buffered file directly in the directory at dir_path,
+ * which writes back their pending directory record updates as well.
+ * Returns 0, or the first error.
+ */
+int wb_sync_dir(const char *dir_path);
+
+/*
+ * Stop buffering file ino without writing it back.  If it was buffered,
+ * returns 0 with the contents in *buf (malloc'ed, NULL if empty), their
+ * length in *len and the mtime in *mtime; otherwise returns -1.
+ */
+int wb_take(uint64_t ino, uint8_t **buf, size_t *len, time_t *mtime);
+
+/*
+ * The memory budget's reclaim function: dirty data can't simply be
+ * dropped, so this asks the flusher to write back at least bytes and
+ * returns 0.
+ */
+uint64_t wb_reclaim(uint64_t bytes);
+
+void wb_stats(wb_stats_t *stats);
+
+#endif // __S3FS_WRITEBACK_H__